@@ -0,0 +1,64 @@
+#include "kernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Effective memory bandwidth (GB/s) of every kernel variant on arrays that
+// fit in L2 and on arrays far larger than the last level cache
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main() {
+    size_t sizes[] = {64 * 1024, 64 * 1024 * 1024};
+    size_t n_max = sizes[1];
+
+    float *a = malloc(n_max * sizeof(float));
+    float *b = malloc(n_max * sizeof(float));
+    float *out = malloc(n_max * sizeof(float));
+    for (size_t i = 0; i < n_max; i++) {
+        a[i] = (float)(i % 97) + 1.0f;
+        b[i] = (float)(i % 89) + 1.0f;
+        out[i] = 0.0f;
+    }
+
+    printf("%-8s %12s %12s %12s\n", "isa", "elements", "add GB/s", "mul_s GB/s");
+    for (int isa = 0; isa < KERNEL_ISA_COUNT; isa++) {
+        const Kernels *k = kernels_for_isa((KernelIsa)isa);
+        if (!k) {
+            continue;
+        }
+        for (size_t s = 0; s < 2; s++) {
+            size_t n = sizes[s];
+            size_t reps = n_max / n;
+
+            // Warm up caches and page tables
+            k->add(n, a, b, out);
+
+            double start = now_seconds();
+            for (size_t r = 0; r < reps; r++) {
+                k->add(n, a, b, out);
+            }
+            double t_add = now_seconds() - start;
+
+            start = now_seconds();
+            for (size_t r = 0; r < reps; r++) {
+                k->mul_scalar(n, a, 1.5f, out);
+            }
+            double t_mul = now_seconds() - start;
+
+            // Binary ops move three arrays, scalar ops two
+            double bytes = (double)n * reps * sizeof(float);
+            printf("%-8s %12zu %12.2f %12.2f\n", k->name, n,
+                   3 * bytes / t_add * 1e-9, 2 * bytes / t_mul * 1e-9);
+        }
+    }
+
+    free(a);
+    free(b);
+    free(out);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+#include "la.h"
+#include "lazy.h"
+#include "tensor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Eager operation chains against the same chains evaluated lazily, on
+// tensors far larger than the last level cache
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// a * b + 2c, one temporary per operation
+static double eager_chain(const Tensor *a, const Tensor *b, const Tensor *c) {
+    double start = now_seconds();
+    Tensor *ab = tensor_multiply(a, b);
+    Tensor *c2 = tensor_multiply_scalar(c, 2);
+    Tensor *result = tensor_add(ab, c2);
+    double elapsed = now_seconds() - start;
+    tensor_free(ab);
+    tensor_free(c2);
+    tensor_free(result);
+    return elapsed;
+}
+
+static double lazy_chain(const Tensor *a, const Tensor *b, const Tensor *c) {
+    double start = now_seconds();
+    LazyGraph *g = lazy_graph_create();
+    LazyTensor *e = lazy_add(lazy_multiply(lazy_tensor(g, a), lazy_tensor(g, b)),
+                             lazy_multiply_scalar(lazy_tensor(g, c), 2));
+    Tensor *result = lazy_eval(e);
+    lazy_graph_free(g);
+    double elapsed = now_seconds() - start;
+    tensor_free(result);
+    return elapsed;
+}
+
+// Mean squared residual of predictions p against targets y
+static double eager_loss(const Tensor *y, const Tensor *p, Dtype *loss) {
+    double start = now_seconds();
+    Tensor *r = tensor_subtract(y, p);
+    Tensor *r2 = tensor_multiply(r, r);
+    *loss = tensor_mean(r2);
+    double elapsed = now_seconds() - start;
+    tensor_free(r);
+    tensor_free(r2);
+    return elapsed;
+}
+
+static double lazy_loss(const Tensor *y, const Tensor *p, Dtype *loss) {
+    double start = now_seconds();
+    LazyGraph *g = lazy_graph_create();
+    LazyTensor *r = lazy_subtract(lazy_tensor(g, y), lazy_tensor(g, p));
+    *loss = lazy_mean(lazy_multiply(r, r));
+    lazy_graph_free(g);
+    return now_seconds() - start;
+}
+
+int main() {
+    size_t n = 16 * 1024 * 1024;
+    Tensor *a = tensor_rand(1, n);
+    Tensor *b = tensor_rand(1, n);
+    Tensor *c = tensor_rand(1, n);
+
+    // Warm up page tables and the buffer pool
+    eager_chain(a, b, c);
+    lazy_chain(a, b, c);
+
+    double t_eager = eager_chain(a, b, c);
+    double t_lazy = lazy_chain(a, b, c);
+    printf("%-16s %10s %10s %8s\n", "chain", "eager ms", "lazy ms", "speedup");
+    printf("%-16s %10.2f %10.2f %7.1fx\n", "a*b + 2c", t_eager * 1e3, t_lazy * 1e3,
+           t_eager / t_lazy);
+
+    Dtype eager, lazy;
+    t_eager = eager_loss(a, b, &eager);
+    t_lazy = lazy_loss(a, b, &lazy);
+    printf("%-16s %10.2f %10.2f %7.1fx  (%g vs %g)\n", "mean((y-p)^2)", t_eager * 1e3,
+           t_lazy * 1e3, t_eager / t_lazy, eager, lazy);
+
+    tensor_free(a);
+    tensor_free(b);
+    tensor_free(c);
+    return EXIT_SUCCESS;
+}
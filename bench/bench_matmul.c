@@ -0,0 +1,129 @@
+#include "la.h"
+#include "tensor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// GFLOPS of tensor_matmul against the textbook i-j-k loop it replaced, and
+// of tensor_gram against tensor_matmul(X^T, X)
+
+typedef struct {
+    const char *kind;
+    size_t m, k, n;
+} Shape;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The original tensor_matmul loop, kept here as the baseline
+static void naive_matmul(const Tensor *t1, const Tensor *t2, Tensor *result) {
+    for (size_t i = 0; i < t1->shape[0]; i++) {
+        for (size_t j = 0; j < t2->shape[1]; j++) {
+            result->data[i * result->shape[1] + j] = 0;
+            for (size_t k = 0; k < t1->shape[1]; k++) {
+                result->data[i * result->shape[1] + j] +=
+                    t1->data[i * t1->shape[1] + k] *
+                    t2->data[k * t2->shape[1] + j];
+            }
+        }
+    }
+}
+
+// Run at least once and until min_seconds have elapsed, return seconds per run
+static double time_naive(const Tensor *a, const Tensor *b, Tensor *c, double min_seconds) {
+    size_t runs = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        naive_matmul(a, b, c);
+        runs++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < min_seconds);
+    return elapsed / runs;
+}
+
+static double time_blocked(const Tensor *a, const Tensor *b, double min_seconds) {
+    size_t runs = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        Tensor *c = tensor_matmul(a, b);
+        tensor_free(c);
+        runs++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < min_seconds);
+    return elapsed / runs;
+}
+
+int main(int argc, char *argv[]) {
+    // Pass "quick" to skip the 2048 square case
+    int quick = argc > 1 && argv[1][0] == 'q';
+    Shape shapes[] = {
+        {"square", 256, 256, 256},
+        {"square", 512, 512, 512},
+        {"square", 1024, 1024, 1024},
+        {"square", 2048, 2048, 2048},
+        {"tall-skinny", 65536, 32, 32},
+        {"tall-skinny", 16384, 128, 128},
+        {"short-fat", 32, 32, 65536},
+        {"short-fat", 128, 16384, 128},
+    };
+    size_t n_shapes = sizeof(shapes) / sizeof(shapes[0]);
+
+    printf("%-12s %6s %6s %6s %12s %12s %8s\n",
+           "shape", "m", "k", "n", "naive GF/s", "gemm GF/s", "speedup");
+    for (size_t s = 0; s < n_shapes; s++) {
+        Shape sh = shapes[s];
+        if (quick && sh.m * sh.k * sh.n > 1024UL * 1024 * 1024) {
+            continue;
+        }
+
+        Tensor *a = tensor_rand(2, sh.m, sh.k);
+        Tensor *b = tensor_rand(2, sh.k, sh.n);
+        Tensor *c = tensor_create(2, sh.m, sh.n);
+
+        double flops = 2.0 * sh.m * sh.k * sh.n;
+        double t_naive = time_naive(a, b, c, 0.5);
+        double t_gemm = time_blocked(a, b, 0.5);
+
+        printf("%-12s %6zu %6zu %6zu %12.2f %12.2f %7.1fx\n", sh.kind,
+               sh.m, sh.k, sh.n, flops / t_naive * 1e-9, flops / t_gemm * 1e-9,
+               t_naive / t_gemm);
+
+        tensor_free(a);
+        tensor_free(b);
+        tensor_free(c);
+    }
+
+    // Tall X as in regression fits
+    size_t grams[][2] = {{100000, 64}, {100000, 256}, {20000, 1024}};
+    printf("\n%-12s %8s %6s %12s %12s %8s\n", "gram", "n", "d", "matmul ms", "gram ms", "speedup");
+    for (size_t g = 0; g < sizeof(grams) / sizeof(grams[0]); g++) {
+        size_t n = grams[g][0], d = grams[g][1];
+        if (quick && n * d * d > 1024UL * 1024 * 1024) {
+            continue;
+        }
+        Tensor *x = tensor_rand(2, n, d);
+        Tensor *xt = tensor_transpose(x);
+
+        double t_matmul = 0, t_gram = 0;
+        for (int rep = 0; rep < 3; rep++) {
+            double start = now_seconds();
+            Tensor *full = tensor_matmul(xt, x);
+            t_matmul += now_seconds() - start;
+            start = now_seconds();
+            Tensor *gram = tensor_gram(x);
+            t_gram += now_seconds() - start;
+            tensor_free(full);
+            tensor_free(gram);
+        }
+        printf("%-12s %8zu %6zu %12.1f %12.1f %7.1fx\n", "X^T X", n, d,
+               t_matmul / 3 * 1e3, t_gram / 3 * 1e3, t_matmul / t_gram);
+
+        tensor_free(x);
+        tensor_free(xt);
+    }
+
+    return EXIT_SUCCESS;
+}
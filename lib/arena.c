@@ -0,0 +1,268 @@
+#include "arena.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Arena chunks are at least this large, bigger requests get their own chunk
+#define ARENA_CHUNK_SIZE (1 << 20)
+// Chunks larger than this are freed when the outermost scope closes
+#define ARENA_RETAIN_SIZE (64 << 20)
+#define ARENA_MAX_DEPTH 64
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t capacity;
+    size_t used;
+    unsigned char *data;
+} ArenaChunk;
+
+// Callback to run when the scope it was registered in is popped, allocated
+// from that scope
+typedef struct ArenaDeferred {
+    struct ArenaDeferred *next;
+    void (*fn)(void *);
+    void *arg;
+} ArenaDeferred;
+
+typedef struct {
+    ArenaChunk *chunk;
+    size_t used;
+    ArenaDeferred *deferred;
+} ArenaMark;
+
+static _Thread_local ArenaChunk *arena_first;
+static _Thread_local ArenaChunk *arena_current;
+static _Thread_local ArenaMark arena_marks[ARENA_MAX_DEPTH];
+static _Thread_local size_t arena_depth;
+static _Thread_local ArenaDeferred *arena_deferred;
+
+static ArenaChunk *arena_chunk_create(size_t capacity) {
+    ArenaChunk *chunk = (ArenaChunk *)malloc(sizeof(ArenaChunk));
+    chunk->next = NULL;
+    chunk->capacity = capacity;
+    chunk->used = 0;
+    chunk->data = (unsigned char *)aligned_alloc(64, capacity);
+    return chunk;
+}
+
+static void arena_chunk_free_list(ArenaChunk *chunk) {
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        free(chunk->data);
+        free(chunk);
+        chunk = next;
+    }
+}
+
+void arena_push(void) {
+    if (arena_depth == ARENA_MAX_DEPTH) {
+        fprintf(stderr, "Error: Too many nested arena scopes.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!arena_first) {
+        arena_first = arena_chunk_create(ARENA_CHUNK_SIZE);
+        arena_current = arena_first;
+    }
+
+    arena_marks[arena_depth].chunk = arena_current;
+    arena_marks[arena_depth].used = arena_current->used;
+    arena_marks[arena_depth].deferred = arena_deferred;
+    arena_depth++;
+}
+
+void arena_pop(void) {
+    if (arena_depth == 0) {
+        fprintf(stderr, "Error: arena_pop without a matching arena_push.\n");
+        return;
+    }
+
+    // Callbacks run newest first, while the scope's memory is still intact
+    arena_depth--;
+    while (arena_deferred != arena_marks[arena_depth].deferred) {
+        ArenaDeferred *d = arena_deferred;
+        arena_deferred = d->next;
+        d->fn(d->arg);
+    }
+    arena_current = arena_marks[arena_depth].chunk;
+    arena_current->used = arena_marks[arena_depth].used;
+
+    if (arena_depth > 0) {
+        return;
+    }
+
+    // Keep the chunks for the next scope, unless a huge one was needed
+    for (ArenaChunk *prev = arena_first; prev; prev = prev->next) {
+        while (prev->next && prev->next->capacity > ARENA_RETAIN_SIZE) {
+            ArenaChunk *huge = prev->next;
+            prev->next = huge->next;
+            huge->next = NULL;
+            arena_chunk_free_list(huge);
+        }
+    }
+}
+
+bool arena_active(void) {
+    return arena_depth > 0;
+}
+
+void *arena_alloc(size_t size, size_t align) {
+    if (arena_depth == 0) {
+        return NULL;
+    }
+
+    for (;;) {
+        ArenaChunk *chunk = arena_current;
+        size_t start = (chunk->used + align - 1) / align * align;
+        if (start + size <= chunk->capacity) {
+            chunk->used = start + size;
+            return chunk->data + start;
+        }
+
+        // Move on to the next kept chunk if it is large enough, otherwise
+        // replace the rest of the list with a chunk that fits
+        if (!chunk->next || chunk->next->capacity < size) {
+            arena_chunk_free_list(chunk->next);
+            size_t capacity = size > ARENA_CHUNK_SIZE ? (size + 63) / 64 * 64 : ARENA_CHUNK_SIZE;
+            chunk->next = arena_chunk_create(capacity);
+        }
+        arena_current = chunk->next;
+        arena_current->used = 0;
+    }
+}
+
+bool arena_defer(void (*fn)(void *), void *arg) {
+    ArenaDeferred *d = (ArenaDeferred *)arena_alloc(sizeof(ArenaDeferred),
+                                                    _Alignof(ArenaDeferred));
+    if (!d) {
+        return false;
+    }
+    d->fn = fn;
+    d->arg = arg;
+    d->next = arena_deferred;
+    arena_deferred = d;
+    return true;
+}
+
+void arena_release(void) {
+    if (arena_depth > 0) {
+        fprintf(stderr, "Error: arena_release inside an arena scope.\n");
+        return;
+    }
+
+    arena_chunk_free_list(arena_first);
+    arena_first = NULL;
+    arena_current = NULL;
+}
+
+// Pool classes cover 64 B to 64 MB, larger blocks bypass the pool
+#define POOL_MIN_SHIFT 6
+#define POOL_MAX_SHIFT 26
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+// Free blocks cached per class, and in total
+#define POOL_MAX_CACHED 32
+#define POOL_MAX_CACHED_BYTES ((size_t)256 << 20)
+
+typedef struct PoolBlock {
+    struct PoolBlock *next;
+} PoolBlock;
+
+typedef struct {
+    pthread_mutex_t lock;
+    PoolBlock *free_list;
+    size_t count;
+} PoolClass;
+
+static PoolClass pool_classes[POOL_CLASSES];
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static atomic_size_t pool_cached_bytes;
+
+static void pool_init(void) {
+    for (size_t c = 0; c < POOL_CLASSES; c++) {
+        pthread_mutex_init(&pool_classes[c].lock, NULL);
+        pool_classes[c].free_list = NULL;
+        pool_classes[c].count = 0;
+    }
+}
+
+// Index of the smallest class holding size bytes, POOL_CLASSES if none does
+static size_t pool_class_of(size_t size) {
+    size_t shift = POOL_MIN_SHIFT;
+    while (shift <= POOL_MAX_SHIFT && ((size_t)1 << shift) < size) {
+        shift++;
+    }
+    return shift - POOL_MIN_SHIFT;
+}
+
+void *pool_alloc(size_t size) {
+    size_t c = pool_class_of(size);
+    if (c >= POOL_CLASSES) {
+        return aligned_alloc(64, (size + 63) / 64 * 64);
+    }
+
+    pthread_once(&pool_once, pool_init);
+    PoolClass *pc = &pool_classes[c];
+    size_t block_size = (size_t)1 << (c + POOL_MIN_SHIFT);
+
+    pthread_mutex_lock(&pc->lock);
+    PoolBlock *block = pc->free_list;
+    if (block) {
+        pc->free_list = block->next;
+        pc->count--;
+        atomic_fetch_sub(&pool_cached_bytes, block_size);
+    }
+    pthread_mutex_unlock(&pc->lock);
+
+    return block ? (void *)block : aligned_alloc(64, block_size);
+}
+
+void pool_free(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+
+    size_t c = pool_class_of(size);
+    if (c >= POOL_CLASSES) {
+        free(ptr);
+        return;
+    }
+
+    pthread_once(&pool_once, pool_init);
+    PoolClass *pc = &pool_classes[c];
+    size_t block_size = (size_t)1 << (c + POOL_MIN_SHIFT);
+
+    if (atomic_load(&pool_cached_bytes) + block_size <= POOL_MAX_CACHED_BYTES) {
+        pthread_mutex_lock(&pc->lock);
+        if (pc->count < POOL_MAX_CACHED) {
+            PoolBlock *block = (PoolBlock *)ptr;
+            block->next = pc->free_list;
+            pc->free_list = block;
+            pc->count++;
+            atomic_fetch_add(&pool_cached_bytes, block_size);
+            ptr = NULL;
+        }
+        pthread_mutex_unlock(&pc->lock);
+    }
+
+    free(ptr);
+}
+
+void pool_trim(void) {
+    pthread_once(&pool_once, pool_init);
+    for (size_t c = 0; c < POOL_CLASSES; c++) {
+        PoolClass *pc = &pool_classes[c];
+        pthread_mutex_lock(&pc->lock);
+        PoolBlock *block = pc->free_list;
+        pc->free_list = NULL;
+        atomic_fetch_sub(&pool_cached_bytes, pc->count << (c + POOL_MIN_SHIFT));
+        pc->count = 0;
+        pthread_mutex_unlock(&pc->lock);
+
+        while (block) {
+            PoolBlock *next = block->next;
+            free(block);
+            block = next;
+        }
+    }
+}
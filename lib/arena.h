@@ -0,0 +1,34 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Scoped bump allocation
+// While a scope is open on a thread, every tensor created on that thread
+// (header, shape, strides and 64-byte aligned data) is carved out of a
+// thread-local arena with no call to malloc. arena_pop releases everything
+// allocated since the matching arena_push at once; tensor_free on such a
+// tensor is allowed but returns no memory. Views created in a scope of
+// tensors from outside it, and tensors loaded from files, keep their data
+// alive only until the scope is popped, which drops their references unless
+// tensor_free already did. Tensors that must outlive the scope have to be
+// created before it is opened, e.g. as the output of an _into function.
+// Arena memory is kept for the next scope on the thread.
+void arena_push(void);
+void arena_pop(void);
+bool arena_active(void);
+void *arena_alloc(size_t size, size_t align);
+// Call fn(arg) when the current scope is popped; false outside a scope
+bool arena_defer(void (*fn)(void *), void *arg);
+void arena_release(void); // Free the arena memory kept by this thread
+
+// Size-class pool
+// Heap tensor buffers are rounded up to a power of two and recycled through
+// per-class free lists, so repeated create/free cycles of similar sizes skip
+// the system allocator. Blocks are 64-byte aligned.
+void *pool_alloc(size_t size);
+void pool_free(void *ptr, size_t size);
+void pool_trim(void); // Return all cached blocks to the system
+
+#endif // ARENA_H
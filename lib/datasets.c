@@ -1 +1,847 @@
+#include "datasets.h"
+#include "parallel.h"
+#include "random.h"
+#include <fcntl.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+void dataset_free(Dataset *dataset) {
+    if (!dataset) {
+        return;
+    }
+    // Either tensor is NULL when the dataset failed to allocate
+    if (dataset->X) {
+        tensor_free(dataset->X);
+    }
+    if (dataset->y) {
+        tensor_free(dataset->y);
+    }
+    free(dataset);
+}
+
+// Exact powers of ten in double; a mantissa below 2^53 times one of these is
+// correctly rounded
+static const double csv_pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                   1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                   1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Parse the field [s, end) as a float. False when it is not a number.
+static bool csv_parse_float(const char *s, const char *end, Dtype *out) {
+    while (s < end && (*s == ' ' || *s == '"')) {
+        s++;
+    }
+    while (end > s && (end[-1] == ' ' || end[-1] == '"')) {
+        end--;
+    }
+    if (s == end) {
+        *out = NAN;
+        return true;
+    }
+
+    const char *p = s;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') {
+        p++;
+    }
+
+    // Up to 19 significant digits fit the mantissa exactly
+    unsigned long long mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (unsigned)(*p - '0');
+            digits += mantissa > 0;
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (unsigned)(*p - '0');
+                digits += mantissa > 0;
+                exponent--;
+            }
+        }
+    }
+    if (any && p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool exp_negative = q < end && *q == '-';
+        if (q < end && (*q == '-' || *q == '+')) {
+            q++;
+        }
+        int e = 0;
+        const char *digits_start = q;
+        for (; q < end && *q >= '0' && *q <= '9'; q++) {
+            e = e < 10000 ? e * 10 + (*q - '0') : e;
+        }
+        if (q > digits_start) {
+            exponent += exp_negative ? -e : e;
+            p = q;
+        }
+    }
+
+    if (any && p == end && mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        double value = (double)mantissa;
+        value = exponent < 0 ? value / csv_pow10[-exponent] : value * csv_pow10[exponent];
+        *out = (Dtype)(negative ? -value : value);
+        return true;
+    }
+
+    // Everything else, including nan and inf, goes through the C library
+    char buf[128];
+    size_t len = (size_t)(end - s);
+    if (len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    char *parsed;
+    double value = strtod(buf, &parsed);
+    if (parsed != buf + len) {
+        return false;
+    }
+    *out = (Dtype)value;
+    return true;
+}
+
+// End of the line starting at p, not including the line break
+static const char *csv_line_end(const char *p, const char *end) {
+    const char *nl = (const char *)memchr(p, '\n', (size_t)(end - p));
+    return nl ? nl : end;
+}
+
+static bool csv_is_blank(const char *line, const char *line_end) {
+    return line == line_end || (line + 1 == line_end && *line == '\r');
+}
+
+// Where each column goes: the row of X or y, or nowhere
+typedef struct {
+    int target; // 0 for X, 1 for y, -1 to skip the column
+    size_t index;
+} CsvColumn;
+
+typedef struct {
+    const char *begin; // Start of the data, after the header
+    const char *end;
+    char delimiter;
+    size_t n_columns;
+    const CsvColumn *columns;
+    size_t n_chunks;
+    const char **chunk_starts; // n_chunks + 1 line-aligned boundaries
+    size_t *chunk_rows;        // Rows per chunk, then the first row of each
+    Tensor *X;
+    Tensor *y;
+    size_t *chunk_error; // First bad row in each chunk, SIZE_MAX if none
+    int *chunk_error_kind;
+} CsvContext;
+
+static void csv_count_rows(void *arg, size_t begin, size_t end) {
+    CsvContext *ctx = (CsvContext *)arg;
+    for (size_t c = begin; c < end; c++) {
+        size_t rows = 0;
+        const char *p = ctx->chunk_starts[c], *stop = ctx->chunk_starts[c + 1];
+        while (p < stop) {
+            const char *line_end = csv_line_end(p, stop);
+            rows += !csv_is_blank(p, line_end);
+            p = line_end + 1;
+        }
+        ctx->chunk_rows[c] = rows;
+    }
+}
+
+// Split a line into its fields and store the selected ones in row `row`.
+// Returns 0, 1 for a bad value or 2 for a wrong number of fields.
+static int csv_parse_line(const CsvContext *ctx, const char *p, const char *line_end, size_t row) {
+    if (line_end > p && line_end[-1] == '\r') {
+        line_end--;
+    }
+
+    size_t nx = ctx->X->shape[1], ny = ctx->y->shape[1];
+    Dtype *x_row = ctx->X->data + row * nx;
+    Dtype *y_row = ctx->y->data + row * ny;
+
+    for (size_t c = 0; c < ctx->n_columns; c++) {
+        const char *field_end = (const char *)memchr(p, ctx->delimiter, (size_t)(line_end - p));
+        if (!field_end) {
+            if (c + 1 < ctx->n_columns) {
+                return 2;
+            }
+            field_end = line_end;
+        } else if (c + 1 == ctx->n_columns) {
+            return 2;
+        }
+
+        const CsvColumn *col = &ctx->columns[c];
+        if (col->target >= 0) {
+            Dtype *dst = col->target == 0 ? x_row + col->index : y_row + col->index;
+            if (!csv_parse_float(p, field_end, dst)) {
+                return 1;
+            }
+        }
+        p = field_end + 1;
+    }
+    return 0;
+}
+
+static void csv_parse_rows(void *arg, size_t begin, size_t end) {
+    CsvContext *ctx = (CsvContext *)arg;
+    for (size_t c = begin; c < end; c++) {
+        size_t row = ctx->chunk_rows[c];
+        const char *p = ctx->chunk_starts[c], *stop = ctx->chunk_starts[c + 1];
+        while (p < stop) {
+            const char *line_end = csv_line_end(p, stop);
+            if (!csv_is_blank(p, line_end)) {
+                int error = csv_parse_line(ctx, p, line_end, row);
+                if (error) {
+                    ctx->chunk_error[c] = row;
+                    ctx->chunk_error_kind[c] = error;
+                    break;
+                }
+                row++;
+            }
+            p = line_end + 1;
+        }
+    }
+}
+
+// Number of fields in a line
+static size_t csv_count_fields(const char *p, const char *line_end, char delimiter) {
+    size_t n = 1;
+    for (; p < line_end; p++) {
+        n += *p == delimiter;
+    }
+    return n;
+}
+
+static char csv_guess_delimiter(const char *p, const char *line_end) {
+    const char candidates[] = {',', '\t', ';'};
+    char best = ',';
+    size_t best_count = 0;
+    for (size_t i = 0; i < sizeof(candidates); i++) {
+        size_t count = csv_count_fields(p, line_end, candidates[i]) - 1;
+        if (count > best_count) {
+            best = candidates[i];
+            best_count = count;
+        }
+    }
+    return best;
+}
+
+// Whether every field of a line parses as a number
+static bool csv_is_numeric(const char *p, const char *line_end, char delimiter) {
+    if (line_end > p && line_end[-1] == '\r') {
+        line_end--;
+    }
+    for (;;) {
+        const char *field_end = (const char *)memchr(p, delimiter, (size_t)(line_end - p));
+        Dtype value;
+        if (!csv_parse_float(p, field_end ? field_end : line_end, &value)) {
+            return false;
+        }
+        if (!field_end) {
+            return true;
+        }
+        p = field_end + 1;
+    }
+}
+
+// Route the selected columns to X and y
+static bool csv_map_columns(const CsvOptions *opt, size_t n_columns, CsvColumn *columns,
+                            size_t *nx, size_t *ny) {
+    for (size_t c = 0; c < n_columns; c++) {
+        columns[c] = (CsvColumn){-1, 0};
+    }
+
+    size_t last = n_columns - 1;
+    const size_t *y_cols = opt->y_columns ? opt->y_columns : &last;
+    *ny = opt->y_columns ? opt->n_y_columns : 1;
+    for (size_t i = 0; i < *ny; i++) {
+        if (y_cols[i] >= n_columns || columns[y_cols[i]].target >= 0) {
+            return false;
+        }
+        columns[y_cols[i]] = (CsvColumn){1, i};
+    }
+
+    if (opt->x_columns) {
+        *nx = opt->n_x_columns;
+        for (size_t i = 0; i < *nx; i++) {
+            if (opt->x_columns[i] >= n_columns || columns[opt->x_columns[i]].target >= 0) {
+                return false;
+            }
+            columns[opt->x_columns[i]] = (CsvColumn){0, i};
+        }
+    } else {
+        *nx = 0;
+        for (size_t c = 0; c < n_columns; c++) {
+            if (columns[c].target < 0) {
+                columns[c] = (CsvColumn){0, (*nx)++};
+            }
+        }
+    }
+    return true;
+}
+
+// The per-chunk buffers of ctx; the tensors are left to the caller
+static void csv_context_free(CsvContext *ctx) {
+    free(ctx->chunk_starts);
+    free(ctx->chunk_rows);
+    free(ctx->chunk_error);
+    free(ctx->chunk_error_kind);
+}
+
+static Dataset *csv_parse(const char *path, const char *text, size_t length, const CsvOptions *opt) {
+    const char *end = text + length;
+    const char *first_end = csv_line_end(text, end);
+    if (first_end > text && first_end[-1] == '\r') {
+        first_end--;
+    }
+
+    char delimiter = opt->delimiter ? opt->delimiter : csv_guess_delimiter(text, first_end);
+    size_t n_columns = csv_count_fields(text, first_end, delimiter);
+    bool header = opt->header == 1 || (opt->header < 0 && !csv_is_numeric(text, first_end, delimiter));
+    const char *begin = header ? csv_line_end(text, end) + 1 : text;
+    if (begin > end) {
+        begin = end;
+    }
+
+    CsvColumn *columns = (CsvColumn *)malloc(n_columns * sizeof(CsvColumn));
+    if (!columns) {
+        fprintf(stderr, "Error: Cannot allocate the %zu columns of %s.\n", n_columns, path);
+        return NULL;
+    }
+    size_t nx, ny;
+    if (!csv_map_columns(opt, n_columns, columns, &nx, &ny)) {
+        fprintf(stderr, "Error: Invalid column selection for %s with %zu columns.\n", path, n_columns);
+        free(columns);
+        return NULL;
+    }
+
+    // One range per worker, each moved forward to the start of a line
+    size_t n_chunks = parallel_num_threads();
+    size_t span = (size_t)(end - begin);
+    if (n_chunks > span / 4096 + 1) {
+        n_chunks = span / 4096 + 1;
+    }
+
+    CsvContext ctx = {.begin = begin, .end = end, .delimiter = delimiter, .n_columns = n_columns,
+                      .columns = columns, .n_chunks = n_chunks};
+    ctx.chunk_starts = (const char **)malloc((n_chunks + 1) * sizeof(char *));
+    ctx.chunk_rows = (size_t *)malloc(n_chunks * sizeof(size_t));
+    ctx.chunk_error = (size_t *)malloc(n_chunks * sizeof(size_t));
+    ctx.chunk_error_kind = (int *)malloc(n_chunks * sizeof(int));
+    if (!ctx.chunk_starts || !ctx.chunk_rows || !ctx.chunk_error || !ctx.chunk_error_kind) {
+        fprintf(stderr, "Error: Cannot allocate the row ranges of %s.\n", path);
+        csv_context_free(&ctx);
+        free(columns);
+        return NULL;
+    }
+    ctx.chunk_starts[0] = begin;
+    ctx.chunk_starts[n_chunks] = end;
+    for (size_t c = 1; c < n_chunks; c++) {
+        const char *p = begin + c * span / n_chunks;
+        if (p < ctx.chunk_starts[c - 1]) {
+            p = ctx.chunk_starts[c - 1];
+        }
+        const char *nl = (const char *)memchr(p - 1, '\n', (size_t)(end - p + 1));
+        ctx.chunk_starts[c] = nl ? nl + 1 : end;
+    }
+
+    // Count the rows of every range, then parse each range into its rows
+    parallel_for(n_chunks, csv_count_rows, &ctx);
+    size_t n_rows = 0;
+    for (size_t c = 0; c < n_chunks; c++) {
+        size_t rows = ctx.chunk_rows[c];
+        ctx.chunk_rows[c] = n_rows;
+        ctx.chunk_error[c] = SIZE_MAX;
+        n_rows += rows;
+    }
+
+    size_t x_shape[] = {n_rows, nx}, y_shape[] = {n_rows, ny};
+    ctx.X = tensor_create_from_shape(2, x_shape);
+    ctx.y = tensor_create_from_shape(2, y_shape);
+    if (!ctx.X || !ctx.y) {
+        if (ctx.X) {
+            tensor_free(ctx.X);
+        }
+        if (ctx.y) {
+            tensor_free(ctx.y);
+        }
+        csv_context_free(&ctx);
+        free(columns);
+        return NULL;
+    }
+    parallel_for(n_chunks, csv_parse_rows, &ctx);
+
+    Dataset *dataset = NULL;
+    size_t c = 0;
+    while (c < n_chunks && ctx.chunk_error[c] == SIZE_MAX) {
+        c++;
+    }
+    if (c < n_chunks) {
+        // Rows are numbered from 1 and without the header, as in a spreadsheet
+        fprintf(stderr, "Error: %s in data row %zu of %s.\n",
+                ctx.chunk_error_kind[c] == 1 ? "Bad value" : "Wrong number of fields",
+                ctx.chunk_error[c] + 1, path);
+        tensor_free(ctx.X);
+        tensor_free(ctx.y);
+    } else {
+        dataset = (Dataset *)malloc(sizeof(Dataset));
+        if (dataset) {
+            dataset->X = ctx.X;
+            dataset->y = ctx.y;
+        } else {
+            fprintf(stderr, "Error: Cannot allocate a dataset.\n");
+            tensor_free(ctx.X);
+            tensor_free(ctx.y);
+        }
+    }
+
+    free(columns);
+    csv_context_free(&ctx);
+    return dataset;
+}
+
+Dataset *dataset_load_csv(const char *path, const CsvOptions *options) {
+    CsvOptions defaults = {0, -1, NULL, 0, NULL, 0};
+    const CsvOptions *opt = options ? options : &defaults;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open %s.\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: %s is empty.\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t length = (size_t)st.st_size;
+    void *text = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot read %s.\n", path);
+        return NULL;
+    }
+    madvise(text, length, MADV_SEQUENTIAL);
+
+    Dataset *dataset = csv_parse(path, (const char *)text, length, opt);
+    munmap(text, length);
+    return dataset;
+}
+
+// Synthetic Data
+// Each kind of random draw is its own Philox stream, keyed by the seed and
+// the kind. Row r takes the stream positions r * (draws per row) onwards of
+// every stream, which is what makes chunks independent of each other.
+
+enum {
+    SYNTH_FEATURES,
+    SYNTH_NOISE,
+    SYNTH_WEIGHTS,
+    SYNTH_COLUMNS,
+    SYNTH_LABELS,
+    SYNTH_CENTRES,
+};
+
+// splitmix64 of the seed offset by the stream
+static uint64_t synth_key(uint64_t seed, uint64_t stream) {
+    uint64_t z = seed + (stream + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static bool regression_options(const RegressionOptions *options, RegressionOptions *o) {
+    *o = *options;
+    o->n_informative = o->n_informative ? o->n_informative : o->n_features;
+    o->n_targets = o->n_targets ? o->n_targets : 1;
+    if (o->n_features == 0 || o->n_informative > o->n_features) {
+        fprintf(stderr, "Error: Need at least one feature and no more informative ones.\n");
+        return false;
+    }
+    return true;
+}
+
+static bool check_rows(const Tensor *t, size_t rows, size_t cols, size_t begin, size_t n,
+                       const char *name) {
+    if (t->dtype != TENSOR_F32 || t->ndim != 2 || t->shape[0] != rows || t->shape[1] != cols) {
+        fprintf(stderr, "Error: %s must be a float32 [%zu, %zu] matrix.\n", name, rows, cols);
+        return false;
+    }
+    if (begin + rows > n) {
+        fprintf(stderr, "Error: Rows [%zu, %zu) are beyond the %zu samples.\n", begin,
+                begin + rows, n);
+        return false;
+    }
+    return true;
+}
+
+Tensor *make_regression_coef(const RegressionOptions *options) {
+    RegressionOptions o;
+    if (!regression_options(options, &o)) {
+        return NULL;
+    }
+
+    Tensor *W = tensor_create(2, o.n_features, o.n_targets);
+    tensor_fill(W, 0);
+    Tensor *informative = tensor_slice(W, 0, 0, o.n_informative);
+    random_uniform_at(synth_key(o.seed, SYNTH_WEIGHTS), 0, informative, 0.0f, 100.0f);
+    tensor_free(informative);
+    return W;
+}
+
+// Targets y += X W over the informative features, row by row in double
+typedef struct {
+    const Tensor *X;
+    Tensor *y;
+    const Tensor *W;
+    size_t informative;
+} TargetJob;
+
+static void target_rows(void *arg, size_t begin, size_t end) {
+    const TargetJob *job = (const TargetJob *)arg;
+    const Tensor *X = job->X, *W = job->W;
+    Tensor *y = job->y;
+    size_t k = y->shape[1];
+    for (size_t r = begin; r < end; r++) {
+        const Dtype *x = X->data + r * X->strides[0];
+        for (size_t c = 0; c < k; c++) {
+            Dtype *t = y->data + r * y->strides[0] + c * y->strides[1];
+            double acc = *t;
+            for (size_t j = 0; j < job->informative; j++) {
+                acc += (double)x[j * X->strides[1]] * W->data[j * W->strides[0] + c];
+            }
+            *t = (Dtype)acc;
+        }
+    }
+}
+
+bool make_regression_rows(const RegressionOptions *options, size_t begin, Tensor *X, Tensor *y) {
+    RegressionOptions o;
+    if (!regression_options(options, &o)) {
+        return false;
+    }
+    size_t m = X->ndim == 2 ? X->shape[0] : 0, d = o.n_features, k = o.n_targets;
+    if (!check_rows(X, m, d, begin, o.n_samples, "Features") ||
+        !check_rows(y, m, k, begin, o.n_samples, "Targets")) {
+        return false;
+    }
+
+    random_normal_at(synth_key(o.seed, SYNTH_FEATURES), (uint64_t)begin * d, X, 0.0f, 1.0f);
+    random_normal_at(synth_key(o.seed, SYNTH_NOISE), (uint64_t)begin * k, y, o.bias, o.noise);
+
+    Tensor *W = make_regression_coef(&o);
+    TargetJob job = {X, y, W, o.n_informative};
+    parallel_for_grain(m, PARALLEL_GRAIN / (o.n_informative * k + 1) + 1, target_rows, &job);
+    tensor_free(W);
+    return true;
+}
+
+// Allocate a dataset and generate its rows
+static Dataset *synth_dataset(size_t n, size_t d, size_t k, const void *options,
+                              bool (*rows)(const void *, size_t, Tensor *, Tensor *)) {
+    Dataset *dataset = (Dataset *)calloc(1, sizeof(Dataset));
+    if (!dataset) {
+        fprintf(stderr, "Error: Cannot allocate a dataset.\n");
+        return NULL;
+    }
+    dataset->X = tensor_create(2, n, d);
+    dataset->y = tensor_create(2, n, k);
+    if (!dataset->X || !dataset->y || !rows(options, 0, dataset->X, dataset->y)) {
+        dataset_free(dataset);
+        return NULL;
+    }
+    return dataset;
+}
+
+static bool regression_rows(const void *options, size_t begin, Tensor *X, Tensor *y) {
+    return make_regression_rows((const RegressionOptions *)options, begin, X, y);
+}
+
+Dataset *make_regression(const RegressionOptions *options) {
+    RegressionOptions o;
+    if (!regression_options(options, &o)) {
+        return NULL;
+    }
+    return synth_dataset(o.n_samples, o.n_features, o.n_targets, &o, regression_rows);
+}
+
+// Sparse rows: the columns of a row are drawn with Floyd's algorithm, which
+// takes exactly one draw per nonzero, so every row uses the same number of
+// stream positions
+typedef struct {
+    SparseTensor *X;
+    Tensor *y;
+    const Tensor *W;
+    const Dtype *values;
+    uint64_t columns_key;
+    size_t first_row;
+    size_t per_row;
+    size_t informative;
+    atomic_bool failed; // A worker could not allocate its scratch
+} SparseRowsJob;
+
+static void sparse_rows(void *arg, size_t begin, size_t end) {
+    SparseRowsJob *job = (SparseRowsJob *)arg;
+    SparseTensor *X = job->X;
+    size_t d = X->cols, p = job->per_row, k = job->y->shape[1];
+    uint32_t *bits = (uint32_t *)malloc(p * sizeof(uint32_t));
+    if (!bits) {
+        atomic_store(&job->failed, true);
+        return;
+    }
+
+    for (size_t i = begin; i < end; i++) {
+        random_bits_at(job->columns_key, (uint64_t)(job->first_row + i) * p, p, bits);
+        uint32_t *cols = X->indices + i * p;
+        Dtype *values = X->values + i * p;
+        for (size_t t = 0; t < p; t++) {
+            size_t last = d - p + t;
+            uint32_t c = (uint32_t)(((uint64_t)bits[t] * (last + 1)) >> 32);
+            for (size_t s = 0; s < t; s++) {
+                if (cols[s] == c) {
+                    c = (uint32_t)last;
+                    break;
+                }
+            }
+            // Kept sorted by insertion
+            size_t s = t;
+            for (; s > 0 && cols[s - 1] > c; s--) {
+                cols[s] = cols[s - 1];
+            }
+            cols[s] = c;
+        }
+        memcpy(values, job->values + i * p, p * sizeof(Dtype));
+        X->indptr[i + 1] = (i + 1) * p;
+
+        for (size_t c = 0; c < k; c++) {
+            Dtype *t = job->y->data + i * job->y->strides[0] + c * job->y->strides[1];
+            double acc = *t;
+            for (size_t q = 0; q < p && cols[q] < job->informative; q++) {
+                acc += (double)values[q] * job->W->data[cols[q] * job->W->strides[0] + c];
+            }
+            *t = (Dtype)acc;
+        }
+    }
+    free(bits);
+}
+
+SparseDataset *make_sparse_regression_rows(const RegressionOptions *options, size_t begin,
+                                           size_t count) {
+    RegressionOptions o;
+    if (!regression_options(options, &o)) {
+        return NULL;
+    }
+    if (!(o.density > 0 && o.density <= 1)) {
+        fprintf(stderr, "Error: Density must be in (0, 1].\n");
+        return NULL;
+    }
+    if (begin + count > o.n_samples) {
+        fprintf(stderr, "Error: Rows [%zu, %zu) are beyond the %zu samples.\n", begin,
+                begin + count, o.n_samples);
+        return NULL;
+    }
+
+    size_t d = o.n_features, k = o.n_targets;
+    size_t per_row = (size_t)lround(o.density * (double)d);
+    per_row = per_row > 0 ? per_row : 1;
+    SparseTensor *X = sparse_create(SPARSE_CSR, count, d, count * per_row);
+    if (!X) {
+        return NULL;
+    }
+    SparseDataset *dataset = (SparseDataset *)malloc(sizeof(SparseDataset));
+    if (!dataset) {
+        fprintf(stderr, "Error: Cannot allocate a dataset.\n");
+        sparse_free(X);
+        return NULL;
+    }
+    dataset->X = X;
+    dataset->y = tensor_create(2, count, k);
+    Tensor *values = tensor_create(1, count * per_row);
+    Tensor *W = make_regression_coef(&o);
+    if (!dataset->y || !values || !W) {
+        if (values) {
+            tensor_free(values);
+        }
+        if (W) {
+            tensor_free(W);
+        }
+        sparse_dataset_free(dataset);
+        return NULL;
+    }
+
+    random_normal_at(synth_key(o.seed, SYNTH_FEATURES), (uint64_t)begin * per_row, values, 0.0f,
+                     1.0f);
+    random_normal_at(synth_key(o.seed, SYNTH_NOISE), (uint64_t)begin * k, dataset->y, o.bias,
+                     o.noise);
+
+    SparseRowsJob job = {.X = X,
+                         .y = dataset->y,
+                         .W = W,
+                         .values = values->data,
+                         .columns_key = synth_key(o.seed, SYNTH_COLUMNS),
+                         .first_row = begin,
+                         .per_row = per_row,
+                         .informative = o.n_informative};
+    atomic_init(&job.failed, false);
+    parallel_for_grain(count, PARALLEL_GRAIN / (per_row * (per_row + k)) + 1, sparse_rows, &job);
+    tensor_free(values);
+    tensor_free(W);
+    if (atomic_load(&job.failed)) {
+        fprintf(stderr, "Error: Cannot allocate the column draws of a sparse dataset.\n");
+        sparse_dataset_free(dataset);
+        return NULL;
+    }
+    return dataset;
+}
+
+SparseDataset *make_sparse_regression(const RegressionOptions *options) {
+    return make_sparse_regression_rows(options, 0, options->n_samples);
+}
+
+void sparse_dataset_free(SparseDataset *dataset) {
+    if (dataset) {
+        sparse_free(dataset->X);
+        if (dataset->y) {
+            tensor_free(dataset->y);
+        }
+        free(dataset);
+    }
+}
+
+static bool classification_options(const ClassificationOptions *options,
+                                   ClassificationOptions *o) {
+    *o = *options;
+    o->n_informative = o->n_informative ? o->n_informative : o->n_features;
+    o->n_classes = o->n_classes ? o->n_classes : 2;
+    o->class_sep = o->class_sep != 0 ? o->class_sep : 1.0f;
+    if (o->n_features == 0 || o->n_informative > o->n_features) {
+        fprintf(stderr, "Error: Need at least one feature and no more informative ones.\n");
+        return false;
+    }
+    if (o->n_informative < 64 && o->n_classes > (size_t)1 << o->n_informative) {
+        fprintf(stderr, "Error: %zu classes need more than %zu informative features.\n",
+                o->n_classes, o->n_informative);
+        return false;
+    }
+    return true;
+}
+
+// The centres of the classes, ±class_sep in each informative feature, as a
+// [n_classes, n_informative] table. The first b = ceil(log2 n_classes)
+// features hold the bits of the class index, which makes the vertices
+// distinct; the others are random but never the same for every class. Each
+// feature then has its sign flipped at random.
+static Dtype *class_centres(const ClassificationOptions *o) {
+    size_t k = o->n_classes, inf = o->n_informative;
+    size_t b = 0;
+    while (b < inf && b < 64 && ((size_t)1 << b) < k) {
+        b++;
+    }
+
+    Dtype *centres = (Dtype *)malloc(k * inf * sizeof(Dtype));
+    uint32_t *bits = (uint32_t *)malloc((k + 1) * inf * sizeof(uint32_t));
+    if (!centres || !bits) {
+        free(centres);
+        free(bits);
+        return NULL;
+    }
+    random_bits_at(synth_key(o->seed, SYNTH_CENTRES), 0, (k + 1) * inf, bits);
+
+    for (size_t j = 0; j < inf; j++) {
+        bool flip = bits[k * inf + j] & 1;
+        bool any = false, all = true;
+        for (size_t c = 0; c < k; c++) {
+            bool set = j < b ? (c >> j) & 1 : bits[c * inf + j] & 1;
+            if (j >= b && c + 1 == k && k > 1 && (set ? all : !any)) {
+                set = !set; // The last class differs from the ones before
+            }
+            any |= set;
+            all &= set;
+            centres[c * inf + j] = set != flip ? o->class_sep : -o->class_sep;
+        }
+    }
+    free(bits);
+    return centres;
+}
+
+// Three uniform draws per row: the class, whether to flip the label and the
+// flipped label
+typedef struct {
+    const ClassificationOptions *o;
+    Tensor *X;
+    Tensor *y;
+    const Tensor *draws; // [m, 3]
+    const Dtype *centres;
+} ClassJob;
+
+static void class_rows(void *arg, size_t begin, size_t end) {
+    const ClassJob *job = (const ClassJob *)arg;
+    const ClassificationOptions *o = job->o;
+    size_t n_classes = o->n_classes;
+    for (size_t r = begin; r < end; r++) {
+        const Dtype *u = job->draws->data + 3 * r;
+        size_t label = (size_t)(u[0] * (Dtype)n_classes);
+        label = label < n_classes ? label : n_classes - 1;
+
+        Dtype *x = job->X->data + r * job->X->strides[0];
+        const Dtype *centre = job->centres + label * o->n_informative;
+        for (size_t j = 0; j < o->n_informative; j++) {
+            x[j * job->X->strides[1]] += centre[j];
+        }
+
+        if (u[1] < o->flip_y) {
+            label = (size_t)(u[2] * (Dtype)n_classes);
+            label = label < n_classes ? label : n_classes - 1;
+        }
+        job->y->data[r * job->y->strides[0]] = (Dtype)label;
+    }
+}
+
+bool make_classification_rows(const ClassificationOptions *options, size_t begin, Tensor *X,
+                              Tensor *y) {
+    ClassificationOptions o;
+    if (!classification_options(options, &o)) {
+        return false;
+    }
+    size_t m = X->ndim == 2 ? X->shape[0] : 0, d = o.n_features;
+    if (!check_rows(X, m, d, begin, o.n_samples, "Features") ||
+        !check_rows(y, m, 1, begin, o.n_samples, "Labels")) {
+        return false;
+    }
+
+    Dtype *centres = class_centres(&o);
+    if (!centres) {
+        return false;
+    }
+    random_normal_at(synth_key(o.seed, SYNTH_FEATURES), (uint64_t)begin * d, X, 0.0f, 1.0f);
+    Tensor *draws = tensor_create(2, m, (size_t)3);
+    random_uniform_at(synth_key(o.seed, SYNTH_LABELS), (uint64_t)begin * 3, draws, 0.0f, 1.0f);
+    ClassJob job = {&o, X, y, draws, centres};
+    parallel_for_grain(m, PARALLEL_GRAIN / (o.n_informative + 1) + 1, class_rows, &job);
+    tensor_free(draws);
+    free(centres);
+    return true;
+}
+
+static bool classification_rows(const void *options, size_t begin, Tensor *X, Tensor *y) {
+    return make_classification_rows((const ClassificationOptions *)options, begin, X, y);
+}
+
+Dataset *make_classification(const ClassificationOptions *options) {
+    ClassificationOptions o;
+    if (!classification_options(options, &o)) {
+        return NULL;
+    }
+    return synth_dataset(o.n_samples, o.n_features, 1, &o, classification_rows);
+}
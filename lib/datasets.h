@@ -2,17 +2,102 @@
 #define DATASET_H
 
 #include "la.h"
+#include "sparse.h"
+#include <stdint.h>
 
 typedef struct {
     Tensor *X;
     Tensor *y;
 } Dataset;
 
-Dataset *make_regression(int n_samples, int n_features, Tensor *weight, double bias) {
-    Tensor *X = rand_tensor(n_samples, n_features);
-    
-}
+void dataset_free(Dataset *dataset);
 
+// Delimited text files
+// The file is mapped, split into one byte range per worker at line breaks,
+// and every range is parsed in parallel straight into rows of X and y, which
+// are allocated once the lines have been counted. Fields are parsed with a
+// fast decimal parser that falls back to strtod for long mantissas, huge
+// exponents, nan and inf; an empty field is NaN. CRLF line ends, blank lines
+// and double-quoted numbers are accepted.
+typedef struct {
+    char delimiter;          // ',' or '\t' for instance, 0 to guess from the first line
+    int header;              // 1 to skip the first line, 0 not to, -1 to skip it when
+                             // it does not parse as numbers
+    const size_t *x_columns; // Columns of X in order, NULL for all columns not in y
+    size_t n_x_columns;
+    const size_t *y_columns; // Columns of y in order, NULL for the last column
+    size_t n_y_columns;
+} CsvOptions;
+
+// NULL options guess the delimiter and the header and use the last column as y
+Dataset *dataset_load_csv(const char *path, const CsvOptions *options);
+
+// Synthetic Data
+// Regression and classification problems of any size, for benchmarks and
+// load tests. Every value is a function of the seed and its row only, so
+// rows come out the same whether a dataset is made whole or chunk by chunk,
+// on any number of threads:
+//
+//     RegressionOptions options = {.n_samples = n, .n_features = d, .seed = 1};
+//     Tensor *X = tensor_create(2, chunk, d), *y = tensor_create(2, chunk, 1);
+//     for (size_t i = 0; i + chunk <= n; i += chunk) {
+//         make_regression_rows(&options, i, X, y); // Rows [i, i + chunk)
+//         linear_regression_partial_fit(lr, X, y);
+//     }
+//
+// Features are standard normal, the random draws of the rows are generated
+// in parallel and so are the targets.
+
+typedef struct {
+    size_t n_samples;
+    size_t n_features;
+    size_t n_informative; // Leading features the targets depend on, 0 for all
+    size_t n_targets;     // 0 for 1
+    float bias;
+    float noise;   // Standard deviation of the normal noise added to the targets
+    float density; // Sparse features only: fraction of nonzero features per row
+    uint64_t seed;
+} RegressionOptions;
+
+// y = X W + bias + noise, with the weights of the informative features
+// uniform in [0, 100) and the others 0
+Dataset *make_regression(const RegressionOptions *options);
+// Rows [begin, begin + X->shape[0]) into X [m, n_features] and y [m, n_targets]
+bool make_regression_rows(const RegressionOptions *options, size_t begin, Tensor *X, Tensor *y);
+// The weights W [n_features, n_targets] of the targets
+Tensor *make_regression_coef(const RegressionOptions *options);
+
+// The same targets over sparse features: each row has round(density *
+// n_features) nonzeros, at least one, in distinct random columns, with
+// standard normal values
+typedef struct {
+    SparseTensor *X; // CSR
+    Tensor *y;
+} SparseDataset;
+
+SparseDataset *make_sparse_regression(const RegressionOptions *options);
+SparseDataset *make_sparse_regression_rows(const RegressionOptions *options, size_t begin,
+                                           size_t count);
+void sparse_dataset_free(SparseDataset *dataset);
+
+// Classes centred on distinct vertices of a hypercube in the informative
+// features, at ±class_sep along each, drawn from the seed so that every
+// informative feature separates some of the classes; n_classes must be at
+// most 2^n_informative. Rows draw their class uniformly; y [n, 1] holds the
+// class index. A fraction flip_y of the labels is then replaced by random
+// ones.
+typedef struct {
+    size_t n_samples;
+    size_t n_features;
+    size_t n_informative; // 0 for all
+    size_t n_classes;     // 0 for 2
+    float class_sep;      // 0 for 1
+    float flip_y;
+    uint64_t seed;
+} ClassificationOptions;
 
+Dataset *make_classification(const ClassificationOptions *options);
+bool make_classification_rows(const ClassificationOptions *options, size_t begin, Tensor *X,
+                              Tensor *y);
 
 #endif
@@ -0,0 +1,358 @@
+#include "gemm.h"
+#include "parallel.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Register block computed by the micro-kernel: MR rows of A times NR columns
+// of B are accumulated in registers over the whole KC depth of a block.
+#define GEMM_MR 4
+#define GEMM_NR 8
+
+// Products smaller than this (m * n * k) skip packing entirely
+#define GEMM_SMALL_VOLUME (32 * 32 * 32)
+
+// Cache block sizes, derived once from the cache hierarchy:
+//   KC - depth of a block, a KC x NR sliver of B stays in L1
+//   MC - rows of the packed A block that stays in L2
+//   NC - columns of the packed B panel that stays in L3
+static size_t gemm_mc = 128;
+static size_t gemm_kc = 256;
+static size_t gemm_nc = 4096;
+static pthread_once_t gemm_blocking_once = PTHREAD_ONCE_INIT;
+
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+static size_t cache_size(int name, size_t fallback) {
+    long size = sysconf(name);
+    return size > 0 ? (size_t)size : fallback;
+}
+#endif
+
+static size_t clamp_multiple(size_t value, size_t lo, size_t hi, size_t multiple) {
+    if (value < lo)
+        value = lo;
+    if (value > hi)
+        value = hi;
+    return value / multiple * multiple;
+}
+
+static void gemm_init_blocking(void) {
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    size_t l1 = cache_size(_SC_LEVEL1_DCACHE_SIZE, 32 * 1024);
+    size_t l2 = cache_size(_SC_LEVEL2_CACHE_SIZE, 256 * 1024);
+    size_t l3 = cache_size(_SC_LEVEL3_CACHE_SIZE, 8 * 1024 * 1024);
+#else
+    size_t l1 = 32 * 1024;
+    size_t l2 = 256 * 1024;
+    size_t l3 = 8 * 1024 * 1024;
+#endif
+
+    // Use about half of each level, the rest is left for C and streaming data
+    gemm_kc = clamp_multiple(l1 / 2 / ((GEMM_MR + GEMM_NR) * sizeof(float)), 64, 512, 8);
+    gemm_mc = clamp_multiple(l2 / 2 / (gemm_kc * sizeof(float)), GEMM_MR, 1024, GEMM_MR);
+    gemm_nc = clamp_multiple(l3 / 2 / (gemm_kc * sizeof(float)), GEMM_NR, 8192, GEMM_NR);
+}
+
+static float *gemm_alloc(size_t count) {
+    size_t bytes = (count * sizeof(float) + 63) / 64 * 64;
+    return (float *)aligned_alloc(64, bytes);
+}
+
+// Pack an mc x kc block of A into row panels of MR rows. Inside a panel the
+// MR values of one column are adjacent, so the micro-kernel reads A linearly.
+// Rows past mc are zero padded.
+static void pack_a(size_t mc, size_t kc, const float *a, size_t rsa, size_t csa, float *ap) {
+    for (size_t ir = 0; ir < mc; ir += GEMM_MR) {
+        size_t mr = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+        const float *panel = a + ir * rsa;
+        for (size_t p = 0; p < kc; p++) {
+            size_t i = 0;
+            for (; i < mr; i++) {
+                ap[i] = panel[i * rsa + p * csa];
+            }
+            for (; i < GEMM_MR; i++) {
+                ap[i] = 0.0f;
+            }
+            ap += GEMM_MR;
+        }
+    }
+}
+
+// Pack a kc x nc panel of B into column panels of NR columns. Inside a panel
+// the NR values of one row are adjacent. Columns past nc are zero padded.
+static void pack_b(size_t kc, size_t nc, const float *b, size_t rsb, size_t csb, float *bp) {
+    for (size_t jr = 0; jr < nc; jr += GEMM_NR) {
+        size_t nr = nc - jr < GEMM_NR ? nc - jr : GEMM_NR;
+        const float *panel = b + jr * csb;
+        for (size_t p = 0; p < kc; p++) {
+            const float *row = panel + p * rsb;
+            size_t j = 0;
+            if (csb == 1) {
+                for (; j < nr; j++) {
+                    bp[j] = row[j];
+                }
+            } else {
+                for (; j < nr; j++) {
+                    bp[j] = row[j * csb];
+                }
+            }
+            for (; j < GEMM_NR; j++) {
+                bp[j] = 0.0f;
+            }
+            bp += GEMM_NR;
+        }
+    }
+}
+
+// Micro-kernel: C[MR x NR] = alpha * Ap * Bp + beta * C, with the whole
+// MR x NR accumulator block kept in registers across the kc loop.
+static void gemm_kernel(size_t kc, const float *restrict a, const float *restrict b,
+                        float *c, size_t rsc, size_t csc, float alpha, float beta) {
+    float ab[GEMM_MR][GEMM_NR] = {{0}};
+
+    for (size_t p = 0; p < kc; p++) {
+        for (size_t i = 0; i < GEMM_MR; i++) {
+            for (size_t j = 0; j < GEMM_NR; j++) {
+                ab[i][j] += a[i] * b[j];
+            }
+        }
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+
+    for (size_t i = 0; i < GEMM_MR; i++) {
+        for (size_t j = 0; j < GEMM_NR; j++) {
+            float *cij = &c[i * rsc + j * csc];
+            *cij = beta == 0.0f ? alpha * ab[i][j] : alpha * ab[i][j] + beta * *cij;
+        }
+    }
+}
+
+// Run the micro-kernel over one packed A block and one packed B panel. Edge
+// tiles are computed into a local tile and then merged into C.
+static void gemm_macro_kernel(size_t mc, size_t nc, size_t kc, float alpha,
+                              const float *ap, const float *bp, float beta,
+                              float *c, size_t rsc, size_t csc) {
+    float tile[GEMM_MR * GEMM_NR];
+
+    for (size_t jr = 0; jr < nc; jr += GEMM_NR) {
+        size_t nr = nc - jr < GEMM_NR ? nc - jr : GEMM_NR;
+        for (size_t ir = 0; ir < mc; ir += GEMM_MR) {
+            size_t mr = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+            const float *a_panel = ap + ir * kc;
+            const float *b_panel = bp + jr * kc;
+            float *c_tile = c + ir * rsc + jr * csc;
+
+            if (mr == GEMM_MR && nr == GEMM_NR) {
+                gemm_kernel(kc, a_panel, b_panel, c_tile, rsc, csc, alpha, beta);
+                continue;
+            }
+
+            gemm_kernel(kc, a_panel, b_panel, tile, GEMM_NR, 1, alpha, 0.0f);
+            for (size_t i = 0; i < mr; i++) {
+                for (size_t j = 0; j < nr; j++) {
+                    float *cij = &c_tile[i * rsc + j * csc];
+                    *cij = beta == 0.0f ? tile[i * GEMM_NR + j]
+                                        : tile[i * GEMM_NR + j] + beta * *cij;
+                }
+            }
+        }
+    }
+}
+
+// Unpacked path for tiny products where packing costs more than it saves
+static void gemm_small(size_t m, size_t n, size_t k, float alpha,
+                       const float *a, size_t rsa, size_t csa,
+                       const float *b, size_t rsb, size_t csb,
+                       float beta, float *c, size_t rsc, size_t csc) {
+    for (size_t i = 0; i < m; i++) {
+        float *ci = c + i * rsc;
+        for (size_t j = 0; j < n; j++) {
+            ci[j * csc] = beta == 0.0f ? 0.0f : beta * ci[j * csc];
+        }
+        for (size_t p = 0; p < k; p++) {
+            float aip = alpha * a[i * rsa + p * csa];
+            const float *bp = b + p * rsb;
+            for (size_t j = 0; j < n; j++) {
+                ci[j * csc] += aip * bp[j * csb];
+            }
+        }
+    }
+}
+
+static void gemm_scale(size_t m, size_t n, float beta, float *c, size_t rsc, size_t csc) {
+    for (size_t i = 0; i < m; i++) {
+        for (size_t j = 0; j < n; j++) {
+            float *cij = &c[i * rsc + j * csc];
+            *cij = beta == 0.0f ? 0.0f : beta * *cij;
+        }
+    }
+}
+
+// The row blocks of A against one packed panel of B are independent and run
+// on the thread pool, each piece packing its blocks of A into a buffer of its
+// own
+typedef struct {
+    size_t m, mc_max, kc_max;
+    size_t nc, kc;
+    float alpha, beta;
+    const float *a; // At the depth of the panel
+    size_t rsa, csa;
+    const float *b; // The panel unpacked
+    size_t rsb, csb;
+    const float *bp;
+    float *c; // At the columns of the panel
+    size_t rsc, csc;
+    bool syrk; // Stop each block at the diagonal, c and the panel at column jc
+    size_t jc;
+} GemmJob;
+
+static void gemm_blocks(void *arg, size_t begin, size_t end) {
+    const GemmJob *job = (const GemmJob *)arg;
+    float *ap = gemm_alloc(((job->mc_max + GEMM_MR - 1) / GEMM_MR) * GEMM_MR * job->kc_max);
+    for (size_t ic = begin * job->mc_max; ic < end * job->mc_max && ic < job->m; ic += job->mc_max) {
+        size_t mc = job->m - ic < job->mc_max ? job->m - ic : job->mc_max;
+        size_t width = job->nc;
+        if (job->syrk) {
+            // Columns up to the last row of this block, none when the block
+            // lies entirely above the diagonal
+            if (ic + mc <= job->jc) {
+                continue;
+            }
+            width = ic + mc - job->jc < job->nc ? ic + mc - job->jc : job->nc;
+        }
+
+        const float *a = job->a + ic * job->rsa;
+        float *c = job->c + ic * job->rsc;
+        if (!ap) {
+            // Out of memory for the packed block: multiply it unpacked
+            gemm_small(mc, width, job->kc, job->alpha, a, job->rsa, job->csa, job->b,
+                       job->rsb, job->csb, job->beta, c, job->rsc, job->csc);
+            continue;
+        }
+        pack_a(mc, job->kc, a, job->rsa, job->csa, ap);
+        gemm_macro_kernel(mc, width, job->kc, job->alpha, ap, job->bp, job->beta, c, job->rsc,
+                          job->csc);
+    }
+    free(ap);
+}
+
+// Row blocks of A per piece of work on the thread pool, all of them when the
+// product is too small to split. Large enough products get row blocks small
+// enough to give every thread some; this does not change the results, as
+// every element of C still sums over k in the same order.
+static size_t gemm_parallel_grain(size_t m, size_t n, size_t k, size_t *mc_max) {
+    if (m * n * k < GEMM_PARALLEL_VOLUME) {
+        return (m + *mc_max - 1) / *mc_max;
+    }
+    size_t n_threads = parallel_num_threads();
+    size_t share = ((m + n_threads - 1) / n_threads + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+    if (share < *mc_max) {
+        *mc_max = share;
+    }
+    return 1;
+}
+
+void gemm_sgemm(size_t m, size_t n, size_t k, float alpha,
+                const float *a, size_t rsa, size_t csa,
+                const float *b, size_t rsb, size_t csb,
+                float beta, float *c, size_t rsc, size_t csc) {
+    if (m == 0 || n == 0) {
+        return;
+    }
+
+    if (k == 0 || alpha == 0.0f) {
+        gemm_scale(m, n, beta, c, rsc, csc);
+        return;
+    }
+
+    if (m * n * k <= GEMM_SMALL_VOLUME) {
+        gemm_small(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc);
+        return;
+    }
+
+    pthread_once(&gemm_blocking_once, gemm_init_blocking);
+    size_t mc_max = gemm_mc < m ? gemm_mc : m;
+    size_t kc_max = gemm_kc < k ? gemm_kc : k;
+    size_t nc_max = gemm_nc < n ? gemm_nc : n;
+    size_t grain = gemm_parallel_grain(m, n, k, &mc_max);
+
+    // Packed B is padded up to whole NR panels
+    float *bp = gemm_alloc(((nc_max + GEMM_NR - 1) / GEMM_NR) * GEMM_NR * kc_max);
+    if (!bp) {
+        // Out of memory for the packed buffers: still produce a result
+        gemm_small(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc);
+        return;
+    }
+
+    GemmJob job = {.m = m, .mc_max = mc_max, .kc_max = kc_max, .alpha = alpha,
+                   .rsa = rsa, .csa = csa, .rsb = rsb, .csb = csb, .bp = bp,
+                   .rsc = rsc, .csc = csc};
+    for (size_t jc = 0; jc < n; jc += nc_max) {
+        job.nc = n - jc < nc_max ? n - jc : nc_max;
+        for (size_t pc = 0; pc < k; pc += kc_max) {
+            job.kc = k - pc < kc_max ? k - pc : kc_max;
+            // Only the first pass over k applies beta, later ones accumulate
+            job.beta = pc == 0 ? beta : 1.0f;
+            job.a = a + pc * csa;
+            job.b = b + pc * rsb + jc * csb;
+            job.c = c + jc * csc;
+
+            pack_b(job.kc, job.nc, job.b, rsb, csb, bp);
+            parallel_for_grain((m + mc_max - 1) / mc_max, grain, gemm_blocks, &job);
+        }
+    }
+
+    free(bp);
+}
+
+void gemm_ssyrk(size_t n, size_t k, float alpha, const float *a, size_t rsa, size_t csa,
+                float beta, float *c, size_t rsc, size_t csc) {
+    if (n == 0) {
+        return;
+    }
+
+    // B = A^T is A read with its strides swapped
+    if (k == 0 || alpha == 0.0f || n * n * k <= GEMM_SMALL_VOLUME) {
+        gemm_sgemm(n, n, k, alpha, a, rsa, csa, a, csa, rsa, beta, c, rsc, csc);
+        return;
+    }
+
+    pthread_once(&gemm_blocking_once, gemm_init_blocking);
+    size_t kc_max = gemm_kc < k ? gemm_kc : k;
+    size_t nc_max = gemm_nc < n ? gemm_nc : n;
+    // Row blocks of about n / 16 rows, so that the blocks straddling the
+    // diagonal add little work above it
+    size_t mc_max = ((n + 15) / 16 + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+    if (mc_max > gemm_mc) {
+        mc_max = gemm_mc;
+    }
+    size_t grain = gemm_parallel_grain(n, n, k, &mc_max);
+
+    float *bp = gemm_alloc(((nc_max + GEMM_NR - 1) / GEMM_NR) * GEMM_NR * kc_max);
+    if (!bp) {
+        gemm_small(n, n, k, alpha, a, rsa, csa, a, csa, rsa, beta, c, rsc, csc);
+        return;
+    }
+
+    GemmJob job = {.m = n, .mc_max = mc_max, .kc_max = kc_max, .alpha = alpha,
+                   .rsa = rsa, .csa = csa, .rsb = csa, .csb = rsa, .bp = bp,
+                   .rsc = rsc, .csc = csc, .syrk = true};
+    for (size_t jc = 0; jc < n; jc += nc_max) {
+        job.nc = n - jc < nc_max ? n - jc : nc_max;
+        job.jc = jc;
+        for (size_t pc = 0; pc < k; pc += kc_max) {
+            job.kc = k - pc < kc_max ? k - pc : kc_max;
+            job.beta = pc == 0 ? beta : 1.0f;
+            job.a = a + pc * csa;
+            job.b = a + pc * csa + jc * rsa;
+            job.c = c + jc * csc;
+
+            pack_b(job.kc, job.nc, job.b, csa, rsa, bp);
+            parallel_for_grain((n + mc_max - 1) / mc_max, grain, gemm_blocks, &job);
+        }
+    }
+
+    free(bp);
+}
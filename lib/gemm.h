@@ -0,0 +1,29 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stddef.h>
+
+// Products smaller than this (m * n * k) run on the calling thread only, so a
+// batch of them is better split across threads by the caller
+#define GEMM_PARALLEL_VOLUME (128 * 128 * 128)
+
+// General matrix multiplication on raw float buffers:
+//     C = alpha * A * B + beta * C
+// A is m x k, B is k x n and C is m x n. Every operand is addressed through a
+// row stride (rs) and a column stride (cs) in elements, so row-major,
+// column-major and transposed operands are all consumed without copying.
+// When beta is 0, C is not read.
+void gemm_sgemm(size_t m, size_t n, size_t k, float alpha,
+                const float *a, size_t rsa, size_t csa,
+                const float *b, size_t rsb, size_t csb,
+                float beta, float *c, size_t rsc, size_t csc);
+
+// Symmetric rank-k update of the lower triangle:
+//     C = alpha * A * A^T + beta * C
+// A is n x k and C is n x n. Only the blocks of C on or below the diagonal
+// are computed, which is about half the work of gemm_sgemm; entries above the
+// diagonal inside those blocks are overwritten, the others are left alone.
+void gemm_ssyrk(size_t n, size_t k, float alpha, const float *a, size_t rsa, size_t csa,
+                float beta, float *c, size_t rsc, size_t csc);
+
+#endif // GEMM_H
@@ -0,0 +1,284 @@
+#include "io.h"
+#include "iter.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NPY_MAGIC "\x93NUMPY"
+#define NPY_MAGIC_SIZE 6
+// Longest header tensor_save writes: the fixed keys and 32 dimensions
+#define NPY_MAX_HEADER 1024
+// Elements gathered per write of a strided or converted run
+#define NPY_WRITE_STAGE 256
+
+bool tensor_save(const Tensor *t, const char *path) {
+    // The header is a Python dict literal padded with spaces and ended by a
+    // newline, so that magic, version, length and header fill whole cache lines
+    // bfloat16 has no NumPy dtype and is written as float32
+    static const char *const descrs[TENSOR_DTYPE_COUNT] = {"<f4", "<f8", "<f2", "<f4"};
+    TensorDtype file_dtype = t->dtype == TENSOR_BF16 ? TENSOR_F32 : t->dtype;
+    size_t itemsize = tensor_dtype_size(file_dtype);
+
+    char header[NPY_MAX_HEADER];
+    int len = snprintf(header, sizeof(header), "{'descr': '%s', 'fortran_order': False, 'shape': (",
+                       descrs[t->dtype]);
+    for (size_t i = 0; i < t->ndim; i++) {
+        len += snprintf(header + len, sizeof(header) - len, i > 0 ? ", %zu" : "%zu", t->shape[i]);
+    }
+    len += snprintf(header + len, sizeof(header) - len, t->ndim == 1 ? ",), }" : "), }");
+
+    size_t total = (10 + (size_t)len + 1 + 63) / 64 * 64;
+    size_t header_len = total - 10;
+    memset(header + len, ' ', header_len - 1 - len);
+    header[header_len - 1] = '\n';
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open %s for writing.\n", path);
+        return false;
+    }
+
+    unsigned char prefix[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                                (unsigned char)(header_len & 0xff), (unsigned char)(header_len >> 8)};
+    fwrite(prefix, 1, sizeof(prefix), f);
+    fwrite(header, 1, header_len, f);
+
+    // Elements go out in logical row-major order, whatever the layout of t
+    TensorIter it;
+    iter_init(&it, 1, (const Tensor *[]){t});
+    double buffer[NPY_WRITE_STAGE];
+    while (iter_next(&it)) {
+        size_t stride = it.inner_strides[0];
+        if (stride == 1 && file_dtype == t->dtype) {
+            fwrite(tensor_element(t, it.offsets[0]), itemsize, it.inner_size, f);
+            continue;
+        }
+        for (size_t start = 0; start < it.inner_size; start += NPY_WRITE_STAGE) {
+            size_t n = it.inner_size - start < NPY_WRITE_STAGE ? it.inner_size - start
+                                                               : NPY_WRITE_STAGE;
+            dtype_convert(n, file_dtype, buffer, 1, t->dtype,
+                          tensor_element(t, it.offsets[0] + start * stride), stride);
+            fwrite(buffer, itemsize, n, f);
+        }
+    }
+
+    bool ok = !ferror(f);
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to write %s.\n", path);
+    }
+    return ok;
+}
+
+// The text following 'key': in the header dict, NULL if the key is missing
+static const char *npy_value(const char *header, const char *key) {
+    char quoted[32];
+    snprintf(quoted, sizeof(quoted), "'%s'", key);
+    const char *p = strstr(header, quoted);
+    if (!p) {
+        return NULL;
+    }
+
+    p += strlen(quoted);
+    while (*p == ' ' || *p == ':') {
+        p++;
+    }
+    return p;
+}
+
+// Parse a shape tuple such as (), (5,) or (3, 4)
+static bool npy_parse_shape(const char *p, size_t *ndim, size_t shape[]) {
+    if (!p || *p != '(') {
+        return false;
+    }
+    p++;
+
+    *ndim = 0;
+    for (;;) {
+        while (*p == ' ' || *p == ',') {
+            p++;
+        }
+        if (*p == ')') {
+            return true;
+        }
+
+        char *end;
+        unsigned long long dim = strtoull(p, &end, 10);
+        if (end == p || *ndim == TENSOR_MAX_DIMS) {
+            return false;
+        }
+        shape[(*ndim)++] = (size_t)dim;
+        p = end;
+    }
+}
+
+static bool read_fully(int fd, void *buf, size_t bytes, size_t offset) {
+    unsigned char *dst = (unsigned char *)buf;
+    while (bytes > 0) {
+        ssize_t got = pread(fd, dst, bytes, (off_t)offset);
+        if (got <= 0) {
+            return false;
+        }
+        dst += got;
+        bytes -= (size_t)got;
+        offset += (size_t)got;
+    }
+    return true;
+}
+
+// Read the data of a file that cannot be mapped as it is into a new tensor
+static Tensor *npy_read(int fd, size_t offset, TensorDtype dtype, size_t ndim,
+                        const size_t shape[]) {
+    Tensor *t = tensor_create_typed(dtype, ndim, shape);
+    if (t && !read_fully(fd, t->data, t->size * tensor_dtype_size(dtype), offset)) {
+        tensor_free(t);
+        t = NULL;
+    }
+    return t;
+}
+
+// Wrap the whole file as storage, with the data at offset
+static Tensor *npy_map(int fd, size_t file_size, size_t offset, TensorDtype dtype, size_t ndim,
+                       const size_t shape[]) {
+    void *mapping = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    TensorStorage *storage = (TensorStorage *)malloc(sizeof(TensorStorage));
+    storage->data = (Dtype *)((unsigned char *)mapping + offset);
+    atomic_init(&storage->refcount, 1);
+    storage->capacity = file_size;
+    storage->kind = TENSOR_STORAGE_MMAP;
+    storage->mapping = mapping;
+
+    Tensor *t = tensor_from_storage(storage, dtype, ndim, shape);
+    if (!t) {
+        munmap(mapping, file_size);
+        free(storage);
+    }
+    return t;
+}
+
+typedef struct {
+    size_t offset;   // Of the data in the file
+    TensorDtype dtype;
+    size_t itemsize; // 0 for dtypes tensors do not have
+    bool fortran;
+    size_t ndim;
+    size_t shape[TENSOR_MAX_DIMS];
+} NpyHeader;
+
+// Read and check the header of an open .npy file of file_size bytes
+static bool npy_read_header(int fd, size_t file_size, const char *path, NpyHeader *h) {
+    unsigned char prefix[12];
+    if (file_size < 12 || !read_fully(fd, prefix, 12, 0) ||
+        memcmp(prefix, NPY_MAGIC, NPY_MAGIC_SIZE) != 0 || prefix[6] < 1 || prefix[6] > 3) {
+        fprintf(stderr, "Error: %s is not a .npy file.\n", path);
+        return false;
+    }
+
+    // Version 1 has a 2-byte header length, later versions 4 bytes
+    size_t start = prefix[6] == 1 ? 10 : 12;
+    size_t header_len = prefix[8] | (size_t)prefix[9] << 8;
+    if (prefix[6] > 1) {
+        header_len |= (size_t)prefix[10] << 16 | (size_t)prefix[11] << 24;
+    }
+    h->offset = start + header_len;
+    if (h->offset > file_size) {
+        fprintf(stderr, "Error: %s is not a valid .npy file.\n", path);
+        return false;
+    }
+
+    char *header = (char *)malloc(header_len + 1);
+    bool ok = read_fully(fd, header, header_len, start);
+    header[ok ? header_len : 0] = '\0';
+
+    const char *descr = npy_value(header, "descr");
+    const char *fortran = npy_value(header, "fortran_order");
+    ok = ok && descr && fortran && npy_parse_shape(npy_value(header, "shape"), &h->ndim, h->shape);
+    if (ok) {
+        h->fortran = strncmp(fortran, "True", 4) == 0;
+        static const struct {
+            const char *descr;
+            TensorDtype dtype;
+        } dtypes[] = {{"'<f4'", TENSOR_F32}, {"'<f8'", TENSOR_F64}, {"'<f2'", TENSOR_F16}};
+        h->itemsize = 0;
+        for (size_t i = 0; i < sizeof(dtypes) / sizeof(dtypes[0]); i++) {
+            if (strncmp(descr, dtypes[i].descr, 5) == 0) {
+                h->dtype = dtypes[i].dtype;
+                h->itemsize = tensor_dtype_size(h->dtype);
+            }
+        }
+    }
+    free(header);
+
+    if (!ok) {
+        fprintf(stderr, "Error: %s is not a valid .npy file.\n", path);
+        return false;
+    }
+    if (h->itemsize == 0) {
+        fprintf(stderr, "Error: %s holds an unsupported dtype.\n", path);
+        return false;
+    }
+
+    // A crafted shape must not wrap around to a small size
+    size_t size = 1, bytes, end;
+    bool overflow = false;
+    for (size_t i = 0; i < h->ndim; i++) {
+        overflow |= __builtin_mul_overflow(size, h->shape[i], &size);
+    }
+    overflow |= __builtin_mul_overflow(size, h->itemsize, &bytes);
+    overflow |= __builtin_add_overflow(h->offset, bytes, &end);
+    if (overflow) {
+        fprintf(stderr, "Error: %s has an invalid shape.\n", path);
+        return false;
+    }
+    if (end > file_size) {
+        fprintf(stderr, "Error: %s is truncated.\n", path);
+        return false;
+    }
+    return true;
+}
+
+Tensor *tensor_load(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open %s.\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    NpyHeader h;
+    if (fstat(fd, &st) != 0 || !npy_read_header(fd, (size_t)st.st_size, path, &h)) {
+        close(fd);
+        return NULL;
+    }
+
+    // Fortran order is C order of the reversed shape, transposed back below
+    size_t file_shape[TENSOR_MAX_DIMS];
+    for (size_t i = 0; i < h.ndim; i++) {
+        file_shape[i] = h.fortran ? h.shape[h.ndim - 1 - i] : h.shape[i];
+    }
+
+    Tensor *t;
+    if (h.offset % h.itemsize == 0) {
+        t = npy_map(fd, (size_t)st.st_size, h.offset, h.dtype, h.ndim, file_shape);
+    } else {
+        t = npy_read(fd, h.offset, h.dtype, h.ndim, file_shape);
+    }
+    close(fd);
+
+    if (!t) {
+        fprintf(stderr, "Error: Failed to read %s.\n", path);
+        return NULL;
+    }
+    if (h.fortran && h.ndim > 1) {
+        Tensor *view = tensor_transpose(t);
+        tensor_free(t);
+        t = view;
+    }
+    return t;
+}
@@ -0,0 +1,23 @@
+#ifndef IO_H
+#define IO_H
+
+#include "tensor.h"
+
+// NumPy .npy files
+// tensor_save writes a version 1.0 file (C order) holding the logical
+// contents of t, which may be a view: '<f4', '<f8' or '<f2' by its dtype, and
+// '<f4' for bfloat16. The header is padded so that the data
+// starts 64-byte aligned. Returns false on I/O errors.
+//
+// tensor_load maps a little-endian '<f4', '<f8' or '<f2' file into memory and
+// wraps the mapping as the storage of a float32, float64 or float16 tensor
+// without copying: the load itself reads only the header, pages are read on
+// first access and shared with every other process mapping the same file.
+// The mapping is private, so writes to the tensor never reach the file.
+// Fortran-order files load as a transposed view. Files whose data is not
+// aligned to the element size are read into a regular tensor. Returns NULL
+// when the file cannot be read or holds another dtype.
+bool tensor_save(const Tensor *t, const char *path);
+Tensor *tensor_load(const char *path);
+
+#endif // IO_H
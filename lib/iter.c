@@ -0,0 +1,324 @@
+#include "iter.h"
+#include "kernels.h"
+#include <string.h>
+
+void iter_init_strided(TensorIter *it, size_t n_operands, Dtype *const base[],
+                       size_t ndim, const size_t shape[], const size_t *const strides[]) {
+    size_t nd = 0;
+
+    it->n_operands = n_operands;
+    it->started = false;
+    it->done = false;
+    for (size_t k = 0; k < n_operands; k++) {
+        it->base[k] = base[k];
+        it->offsets[k] = 0;
+    }
+
+    // Coalesce: drop dimensions of size 1 and merge a dimension into the one
+    // before it when, for every operand, stepping the outer one is the same as
+    // stepping the inner one past its end
+    for (size_t d = 0; d < ndim; d++) {
+        if (shape[d] == 0) {
+            it->done = true;
+        }
+        if (shape[d] == 1) {
+            continue;
+        }
+
+        bool merge = nd > 0;
+        for (size_t k = 0; merge && k < n_operands; k++) {
+            merge = it->strides[k][nd - 1] == strides[k][d] * shape[d];
+        }
+
+        if (merge) {
+            it->shape[nd - 1] *= shape[d];
+            for (size_t k = 0; k < n_operands; k++) {
+                it->strides[k][nd - 1] = strides[k][d];
+            }
+        } else {
+            it->shape[nd] = shape[d];
+            for (size_t k = 0; k < n_operands; k++) {
+                it->strides[k][nd] = strides[k][d];
+            }
+            nd++;
+        }
+    }
+
+    // The last remaining dimension is the run, the others are counted
+    it->offset = 0;
+    if (nd == 0) {
+        it->ndim = 0;
+        it->inner_size = 1;
+        for (size_t k = 0; k < n_operands; k++) {
+            it->inner_strides[k] = 0;
+        }
+    } else {
+        it->ndim = nd - 1;
+        it->inner_size = it->shape[nd - 1];
+        for (size_t k = 0; k < n_operands; k++) {
+            it->inner_strides[k] = it->strides[k][nd - 1];
+        }
+        for (size_t d = 0; d < it->ndim; d++) {
+            it->index[d] = 0;
+        }
+    }
+
+    it->run_size = it->inner_size;
+    it->size = 0;
+    if (!it->done) {
+        it->size = it->run_size;
+        for (size_t d = 0; d < it->ndim; d++) {
+            it->size *= it->shape[d];
+        }
+    }
+    it->left = it->size;
+}
+
+void iter_restrict(TensorIter *it, size_t begin, size_t end) {
+    it->left = end - begin;
+    if (it->done || begin >= end) {
+        it->done = true;
+        return;
+    }
+
+    // Move the counter and the offsets to the run holding begin
+    size_t run = begin / it->run_size;
+    it->offset = begin % it->run_size;
+    for (size_t d = it->ndim; d-- > 0;) {
+        it->index[d] = run % it->shape[d];
+        run /= it->shape[d];
+        for (size_t k = 0; k < it->n_operands; k++) {
+            it->offsets[k] += it->index[d] * it->strides[k][d];
+        }
+    }
+}
+
+void iter_init(TensorIter *it, size_t n_operands, const Tensor *const operands[]) {
+    Dtype *base[ITER_MAX_OPERANDS];
+    const size_t *strides[ITER_MAX_OPERANDS];
+
+    for (size_t k = 0; k < n_operands; k++) {
+        base[k] = operands[k]->dtype == TENSOR_F32 ? operands[k]->data : NULL;
+        strides[k] = operands[k]->strides;
+    }
+
+    iter_init_strided(it, n_operands, base, operands[0]->ndim, operands[0]->shape, strides);
+}
+
+bool iter_init_broadcast(TensorIter *it, size_t n_operands, const Tensor *const operands[],
+                         size_t ndim, const size_t shape[]) {
+    Dtype *base[ITER_MAX_OPERANDS];
+    size_t strides[ITER_MAX_OPERANDS][TENSOR_MAX_DIMS];
+    const size_t *stride_ptrs[ITER_MAX_OPERANDS];
+
+    for (size_t k = 0; k < n_operands; k++) {
+        const Tensor *t = operands[k];
+        if (t->ndim > ndim) {
+            return false;
+        }
+
+        // Missing leading dimensions and dimensions of size 1 repeat
+        size_t lead = ndim - t->ndim;
+        for (size_t d = 0; d < ndim; d++) {
+            if (d < lead) {
+                strides[k][d] = 0;
+            } else if (t->shape[d - lead] == shape[d]) {
+                strides[k][d] = t->strides[d - lead];
+            } else if (t->shape[d - lead] == 1) {
+                strides[k][d] = 0;
+            } else {
+                return false;
+            }
+        }
+
+        base[k] = t->dtype == TENSOR_F32 ? t->data : NULL;
+        stride_ptrs[k] = strides[k];
+    }
+
+    iter_init_strided(it, n_operands, base, ndim, shape, stride_ptrs);
+    return true;
+}
+
+static void iter_point(TensorIter *it) {
+    for (size_t k = 0; k < it->n_operands; k++) {
+        it->ptrs[k] = it->base[k] ? it->base[k] + it->offsets[k] : NULL;
+    }
+}
+
+bool iter_next(TensorIter *it) {
+    if (it->done) {
+        return false;
+    }
+
+    if (!it->started) {
+        it->started = true;
+        for (size_t k = 0; k < it->n_operands; k++) {
+            it->offsets[k] += it->offset * it->inner_strides[k];
+        }
+        it->inner_size = it->run_size - it->offset < it->left ? it->run_size - it->offset : it->left;
+        it->left -= it->inner_size;
+        iter_point(it);
+        return true;
+    }
+    if (it->left == 0) {
+        it->done = true;
+        return false;
+    }
+
+    // Later runs are whole, except where the restriction ends
+    for (size_t k = 0; k < it->n_operands; k++) {
+        it->offsets[k] -= it->offset * it->inner_strides[k];
+    }
+    it->offset = 0;
+    it->inner_size = it->run_size < it->left ? it->run_size : it->left;
+    it->left -= it->inner_size;
+
+    // Advance the counter over the outer dimensions, last one fastest
+    for (size_t d = it->ndim; d-- > 0;) {
+        if (++it->index[d] < it->shape[d]) {
+            for (size_t k = 0; k < it->n_operands; k++) {
+                it->offsets[k] += it->strides[k][d];
+            }
+            iter_point(it);
+            return true;
+        }
+
+        it->index[d] = 0;
+        for (size_t k = 0; k < it->n_operands; k++) {
+            it->offsets[k] -= it->strides[k][d] * (it->shape[d] - 1);
+        }
+    }
+
+    it->done = true;
+    return false;
+}
+
+// Runs are staged through small buffers of this many elements
+#define CONVERT_STAGE 256
+
+// One run of another dtype to float32, reading from src when it already is
+static const float *convert_load(const Kernels *k, size_t n, TensorDtype dtype, const void *src,
+                                 size_t ss, float *buffer) {
+    uint16_t half[CONVERT_STAGE];
+    switch (dtype) {
+    case TENSOR_F32:
+        if (ss == 1) {
+            return (const float *)src;
+        }
+        for (size_t i = 0; i < n; i++) {
+            buffer[i] = ((const float *)src)[i * ss];
+        }
+        break;
+    case TENSOR_F64:
+        for (size_t i = 0; i < n; i++) {
+            buffer[i] = (float)((const double *)src)[i * ss];
+        }
+        break;
+    default:
+        for (size_t i = 0; i < n; i++) {
+            half[i] = ((const uint16_t *)src)[i * ss];
+        }
+        (dtype == TENSOR_F16 ? k->f16_to_f32 : k->bf16_to_f32)(n, half, buffer);
+        break;
+    }
+    return buffer;
+}
+
+static void convert_store(const Kernels *k, size_t n, TensorDtype dtype, void *dst, size_t ds,
+                          const float *values) {
+    uint16_t half[CONVERT_STAGE];
+    switch (dtype) {
+    case TENSOR_F32:
+        for (size_t i = 0; i < n; i++) {
+            ((float *)dst)[i * ds] = values[i];
+        }
+        break;
+    case TENSOR_F64:
+        for (size_t i = 0; i < n; i++) {
+            ((double *)dst)[i * ds] = values[i];
+        }
+        break;
+    default:
+        if (ds == 1) {
+            (dtype == TENSOR_F16 ? k->f32_to_f16 : k->f32_to_bf16)(n, values, (uint16_t *)dst);
+            break;
+        }
+        (dtype == TENSOR_F16 ? k->f32_to_f16 : k->f32_to_bf16)(n, values, half);
+        for (size_t i = 0; i < n; i++) {
+            ((uint16_t *)dst)[i * ds] = half[i];
+        }
+        break;
+    }
+}
+
+void dtype_convert(size_t n, TensorDtype dst_dtype, void *dst, size_t ds, TensorDtype src_dtype,
+                   const void *src, size_t ss) {
+    size_t size = tensor_dtype_size(src_dtype);
+    if (dst_dtype == src_dtype) {
+        if (ds == 1 && ss == 1) {
+            memmove(dst, src, n * size);
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (size == sizeof(double)) {
+                ((double *)dst)[i * ds] = ((const double *)src)[i * ss];
+            } else if (size == sizeof(float)) {
+                ((float *)dst)[i * ds] = ((const float *)src)[i * ss];
+            } else {
+                ((uint16_t *)dst)[i * ds] = ((const uint16_t *)src)[i * ss];
+            }
+        }
+        return;
+    }
+    if (dst_dtype == TENSOR_F64 && src_dtype == TENSOR_F32) {
+        for (size_t i = 0; i < n; i++) {
+            ((double *)dst)[i * ds] = ((const float *)src)[i * ss];
+        }
+        return;
+    }
+
+    // Everything else goes through float32, which holds float16 and bfloat16
+    // exactly
+    const Kernels *k = kernels_get();
+    float buffer[CONVERT_STAGE];
+    size_t dst_size = tensor_dtype_size(dst_dtype);
+    for (size_t start = 0; start < n; start += CONVERT_STAGE) {
+        size_t len = n - start < CONVERT_STAGE ? n - start : CONVERT_STAGE;
+        const float *values = convert_load(
+            k, len, src_dtype, (const unsigned char *)src + start * ss * size, ss, buffer);
+        convert_store(k, len, dst_dtype, (unsigned char *)dst + start * ds * dst_size, ds, values);
+    }
+}
+
+bool broadcast_shapes(size_t n_operands, const Tensor *const operands[],
+                      size_t *ndim, size_t shape[]) {
+    size_t nd = 0;
+    for (size_t k = 0; k < n_operands; k++) {
+        if (operands[k]->ndim > nd) {
+            nd = operands[k]->ndim;
+        }
+    }
+    if (nd > TENSOR_MAX_DIMS) {
+        return false;
+    }
+
+    for (size_t d = 0; d < nd; d++) {
+        shape[d] = 1;
+    }
+
+    for (size_t k = 0; k < n_operands; k++) {
+        const Tensor *t = operands[k];
+        size_t lead = nd - t->ndim;
+        for (size_t d = 0; d < t->ndim; d++) {
+            size_t dim = t->shape[d];
+            if (shape[lead + d] == 1) {
+                shape[lead + d] = dim;
+            } else if (dim != 1 && dim != shape[lead + d]) {
+                return false;
+            }
+        }
+    }
+
+    *ndim = nd;
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef ITER_H
+#define ITER_H
+
+#include "tensor.h"
+
+#define ITER_MAX_OPERANDS 8
+
+// Walks several operands over a common shape in row-major logical order, one
+// run of the innermost dimension at a time:
+//
+//     TensorIter it;
+//     iter_init(&it, 2, (const Tensor *[]){out, in});
+//     while (iter_next(&it)) {
+//         // it.ptrs[k] is the start of the run of operand k, it.inner_size
+//         // its length and it.inner_strides[k] the step between elements
+//     }
+//
+// it.offsets[k] is the same position counted in elements from the first
+// element of operand k. Tensors of other dtypes than float32 are addressed
+// through it, their ptrs are NULL.
+//
+// Dimensions of size 1 are dropped and neighbouring dimensions that are laid
+// out back to back in every operand are merged, so contiguous operands are a
+// single run and e.g. a slice of whole rows is walked as one. A stride of 0
+// repeats an element, which is how broadcast operands are walked.
+typedef struct {
+    size_t n_operands;
+    size_t ndim; // Number of outer dimensions walked by the counter
+    size_t shape[TENSOR_MAX_DIMS];
+    size_t strides[ITER_MAX_OPERANDS][TENSOR_MAX_DIMS];
+    size_t index[TENSOR_MAX_DIMS];
+    Dtype *base[ITER_MAX_OPERANDS];
+
+    size_t inner_size;
+    size_t inner_strides[ITER_MAX_OPERANDS];
+    Dtype *ptrs[ITER_MAX_OPERANDS];
+    size_t offsets[ITER_MAX_OPERANDS];
+
+    size_t size;     // Elements in the whole walk
+    size_t run_size; // Length of a full run
+    size_t offset;   // Into the first run, set by iter_restrict
+    size_t left;     // Elements not yet handed out
+
+    bool started;
+    bool done;
+} TensorIter;
+
+// Operands given by their first element and strides over a common shape. A
+// NULL base walks the offsets only.
+void iter_init_strided(TensorIter *it, size_t n_operands, Dtype *const base[],
+                       size_t ndim, const size_t shape[], const size_t *const strides[]);
+// Tensors that all have the shape of the first one
+void iter_init(TensorIter *it, size_t n_operands, const Tensor *const operands[]);
+// Tensors broadcast to shape, false when one of them does not broadcast
+bool iter_init_broadcast(TensorIter *it, size_t n_operands, const Tensor *const operands[],
+                         size_t ndim, const size_t shape[]);
+bool iter_next(TensorIter *it);
+// Walk only the elements [begin, end) of the full walk, in the same order.
+// The first and last runs may then be shorter than inner_size after
+// iter_init. Call before the first iter_next. This is how a walk is split
+// between threads.
+void iter_restrict(TensorIter *it, size_t begin, size_t end);
+
+// Convert n elements from src, which steps ss elements at a time, to dst
+// stepping ds, e.g. a run of two iterator operands
+void dtype_convert(size_t n, TensorDtype dst_dtype, void *dst, size_t ds, TensorDtype src_dtype,
+                   const void *src, size_t ss);
+// Address of the element offset elements past the first one of t
+static inline void *tensor_element(const Tensor *t, size_t offset) {
+    return (unsigned char *)t->data + offset * tensor_dtype_size(t->dtype);
+}
+
+// NumPy broadcasting: shapes are aligned on their last dimension, and each
+// dimension must match or be 1. Returns false when the shapes do not broadcast.
+bool broadcast_shapes(size_t n_operands, const Tensor *const operands[],
+                      size_t *ndim, size_t shape[]);
+
+#endif // ITER_H
@@ -0,0 +1,868 @@
+#include "kernels.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// Portable versions, also used for the tails of the vector loops. Each
+// template is instantiated for float and, with the _f64 suffix, for double.
+
+#define SCALAR_BINARY(name, op, type, sfx)                                       \
+    static void scalar_##name##sfx(size_t n, const type *a, const type *b, type *out) { \
+        for (size_t i = 0; i < n; i++) {                                         \
+            out[i] = a[i] op b[i];                                               \
+        }                                                                        \
+    }
+
+#define SCALAR_SCALAR(name, op, type, sfx)                                       \
+    static void scalar_##name##_scalar##sfx(size_t n, const type *a, type s, type *out) { \
+        for (size_t i = 0; i < n; i++) {                                         \
+            out[i] = a[i] op s;                                                  \
+        }                                                                        \
+    }
+
+#define SCALAR_KERNELS(type, sfx)                                                \
+    SCALAR_BINARY(add, +, type, sfx)                                             \
+    SCALAR_BINARY(sub, -, type, sfx)                                             \
+    SCALAR_BINARY(mul, *, type, sfx)                                             \
+    SCALAR_BINARY(div, /, type, sfx)                                             \
+    SCALAR_SCALAR(add, +, type, sfx)                                             \
+    SCALAR_SCALAR(sub, -, type, sfx)                                             \
+    SCALAR_SCALAR(mul, *, type, sfx)                                             \
+    SCALAR_SCALAR(div, /, type, sfx)
+
+SCALAR_KERNELS(float, )
+SCALAR_KERNELS(double, _f64)
+
+// Transposes walk the matrix in square blocks small enough that the rows of
+// the block in src and the rows it becomes in dst all stay in L1. Inside a
+// block, w x w tiles are transposed by tile(), the edges element by element.
+#define TRANSPOSE_BLOCK 32
+
+#define BLOCKED_TRANSPOSE(name, attr, w, tile)                                   \
+    attr static void name(size_t rows, size_t cols, const float *src, size_t lds, \
+                          float *dst, size_t ldd) {                              \
+        for (size_t i0 = 0; i0 < rows; i0 += TRANSPOSE_BLOCK) {                  \
+            size_t i1 = rows - i0 < TRANSPOSE_BLOCK ? rows : i0 + TRANSPOSE_BLOCK; \
+            for (size_t j0 = 0; j0 < cols; j0 += TRANSPOSE_BLOCK) {              \
+                size_t j1 = cols - j0 < TRANSPOSE_BLOCK ? cols : j0 + TRANSPOSE_BLOCK; \
+                size_t i = i0;                                                   \
+                for (; i + w <= i1; i += w) {                                    \
+                    size_t j = j0;                                               \
+                    for (; j + w <= j1; j += w) {                                \
+                        tile(src + i * lds + j, lds, dst + j * ldd + i, ldd);    \
+                    }                                                            \
+                    for (; j < j1; j++) {                                        \
+                        for (size_t k = i; k < i + w; k++) {                     \
+                            dst[j * ldd + k] = src[k * lds + j];                 \
+                        }                                                        \
+                    }                                                            \
+                }                                                                \
+                for (; i < i1; i++) {                                            \
+                    for (size_t j = j0; j < j1; j++) {                           \
+                        dst[j * ldd + i] = src[i * lds + j];                     \
+                    }                                                            \
+                }                                                                \
+            }                                                                    \
+        }                                                                        \
+    }
+
+static inline void scalar_tile(const float *src, size_t lds, float *dst, size_t ldd) {
+    (void)lds;
+    (void)ldd;
+    *dst = *src;
+}
+
+BLOCKED_TRANSPOSE(scalar_transpose, , 1, scalar_tile)
+
+static double scalar_sum(size_t n, const float *a) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+static double scalar_sum_f64(size_t n, const double *a) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+// Half-precision conversions of one element. float16 has 5 exponent and 10
+// mantissa bits, bfloat16 is the upper half of a float32.
+
+static inline float f16_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | mantissa << 13;
+    } else if (exponent == 0) {
+        // Subnormal: mantissa * 2^-24
+        float f = (float)mantissa * 0x1p-24f;
+        return sign ? -f : f;
+    } else {
+        bits = sign | (exponent + 112) << 23 | mantissa << 13;
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline uint16_t float_to_f16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+    uint32_t abs = x & 0x7fffffff;
+
+    if (abs > 0x7f800000) {
+        return sign | 0x7e00 | ((abs >> 13) & 0x1ff);
+    }
+    if (abs >= 0x477ff000) {
+        // From 65520 on, halfway past the largest float16, rounds to infinity
+        return sign | 0x7c00;
+    }
+    if (abs < 0x38800000) {
+        // Below 2^-14 the result is subnormal, with a step of 2^-24: adding
+        // 0.5 lines the float32 mantissa up with it and lets the FPU round
+        float v, half = 0.5f;
+        uint32_t y, h;
+        memcpy(&v, &abs, sizeof(v));
+        v += half;
+        memcpy(&y, &v, sizeof(y));
+        memcpy(&h, &half, sizeof(h));
+        return sign | (uint16_t)(y - h);
+    }
+    // Rebias the exponent and round the 13 dropped bits to nearest even
+    abs += 0xc8000fffu + ((abs >> 13) & 1);
+    return sign | (uint16_t)(abs >> 13);
+}
+
+static inline float bf16_to_float(uint16_t h) {
+    uint32_t bits = (uint32_t)h << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline uint16_t float_to_bf16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7fffffff) > 0x7f800000) {
+        return (uint16_t)(x >> 16) | 0x40;
+    }
+    return (uint16_t)((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+}
+
+// Whole-array conversions, simple enough for the compiler to vectorize
+// under each target
+#define HALF_CONVERT(isa, attr, half)                                            \
+    attr static void isa##_##half##_to_f32(size_t n, const uint16_t *a, float *out) { \
+        for (size_t i = 0; i < n; i++) {                                         \
+            out[i] = half##_to_float(a[i]);                                      \
+        }                                                                        \
+    }                                                                            \
+    attr static void isa##_f32_to_##half(size_t n, const float *a, uint16_t *out) { \
+        for (size_t i = 0; i < n; i++) {                                         \
+            out[i] = float_to_##half(a[i]);                                      \
+        }                                                                        \
+    }
+
+HALF_CONVERT(scalar, , f16)
+HALF_CONVERT(scalar, , bf16)
+
+#define DOT4_I8(isa, attr)                                                       \
+    attr static void isa##_dot4_i8(size_t n, const int8_t *x, const int8_t *w, size_t ldw, \
+                                   int32_t out[4]) {                             \
+        for (size_t r = 0; r < 4; r++) {                                         \
+            int32_t acc = 0;                                                     \
+            for (size_t i = 0; i < n; i++) {                                     \
+                acc += x[i] * w[r * ldw + i];                                    \
+            }                                                                    \
+            out[r] = acc;                                                        \
+        }                                                                        \
+    }
+
+DOT4_I8(scalar, )
+
+// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2,
+// 3"): ten rounds of two 32 x 32 -> 64-bit multiplies, with the key bumped by
+// Weyl constants between rounds
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+static inline void philox_block(uint64_t counter, uint64_t key, uint32_t out[4]) {
+    uint32_t c0 = (uint32_t)counter, c1 = (uint32_t)(counter >> 32), c2 = 0, c3 = 0;
+    uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+    for (int r = 0; r < PHILOX_ROUNDS; r++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0, p1 = (uint64_t)PHILOX_M1 * c2;
+        c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t)p1;
+        c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+#define PHILOX(isa, attr)                                                        \
+    attr static void isa##_philox(size_t n, uint64_t counter, uint64_t key, uint32_t *out) { \
+        for (size_t i = 0; i < n; i++) {                                         \
+            philox_block(counter + i, key, out + 4 * i);                         \
+        }                                                                        \
+    }
+
+PHILOX(scalar, )
+
+// Box-Muller from pairs of random words, with polynomial approximations of
+// log, sin and cos (after Cephes) in place of the libm calls. The loop has no
+// branches or calls, so the compiler vectorizes it under each target, and
+// every version performs the same float operations and gives the same bits.
+// u = (w0 >> 8) + 1 over 2^24 lies in (0, 1], so the log is finite; the
+// angle is 2 pi k / 2^24 for k = w1 >> 8, reduced to the nearest quarter
+// turn j as an integer and a remainder in [-pi/4, pi/4].
+#define BM_SQRTHF 0.707106781186547524f
+
+static inline float bm_log(float u) {
+    uint32_t bits;
+    memcpy(&bits, &u, sizeof(bits));
+    int32_t e = (int32_t)(bits >> 23) - 126;
+    uint32_t mbits = (bits & 0x007fffffu) | 0x3f000000u; // Mantissa in [0.5, 1)
+    float m;
+    memcpy(&m, &mbits, sizeof(m));
+
+    bool low = m < BM_SQRTHF;
+    e -= low;
+    float x = low ? m + m - 1.0f : m - 1.0f;
+    float z = x * x;
+    float y = 7.0376836292e-2f;
+    y = y * x - 1.1514610310e-1f;
+    y = y * x + 1.1676998740e-1f;
+    y = y * x - 1.2420140846e-1f;
+    y = y * x + 1.4249322787e-1f;
+    y = y * x - 1.6668057665e-1f;
+    y = y * x + 2.0000714765e-1f;
+    y = y * x - 2.4999993993e-1f;
+    y = y * x + 3.3333331174e-1f;
+    y = y * x * z;
+    float fe = (float)e;
+    y += -2.12194440e-4f * fe;
+    y += -0.5f * z;
+    return x + y + 0.693359375f * fe;
+}
+
+#define BOX_MULLER(isa, attr)                                                    \
+    attr static void isa##_box_muller(size_t n, const uint32_t *words, float *out) { \
+        for (size_t i = 0; i < n; i++) {                                         \
+            float u = (float)((words[2 * i] >> 8) + 1) * 0x1p-24f;               \
+            float s2 = -2.0f * bm_log(u);                                        \
+            float r = sqrtf(s2 > 0.0f ? s2 : 0.0f);                              \
+                                                                                 \
+            int32_t k = (int32_t)(words[2 * i + 1] >> 8);                        \
+            int32_t j = (k + (1 << 21)) >> 22;                                   \
+            float a = (float)(k - (j << 22)) * (0x1p-22f * 1.57079632679489662f); \
+            float z = a * a;                                                     \
+            float sn = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z -         \
+                        1.6666654611e-1f) * z * a + a;                           \
+            float cs = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + \
+                        4.166664568298827e-2f) * z * z - 0.5f * z + 1.0f;        \
+                                                                                 \
+            /* (cos, sin) of j quarter turns plus a */                           \
+            float c = j & 1 ? sn : cs, s = j & 1 ? cs : sn;                      \
+            c = (j + 1) & 2 ? -c : c;                                            \
+            s = j & 2 ? -s : s;                                                  \
+            out[2 * i] = r * c;                                                  \
+            out[2 * i + 1] = r * s;                                              \
+        }                                                                        \
+    }
+
+BOX_MULLER(scalar, )
+
+// Combine the extrema found by the vector lanes with the elements from start
+// on. Lane l holds its smallest value lmin[l] at position limin[l], -1 when
+// it saw no value below infinity; likewise for the largest values.
+static void min_max_finish(size_t n, const float *a, size_t start, size_t lanes,
+                           const float *lmin, const int32_t *limin, const float *lmax,
+                           const int32_t *limax, float *min, size_t *argmin, float *max,
+                           size_t *argmax) {
+    float lo = INFINITY, hi = -INFINITY;
+    size_t arg_lo = n, arg_hi = n;
+
+    // Equal values in several lanes: the first position wins
+    for (size_t l = 0; l < lanes; l++) {
+        if (limin[l] >= 0 && (lmin[l] < lo || (lmin[l] == lo && (size_t)limin[l] < arg_lo))) {
+            lo = lmin[l];
+            arg_lo = (size_t)limin[l];
+        }
+        if (limax[l] >= 0 && (lmax[l] > hi || (lmax[l] == hi && (size_t)limax[l] < arg_hi))) {
+            hi = lmax[l];
+            arg_hi = (size_t)limax[l];
+        }
+    }
+    for (size_t i = start; i < n; i++) {
+        if (a[i] < lo) {
+            lo = a[i];
+            arg_lo = i;
+        }
+        if (a[i] > hi) {
+            hi = a[i];
+            arg_hi = i;
+        }
+    }
+
+    // Only infinities or NaNs left: the infinity itself is the extreme
+    for (size_t i = 0; arg_lo == n && i < n; i++) {
+        if (a[i] == INFINITY) {
+            arg_lo = i;
+        }
+    }
+    for (size_t i = 0; arg_hi == n && i < n; i++) {
+        if (a[i] == -INFINITY) {
+            arg_hi = i;
+        }
+    }
+
+    *min = arg_lo == n ? NAN : lo;
+    *max = arg_hi == n ? NAN : hi;
+    *argmin = arg_lo;
+    *argmax = arg_hi;
+}
+
+static void scalar_min_max(size_t n, const float *a, float *min, size_t *argmin, float *max,
+                           size_t *argmax) {
+    min_max_finish(n, a, 0, 0, NULL, NULL, NULL, NULL, min, argmin, max, argmax);
+}
+
+static const Kernels kernels_scalar = {
+    "scalar",
+    scalar_add, scalar_sub, scalar_mul, scalar_div,
+    scalar_add_scalar, scalar_sub_scalar, scalar_mul_scalar, scalar_div_scalar,
+    scalar_transpose, scalar_sum, scalar_min_max,
+    scalar_add_f64, scalar_sub_f64, scalar_mul_f64, scalar_div_f64,
+    scalar_add_scalar_f64, scalar_sub_scalar_f64, scalar_mul_scalar_f64, scalar_div_scalar_f64,
+    scalar_sum_f64,
+    scalar_f16_to_f32, scalar_f32_to_f16, scalar_bf16_to_f32, scalar_f32_to_bf16,
+    scalar_dot4_i8,
+    scalar_philox,
+    scalar_box_muller,
+};
+
+#ifdef KERNELS_X86
+
+// Vector versions. The main loop handles two vectors per iteration so loads
+// of the next pair overlap the arithmetic of the current one.
+
+#define SIMD_BINARY(isa, tgt, type, sfx, vec, width, loadu, storeu, vop, name, op) \
+    __attribute__((target(tgt))) static void isa##_##name##sfx(                  \
+        size_t n, const type *a, const type *b, type *out) {                     \
+        size_t i = 0;                                                            \
+        for (; i + 2 * width <= n; i += 2 * width) {                             \
+            vec x0 = loadu(a + i), x1 = loadu(a + i + width);                    \
+            vec y0 = loadu(b + i), y1 = loadu(b + i + width);                    \
+            storeu(out + i, vop(x0, y0));                                        \
+            storeu(out + i + width, vop(x1, y1));                                \
+        }                                                                        \
+        for (; i + width <= n; i += width) {                                     \
+            storeu(out + i, vop(loadu(a + i), loadu(b + i)));                    \
+        }                                                                        \
+        for (; i < n; i++) {                                                     \
+            out[i] = a[i] op b[i];                                               \
+        }                                                                        \
+    }
+
+#define SIMD_SCALAR(isa, tgt, type, sfx, vec, width, loadu, storeu, set1, vop, name, op) \
+    __attribute__((target(tgt))) static void isa##_##name##_scalar##sfx(         \
+        size_t n, const type *a, type s, type *out) {                            \
+        vec vs = set1(s);                                                        \
+        size_t i = 0;                                                            \
+        for (; i + 2 * width <= n; i += 2 * width) {                             \
+            vec x0 = loadu(a + i), x1 = loadu(a + i + width);                    \
+            storeu(out + i, vop(x0, vs));                                        \
+            storeu(out + i + width, vop(x1, vs));                                \
+        }                                                                        \
+        for (; i + width <= n; i += width) {                                     \
+            storeu(out + i, vop(loadu(a + i), vs));                              \
+        }                                                                        \
+        for (; i < n; i++) {                                                     \
+            out[i] = a[i] op s;                                                  \
+        }                                                                        \
+    }
+
+// The four binary and four scalar ops on one element type, whose intrinsics
+// end in sfx (_ps or _pd)
+#define SIMD_ELEMENTWISE(isa, tgt, type, sfx, vec, width, prefix, p)             \
+    SIMD_BINARY(isa, tgt, type, sfx, vec, width, prefix##_loadu_##p, prefix##_storeu_##p, prefix##_add_##p, add, +) \
+    SIMD_BINARY(isa, tgt, type, sfx, vec, width, prefix##_loadu_##p, prefix##_storeu_##p, prefix##_sub_##p, sub, -) \
+    SIMD_BINARY(isa, tgt, type, sfx, vec, width, prefix##_loadu_##p, prefix##_storeu_##p, prefix##_mul_##p, mul, *) \
+    SIMD_BINARY(isa, tgt, type, sfx, vec, width, prefix##_loadu_##p, prefix##_storeu_##p, prefix##_div_##p, div, /) \
+    SIMD_SCALAR(isa, tgt, type, sfx, vec, width, prefix##_loadu_##p, prefix##_storeu_##p, prefix##_set1_##p, prefix##_add_##p, add, +) \
+    SIMD_SCALAR(isa, tgt, type, sfx, vec, width, prefix##_loadu_##p, prefix##_storeu_##p, prefix##_set1_##p, prefix##_sub_##p, sub, -) \
+    SIMD_SCALAR(isa, tgt, type, sfx, vec, width, prefix##_loadu_##p, prefix##_storeu_##p, prefix##_set1_##p, prefix##_mul_##p, mul, *) \
+    SIMD_SCALAR(isa, tgt, type, sfx, vec, width, prefix##_loadu_##p, prefix##_storeu_##p, prefix##_set1_##p, prefix##_div_##p, div, /)
+
+#define SIMD_KERNELS(isa, tgt, vec, vecd, width, prefix)                         \
+    SIMD_ELEMENTWISE(isa, tgt, float, , vec, width, prefix, ps)                  \
+    SIMD_ELEMENTWISE(isa, tgt, double, _f64, vecd, width / 2, prefix, pd)        \
+    static const Kernels kernels_##isa = {                                       \
+        #isa,                                                                    \
+        isa##_add, isa##_sub, isa##_mul, isa##_div,                              \
+        isa##_add_scalar, isa##_sub_scalar, isa##_mul_scalar, isa##_div_scalar,  \
+        isa##_transpose, isa##_sum, isa##_min_max,                               \
+        isa##_add_f64, isa##_sub_f64, isa##_mul_f64, isa##_div_f64,              \
+        isa##_add_scalar_f64, isa##_sub_scalar_f64, isa##_mul_scalar_f64,        \
+        isa##_div_scalar_f64, isa##_sum_f64,                                     \
+        isa##_f16_to_f32, isa##_f32_to_f16, isa##_bf16_to_f32, isa##_f32_to_bf16, \
+        isa##_dot4_i8,                                                           \
+        isa##_philox,                                                            \
+        isa##_box_muller,                                                        \
+    };
+
+// In-register transposes of a 4 x 4 and an 8 x 8 tile: rows are loaded whole,
+// interleaved pairwise by unpack and shuffle, and stored as columns
+
+__attribute__((target("sse2"))) static inline void sse2_tile(const float *src, size_t lds,
+                                                             float *dst, size_t ldd) {
+    __m128 r0 = _mm_loadu_ps(src), r1 = _mm_loadu_ps(src + lds);
+    __m128 r2 = _mm_loadu_ps(src + 2 * lds), r3 = _mm_loadu_ps(src + 3 * lds);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(dst, r0);
+    _mm_storeu_ps(dst + ldd, r1);
+    _mm_storeu_ps(dst + 2 * ldd, r2);
+    _mm_storeu_ps(dst + 3 * ldd, r3);
+}
+
+__attribute__((target("avx2"))) static inline void avx2_tile(const float *src, size_t lds,
+                                                             float *dst, size_t ldd) {
+    __m256 r[8], t[8];
+    for (int k = 0; k < 8; k++) {
+        r[k] = _mm256_loadu_ps(src + k * lds);
+    }
+    // Pairs of rows interleaved: t0 = a0 b0 a1 b1 | a4 b4 a5 b5, ...
+    for (int k = 0; k < 8; k += 2) {
+        t[k] = _mm256_unpacklo_ps(r[k], r[k + 1]);
+        t[k + 1] = _mm256_unpackhi_ps(r[k], r[k + 1]);
+    }
+    // Quads: r0 = a0 b0 c0 d0 | a4 b4 c4 d4, ...
+    for (int k = 0; k < 8; k += 4) {
+        r[k] = _mm256_shuffle_ps(t[k], t[k + 2], _MM_SHUFFLE(1, 0, 1, 0));
+        r[k + 1] = _mm256_shuffle_ps(t[k], t[k + 2], _MM_SHUFFLE(3, 2, 3, 2));
+        r[k + 2] = _mm256_shuffle_ps(t[k + 1], t[k + 3], _MM_SHUFFLE(1, 0, 1, 0));
+        r[k + 3] = _mm256_shuffle_ps(t[k + 1], t[k + 3], _MM_SHUFFLE(3, 2, 3, 2));
+    }
+    // Lanes of the upper four rows joined to those of the lower four
+    for (int k = 0; k < 4; k++) {
+        _mm256_storeu_ps(dst + k * ldd, _mm256_permute2f128_ps(r[k], r[k + 4], 0x20));
+        _mm256_storeu_ps(dst + (k + 4) * ldd, _mm256_permute2f128_ps(r[k], r[k + 4], 0x31));
+    }
+}
+
+BLOCKED_TRANSPOSE(sse2_transpose, __attribute__((target("sse2"))), 4, sse2_tile)
+BLOCKED_TRANSPOSE(avx2_transpose, __attribute__((target("avx2"))), 8, avx2_tile)
+// The copy is bound by memory traffic, not shuffles: AVX-512 reuses the 8 x 8 tiles
+BLOCKED_TRANSPOSE(avx512_transpose, __attribute__((target("avx512f"))), 8, avx2_tile)
+
+// Sums convert to double and keep four vector accumulators, so consecutive
+// additions do not wait on each other
+
+__attribute__((target("sse2"))) static double sse2_sum(size_t n, const float *a) {
+    __m128d acc[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 x0 = _mm_loadu_ps(a + i), x1 = _mm_loadu_ps(a + i + 4);
+        acc[0] = _mm_add_pd(acc[0], _mm_cvtps_pd(x0));
+        acc[1] = _mm_add_pd(acc[1], _mm_cvtps_pd(_mm_movehl_ps(x0, x0)));
+        acc[2] = _mm_add_pd(acc[2], _mm_cvtps_pd(x1));
+        acc[3] = _mm_add_pd(acc[3], _mm_cvtps_pd(_mm_movehl_ps(x1, x1)));
+    }
+    __m128d v = _mm_add_pd(_mm_add_pd(acc[0], acc[1]), _mm_add_pd(acc[2], acc[3]));
+    double lanes[2];
+    _mm_storeu_pd(lanes, v);
+    return lanes[0] + lanes[1] + scalar_sum(n - i, a + i);
+}
+
+__attribute__((target("avx2"))) static double avx2_sum(size_t n, const float *a) {
+    __m256d acc[4] = {_mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd(),
+                      _mm256_setzero_pd()};
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        for (int k = 0; k < 4; k++) {
+            acc[k] = _mm256_add_pd(acc[k], _mm256_cvtps_pd(_mm_loadu_ps(a + i + 4 * k)));
+        }
+    }
+    __m256d v = _mm256_add_pd(_mm256_add_pd(acc[0], acc[1]), _mm256_add_pd(acc[2], acc[3]));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + scalar_sum(n - i, a + i);
+}
+
+__attribute__((target("avx512f"))) static double avx512_sum(size_t n, const float *a) {
+    __m512d acc[4] = {_mm512_setzero_pd(), _mm512_setzero_pd(), _mm512_setzero_pd(),
+                      _mm512_setzero_pd()};
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        for (int k = 0; k < 4; k++) {
+            acc[k] = _mm512_add_pd(acc[k], _mm512_cvtps_pd(_mm256_loadu_ps(a + i + 8 * k)));
+        }
+    }
+    __m512d v = _mm512_add_pd(_mm512_add_pd(acc[0], acc[1]), _mm512_add_pd(acc[2], acc[3]));
+    return _mm512_reduce_add_pd(v) + scalar_sum(n - i, a + i);
+}
+
+#define SIMD_SUM_F64(isa, tgt, vecd, width, prefix)                              \
+    __attribute__((target(tgt))) static double isa##_sum_f64(size_t n, const double *a) { \
+        vecd acc[4] = {prefix##_setzero_pd(), prefix##_setzero_pd(), prefix##_setzero_pd(), \
+                       prefix##_setzero_pd()};                                   \
+        size_t i = 0;                                                            \
+        for (; i + 4 * width <= n; i += 4 * width) {                             \
+            for (int k = 0; k < 4; k++) {                                        \
+                acc[k] = prefix##_add_pd(acc[k], prefix##_loadu_pd(a + i + k * width)); \
+            }                                                                    \
+        }                                                                        \
+        vecd v = prefix##_add_pd(prefix##_add_pd(acc[0], acc[1]),                \
+                                 prefix##_add_pd(acc[2], acc[3]));               \
+        double lanes[width], sum = 0;                                            \
+        prefix##_storeu_pd(lanes, v);                                            \
+        for (int l = 0; l < width; l++) {                                        \
+            sum += lanes[l];                                                     \
+        }                                                                        \
+        return sum + scalar_sum_f64(n - i, a + i);                               \
+    }
+
+SIMD_SUM_F64(sse2, "sse2", __m128d, 2, _mm)
+SIMD_SUM_F64(avx2, "avx2", __m256d, 4, _mm256)
+SIMD_SUM_F64(avx512, "avx512f", __m512d, 8, _mm512)
+
+// float16 goes through the F16C instructions from AVX2 on, bfloat16 is plain
+// integer work the compiler vectorizes
+HALF_CONVERT(sse2, __attribute__((target("sse2"))), f16)
+HALF_CONVERT(sse2, __attribute__((target("sse2"))), bf16)
+HALF_CONVERT(avx2, __attribute__((target("avx2"))), bf16)
+HALF_CONVERT(avx512, __attribute__((target("avx512f"))), bf16)
+
+__attribute__((target("avx2,f16c"))) static void avx2_f16_to_f32(size_t n, const uint16_t *a,
+                                                                 float *out) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(a + i))));
+    }
+    scalar_f16_to_f32(n - i, a + i, out + i);
+}
+
+__attribute__((target("avx2,f16c"))) static void avx2_f32_to_f16(size_t n, const float *a,
+                                                                 uint16_t *out) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(a + i),
+                                    _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128((__m128i *)(out + i), h);
+    }
+    scalar_f32_to_f16(n - i, a + i, out + i);
+}
+
+#define avx512_f16_to_f32 avx2_f16_to_f32
+#define avx512_f32_to_f16 avx2_f32_to_f16
+
+// int8 dot products multiply |x| by w carrying the sign of x, which is x * w
+// with the unsigned operand first, as maddubs and VNNI's vpdpbusd take them.
+// With both in [-127, 127] the pairwise sums of maddubs stay below 2^15.
+#define SIMD_DOT4_I8(isa, tgt, ivec, width, zero, load, abs8, sign8, dot, hsum)  \
+    __attribute__((target(tgt))) static void isa##_dot4_i8(                      \
+        size_t n, const int8_t *x, const int8_t *w, size_t ldw, int32_t out[4]) { \
+        ivec acc[4] = {zero(), zero(), zero(), zero()};                          \
+        size_t i = 0;                                                            \
+        for (; i + width <= n; i += width) {                                     \
+            ivec xv = load(x + i), xa = abs8(xv);                                \
+            for (size_t r = 0; r < 4; r++) {                                     \
+                acc[r] = dot(acc[r], xa, sign8(load(w + r * ldw + i), xv));      \
+            }                                                                    \
+        }                                                                        \
+        for (size_t r = 0; r < 4; r++) {                                         \
+            int32_t sum = hsum(acc[r]);                                          \
+            for (size_t j = i; j < n; j++) {                                     \
+                sum += x[j] * w[r * ldw + j];                                    \
+            }                                                                    \
+            out[r] = sum;                                                        \
+        }                                                                        \
+    }
+
+__attribute__((target("avx2"))) static inline int32_t avx2_hsum_epi32(__m256i v) {
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+#define AVX2_LOAD_I8(p) _mm256_loadu_si256((const __m256i *)(p))
+#define AVX2_DOT_I8(acc, a, b)                                                   \
+    _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), _mm256_set1_epi16(1)))
+#define AVXVNNI_DOT_I8(acc, a, b) _mm256_dpbusd_avx_epi32(acc, a, b)
+#define AVX512_LOAD_I8(p) _mm512_loadu_si512((const void *)(p))
+#define AVX512_SIGN_I8(w, x)                                                     \
+    _mm512_mask_sub_epi8(w, _mm512_movepi8_mask(x), _mm512_setzero_si512(), w)
+
+DOT4_I8(sse2, __attribute__((target("sse2"))))
+SIMD_DOT4_I8(avx2, "avx2", __m256i, 32, _mm256_setzero_si256, AVX2_LOAD_I8, _mm256_abs_epi8,
+             _mm256_sign_epi8, AVX2_DOT_I8, avx2_hsum_epi32)
+// Only AVX-512 F is required by the tier, the byte instructions are not
+#define avx512_dot4_i8 avx2_dot4_i8
+
+// The VNNI versions, swapped into the selected kernels when the CPU has them
+SIMD_DOT4_I8(avxvnni, "avx2,avxvnni", __m256i, 32, _mm256_setzero_si256, AVX2_LOAD_I8,
+             _mm256_abs_epi8, _mm256_sign_epi8, AVXVNNI_DOT_I8, avx2_hsum_epi32)
+SIMD_DOT4_I8(avx512vnni, "avx512f,avx512bw,avx512vnni", __m512i, 64, _mm512_setzero_si512,
+             AVX512_LOAD_I8, _mm512_abs_epi8, AVX512_SIGN_I8, _mm512_dpbusd_epi32,
+             _mm512_reduce_add_epi32)
+
+// Eight Philox blocks at a time, one per 32-bit lane. The multiplies take
+// the even lanes, so the odd ones are shifted down for a second multiply and
+// the halves of both products blended back into place.
+__attribute__((target("avx2"))) static inline __m256i avx2_mulhilo(__m256i c, __m256i m,
+                                                                  __m256i *hi) {
+    __m256i even = _mm256_mul_epu32(c, m);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(c, 32), m);
+    *hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+    return _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+}
+
+__attribute__((target("avx2"))) static void avx2_philox(size_t n, uint64_t counter,
+                                                        uint64_t key, uint32_t *out) {
+    const __m256i m0 = _mm256_set1_epi32((int)PHILOX_M0), m1 = _mm256_set1_epi32((int)PHILOX_M1);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t first = counter + i;
+        // Eight blocks whose high counter words differ go one at a time
+        if ((uint32_t)first > UINT32_MAX - 7) {
+            for (size_t b = 0; b < 8; b++) {
+                philox_block(first + b, key, out + 4 * (i + b));
+            }
+            continue;
+        }
+        __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32((int)(uint32_t)first), lanes);
+        __m256i c1 = _mm256_set1_epi32((int)(uint32_t)(first >> 32));
+        __m256i c2 = _mm256_setzero_si256(), c3 = _mm256_setzero_si256();
+        uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+        for (int r = 0; r < PHILOX_ROUNDS; r++) {
+            __m256i hi0, hi1;
+            __m256i lo0 = avx2_mulhilo(c0, m0, &hi0), lo1 = avx2_mulhilo(c2, m1, &hi1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32((int)k0));
+            c1 = lo1;
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32((int)k1));
+            c3 = lo0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+
+        // Lane b of c0..c3 is block b: transposed so blocks are stored whole
+        __m256i t0 = _mm256_unpacklo_epi32(c0, c1), t1 = _mm256_unpackhi_epi32(c0, c1);
+        __m256i t2 = _mm256_unpacklo_epi32(c2, c3), t3 = _mm256_unpackhi_epi32(c2, c3);
+        __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+        __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+        __m256i *o = (__m256i *)(out + 4 * i);
+        _mm256_storeu_si256(o, _mm256_permute2x128_si256(u0, u1, 0x20));
+        _mm256_storeu_si256(o + 1, _mm256_permute2x128_si256(u2, u3, 0x20));
+        _mm256_storeu_si256(o + 2, _mm256_permute2x128_si256(u0, u1, 0x31));
+        _mm256_storeu_si256(o + 3, _mm256_permute2x128_si256(u2, u3, 0x31));
+    }
+    for (; i < n; i++) {
+        philox_block(counter + i, key, out + 4 * i);
+    }
+}
+
+PHILOX(sse2, __attribute__((target("sse2"))))
+#define avx512_philox avx2_philox
+
+// AVX-512F has fused multiply-adds, which the compiler would contract the
+// polynomials into, changing the bits; that tier uses the AVX2 version
+BOX_MULLER(sse2, __attribute__((target("sse2"))))
+BOX_MULLER(avx2, __attribute__((target("avx2"))))
+#define avx512_box_muller avx2_box_muller
+
+// Fused extrema: every lane keeps its smallest and largest value and their
+// positions, replaced where a new element compares strictly smaller (larger),
+// so NaNs never enter and each lane keeps the first of equal values
+
+#define SIMD_MIN_MAX(isa, tgt, vec, ivec, width, loadu, set1, seti, addi, cmplt, cmpgt, blend, \
+                     storeu, loadi, storei)                                      \
+    __attribute__((target(tgt))) static void isa##_min_max(                      \
+        size_t n, const float *a, float *min, size_t *argmin, float *max, size_t *argmax) { \
+        vec lo = set1(INFINITY), hi = set1(-INFINITY);                           \
+        int32_t first[width];                                                    \
+        for (int l = 0; l < width; l++) {                                        \
+            first[l] = l;                                                        \
+        }                                                                        \
+        ivec arg_lo = seti(-1), arg_hi = seti(-1), step = seti(width);           \
+        ivec pos = loadi((const ivec *)first);                                   \
+        size_t i = 0;                                                            \
+        for (; i + width <= n; i += width) {                                     \
+            vec x = loadu(a + i);                                                \
+            vec lt = cmplt(x, lo), gt = cmpgt(x, hi);                            \
+            lo = blend(lo, x, lt);                                               \
+            hi = blend(hi, x, gt);                                               \
+            arg_lo = (ivec)blend((vec)arg_lo, (vec)pos, lt);                     \
+            arg_hi = (ivec)blend((vec)arg_hi, (vec)pos, gt);                     \
+            pos = addi(pos, step);                                               \
+        }                                                                        \
+        float lmin[width], lmax[width];                                          \
+        int32_t limin[width], limax[width];                                      \
+        storeu(lmin, lo);                                                        \
+        storeu(lmax, hi);                                                        \
+        storei((ivec *)limin, arg_lo);                                           \
+        storei((ivec *)limax, arg_hi);                                           \
+        min_max_finish(n, a, i, width, lmin, limin, lmax, limax, min, argmin, max, argmax); \
+    }
+
+#define SSE2_BLEND(a, b, mask) _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a))
+#define AVX_LT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define AVX_GT(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+
+SIMD_MIN_MAX(sse2, "sse2", __m128, __m128i, 4, _mm_loadu_ps, _mm_set1_ps, _mm_set1_epi32,
+             _mm_add_epi32, _mm_cmplt_ps, _mm_cmpgt_ps, SSE2_BLEND, _mm_storeu_ps,
+             _mm_loadu_si128, _mm_storeu_si128)
+SIMD_MIN_MAX(avx2, "avx2", __m256, __m256i, 8, _mm256_loadu_ps, _mm256_set1_ps,
+             _mm256_set1_epi32, _mm256_add_epi32, AVX_LT, AVX_GT, _mm256_blendv_ps,
+             _mm256_storeu_ps, _mm256_loadu_si256, _mm256_storeu_si256)
+// Bound by memory bandwidth already, AVX-512 reuses the AVX2 loop
+#define avx512_min_max avx2_min_max
+
+SIMD_KERNELS(sse2, "sse2", __m128, __m128d, 4, _mm)
+SIMD_KERNELS(avx2, "avx2", __m256, __m256d, 8, _mm256)
+SIMD_KERNELS(avx512, "avx512f", __m512, __m512d, 16, _mm512)
+
+static uint64_t read_xcr0(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Query CPUID for the instruction set, and XCR0 for whether the OS saves the
+// matching register state
+static bool cpu_supports(KernelIsa isa) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (isa == KERNEL_ISA_SCALAR) {
+        return true;
+    }
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    if (isa == KERNEL_ISA_SSE2) {
+        return (edx & bit_SSE2) != 0;
+    }
+
+    // AVX and later need YMM state (XCR0 bits 1-2) enabled by the OS. Their
+    // float16 conversions use F16C, which every AVX2 CPU has.
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX) || !(ecx & bit_F16C)) {
+        return false;
+    }
+    uint64_t xcr0 = read_xcr0();
+    if ((xcr0 & 0x6) != 0x6) {
+        return false;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    if (isa == KERNEL_ISA_AVX2) {
+        return (ebx & bit_AVX2) != 0;
+    }
+
+    // AVX-512 additionally needs opmask and ZMM state (XCR0 bits 5-7)
+    return isa == KERNEL_ISA_AVX512 && (ebx & bit_AVX512F) && (xcr0 & 0xe6) == 0xe6;
+}
+
+static const Kernels *const kernels_table[KERNEL_ISA_COUNT] = {
+    &kernels_scalar, &kernels_sse2, &kernels_avx2, &kernels_avx512,
+};
+
+// VNNI is not part of any tier: AVX-512 CPUs may lack it and AVX2 ones may
+// have it (as AVX-VNNI). The int8 dot product of a selected tier is upgraded
+// on its own.
+static kernel_dot4_i8_fn vnni_dot4_i8(KernelIsa isa) {
+    unsigned int eax, ebx, ecx, edx;
+    if (isa == KERNEL_ISA_AVX512 && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+        (ebx & bit_AVX512BW) && (ecx & bit_AVX512VNNI)) {
+        return avx512vnni_dot4_i8;
+    }
+    if (isa >= KERNEL_ISA_AVX2 && __get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx) &&
+        (eax & bit_AVXVNNI)) {
+        return avxvnni_dot4_i8;
+    }
+    return NULL;
+}
+
+#else
+
+static bool cpu_supports(KernelIsa isa) {
+    return isa == KERNEL_ISA_SCALAR;
+}
+
+static const Kernels *const kernels_table[KERNEL_ISA_COUNT] = {&kernels_scalar};
+
+static kernel_dot4_i8_fn vnni_dot4_i8(KernelIsa isa) {
+    (void)isa;
+    return NULL;
+}
+
+#endif // KERNELS_X86
+
+static const Kernels *kernels_selected = &kernels_scalar;
+static Kernels kernels_vnni; // The selected tier with the VNNI dot product
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void kernels_select(void) {
+    KernelIsa cap = KERNEL_ISA_COUNT - 1;
+    const char *env = getenv("MLC_KERNELS");
+
+    if (env) {
+        for (int isa = 0; isa < KERNEL_ISA_COUNT; isa++) {
+            if (kernels_table[isa] && strcmp(env, kernels_table[isa]->name) == 0) {
+                cap = (KernelIsa)isa;
+            }
+        }
+    }
+
+    for (int isa = cap; isa >= 0; isa--) {
+        const Kernels *k = kernels_for_isa((KernelIsa)isa);
+        if (k) {
+            kernels_selected = k;
+            kernel_dot4_i8_fn dot4_i8 = vnni_dot4_i8((KernelIsa)isa);
+            if (dot4_i8) {
+                kernels_vnni = *k;
+                kernels_vnni.dot4_i8 = dot4_i8;
+                kernels_selected = &kernels_vnni;
+            }
+            return;
+        }
+    }
+}
+
+const Kernels *kernels_for_isa(KernelIsa isa) {
+    if (isa >= KERNEL_ISA_COUNT || !kernels_table[isa] || !cpu_supports(isa)) {
+        return NULL;
+    }
+    return kernels_table[isa];
+}
+
+const Kernels *kernels_get(void) {
+    pthread_once(&kernels_once, kernels_select);
+    return kernels_selected;
+}
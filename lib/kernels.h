@@ -0,0 +1,102 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Vectorized loops over contiguous float arrays. Every op has a portable
+// scalar version and SSE2 / AVX2 / AVX-512 versions; the best one supported
+// by the running CPU is picked once, on first use. The element-wise ops and
+// the sum also come in double versions, generated from the same templates.
+
+// out[i] = a[i] op b[i]
+typedef void (*kernel_binary_fn)(size_t n, const float *a, const float *b, float *out);
+// out[i] = a[i] op scalar
+typedef void (*kernel_scalar_fn)(size_t n, const float *a, float scalar, float *out);
+// dst[j * ldd + i] = src[i * lds + j] for i < rows and j < cols, i.e. dst is
+// the transpose of the rows x cols matrix src. The two must not overlap.
+typedef void (*kernel_transpose_fn)(size_t rows, size_t cols, const float *src, size_t lds,
+                                    float *dst, size_t ldd);
+// Sum of a[0..n) accumulated in double, which keeps the relative error near
+// n * 2^-53 where a float accumulator loses n * 2^-24
+typedef double (*kernel_sum_fn)(size_t n, const float *a);
+// Smallest and largest element of a[0..n) and the first position of each in
+// one pass, skipping NaNs. When all elements are NaN the values are NaN and
+// the positions n. n must be below 2^31.
+typedef void (*kernel_min_max_fn)(size_t n, const float *a, float *min, size_t *argmin,
+                                  float *max, size_t *argmax);
+
+typedef void (*kernel_binary_f64_fn)(size_t n, const double *a, const double *b, double *out);
+typedef void (*kernel_scalar_f64_fn)(size_t n, const double *a, double scalar, double *out);
+typedef double (*kernel_sum_f64_fn)(size_t n, const double *a);
+
+// float16 and bfloat16 bit patterns to float32, which is exact, and back,
+// rounding to nearest even. NaNs stay NaNs and come out quiet.
+typedef void (*kernel_widen_fn)(size_t n, const uint16_t *a, float *out);
+typedef void (*kernel_narrow_fn)(size_t n, const float *a, uint16_t *out);
+
+// out[r] = sum of x[i] * w[r * ldw + i] over i < n, for the four rows r of w,
+// accumulated in int32. Elements must lie in [-127, 127] and n below 2^17, so
+// that nothing overflows. On CPUs with VNNI the selected kernels use its
+// int8 dot product instruction, whatever the tier.
+typedef void (*kernel_dot4_i8_fn)(size_t n, const int8_t *x, const int8_t *w, size_t ldw,
+                                  int32_t out[4]);
+
+// Philox4x32-10 random words: out[4 i .. 4 i + 4) is the block of the 128-bit
+// counter (counter + i, 0) under the 64-bit key, for i < n. Every version
+// gives the same bits.
+typedef void (*kernel_philox_fn)(size_t n, uint64_t counter, uint64_t key, uint32_t *out);
+
+// Standard normal pairs by Box-Muller: words 2 i and 2 i + 1 give out[2 i]
+// and out[2 i + 1], the cosine and sine sides, for i < n. Every version gives
+// the same bits.
+typedef void (*kernel_box_muller_fn)(size_t n, const uint32_t *words, float *out);
+
+typedef enum {
+    KERNEL_ISA_SCALAR,
+    KERNEL_ISA_SSE2,
+    KERNEL_ISA_AVX2,
+    KERNEL_ISA_AVX512,
+    KERNEL_ISA_COUNT
+} KernelIsa;
+
+typedef struct {
+    const char *name;
+    kernel_binary_fn add;
+    kernel_binary_fn sub;
+    kernel_binary_fn mul;
+    kernel_binary_fn div;
+    kernel_scalar_fn add_scalar;
+    kernel_scalar_fn sub_scalar;
+    kernel_scalar_fn mul_scalar;
+    kernel_scalar_fn div_scalar;
+    kernel_transpose_fn transpose;
+    kernel_sum_fn sum;
+    kernel_min_max_fn min_max;
+    kernel_binary_f64_fn add_f64;
+    kernel_binary_f64_fn sub_f64;
+    kernel_binary_f64_fn mul_f64;
+    kernel_binary_f64_fn div_f64;
+    kernel_scalar_f64_fn add_scalar_f64;
+    kernel_scalar_f64_fn sub_scalar_f64;
+    kernel_scalar_f64_fn mul_scalar_f64;
+    kernel_scalar_f64_fn div_scalar_f64;
+    kernel_sum_f64_fn sum_f64;
+    kernel_widen_fn f16_to_f32;
+    kernel_narrow_fn f32_to_f16;
+    kernel_widen_fn bf16_to_f32;
+    kernel_narrow_fn f32_to_bf16;
+    kernel_dot4_i8_fn dot4_i8;
+    kernel_philox_fn philox;
+    kernel_box_muller_fn box_muller;
+} Kernels;
+
+// Kernels for the best instruction set of this CPU. The MLC_KERNELS
+// environment variable (scalar, sse2, avx2, avx512) caps the choice.
+const Kernels *kernels_get(void);
+
+// Kernels for a specific instruction set, or NULL when the CPU or the
+// compiler does not support it
+const Kernels *kernels_for_isa(KernelIsa isa);
+
+#endif // KERNELS_H
@@ -1,159 +1,607 @@
 #include "la.h"
+#include "gemm.h"
+#include "iter.h"
+#include "kernels.h"
+#include "parallel.h"
 #include "tensor.h"
 #include <math.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
-// Scalar Operations
-// These operate on a tensor and a single number
-Tensor *tensor_add_scalar(const Tensor *a, float scalar) {
-    Tensor *result = tensor_copy(a);
+// Check that a caller-provided output tensor has the expected shape
+static bool check_output(const Tensor *out, size_t ndim, const size_t *shape) {
+    bool ok = out->ndim == ndim;
+    for (size_t i = 0; ok && i < ndim; i++) {
+        ok = out->shape[i] == shape[i];
+    }
 
-    for (size_t i = 0; i < result->size; i++) {
-        result->data[i] += scalar;
+    if (!ok) {
+        fprintf(stderr, "Error: Output tensor has the wrong shape.\n");
     }
+    return ok;
+}
 
-    return result;
+// Check that the operands of an element-wise operation share one dtype
+static bool check_dtypes(size_t n, const Tensor *const tensors[]) {
+    for (size_t i = 1; i < n; i++) {
+        if (tensors[i]->dtype != tensors[0]->dtype) {
+            fprintf(stderr, "Error: Tensors must have the same dtype.\n");
+            return false;
+        }
+    }
+    return true;
 }
 
-Tensor *tensor_subtract_scalar(const Tensor *a, float scalar) {
-    return tensor_add_scalar(a, -scalar);
+// Operations other than the element-wise ones and whole-tensor reductions
+// need float32 tensors
+static bool check_f32(size_t n, const Tensor *const tensors[]) {
+    for (size_t i = 0; i < n; i++) {
+        if (tensors[i]->dtype != TENSOR_F32) {
+            fprintf(stderr, "Error: Operation needs float32 tensors, got %s.\n",
+                    tensor_dtype_name(tensors[i]->dtype));
+            return false;
+        }
+    }
+    return true;
 }
 
-Tensor *tensor_multiply_scalar(const Tensor *a, float scalar) {
-    Tensor *result = tensor_copy(a);
+// Kernels work on contiguous arrays; strided runs are staged through small
+// contiguous buffers of this many elements
+#define STAGE_SIZE 256
+
+// An element-wise op: its tensor-tensor kernel, and the tensor-scalar kernel
+// used when the second operand is broadcast along a whole run, for float and
+// double
+typedef struct {
+    kernel_binary_fn binary;
+    kernel_scalar_fn scalar;
+    kernel_binary_f64_fn binary_f64;
+    kernel_scalar_f64_fn scalar_f64;
+} BinaryKernels;
+
+// The runs of one element type, instantiated for float and double
+#define ELEMENTWISE_RUNS(type, sfx)                                              \
+    static void scalar_run##sfx(kernel_scalar##sfx##_fn kernel, size_t n, type *out, size_t so, \
+                                const type *a, size_t sa, type scalar) {         \
+        if (so == 1 && sa == 1) {                                                \
+            kernel(n, a, scalar, out);                                           \
+            return;                                                              \
+        }                                                                        \
+                                                                                 \
+        type ta[STAGE_SIZE], to[STAGE_SIZE];                                     \
+        for (size_t start = 0; start < n; start += STAGE_SIZE) {                 \
+            size_t len = n - start < STAGE_SIZE ? n - start : STAGE_SIZE;        \
+            for (size_t i = 0; i < len; i++) {                                   \
+                ta[i] = a[(start + i) * sa];                                     \
+            }                                                                    \
+            kernel(len, ta, scalar, to);                                         \
+            for (size_t i = 0; i < len; i++) {                                   \
+                out[(start + i) * so] = to[i];                                   \
+            }                                                                    \
+        }                                                                        \
+    }                                                                            \
+                                                                                 \
+    static void binary_run##sfx(kernel_binary##sfx##_fn binary, kernel_scalar##sfx##_fn scalar, \
+                                size_t n, type *out, size_t so, const type *a, size_t sa, \
+                                const type *b, size_t sb) {                      \
+        if (so == 1 && sa == 1 && sb == 1) {                                     \
+            binary(n, a, b, out);                                                \
+            return;                                                              \
+        }                                                                        \
+        if (so == 1 && sa == 1 && sb == 0) {                                     \
+            scalar(n, a, b[0], out);                                             \
+            return;                                                              \
+        }                                                                        \
+                                                                                 \
+        type ta[STAGE_SIZE], tb[STAGE_SIZE], to[STAGE_SIZE];                     \
+        for (size_t start = 0; start < n; start += STAGE_SIZE) {                 \
+            size_t len = n - start < STAGE_SIZE ? n - start : STAGE_SIZE;        \
+            for (size_t i = 0; i < len; i++) {                                   \
+                ta[i] = a[(start + i) * sa];                                     \
+                tb[i] = b[(start + i) * sb];                                     \
+            }                                                                    \
+            binary(len, ta, tb, to);                                             \
+            for (size_t i = 0; i < len; i++) {                                   \
+                out[(start + i) * so] = to[i];                                   \
+            }                                                                    \
+        }                                                                        \
+    }
 
-    for (size_t i = 0; i < result->size; i++) {
-        result->data[i] *= scalar;
+ELEMENTWISE_RUNS(float, )
+ELEMENTWISE_RUNS(double, _f64)
+
+// Element-wise walks are split over the thread pool by element ranges; each
+// piece walks its own copy of the iterator
+typedef struct {
+    TensorIter it;
+    const Tensor *operands[3]; // out, a and for binary ops b
+    TensorDtype dtype;
+    BinaryKernels op;
+    kernel_scalar_fn scalar_kernel;
+    kernel_scalar_f64_fn scalar_kernel_f64;
+    float scalar;
+} ElementwiseJob;
+
+// float16 and bfloat16 runs are converted to float32 a stage at a time and
+// rounded back
+static void half_run(const ElementwiseJob *job, const TensorIter *it, bool binary) {
+    TensorDtype dtype = job->dtype;
+    const size_t *strides = it->inner_strides;
+    float ta[STAGE_SIZE], tb[STAGE_SIZE], to[STAGE_SIZE];
+    for (size_t start = 0; start < it->inner_size; start += STAGE_SIZE) {
+        size_t len = it->inner_size - start < STAGE_SIZE ? it->inner_size - start : STAGE_SIZE;
+        const Tensor *a = job->operands[1], *b = job->operands[2];
+        dtype_convert(len, TENSOR_F32, ta, 1, dtype,
+                      tensor_element(a, it->offsets[1] + start * strides[1]), strides[1]);
+        if (binary) {
+            dtype_convert(len, TENSOR_F32, tb, 1, dtype,
+                          tensor_element(b, it->offsets[2] + start * strides[2]), strides[2]);
+            job->op.binary(len, ta, tb, to);
+        } else {
+            job->scalar_kernel(len, ta, job->scalar, to);
+        }
+        dtype_convert(len, dtype, tensor_element(job->operands[0], it->offsets[0] + start * strides[0]),
+                      strides[0], TENSOR_F32, to, 1);
     }
+}
 
-    return result;
+static void scalar_range(void *arg, size_t begin, size_t end) {
+    const ElementwiseJob *job = (const ElementwiseJob *)arg;
+    TensorIter it = job->it;
+    iter_restrict(&it, begin, end);
+    while (iter_next(&it)) {
+        if (job->dtype == TENSOR_F32) {
+            scalar_run(job->scalar_kernel, it.inner_size, it.ptrs[0], it.inner_strides[0],
+                       it.ptrs[1], it.inner_strides[1], job->scalar);
+        } else if (job->dtype == TENSOR_F64) {
+            scalar_run_f64(job->scalar_kernel_f64, it.inner_size,
+                           job->operands[0]->data_f64 + it.offsets[0], it.inner_strides[0],
+                           job->operands[1]->data_f64 + it.offsets[1], it.inner_strides[1],
+                           job->scalar);
+        } else {
+            half_run(job, &it, false);
+        }
+    }
 }
 
-Tensor *tensor_divide_scalar(const Tensor *a, float scalar) {
-    return tensor_multiply_scalar(a, 1.0 / scalar);
+static void binary_range(void *arg, size_t begin, size_t end) {
+    const ElementwiseJob *job = (const ElementwiseJob *)arg;
+    const BinaryKernels *op = &job->op;
+    TensorIter it = job->it;
+    iter_restrict(&it, begin, end);
+    while (iter_next(&it)) {
+        if (job->dtype == TENSOR_F32) {
+            binary_run(op->binary, op->scalar, it.inner_size, it.ptrs[0], it.inner_strides[0],
+                       it.ptrs[1], it.inner_strides[1], it.ptrs[2], it.inner_strides[2]);
+        } else if (job->dtype == TENSOR_F64) {
+            binary_run_f64(op->binary_f64, op->scalar_f64, it.inner_size,
+                           job->operands[0]->data_f64 + it.offsets[0], it.inner_strides[0],
+                           job->operands[1]->data_f64 + it.offsets[1], it.inner_strides[1],
+                           job->operands[2]->data_f64 + it.offsets[2], it.inner_strides[2]);
+        } else {
+            half_run(job, &it, true);
+        }
+    }
 }
 
-// Add two tensors
-Tensor *tensor_add(const Tensor *t1, const Tensor *t2) {
-    // Check if the tensors have the same number of dimensions
-    if (t1->ndim != t2->ndim) {
-        fprintf(stderr,
-                "Error: Tensors must have the same number of dimensions.\n");
+// Scalar Operations
+// These operate on a tensor and a single number
+static Tensor *scalar_op_into(Tensor *out, const Tensor *a, float scalar,
+                              kernel_scalar_fn kernel, kernel_scalar_f64_fn kernel_f64) {
+    if (!check_output(out, a->ndim, a->shape) || !check_dtypes(2, (const Tensor *[]){out, a})) {
         return NULL;
     }
 
-    // Check if the shapes match
-    for (size_t i = 0; i < t1->ndim; i++) {
-        if (t1->shape[i] != t2->shape[i]) {
-            fprintf(stderr, "Error: Tensors must have the same shape.\n");
-            return NULL;
-        }
+    ElementwiseJob job = {.operands = {out, a},
+                          .dtype = a->dtype,
+                          .scalar_kernel = kernel,
+                          .scalar_kernel_f64 = kernel_f64,
+                          .scalar = scalar};
+    iter_init(&job.it, 2, (const Tensor *[]){out, a});
+    parallel_for_grain(job.it.size, PARALLEL_GRAIN, scalar_range, &job);
+    return out;
+}
+
+Tensor *tensor_add_scalar_into(Tensor *out, const Tensor *a, float scalar) {
+    const Kernels *k = kernels_get();
+    return scalar_op_into(out, a, scalar, k->add_scalar, k->add_scalar_f64);
+}
+
+Tensor *tensor_subtract_scalar_into(Tensor *out, const Tensor *a, float scalar) {
+    const Kernels *k = kernels_get();
+    return scalar_op_into(out, a, scalar, k->sub_scalar, k->sub_scalar_f64);
+}
+
+Tensor *tensor_multiply_scalar_into(Tensor *out, const Tensor *a, float scalar) {
+    const Kernels *k = kernels_get();
+    return scalar_op_into(out, a, scalar, k->mul_scalar, k->mul_scalar_f64);
+}
+
+Tensor *tensor_divide_scalar_into(Tensor *out, const Tensor *a, float scalar) {
+    const Kernels *k = kernels_get();
+    return scalar_op_into(out, a, scalar, k->div_scalar, k->div_scalar_f64);
+}
+
+Tensor *tensor_add_scalar(const Tensor *a, float scalar) {
+    return tensor_add_scalar_into(tensor_create_typed(a->dtype, a->ndim, a->shape), a, scalar);
+}
+
+Tensor *tensor_subtract_scalar(const Tensor *a, float scalar) {
+    return tensor_subtract_scalar_into(tensor_create_typed(a->dtype, a->ndim, a->shape), a, scalar);
+}
+
+Tensor *tensor_multiply_scalar(const Tensor *a, float scalar) {
+    return tensor_multiply_scalar_into(tensor_create_typed(a->dtype, a->ndim, a->shape), a, scalar);
+}
+
+Tensor *tensor_divide_scalar(const Tensor *a, float scalar) {
+    return tensor_divide_scalar_into(tensor_create_typed(a->dtype, a->ndim, a->shape), a, scalar);
+}
+
+// Element-wise Operations
+// Shapes are broadcast NumPy style, e.g. a [n, d] tensor and a [d] bias row
+// or a [n, 1] column of per-row values
+static bool broadcast_result_shape(const Tensor *t1, const Tensor *t2,
+                                   size_t *ndim, size_t shape[]) {
+    if (!broadcast_shapes(2, (const Tensor *[]){t1, t2}, ndim, shape)) {
+        fprintf(stderr, "Error: Tensor shapes cannot be broadcast together.\n");
+        return false;
     }
+    return true;
+}
 
-    // Create a new tensor to store the result
-    Tensor *result = tensor_create_from_shape(t1->ndim, t1->shape);
-    // Perform element-wise addition
-    for (size_t i = 0; i < result->size; i++) {
-        result->data[i] = t1->data[i] + t2->data[i];
+static Tensor *elementwise_op_into(Tensor *out, const Tensor *t1, const Tensor *t2,
+                                   BinaryKernels op) {
+    size_t ndim, shape[TENSOR_MAX_DIMS];
+    if (!broadcast_result_shape(t1, t2, &ndim, shape) || !check_output(out, ndim, shape) ||
+        !check_dtypes(3, (const Tensor *[]){out, t1, t2})) {
+        return NULL;
     }
 
+    ElementwiseJob job = {.operands = {out, t1, t2}, .dtype = t1->dtype, .op = op};
+    iter_init_broadcast(&job.it, 3, (const Tensor *[]){out, t1, t2}, ndim, shape);
+    parallel_for_grain(job.it.size, PARALLEL_GRAIN, binary_range, &job);
+    return out;
+}
+
+// Run an element-wise op into a new tensor of the broadcast shape
+static Tensor *elementwise_op(const Tensor *t1, const Tensor *t2,
+                              Tensor *(*op_into)(Tensor *, const Tensor *, const Tensor *)) {
+    size_t ndim, shape[TENSOR_MAX_DIMS];
+    if (!broadcast_result_shape(t1, t2, &ndim, shape)) {
+        return NULL;
+    }
+    Tensor *out = tensor_create_typed(t1->dtype, ndim, shape);
+    Tensor *result = op_into(out, t1, t2);
+    if (!result) {
+        tensor_free(out);
+    }
     return result;
 }
 
+Tensor *tensor_add_into(Tensor *out, const Tensor *t1, const Tensor *t2) {
+    const Kernels *k = kernels_get();
+    return elementwise_op_into(out, t1, t2,
+                               (BinaryKernels){k->add, k->add_scalar, k->add_f64, k->add_scalar_f64});
+}
+
+Tensor *tensor_subtract_into(Tensor *out, const Tensor *t1, const Tensor *t2) {
+    const Kernels *k = kernels_get();
+    return elementwise_op_into(out, t1, t2,
+                               (BinaryKernels){k->sub, k->sub_scalar, k->sub_f64, k->sub_scalar_f64});
+}
+
+Tensor *tensor_multiply_into(Tensor *out, const Tensor *t1, const Tensor *t2) {
+    const Kernels *k = kernels_get();
+    return elementwise_op_into(out, t1, t2,
+                               (BinaryKernels){k->mul, k->mul_scalar, k->mul_f64, k->mul_scalar_f64});
+}
+
+Tensor *tensor_divide_into(Tensor *out, const Tensor *t1, const Tensor *t2) {
+    const Kernels *k = kernels_get();
+    return elementwise_op_into(out, t1, t2,
+                               (BinaryKernels){k->div, k->div_scalar, k->div_f64, k->div_scalar_f64});
+}
+
+Tensor *tensor_add(const Tensor *t1, const Tensor *t2) {
+    return elementwise_op(t1, t2, tensor_add_into);
+}
+
 Tensor *tensor_subtract(const Tensor *t1, const Tensor *t2) {
-    return tensor_add(t1, tensor_multiply_scalar(t2, -1));
+    return elementwise_op(t1, t2, tensor_subtract_into);
 }
 
 Tensor *tensor_multiply(const Tensor *t1, const Tensor *t2) {
-    // Check if the tensors have the same number of dimensions
-    if (t1->ndim != t2->ndim) {
-        fprintf(stderr,
-                "Error: Tensors must have the same number of dimensions.\n");
-        return NULL;
+    return elementwise_op(t1, t2, tensor_multiply_into);
+}
+
+Tensor *tensor_divide(const Tensor *t1, const Tensor *t2) {
+    return elementwise_op(t1, t2, tensor_divide_into);
+}
+
+// Matrix Multiplication
+// Tensors of more than two dimensions are stacks of matrices in their last
+// two. The leading batch dimensions broadcast NumPy style, so [r, n, d] times
+// [d, k] multiplies each of the r matrices by the same [d, k] one. Batches of
+// products too small for gemm_sgemm to split are spread over the threads a
+// product each; larger products run one after the other on all threads.
+
+typedef struct {
+    size_t m, n, k;
+    size_t ndim; // Batch dimensions
+    size_t shape[TENSOR_MAX_DIMS];
+    size_t count; // Products in the batch
+} MatmulShape;
+
+// Check that op(t1) op(t2) is defined and find its shape, where op(t) is t,
+// or t transposed when its flag is set
+static bool matmul_check(const Tensor *t1, bool trans1, const Tensor *t2, bool trans2,
+                         MatmulShape *s) {
+    if (!check_f32(2, (const Tensor *[]){t1, t2})) {
+        return false;
     }
 
-    // Check if the shapes match
-    for (size_t i = 0; i < t1->ndim; i++) {
-        if (t1->shape[i] != t2->shape[i]) {
-            fprintf(stderr, "Error: Tensors must have the same shape.\n");
-            return NULL;
+    // Check if the tensors have the correct number of dimensions
+    if (t1->ndim < 2 || t2->ndim < 2) {
+        fprintf(stderr, "Error: Tensors must have at least 2 dimensions for matrix "
+                        "multiplication.\n");
+        return false;
+    }
+
+    // Check if the shapes are compatible for matrix multiplication
+    const size_t *s1 = t1->shape + t1->ndim - 2, *s2 = t2->shape + t2->ndim - 2;
+    if (s1[trans1 ? 0 : 1] != s2[trans2 ? 1 : 0]) {
+        fprintf(stderr,
+                "Error: Incompatible shapes for matrix multiplication.\n");
+        return false;
+    }
+    s->m = s1[trans1 ? 1 : 0];
+    s->k = s1[trans1 ? 0 : 1];
+    s->n = s2[trans2 ? 0 : 1];
+
+    // Batch dimensions, aligned on the last one
+    size_t nb1 = t1->ndim - 2, nb2 = t2->ndim - 2;
+    s->ndim = nb1 > nb2 ? nb1 : nb2;
+    s->count = 1;
+    for (size_t d = 0; d < s->ndim; d++) {
+        size_t dim1 = d + nb1 >= s->ndim ? t1->shape[d + nb1 - s->ndim] : 1;
+        size_t dim2 = d + nb2 >= s->ndim ? t2->shape[d + nb2 - s->ndim] : 1;
+        if (dim1 != dim2 && dim1 != 1 && dim2 != 1) {
+            fprintf(stderr, "Error: Batch dimensions cannot be broadcast together.\n");
+            return false;
         }
+        s->shape[d] = dim1 == 1 ? dim2 : dim1;
+        s->count *= s->shape[d];
     }
+    return true;
+}
 
-    // Create a new tensor to store the result
-    Tensor *result = tensor_create_from_shape(t1->ndim, t1->shape);
-    // Perform element-wise multiplication
-    for (size_t i = 0; i < result->size; i++) {
-        result->data[i] = t1->data[i] * t2->data[i];
+// Stride of each batch dimension of t, 0 where it is broadcast
+static void batch_strides(const Tensor *t, const MatmulShape *s, size_t strides[]) {
+    size_t nb = t->ndim - 2;
+    for (size_t d = 0; d < s->ndim; d++) {
+        bool own = d + nb >= s->ndim && t->shape[d + nb - s->ndim] != 1;
+        strides[d] = own ? t->strides[d + nb - s->ndim] : 0;
     }
+}
 
-    return result;
+typedef struct {
+    const MatmulShape *shape;
+    size_t strides[3][TENSOR_MAX_DIMS]; // Batch strides of out, a and b
+    Tensor *out;
+    const Tensor *a, *b;
+    size_t rsa, csa, rsb, csb;
+    float alpha, beta;
+} MatmulJob;
+
+static void matmul_range(void *arg, size_t begin, size_t end) {
+    const MatmulJob *job = (const MatmulJob *)arg;
+    const MatmulShape *s = job->shape;
+    for (size_t i = begin; i < end; i++) {
+        size_t offsets[3] = {0, 0, 0};
+        for (size_t d = s->ndim, rest = i; d-- > 0; rest /= s->shape[d]) {
+            for (size_t t = 0; t < 3; t++) {
+                offsets[t] += rest % s->shape[d] * job->strides[t][d];
+            }
+        }
+        Tensor *out = job->out;
+        gemm_sgemm(s->m, s->n, s->k, job->alpha, job->a->data + offsets[1], job->rsa, job->csa,
+                   job->b->data + offsets[2], job->rsb, job->csb, job->beta,
+                   out->data + offsets[0], out->strides[out->ndim - 2],
+                   out->strides[out->ndim - 1]);
+    }
 }
 
-Tensor *tensor_divide(const Tensor *t1, const Tensor *t2) {
-    // Check if the tensors have the same number of dimensions
-    if (t1->ndim != t2->ndim) {
-        fprintf(stderr,
-                "Error: Tensors must have the same number of dimensions.\n");
+Tensor *tensor_gemm(Tensor *out, const Tensor *a, const Tensor *b, bool trans_a, bool trans_b,
+                    float alpha, float beta) {
+    MatmulShape s;
+    if (!matmul_check(a, trans_a, b, trans_b, &s)) {
         return NULL;
     }
 
-    // Check if the shapes match
-    for (size_t i = 0; i < t1->ndim; i++) {
-        if (t1->shape[i] != t2->shape[i]) {
-            fprintf(stderr, "Error: Tensors must have the same shape.\n");
-            return NULL;
-        }
+    size_t shape[TENSOR_MAX_DIMS];
+    memcpy(shape, s.shape, s.ndim * sizeof(size_t));
+    shape[s.ndim] = s.m;
+    shape[s.ndim + 1] = s.n;
+    if (!check_output(out, s.ndim + 2, shape) || !check_f32(1, (const Tensor *[]){out})) {
+        return NULL;
     }
 
-    // Create a new tensor to store the result
-    Tensor *result = tensor_create_from_shape(t1->ndim, t1->shape);
-    // Perform element-wise division
-    for (size_t i = 0; i < result->size; i++) {
-        result->data[i] = t1->data[i] / t2->data[i];
+    // The output is written block by block while the inputs are still read
+    if (out->storage == a->storage || out->storage == b->storage) {
+        fprintf(stderr, "Error: Output of matrix multiplication must not "
+                        "alias an input.\n");
+        return NULL;
     }
 
-    return result;
+    // The blocked GEMM engine reads any strided operand directly; a
+    // transposed operand is the same data with its strides swapped
+    const size_t *sa = a->strides + a->ndim - 2, *sb = b->strides + b->ndim - 2;
+    MatmulJob job = {.shape = &s, .out = out, .a = a, .b = b,
+                     .rsa = sa[trans_a ? 1 : 0], .csa = sa[trans_a ? 0 : 1],
+                     .rsb = sb[trans_b ? 1 : 0], .csb = sb[trans_b ? 0 : 1],
+                     .alpha = alpha, .beta = beta};
+    batch_strides(out, &s, job.strides[0]);
+    batch_strides(a, &s, job.strides[1]);
+    batch_strides(b, &s, job.strides[2]);
+
+    size_t volume = s.m * s.n * s.k;
+    if (s.count > 1 && volume < GEMM_PARALLEL_VOLUME) {
+        parallel_for_grain(s.count, GEMM_PARALLEL_VOLUME / (volume + 1) + 1, matmul_range, &job);
+    } else {
+        matmul_range(&job, 0, s.count);
+    }
+    return out;
+}
+
+Tensor *tensor_matmul_into(Tensor *out, const Tensor *t1, const Tensor *t2) {
+    return tensor_gemm(out, t1, t2, false, false, 1.0f, 0.0f);
 }
 
-// Matrix Multiplication
 Tensor *tensor_matmul(const Tensor *t1, const Tensor *t2) {
-    // Check if the tensors have the correct number of dimensions
-    if (t1->ndim > 2 || t2->ndim > 2) {
-        fprintf(stderr, "Error: Tensors must have 2 dimensions for matrix "
-                        "multiplication.\n");
+    MatmulShape s;
+    if (!matmul_check(t1, false, t2, false, &s)) {
         return NULL;
     }
 
-    // Check if the shapes are compatible for matrix multiplication
-    if (t1->shape[1] != t2->shape[0]) {
-        fprintf(stderr,
-                "Error: Incompatible shapes for matrix multiplication.\n");
+    // Create a new tensor to store the result
+    size_t shape[TENSOR_MAX_DIMS];
+    memcpy(shape, s.shape, s.ndim * sizeof(size_t));
+    shape[s.ndim] = s.m;
+    shape[s.ndim + 1] = s.n;
+    return tensor_matmul_into(tensor_create_from_shape(s.ndim + 2, shape), t1, t2);
+}
+
+// Gram Matrix
+// X^T X through the symmetric rank-k kernel: only the lower triangle is
+// computed, reading X in place, and then mirrored
+
+// Rows summed in float before being added to the double accumulator
+#define GRAM_DOUBLE_ROWS 4096
+
+static Tensor *gram_into(Tensor *out, const Tensor *x, bool accumulate_double) {
+    if (!check_f32(2, (const Tensor *[]){out, x})) {
+        return NULL;
+    }
+    if (x->ndim != 2) {
+        fprintf(stderr, "Error: Tensor must have 2 dimensions for a Gram matrix.\n");
         return NULL;
     }
 
-    // Create a new tensor to store the result
-    size_t shape[] = {t1->shape[0], t2->shape[1]};
-    Tensor *result = tensor_create_from_shape(2, shape);
-
-    // Perform matrix multiplication
-    for (size_t i = 0; i < t1->shape[0]; i++) {
-        for (size_t j = 0; j < t2->shape[1]; j++) {
-            result->data[i * result->shape[1] + j] = 0;
-            for (size_t k = 0; k < t1->shape[1]; k++) {
-                result->data[i * result->shape[1] + j] +=
-                    t1->data[i * t1->shape[1] + k] *
-                    t2->data[k * t2->shape[1] + j];
+    size_t n = x->shape[0], d = x->shape[1];
+    size_t shape[] = {d, d};
+    if (!check_output(out, 2, shape)) {
+        return NULL;
+    }
+    if (out->storage == x->storage) {
+        fprintf(stderr, "Error: Output of a Gram matrix must not alias its input.\n");
+        return NULL;
+    }
+
+    // X^T is X with its strides swapped
+    size_t rs = x->strides[0], cs = x->strides[1];
+    size_t ro = out->strides[0], co = out->strides[1];
+    if (!accumulate_double) {
+        gemm_ssyrk(d, n, 1.0f, x->data, cs, rs, 0.0f, out->data, ro, co);
+    } else {
+        // Blocks of rows are reduced in float, the blocks are summed in double
+        double *acc = (double *)calloc(d * d, sizeof(double));
+        if (!acc) {
+            fprintf(stderr, "Error: Cannot allocate a %zu x %zu Gram matrix.\n", d, d);
+            return NULL;
+        }
+        for (size_t start = 0; start < n; start += GRAM_DOUBLE_ROWS) {
+            size_t m = n - start < GRAM_DOUBLE_ROWS ? n - start : GRAM_DOUBLE_ROWS;
+            gemm_ssyrk(d, m, 1.0f, x->data + start * rs, cs, rs, 0.0f, out->data, ro, co);
+            for (size_t i = 0; i < d; i++) {
+                for (size_t j = 0; j <= i; j++) {
+                    acc[i * d + j] += out->data[i * ro + j * co];
+                }
+            }
+        }
+        for (size_t i = 0; i < d; i++) {
+            for (size_t j = 0; j <= i; j++) {
+                out->data[i * ro + j * co] = (Dtype)acc[i * d + j];
             }
         }
+        free(acc);
     }
 
-    return result;
+    for (size_t i = 0; i < d; i++) {
+        for (size_t j = 0; j < i; j++) {
+            out->data[j * ro + i * co] = out->data[i * ro + j * co];
+        }
+    }
+    return out;
+}
+
+Tensor *tensor_gram_into(Tensor *out, const Tensor *x) {
+    return gram_into(out, x, false);
+}
+
+Tensor *tensor_gram_double_into(Tensor *out, const Tensor *x) {
+    return gram_into(out, x, true);
+}
+
+Tensor *tensor_gram(const Tensor *x) {
+    if (!check_f32(1, &x)) {
+        return NULL;
+    }
+    if (x->ndim != 2) {
+        fprintf(stderr, "Error: Tensor must have 2 dimensions for a Gram matrix.\n");
+        return NULL;
+    }
+    size_t shape[] = {x->shape[1], x->shape[1]};
+    return tensor_gram_into(tensor_create_from_shape(2, shape), x);
+}
+
+Tensor *tensor_gram_double(const Tensor *x) {
+    if (!check_f32(1, &x)) {
+        return NULL;
+    }
+    if (x->ndim != 2) {
+        fprintf(stderr, "Error: Tensor must have 2 dimensions for a Gram matrix.\n");
+        return NULL;
+    }
+    size_t shape[] = {x->shape[1], x->shape[1]};
+    Tensor *out = tensor_create_from_shape(2, shape);
+    if (!tensor_gram_double_into(out, x)) {
+        tensor_free(out);
+        return NULL;
+    }
+    return out;
 }
 
 // Dot Product
+typedef struct {
+    const Dtype *a;
+    size_t sa;
+    const Dtype *b;
+    size_t sb;
+} DotJob;
+
+static double dot_block(void *arg, size_t begin, size_t end) {
+    const DotJob *job = (const DotJob *)arg;
+    double acc[4] = {0, 0, 0, 0};
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        for (size_t l = 0; l < 4; l++) {
+            acc[l] += (double)job->a[(i + l) * job->sa] * job->b[(i + l) * job->sb];
+        }
+    }
+    for (; i < end; i++) {
+        acc[0] += (double)job->a[i * job->sa] * job->b[i * job->sb];
+    }
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
 float tensor_dot(const Tensor *t1, const Tensor *t2) {
+    if (!check_f32(2, (const Tensor *[]){t1, t2})) {
+        exit(EXIT_FAILURE);
+    }
+
     // Check if the tensors have the correct number of dimensions
     if (t1->ndim != 1 || t2->ndim != 1) {
         fprintf(stderr, "Error: Tensors must have 1 dimension for dot "
@@ -167,16 +615,17 @@ float tensor_dot(const Tensor *t1, const Tensor *t2) {
         exit(EXIT_FAILURE);
     }
 
-    // Perform dot product
-    float dot_product = 0;
-    for (size_t i = 0; i < t1->shape[0]; i++) {
-        dot_product += t1->data[i] * t2->data[i];
-    }
-
-    return dot_product;
+    // Fixed blocks accumulated in double, so the result is the same for any
+    // number of threads
+    DotJob job = {t1->data, t1->strides[0], t2->data, t2->strides[0]};
+    return (float)parallel_reduce(t1->shape[0], PARALLEL_GRAIN, dot_block, &job);
 }
 
 Tensor *tensor_cross(const Tensor *t1, const Tensor *t2) {
+    if (!check_f32(2, (const Tensor *[]){t1, t2})) {
+        return NULL;
+    }
+
     // Check if the tensors have the correct number of dimensions
     if (t1->ndim != 1 || t2->ndim != 1) {
         fprintf(stderr, "Error: Tensors must have 1 dimension for cross "
@@ -196,16 +645,18 @@ Tensor *tensor_cross(const Tensor *t1, const Tensor *t2) {
     Tensor *result = tensor_create_from_shape(1, shape);
 
     // Perform cross product
-    result->data[0] = t1->data[1] * t2->data[2] - t1->data[2] * t2->data[1];
-    result->data[1] = t1->data[2] * t2->data[0] - t1->data[0] * t2->data[2];
-    result->data[2] = t1->data[0] * t2->data[1] - t1->data[1] * t2->data[0];
+    size_t s1 = t1->strides[0], s2 = t2->strides[0];
+    const Dtype *a = t1->data, *b = t2->data;
+    result->data[0] = a[s1] * b[2 * s2] - a[2 * s1] * b[s2];
+    result->data[1] = a[2 * s1] * b[0] - a[0] * b[2 * s2];
+    result->data[2] = a[0] * b[s2] - a[s1] * b[0];
 
     return result;
 }
 
 Tensor *tensor_inverse(const Tensor *t) {
     // Check for valid input (must be 2D square matrix)
-    if (!t || t->ndim != 2 || t->shape[0] != t->shape[1]) {
+    if (!t || t->ndim != 2 || t->shape[0] != t->shape[1] || !check_f32(1, &t)) {
         return NULL;
     }
 
@@ -221,7 +672,7 @@ Tensor *tensor_inverse(const Tensor *t) {
     for (size_t i = 0; i < n; i++) {
         for (size_t j = 0; j < n; j++) {
             // Copy original matrix to left half
-            augmented->data[i * (2 * n) + j] = t->data[i * n + j];
+            augmented->data[i * (2 * n) + j] = t->data[i * t->strides[0] + j * t->strides[1]];
             // Put identity matrix in right half
             augmented->data[i * (2 * n) + (j + n)] = (i == j) ? 1.0f : 0.0f;
         }
@@ -277,13 +728,14 @@ Tensor *tensor_inverse(const Tensor *t) {
 
 // Helper function to check if a matrix is invertible
 bool tensor_is_invertible(const Tensor *t) {
-    if (!t || t->ndim != 2 || t->shape[0] != t->shape[1]) {
+    if (!t || t->ndim != 2 || t->shape[0] != t->shape[1] || !check_f32(1, &t)) {
         return false;
     }
 
     // For 2x2 matrices, check determinant
     if (t->shape[0] == 2) {
-        float det = t->data[0] * t->data[3] - t->data[1] * t->data[2];
+        size_t r = t->strides[0], c = t->strides[1];
+        float det = t->data[0] * t->data[r + c] - t->data[c] * t->data[r];
         return fabsf(det) > 1e-10f;
     }
 
@@ -296,123 +748,1017 @@ bool tensor_is_invertible(const Tensor *t) {
     return true;
 }
 
-// Sum of all elements in a tensor
-Dtype tensor_sum(const Tensor *t) {
-    Dtype sum = 0;
-    for (size_t i = 0; i < t->size; i++) {
-        sum += t->data[i];
+// Linear Solvers
+// Factorizations work on a contiguous copy of the n x n matrix and solve for
+// the r columns of the right-hand side in place
+
+// Rows and columns per block of the Cholesky factorization
+#define CHOLESKY_BLOCK 64
+
+// Unblocked lower Cholesky of the n x n matrix at a with row stride lda. Only
+// the lower triangle is read. False when the matrix is not positive definite.
+static bool cholesky_unblocked(size_t n, Dtype *a, size_t lda) {
+    for (size_t j = 0; j < n; j++) {
+        Dtype *row_j = a + j * lda;
+        Dtype d = row_j[j];
+        for (size_t p = 0; p < j; p++) {
+            d -= row_j[p] * row_j[p];
+        }
+        if (!(d > 0)) {
+            return false;
+        }
+        row_j[j] = sqrtf(d);
+
+        for (size_t i = j + 1; i < n; i++) {
+            Dtype *row_i = a + i * lda;
+            Dtype s = row_i[j];
+            for (size_t p = 0; p < j; p++) {
+                s -= row_i[p] * row_j[p];
+            }
+            row_i[j] = s / row_j[j];
+        }
+    }
+    return true;
+}
+
+// Right-looking blocked Cholesky A = L L^T of a contiguous n x n matrix, L
+// overwriting the lower triangle. The trailing update is a GEMM per block
+// row that stops at the diagonal, so the upper triangle is never computed.
+static bool cholesky_factor(size_t n, Dtype *a) {
+    for (size_t k = 0; k < n; k += CHOLESKY_BLOCK) {
+        size_t nb = n - k < CHOLESKY_BLOCK ? n - k : CHOLESKY_BLOCK;
+        Dtype *akk = a + k * n + k;
+        if (!cholesky_unblocked(nb, akk, n)) {
+            return false;
+        }
+
+        // Panel below the diagonal block: L21 = A21 L11^-T
+        for (size_t i = k + nb; i < n; i++) {
+            Dtype *row = a + i * n + k;
+            for (size_t j = 0; j < nb; j++) {
+                const Dtype *lj = akk + j * n;
+                Dtype s = row[j];
+                for (size_t p = 0; p < j; p++) {
+                    s -= row[p] * lj[p];
+                }
+                row[j] = s / lj[j];
+            }
+        }
+
+        // A22 -= L21 L21^T, lower triangle only
+        size_t t = k + nb;
+        for (size_t i = t; i < n; i += CHOLESKY_BLOCK) {
+            size_t mb = n - i < CHOLESKY_BLOCK ? n - i : CHOLESKY_BLOCK;
+            gemm_sgemm(mb, i + mb - t, nb, -1.0f, a + i * n + k, n, 1,
+                       a + t * n + k, 1, n, 1.0f, a + i * n + t, n, 1);
+        }
+    }
+    return true;
+}
+
+// Solve L L^T X = B for the n x r matrix b in place
+static void cholesky_solve(size_t n, const Dtype *l, size_t r, Dtype *b) {
+    // L Y = B
+    for (size_t i = 0; i < n; i++) {
+        Dtype *bi = b + i * r;
+        for (size_t j = 0; j < i; j++) {
+            Dtype lij = l[i * n + j];
+            const Dtype *bj = b + j * r;
+            for (size_t c = 0; c < r; c++) {
+                bi[c] -= lij * bj[c];
+            }
+        }
+        for (size_t c = 0; c < r; c++) {
+            bi[c] /= l[i * n + i];
+        }
+    }
+
+    // L^T X = Y, walking the rows of L rather than its columns
+    for (size_t i = n; i-- > 0;) {
+        Dtype *bi = b + i * r;
+        for (size_t c = 0; c < r; c++) {
+            bi[c] /= l[i * n + i];
+        }
+        for (size_t j = 0; j < i; j++) {
+            Dtype lij = l[i * n + j];
+            Dtype *bj = b + j * r;
+            for (size_t c = 0; c < r; c++) {
+                bj[c] -= lij * bi[c];
+            }
+        }
+    }
+}
+
+// Gaussian elimination with partial pivoting on a contiguous n x n matrix,
+// applied to the n x r matrix b alongside. False when a is singular.
+static bool lu_solve(size_t n, Dtype *a, size_t r, Dtype *b) {
+    for (size_t k = 0; k < n; k++) {
+        size_t p = k;
+        for (size_t i = k + 1; i < n; i++) {
+            if (fabsf(a[i * n + k]) > fabsf(a[p * n + k])) {
+                p = i;
+            }
+        }
+        if (fabsf(a[p * n + k]) < 1e-10f) {
+            return false;
+        }
+
+        if (p != k) {
+            for (size_t j = 0; j < n; j++) {
+                Dtype tmp = a[k * n + j];
+                a[k * n + j] = a[p * n + j];
+                a[p * n + j] = tmp;
+            }
+            for (size_t c = 0; c < r; c++) {
+                Dtype tmp = b[k * r + c];
+                b[k * r + c] = b[p * r + c];
+                b[p * r + c] = tmp;
+            }
+        }
+
+        for (size_t i = k + 1; i < n; i++) {
+            Dtype f = a[i * n + k] / a[k * n + k];
+            for (size_t j = k + 1; j < n; j++) {
+                a[i * n + j] -= f * a[k * n + j];
+            }
+            for (size_t c = 0; c < r; c++) {
+                b[i * r + c] -= f * b[k * r + c];
+            }
+        }
+    }
+
+    for (size_t i = n; i-- > 0;) {
+        Dtype *bi = b + i * r;
+        for (size_t j = i + 1; j < n; j++) {
+            Dtype aij = a[i * n + j];
+            for (size_t c = 0; c < r; c++) {
+                bi[c] -= aij * b[j * r + c];
+            }
+        }
+        for (size_t c = 0; c < r; c++) {
+            bi[c] /= a[i * n + i];
+        }
+    }
+    return true;
+}
+
+static bool solve_check(const Tensor *a, const Tensor *b) {
+    if (!check_f32(2, (const Tensor *[]){a, b})) {
+        return false;
+    }
+    if (a->ndim != 2 || a->shape[0] != a->shape[1]) {
+        fprintf(stderr, "Error: Matrix must be square.\n");
+        return false;
+    }
+    if ((b->ndim != 1 && b->ndim != 2) || b->shape[0] != a->shape[0]) {
+        fprintf(stderr, "Error: Incompatible shapes for solve.\n");
+        return false;
+    }
+    return true;
+}
+
+static Tensor *solve_into(Tensor *out, const Tensor *a, const Tensor *b, bool symmetric) {
+    if (!solve_check(a, b) || !check_output(out, b->ndim, b->shape) ||
+        !check_f32(1, (const Tensor *[]){out})) {
+        return NULL;
+    }
+
+    size_t n = a->shape[0];
+    size_t r = b->ndim == 2 ? b->shape[1] : 1;
+    Tensor *m = tensor_copy(a);
+    Tensor *x = tensor_copy(b);
+
+    bool solved = false;
+    if (symmetric && cholesky_factor(n, m->data)) {
+        cholesky_solve(n, m->data, r, x->data);
+        solved = true;
+    } else {
+        // Not positive definite: start over from the lower triangle of a,
+        // mirrored, with pivoting
+        if (symmetric) {
+            tensor_copy_into(m, a);
+            for (size_t i = 0; i < n; i++) {
+                for (size_t j = 0; j < i; j++) {
+                    m->data[j * n + i] = m->data[i * n + j];
+                }
+            }
+        }
+        solved = lu_solve(n, m->data, r, x->data);
+    }
+
+    if (solved) {
+        tensor_copy_into(out, x);
     }
+    tensor_free(m);
+    tensor_free(x);
+    return solved ? out : NULL;
+}
+
+Tensor *tensor_solve_into(Tensor *out, const Tensor *a, const Tensor *b) {
+    return solve_into(out, a, b, false);
+}
+
+Tensor *tensor_solve_symmetric_into(Tensor *out, const Tensor *a, const Tensor *b) {
+    return solve_into(out, a, b, true);
+}
+
+Tensor *tensor_solve(const Tensor *a, const Tensor *b) {
+    Tensor *out = tensor_create_from_shape(b->ndim, b->shape);
+    if (!tensor_solve_into(out, a, b)) {
+        tensor_free(out);
+        return NULL;
+    }
+    return out;
+}
+
+Tensor *tensor_solve_symmetric(const Tensor *a, const Tensor *b) {
+    Tensor *out = tensor_create_from_shape(b->ndim, b->shape);
+    if (!tensor_solve_symmetric_into(out, a, b)) {
+        tensor_free(out);
+        return NULL;
+    }
+    return out;
+}
+
+// Lower triangular L with L L^T = t, NULL when t is not positive definite
+Tensor *tensor_cholesky(const Tensor *t) {
+    if (!t || t->ndim != 2 || t->shape[0] != t->shape[1] || !check_f32(1, &t)) {
+        return NULL;
+    }
+
+    size_t n = t->shape[0];
+    Tensor *l = tensor_copy(t);
+    if (!cholesky_factor(n, l->data)) {
+        tensor_free(l);
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i + 1; j < n; j++) {
+            l->data[i * n + j] = 0;
+        }
+    }
+    return l;
+}
+
+// Whole-tensor reductions split the elements, in row-major order, into fixed
+// blocks of REDUCE_BLOCK, reduce every block with a kernel and combine the
+// block results in order. The blocks do not depend on the number of threads,
+// so neither do the results: they are reproducible bit for bit.
+#define REDUCE_BLOCK 65536
+
+typedef struct {
+    double sum;
+    Dtype min, max;
+    size_t argmin, argmax; // In the block, its length when it is all NaN
+    size_t len;
+} ReduceBlock;
+
+// Blocks of float16 and bfloat16 are converted to float32, which is exact,
+// float64 blocks are reduced in double
+typedef struct {
+    const Tensor *t;
+    const Kernels *kernels;
+    bool extrema; // Find min and max instead of the sum
+    TensorDtype block_dtype;
+    ReduceBlock *blocks;
+    atomic_bool failed; // A worker could not allocate its buffer
+} ReduceContext;
+
+// Extrema of a float64 block, compared in double
+static void min_max_f64(size_t n, const double *a, ReduceBlock *b) {
+    double lo = INFINITY, hi = -INFINITY;
+    b->argmin = b->argmax = n;
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] < lo || (b->argmin == n && a[i] == INFINITY)) {
+            lo = a[i];
+            b->argmin = i;
+        }
+        if (a[i] > hi || (b->argmax == n && a[i] == -INFINITY)) {
+            hi = a[i];
+            b->argmax = i;
+        }
+    }
+    b->min = b->argmin == n ? NAN : (Dtype)lo;
+    b->max = b->argmax == n ? NAN : (Dtype)hi;
+}
+
+static void reduce_block(const ReduceContext *ctx, const void *data, size_t len, ReduceBlock *b) {
+    b->len = len;
+    if (ctx->block_dtype == TENSOR_F64) {
+        if (ctx->extrema) {
+            min_max_f64(len, (const double *)data, b);
+        } else {
+            b->sum = ctx->kernels->sum_f64(len, (const double *)data);
+        }
+    } else if (ctx->extrema) {
+        ctx->kernels->min_max(len, (const float *)data, &b->min, &b->argmin, &b->max, &b->argmax);
+    } else {
+        b->sum = ctx->kernels->sum(len, (const float *)data);
+    }
+}
+
+static void reduce_contiguous(void *arg, size_t begin, size_t end) {
+    ReduceContext *ctx = (ReduceContext *)arg;
+    for (size_t i = begin; i < end; i++) {
+        size_t start = i * REDUCE_BLOCK;
+        size_t len = ctx->t->size - start < REDUCE_BLOCK ? ctx->t->size - start : REDUCE_BLOCK;
+        reduce_block(ctx, tensor_element(ctx->t, start), len, &ctx->blocks[i]);
+    }
+}
+
+// Strided and half-precision tensors are gathered block by block into a
+// buffer, giving the same blocks as a contiguous copy would
+static void reduce_strided(void *arg, size_t begin, size_t end) {
+    ReduceContext *ctx = (ReduceContext *)arg;
+    const Tensor *t = ctx->t;
+    size_t size = tensor_dtype_size(ctx->block_dtype);
+    unsigned char *buffer = (unsigned char *)malloc(REDUCE_BLOCK * size);
+    if (!buffer) {
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+    size_t len = 0, block = begin;
+
+    TensorIter it;
+    iter_init(&it, 1, (const Tensor *[]){t});
+    iter_restrict(&it, begin * REDUCE_BLOCK, t->size / REDUCE_BLOCK < end ? t->size : end * REDUCE_BLOCK);
+    while (iter_next(&it)) {
+        size_t stride = it.inner_strides[0];
+        for (size_t i = 0; i < it.inner_size;) {
+            size_t n = it.inner_size - i < REDUCE_BLOCK - len ? it.inner_size - i : REDUCE_BLOCK - len;
+            dtype_convert(n, ctx->block_dtype, buffer + len * size, 1, t->dtype,
+                          tensor_element(t, it.offsets[0] + i * stride), stride);
+            len += n;
+            i += n;
+            if (len == REDUCE_BLOCK) {
+                reduce_block(ctx, buffer, len, &ctx->blocks[block++]);
+                len = 0;
+            }
+        }
+    }
+    if (len > 0) {
+        reduce_block(ctx, buffer, len, &ctx->blocks[block]);
+    }
+    free(buffer);
+}
+
+// Reduce every block of t, the result must be freed. NULL when the blocks or
+// the gather buffers cannot be allocated.
+static ReduceBlock *reduce_blocks(const Tensor *t, bool extrema, size_t *n_blocks) {
+    *n_blocks = (t->size + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+    TensorDtype block_dtype = t->dtype == TENSOR_F64 ? TENSOR_F64 : TENSOR_F32;
+    ReduceContext ctx = {.t = t, .kernels = kernels_get(), .extrema = extrema,
+                         .block_dtype = block_dtype,
+                         .blocks = (ReduceBlock *)malloc((*n_blocks + 1) * sizeof(ReduceBlock))};
+    atomic_init(&ctx.failed, false);
+    if (!ctx.blocks) {
+        fprintf(stderr, "Error: Cannot allocate %zu reduction blocks.\n", *n_blocks);
+        return NULL;
+    }
+
+    bool direct = t->dtype == block_dtype && tensor_is_contiguous(t);
+    parallel_for(*n_blocks, direct ? reduce_contiguous : reduce_strided, &ctx);
+    if (atomic_load(&ctx.failed)) {
+        fprintf(stderr, "Error: Cannot allocate the buffers of a reduction.\n");
+        free(ctx.blocks);
+        return NULL;
+    }
+    return ctx.blocks;
+}
+
+static double reduce_sum(const Tensor *t) {
+    size_t n_blocks;
+    ReduceBlock *blocks = reduce_blocks(t, false, &n_blocks);
+    if (!blocks) {
+        return NAN;
+    }
+    double sum = 0;
+    for (size_t i = 0; i < n_blocks; i++) {
+        sum += blocks[i].sum;
+    }
+    free(blocks);
     return sum;
 }
 
+// Sum of all elements in a tensor
+Dtype tensor_sum(const Tensor *t) {
+    return (Dtype)reduce_sum(t);
+}
+
 // Mean of all elements in a tensor
 Dtype tensor_mean(const Tensor *t) {
-    return tensor_sum(t) / t->size;
+    return (Dtype)(reduce_sum(t) / t->size);
 }
 
-// Max element in a tensor
-Dtype tensor_max(const Tensor *t) {
-    Dtype max = t->data[0];
-    for (size_t i = 1; i < t->size; i++) {
-        if (t->data[i] > max) {
-            max = t->data[i];
+// Smallest and largest element and their positions in one pass
+TensorExtrema tensor_extrema(const Tensor *t) {
+    TensorExtrema e = {NAN, NAN, 0, 0};
+    size_t n_blocks;
+    ReduceBlock *blocks = reduce_blocks(t, true, &n_blocks);
+    if (!blocks) {
+        return e;
+    }
+
+    // Blocks come in order, so on ties the earlier block keeps its position
+    bool found_min = false, found_max = false;
+    for (size_t i = 0, start = 0; i < n_blocks; start += blocks[i].len, i++) {
+        const ReduceBlock *b = &blocks[i];
+        if (b->argmin < b->len && (!found_min || b->min < e.min)) {
+            e.min = b->min;
+            e.argmin = start + b->argmin;
+            found_min = true;
+        }
+        if (b->argmax < b->len && (!found_max || b->max > e.max)) {
+            e.max = b->max;
+            e.argmax = start + b->argmax;
+            found_max = true;
         }
     }
-    return max;
+    free(blocks);
+    return e;
+}
+
+// Max element in a tensor
+Dtype tensor_max(const Tensor *t) {
+    return tensor_extrema(t).max;
 }
 
 // Min element in a tensor
 Dtype tensor_min(const Tensor *t) {
-    Dtype min = t->data[0];
-    for (size_t i = 1; i < t->size; i++) {
-        if (t->data[i] < min) {
-            min = t->data[i];
-        }
-    }
-    return min;
+    return tensor_extrema(t).min;
 }
 
 // Argmax of a tensor
 size_t tensor_argmax(const Tensor *t) {
-    Dtype max = t->data[0];
-    size_t argmax = 0;
-    for (size_t i = 1; i < t->size; i++) {
-        if (t->data[i] > max) {
-            max = t->data[i];
-            argmax = i;
-        }
-    }
-    return argmax;
+    return tensor_extrema(t).argmax;
 }
 
 // Argmin of a tensor
 size_t tensor_argmin(const Tensor *t) {
-    Dtype min = t->data[0];
-    size_t argmin = 0;
-    for (size_t i = 1; i < t->size; i++) {
-        if (t->data[i] < min) {
-            min = t->data[i];
-            argmin = i;
+    return tensor_extrema(t).argmin;
+}
+
+// Axis reductions keep double accumulators for every output element and read
+// the input once, in an order chosen by its layout:
+// - rows: when the fastest-varying dimension is kept, the reduced dimensions
+//   are walked outermost, so every step updates a run of neighbouring outputs
+//   with one element each, e.g. adding whole rows for a reduction over axis 0
+// - segments: when it is reduced, the kept dimensions are walked outermost,
+//   so every output reduces runs of its own elements
+// Either way the elements of one output arrive in row-major order of the
+// reduced dimensions, and r counts them.
+//
+// On the thread pool, segments split the outputs. Rows split the reduced
+// positions into chunks of a size that depends only on the shape; each chunk
+// has its own accumulators, merged in order, so the results do not depend on
+// the number of threads. Chunks run in waves of one per thread and a wave is
+// merged before the next starts, so only that many accumulator sets live at
+// once.
+typedef struct {
+    size_t outputs; // Number of output elements
+    size_t count;   // Elements reduced into each output
+    size_t first;   // Reduced position of the first element accumulated
+    double *sum;
+    Dtype *partial; // Sums of the latest rows in float, when no m2 needs sum
+                    // after every row
+    double *m2;     // Sum of squared deviations from the mean
+    Dtype *min;
+    Dtype *max;
+    size_t *argmin; // count while only NaNs were seen
+    size_t *argmax;
+} AxisReduction;
+
+// Shortest segment reduced by a kernel call
+#define REDUCE_KERNEL_MIN 64
+// Outputs accumulated at a time when reducing segments
+#define REDUCE_SLOTS 1024
+// Rows added up in float before they are folded into the double sums
+#define REDUCE_PARTIAL_ROWS 64
+// Rows chunks: at least this many elements and REDUCE_PARTIAL_ROWS rows each,
+// and at most REDUCE_MAX_CHUNKS of them, bounding the merges
+#define REDUCE_CHUNK (1 << 20)
+#define REDUCE_MAX_CHUNKS 64
+
+// Mark the reduced axes, false when one is out of bounds or repeated
+static bool reduce_axes(const Tensor *t, size_t n_axes, const size_t axes[], bool reduced[]) {
+    for (size_t i = 0; i < t->ndim; i++) {
+        reduced[i] = false;
+    }
+    for (size_t i = 0; i < n_axes; i++) {
+        if (axes[i] >= t->ndim) {
+            fprintf(stderr, "Error: Axis out of bounds.\n");
+            return false;
+        }
+        if (reduced[axes[i]]) {
+            fprintf(stderr, "Error: Axis repeated in a reduction.\n");
+            return false;
         }
+        reduced[axes[i]] = true;
     }
-    return argmin;
+    return true;
 }
 
-Tensor *tensor_sum_axis(const Tensor *tensor, size_t axis) {
-    if (axis >= tensor->ndim) {
-        fprintf(stderr, "Error: Axis out of bounds.\n");
-        return NULL;
+// Shape of the result, with the reduced axes as size 1 when keepdims is set
+static size_t reduce_shape(const Tensor *t, const bool reduced[], bool keepdims, size_t shape[]) {
+    size_t ndim = 0;
+    for (size_t i = 0; i < t->ndim; i++) {
+        if (!reduced[i]) {
+            shape[ndim++] = t->shape[i];
+        } else if (keepdims) {
+            shape[ndim++] = 1;
+        }
     }
+    return ndim;
+}
 
-    // Calculate the shape of the result tensor
-    size_t *result_shape = malloc((tensor->ndim - 1) * sizeof(size_t));
-    if (!result_shape) {
-        fprintf(stderr, "Error: Memory allocation failed.\n");
-        return NULL;
+// out may have the result shape with or without the reduced axes
+static bool check_reduce_output(const Tensor *out, const Tensor *t, const bool reduced[]) {
+    size_t shape[TENSOR_MAX_DIMS];
+    size_t ndim = reduce_shape(t, reduced, out->ndim == t->ndim, shape);
+    return check_output(out, ndim, shape);
+}
+
+// One element at reduced position r for each of the outputs j .. j + len
+static void reduce_row(AxisReduction *red, const Kernels *k, size_t j, size_t r, const Dtype *x,
+                       size_t stride, size_t len) {
+    if (red->m2 && r > red->first) {
+        // Welford: the deviation from the mean of the n elements so far
+        size_t n = r - red->first;
+        double inv_r = 1.0 / n, w = (double)n / (n + 1);
+        for (size_t i = 0; i < len; i++) {
+            double d = x[i * stride] - red->sum[j + i] * inv_r;
+            red->m2[j + i] += d * d * w;
+        }
+    }
+    if (red->partial && stride == 1) {
+        k->add(len, red->partial + j, x, red->partial + j);
+    } else if (red->partial) {
+        for (size_t i = 0; i < len; i++) {
+            red->partial[j + i] += x[i * stride];
+        }
+    } else if (red->sum) {
+        for (size_t i = 0; i < len; i++) {
+            red->sum[j + i] += x[i * stride];
+        }
     }
 
-    for (size_t i = 0, j = 0; i < tensor->ndim; i++) {
-        if (i != axis) {
-            result_shape[j++] = tensor->shape[i];
+    // An output takes the first value that is not NaN, then strictly
+    // smaller (larger) ones, so ties keep the first position
+    for (size_t i = 0; red->min && i < len; i++) {
+        Dtype v = x[i * stride];
+        if (red->argmin[j + i] == red->count ? v == v : v < red->min[j + i]) {
+            red->min[j + i] = v;
+            red->argmin[j + i] = r;
+        }
+    }
+    for (size_t i = 0; red->max && i < len; i++) {
+        Dtype v = x[i * stride];
+        if (red->argmax[j + i] == red->count ? v == v : v > red->max[j + i]) {
+            red->max[j + i] = v;
+            red->argmax[j + i] = r;
         }
     }
+}
 
-    // Create the result tensor
-    Tensor *result = tensor_create_from_shape(tensor->ndim - 1, result_shape);
-    free(result_shape);
-    if (!result) {
-        return NULL;
+// The elements at reduced positions r .. r + len of output j
+static void reduce_segment(AxisReduction *red, const Kernels *k, size_t j, size_t r,
+                           const Dtype *x, size_t stride, size_t len) {
+    // Short segments do not pay for a kernel call
+    double sum = 0;
+    if (stride == 1 && len >= REDUCE_KERNEL_MIN) {
+        sum = k->sum(len, x);
+    } else {
+        // Four chains of additions instead of one long one
+        double part[4] = {0, 0, 0, 0};
+        size_t i = 0;
+        if (stride == 1) {
+            for (; i + 4 <= len; i += 4) {
+                for (size_t p = 0; p < 4; p++) {
+                    part[p] += x[i + p];
+                }
+            }
+        }
+        for (; i + 4 <= len; i += 4) {
+            for (size_t p = 0; p < 4; p++) {
+                part[p] += x[(i + p) * stride];
+            }
+        }
+        for (; i < len; i++) {
+            part[0] += x[i * stride];
+        }
+        sum = (part[0] + part[1]) + (part[2] + part[3]);
+    }
+
+    if (red->m2) {
+        // Deviations from the segment mean, merged as in Chan et al.
+        double mean = sum / len, m2 = 0;
+        for (size_t i = 0; i < len; i++) {
+            double d = x[i * stride] - mean;
+            m2 += d * d;
+        }
+        if (r > 0) {
+            double delta = mean - red->sum[j] / r;
+            m2 += delta * delta * ((double)r * len / (r + len));
+        }
+        red->m2[j] += m2;
+    }
+    if (red->sum) {
+        red->sum[j] += sum;
     }
 
-    // Initialize the result tensor to zero
-    for (size_t i = 0; i < result->size; i++) {
-        result->data[i] = 0;
+    if (red->min || red->max) {
+        Dtype lo = NAN, hi = NAN;
+        size_t arg_lo = len, arg_hi = len;
+        if (stride == 1 && len >= REDUCE_KERNEL_MIN) {
+            k->min_max(len, x, &lo, &arg_lo, &hi, &arg_hi);
+        } else {
+            for (size_t i = 0; i < len; i++) {
+                Dtype v = x[i * stride];
+                if (arg_lo == len ? v == v : v < lo) {
+                    lo = v;
+                    arg_lo = i;
+                }
+                if (arg_hi == len ? v == v : v > hi) {
+                    hi = v;
+                    arg_hi = i;
+                }
+            }
+        }
+        if (red->min && arg_lo < len && (red->argmin[j] == red->count || lo < red->min[j])) {
+            red->min[j] = lo;
+            red->argmin[j] = r + arg_lo;
+        }
+        if (red->max && arg_hi < len && (red->argmax[j] == red->count || hi > red->max[j])) {
+            red->max[j] = hi;
+            red->argmax[j] = r + arg_hi;
+        }
     }
+}
 
-    // Sum along the specified axis
-    size_t stride = 1;
-    for (size_t i = axis + 1; i < tensor->ndim; i++) {
-        stride *= tensor->shape[i];
+static Dtype reduce_value(const AxisReduction *red, TensorReduceOp op, size_t j) {
+    switch (op) {
+    case TENSOR_REDUCE_SUM:
+        return (Dtype)red->sum[j];
+    case TENSOR_REDUCE_MEAN:
+        return (Dtype)(red->sum[j] / red->count);
+    case TENSOR_REDUCE_VAR:
+        return (Dtype)(red->m2[j] / red->count);
+    case TENSOR_REDUCE_STD:
+        return (Dtype)sqrt(red->m2[j] / red->count);
+    case TENSOR_REDUCE_MIN:
+        return red->min[j];
+    case TENSOR_REDUCE_MAX:
+        return red->max[j];
+    case TENSOR_REDUCE_ARGMIN:
+        return red->argmin[j] == red->count ? 0 : (Dtype)red->argmin[j];
+    default:
+        return red->argmax[j] == red->count ? 0 : (Dtype)red->argmax[j];
     }
+}
 
-    for (size_t i = 0; i < result->size; i++) {
-        size_t offset = (i / stride) * tensor->shape[axis] * stride + (i % stride);
-        for (size_t j = 0; j < tensor->shape[axis]; j++) {
-            result->data[i] += tensor->data[offset + j * stride];
+static void reduce_reset(AxisReduction *red, size_t j) {
+    if (red->sum) {
+        red->sum[j] = 0;
+    }
+    if (red->m2) {
+        red->m2[j] = 0;
+    }
+    if (red->min) {
+        red->min[j] = NAN;
+        red->argmin[j] = red->count;
+    }
+    if (red->max) {
+        red->max[j] = NAN;
+        red->argmax[j] = red->count;
+    }
+}
+
+// Writes the results of consecutive outputs, in row-major order, to every
+// requested output tensor
+typedef struct {
+    size_t n_ops;
+    TensorReduceOp ops[TENSOR_REDUCE_COUNT];
+    TensorIter it[TENSOR_REDUCE_COUNT];
+    size_t pos[TENSOR_REDUCE_COUNT]; // In the current run of it
+} ReduceWriter;
+
+// Write the results in slots 0 .. n as the next n outputs and reset the slots
+static void reduce_flush(ReduceWriter *w, AxisReduction *red, size_t n) {
+    for (size_t i = 0; i < w->n_ops; i++) {
+        TensorIter *it = &w->it[i];
+        for (size_t j = 0, len; j < n; j += len) {
+            if (!it->started || w->pos[i] == it->inner_size) {
+                iter_next(it);
+                w->pos[i] = 0;
+            }
+            len = it->inner_size - w->pos[i] < n - j ? it->inner_size - w->pos[i] : n - j;
+            Dtype *dst = it->ptrs[0] + w->pos[i] * it->inner_strides[0];
+            for (size_t q = 0; q < len; q++) {
+                dst[q * it->inner_strides[0]] = reduce_value(red, w->ops[i], j + q);
+            }
+            w->pos[i] += len;
         }
     }
+    for (size_t j = 0; j < n; j++) {
+        reduce_reset(red, j);
+    }
+}
 
-    return result;
+static void reduce_fold(AxisReduction *red) {
+    for (size_t j = 0; red->partial && j < red->outputs; j++) {
+        red->sum[j] += red->partial[j];
+        red->partial[j] = 0;
+    }
 }
 
-Tensor *tensor_mean_axis(const Tensor *tensor, size_t axis) {
-    Tensor *sum = tensor_sum_axis(tensor, axis);
-    if (!sum) {
+// Fold the rows b->first .. last accumulated by b, which follow those of a,
+// into a
+static void reduce_merge(AxisReduction *a, const AxisReduction *b, size_t last) {
+    double n_a = (double)(b->first - a->first), n_b = (double)(last - b->first);
+    for (size_t j = 0; j < a->outputs; j++) {
+        if (a->m2) {
+            // Chan et al.: the two parts' m2 and the spread of their means
+            double delta = b->sum[j] / n_b - a->sum[j] / n_a;
+            a->m2[j] += b->m2[j] + delta * delta * (n_a * n_b / (n_a + n_b));
+        }
+        if (a->sum) {
+            a->sum[j] += b->sum[j];
+        }
+        if (a->min && b->argmin[j] != b->count &&
+            (a->argmin[j] == a->count || b->min[j] < a->min[j])) {
+            a->min[j] = b->min[j];
+            a->argmin[j] = b->argmin[j];
+        }
+        if (a->max && b->argmax[j] != b->count &&
+            (a->argmax[j] == a->count || b->max[j] > a->max[j])) {
+            a->max[j] = b->max[j];
+            a->argmax[j] = b->argmax[j];
+        }
+    }
+}
+
+typedef struct {
+    Tensor *const *out;
+    const Tensor *t;
+    size_t shape[TENSOR_MAX_DIMS]; // Of t, in walk order
+    size_t strides[TENSOR_MAX_DIMS];
+    bool segments;
+    AxisReduction proto; // Sizes, no accumulators
+    size_t chunk_rows;
+    size_t first_chunk; // Of the current wave
+    AxisReduction *chunks; // One per chunk of the wave
+} AxisReduceJob;
+
+// Only the accumulators the requested results need
+static void reduce_alloc(AxisReduction *red, Tensor *const out[], size_t slots, bool segments) {
+    if (out[TENSOR_REDUCE_SUM] || out[TENSOR_REDUCE_MEAN] || out[TENSOR_REDUCE_VAR] ||
+        out[TENSOR_REDUCE_STD]) {
+        red->sum = (double *)malloc(slots * sizeof(double));
+    }
+    if (out[TENSOR_REDUCE_VAR] || out[TENSOR_REDUCE_STD]) {
+        red->m2 = (double *)malloc(slots * sizeof(double));
+    } else if (red->sum && !segments) {
+        red->partial = (Dtype *)calloc(slots, sizeof(Dtype));
+    }
+    if (out[TENSOR_REDUCE_MIN] || out[TENSOR_REDUCE_ARGMIN]) {
+        red->min = (Dtype *)malloc(slots * sizeof(Dtype));
+        red->argmin = (size_t *)malloc(slots * sizeof(size_t));
+    }
+    if (out[TENSOR_REDUCE_MAX] || out[TENSOR_REDUCE_ARGMAX]) {
+        red->max = (Dtype *)malloc(slots * sizeof(Dtype));
+        red->argmax = (size_t *)malloc(slots * sizeof(size_t));
+    }
+    for (size_t j = 0; j < slots; j++) {
+        reduce_reset(red, j);
+    }
+}
+
+static void reduce_free(AxisReduction *red) {
+    free(red->sum);
+    free(red->partial);
+    free(red->m2);
+    free(red->min);
+    free(red->max);
+    free(red->argmin);
+    free(red->argmax);
+}
+
+// Writes the outputs begin .. end of every requested result
+static void reduce_writer_init(ReduceWriter *w, Tensor *const out[], size_t begin, size_t end) {
+    w->n_ops = 0;
+    for (int op = 0; op < TENSOR_REDUCE_COUNT; op++) {
+        if (out[op]) {
+            w->ops[w->n_ops] = (TensorReduceOp)op;
+            iter_init(&w->it[w->n_ops], 1, (const Tensor *[]){out[op]});
+            iter_restrict(&w->it[w->n_ops], begin, end);
+            w->pos[w->n_ops++] = 0;
+        }
+    }
+}
+
+// Read every element of t that belongs to the outputs begin .. end
+// (segments) or the reduced positions begin .. end (rows) once. Rows keep one
+// slot per output, left for the caller to write. Segments finish the outputs
+// one after the other, so they cycle through a few slots and write them
+// whenever all are used.
+static void reduce_walk(AxisReduction *red, ReduceWriter *w, const AxisReduceJob *job,
+                        size_t begin, size_t end, size_t slots) {
+    const Kernels *k = kernels_get();
+    const Tensor *t = job->t;
+    bool segments = job->segments;
+    size_t j = 0, r = segments ? 0 : begin;
+    size_t unit = segments ? red->count : red->outputs;
+    TensorIter it;
+    iter_init_strided(&it, 1, (Dtype *[]){t->data}, t->ndim, job->shape,
+                      (const size_t *[]){job->strides});
+    iter_restrict(&it, begin * unit, end * unit);
+    while (iter_next(&it)) {
+        const Dtype *x = it.ptrs[0];
+        size_t stride = it.inner_strides[0];
+
+        // A run may span several outputs (segments) or reduced positions (rows)
+        for (size_t done = 0, len; done < it.inner_size; done += len) {
+            len = it.inner_size - done;
+            if (segments) {
+                len = len < red->count - r ? len : red->count - r;
+                len = len < REDUCE_BLOCK ? len : REDUCE_BLOCK;
+                reduce_segment(red, k, j, r, x + done * stride, stride, len);
+                r += len;
+                if (r == red->count) {
+                    r = 0;
+                    if (++j == slots) {
+                        reduce_flush(w, red, slots);
+                        j = 0;
+                    }
+                }
+            } else {
+                len = len < red->outputs - j ? len : red->outputs - j;
+                reduce_row(red, k, j, r, x + done * stride, stride, len);
+                j += len;
+                if (j == red->outputs) {
+                    j = 0;
+                    if (++r % REDUCE_PARTIAL_ROWS == 0) {
+                        reduce_fold(red);
+                    }
+                }
+            }
+        }
+    }
+
+    if (!segments) {
+        reduce_fold(red);
+    } else if (red->count > 0) {
+        reduce_flush(w, red, j);
+    } else {
+        // Nothing was read: every output is the result of no elements
+        for (size_t done = begin; done < end; done += slots) {
+            reduce_flush(w, red, end - done < slots ? end - done : slots);
+        }
+    }
+}
+
+static void reduce_segments_range(void *arg, size_t begin, size_t end) {
+    const AxisReduceJob *job = (const AxisReduceJob *)arg;
+    AxisReduction red = job->proto;
+    size_t slots = end - begin < REDUCE_SLOTS ? end - begin : REDUCE_SLOTS;
+    reduce_alloc(&red, job->out, slots, true);
+    ReduceWriter w;
+    reduce_writer_init(&w, job->out, begin, end);
+    reduce_walk(&red, &w, job, begin, end, slots);
+    reduce_free(&red);
+}
+
+static void reduce_rows_range(void *arg, size_t begin, size_t end) {
+    const AxisReduceJob *job = (const AxisReduceJob *)arg;
+    for (size_t c = begin; c < end; c++) {
+        AxisReduction *red = &job->chunks[c];
+        size_t first = (job->first_chunk + c) * job->chunk_rows;
+        size_t last = job->proto.count - first < job->chunk_rows ? job->proto.count
+                                                                 : first + job->chunk_rows;
+        *red = job->proto;
+        red->first = first;
+        reduce_alloc(red, job->out, red->outputs, false);
+        reduce_walk(red, NULL, job, first, last, red->outputs);
+    }
+}
+
+bool tensor_reduce_into(Tensor *const out[TENSOR_REDUCE_COUNT], const Tensor *t, size_t n_axes,
+                        const size_t axes[]) {
+    bool reduced[TENSOR_MAX_DIMS];
+    if (!check_f32(1, &t) || !reduce_axes(t, n_axes, axes, reduced)) {
+        return false;
+    }
+    for (int op = 0; op < TENSOR_REDUCE_COUNT; op++) {
+        if (out[op] && (!check_reduce_output(out[op], t, reduced) ||
+                        !check_f32(1, (const Tensor *[]){out[op]}))) {
+            return false;
+        }
+    }
+
+    AxisReduceJob job = {.out = out, .t = t};
+    job.proto = (AxisReduction){1, 1, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+    for (size_t d = 0; d < t->ndim; d++) {
+        *(reduced[d] ? &job.proto.count : &job.proto.outputs) *= t->shape[d];
+    }
+
+    // The dimension with the smallest stride decides the order
+    size_t fastest = t->ndim;
+    for (size_t d = 0; d < t->ndim; d++) {
+        if (t->shape[d] > 1 && (fastest == t->ndim || t->strides[d] < t->strides[fastest])) {
+            fastest = d;
+        }
+    }
+    job.segments = fastest < t->ndim && reduced[fastest];
+
+    // Reduced dimensions first for rows, kept ones first for segments
+    size_t nd = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t d = 0; d < t->ndim; d++) {
+            if (reduced[d] == ((pass == 0) != job.segments)) {
+                job.shape[nd] = t->shape[d];
+                job.strides[nd++] = t->strides[d];
+            }
+        }
+    }
+
+    size_t outputs = job.proto.outputs, count = job.proto.count;
+    if (job.segments) {
+        size_t grain = count > 0 && count < PARALLEL_GRAIN ? PARALLEL_GRAIN / count : 1;
+        parallel_for_grain(outputs, count > 0 ? grain : outputs, reduce_segments_range, &job);
+        return true;
+    }
+
+    job.chunk_rows = REDUCE_PARTIAL_ROWS;
+    if (job.chunk_rows < (count + REDUCE_MAX_CHUNKS - 1) / REDUCE_MAX_CHUNKS) {
+        job.chunk_rows = (count + REDUCE_MAX_CHUNKS - 1) / REDUCE_MAX_CHUNKS;
+    }
+    if (outputs > 0 && job.chunk_rows < (REDUCE_CHUNK + outputs - 1) / outputs) {
+        job.chunk_rows = (REDUCE_CHUNK + outputs - 1) / outputs;
+    }
+    size_t n_chunks = count > job.chunk_rows ? (count + job.chunk_rows - 1) / job.chunk_rows : 1;
+    size_t wave = parallel_num_threads() < n_chunks ? parallel_num_threads() : n_chunks;
+    job.chunks = (AxisReduction *)malloc(wave * sizeof(AxisReduction));
+    if (!job.chunks) {
+        fprintf(stderr, "Error: Cannot allocate %zu reduction chunks.\n", wave);
+        return false;
+    }
+
+    // Chunk 0 becomes the total, the later ones are folded into it in order
+    AxisReduction total;
+    for (job.first_chunk = 0; job.first_chunk < n_chunks; job.first_chunk += wave) {
+        size_t n = n_chunks - job.first_chunk < wave ? n_chunks - job.first_chunk : wave;
+        parallel_for(n, reduce_rows_range, &job);
+        for (size_t c = 0; c < n; c++) {
+            AxisReduction *red = &job.chunks[c];
+            if (job.first_chunk + c == 0) {
+                total = *red;
+                continue;
+            }
+            size_t last = count - red->first < job.chunk_rows ? count : red->first + job.chunk_rows;
+            reduce_merge(&total, red, last);
+            reduce_free(red);
+        }
+    }
+    ReduceWriter w;
+    reduce_writer_init(&w, out, 0, outputs);
+    reduce_flush(&w, &total, outputs);
+    reduce_free(&total);
+    free(job.chunks);
+    return true;
+}
+
+Tensor *tensor_reduce(const Tensor *t, TensorReduceOp op, size_t n_axes, const size_t axes[],
+                      bool keepdims) {
+    bool reduced[TENSOR_MAX_DIMS];
+    if (op >= TENSOR_REDUCE_COUNT || !check_f32(1, &t) || !reduce_axes(t, n_axes, axes, reduced)) {
         return NULL;
     }
 
-    Tensor *mean = tensor_multiply_scalar(sum, 1.0 / tensor->shape[axis]);
-    tensor_free(sum);
+    size_t shape[TENSOR_MAX_DIMS];
+    size_t ndim = reduce_shape(t, reduced, keepdims, shape);
+    Tensor *result = tensor_create_from_shape(ndim, shape);
+    Tensor *out[TENSOR_REDUCE_COUNT] = {NULL};
+    out[op] = result;
+    tensor_reduce_into(out, t, n_axes, axes);
+    return result;
+}
+
+Tensor *tensor_sum_axis_into(Tensor *out, const Tensor *tensor, size_t axis) {
+    Tensor *outs[TENSOR_REDUCE_COUNT] = {NULL};
+    outs[TENSOR_REDUCE_SUM] = out;
+    return tensor_reduce_into(outs, tensor, 1, &axis) ? out : NULL;
+}
 
-    return mean;
+Tensor *tensor_mean_axis_into(Tensor *out, const Tensor *tensor, size_t axis) {
+    Tensor *outs[TENSOR_REDUCE_COUNT] = {NULL};
+    outs[TENSOR_REDUCE_MEAN] = out;
+    return tensor_reduce_into(outs, tensor, 1, &axis) ? out : NULL;
+}
+
+Tensor *tensor_sum_axis(const Tensor *tensor, size_t axis) {
+    return tensor_reduce(tensor, TENSOR_REDUCE_SUM, 1, &axis, false);
+}
+
+Tensor *tensor_mean_axis(const Tensor *tensor, size_t axis) {
+    return tensor_reduce(tensor, TENSOR_REDUCE_MEAN, 1, &axis, false);
 }
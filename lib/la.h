@@ -1,7 +1,12 @@
+#ifndef LA_H
+#define LA_H
+
 #include "tensor.h"
 
 // Element-wise Operations
-// These operate on tensors of the same shape
+// These operate on tensors of the same shape and dtype, and so do the scalar
+// and whole-tensor reductions below; everything else needs float32 tensors
+// and fails on others
 Tensor *tensor_add(const Tensor *a, const Tensor *b);
 Tensor *tensor_subtract(const Tensor *a, const Tensor *b);
 Tensor *tensor_multiply(const Tensor *a, const Tensor *b); // Hadamard product
@@ -15,18 +20,109 @@ Tensor *tensor_multiply_scalar(const Tensor *a, float scalar);
 Tensor *tensor_divide_scalar(const Tensor *a, float scalar);
 
 // Linear Algebra Operations
-Tensor *tensor_matmul(const Tensor *a, const Tensor *b); // Matrix multiplication
+// Matrix multiplication of [..., m, k] by [..., k, n]. Beyond two dimensions
+// the tensors are batches of matrices whose leading dimensions broadcast,
+// e.g. [r, n, d] by [d, k] into [r, n, k]. Batches of small products run one
+// product per thread, large ones on all threads each.
+Tensor *tensor_matmul(const Tensor *a, const Tensor *b);
 float tensor_dot(const Tensor *a, const Tensor *b);      // Dot product
 Tensor *tensor_cross(const Tensor *a, const Tensor *b);  // Cross product (3D vectors only)
 Tensor *tensor_inverse(const Tensor *t);
+// Gram matrix X^T X of a [n, d] tensor, computing one triangle and mirroring
+// it. tensor_gram_double sums blocks of rows in double, for very tall X.
+Tensor *tensor_gram(const Tensor *x);
+Tensor *tensor_gram_double(const Tensor *x);
+
+// Linear Solvers
+// Solve a X = b for a square a and a [n] or [n, r] right-hand side b, NULL
+// when a is singular. tensor_solve uses Gaussian elimination with partial
+// pivoting. tensor_solve_symmetric reads only the lower triangle of a
+// symmetric a and uses a Cholesky factorization, falling back to pivoting
+// when a is not positive definite. Prefer both to multiplying by the inverse.
+Tensor *tensor_solve(const Tensor *a, const Tensor *b);
+Tensor *tensor_solve_symmetric(const Tensor *a, const Tensor *b);
+Tensor *tensor_cholesky(const Tensor *t); // Lower L with L L^T = t
 
 // Reduction Operations
+// Whole-tensor reductions use every thread on large tensors and vector
+// kernels. Sums accumulate in double. Results do not depend on the number of
+// threads. Min, max and their positions skip NaNs and report the first
+// position on ties. float64 tensors are reduced in double, float16 and
+// bfloat16 through their exact float32 values. When their scratch cannot be
+// allocated they print an error and give NaN (positions 0).
+typedef struct {
+    Dtype min;
+    Dtype max;
+    size_t argmin;
+    size_t argmax;
+} TensorExtrema;
+
 Dtype tensor_sum(const Tensor *tensor);
 Dtype tensor_mean(const Tensor *tensor);
 Dtype tensor_min(const Tensor *tensor);
 Dtype tensor_max(const Tensor *tensor);
 size_t tensor_argmin(const Tensor *tensor);
 size_t tensor_argmax(const Tensor *tensor);
+TensorExtrema tensor_extrema(const Tensor *tensor); // All four in one pass
 
 Tensor *tensor_sum_axis(const Tensor *tensor, size_t axis);
 Tensor *tensor_mean_axis(const Tensor *tensor, size_t axis);
+
+// Reductions over several axes at once. With keepdims the reduced axes stay
+// as dimensions of size 1, otherwise they are dropped. The input is read once,
+// accumulating in double. VAR and STD are the population versions, divided by
+// the number of elements, and use Welford updates. ARGMIN and ARGMAX give the
+// row-major position within the reduced axes, for a single axis the index
+// along it. MIN and MAX skip NaNs as above.
+typedef enum {
+    TENSOR_REDUCE_SUM,
+    TENSOR_REDUCE_MEAN,
+    TENSOR_REDUCE_VAR,
+    TENSOR_REDUCE_STD,
+    TENSOR_REDUCE_MIN,
+    TENSOR_REDUCE_MAX,
+    TENSOR_REDUCE_ARGMIN,
+    TENSOR_REDUCE_ARGMAX,
+    TENSOR_REDUCE_COUNT
+} TensorReduceOp;
+
+Tensor *tensor_reduce(const Tensor *tensor, TensorReduceOp op, size_t n_axes, const size_t axes[],
+                      bool keepdims);
+
+// Allocation-free Variants
+// These write into a caller-provided tensor `out` of the result shape and
+// return it, or return NULL when the shapes do not match. For element-wise and
+// scalar operations `out` may be one of the inputs, e.g.
+// tensor_add_into(a, a, b) computes a += b in place.
+Tensor *tensor_add_into(Tensor *out, const Tensor *a, const Tensor *b);
+Tensor *tensor_subtract_into(Tensor *out, const Tensor *a, const Tensor *b);
+Tensor *tensor_multiply_into(Tensor *out, const Tensor *a, const Tensor *b);
+Tensor *tensor_divide_into(Tensor *out, const Tensor *a, const Tensor *b);
+
+Tensor *tensor_add_scalar_into(Tensor *out, const Tensor *a, float scalar);
+Tensor *tensor_subtract_scalar_into(Tensor *out, const Tensor *a, float scalar);
+Tensor *tensor_multiply_scalar_into(Tensor *out, const Tensor *a, float scalar);
+Tensor *tensor_divide_scalar_into(Tensor *out, const Tensor *a, float scalar);
+
+// `out` must not alias an input of a matrix multiplication
+Tensor *tensor_matmul_into(Tensor *out, const Tensor *a, const Tensor *b);
+// out = alpha * op(a) * op(b) + beta * out, where op transposes its operand
+// when the matching flag is set, e.g. X^T r or A B^T without a transposed
+// copy. out is not read when beta is 0, so beta 1 accumulates into it.
+Tensor *tensor_gemm(Tensor *out, const Tensor *a, const Tensor *b, bool trans_a, bool trans_b,
+                    float alpha, float beta);
+Tensor *tensor_gram_into(Tensor *out, const Tensor *x);
+Tensor *tensor_gram_double_into(Tensor *out, const Tensor *x);
+// `out` may be b for the solvers
+Tensor *tensor_solve_into(Tensor *out, const Tensor *a, const Tensor *b);
+Tensor *tensor_solve_symmetric_into(Tensor *out, const Tensor *a, const Tensor *b);
+
+Tensor *tensor_sum_axis_into(Tensor *out, const Tensor *tensor, size_t axis);
+Tensor *tensor_mean_axis_into(Tensor *out, const Tensor *tensor, size_t axis);
+// Several reductions over the same axes in one pass, e.g. per-feature mean,
+// variance, min and max: every non-NULL out[op] receives reduction op, in the
+// result shape with or without the reduced axes
+bool tensor_reduce_into(Tensor *const out[TENSOR_REDUCE_COUNT], const Tensor *tensor,
+                        size_t n_axes, const size_t axes[]);
+
+#endif // LA_H
@@ -0,0 +1,436 @@
+#include "lazy.h"
+#include "iter.h"
+#include "kernels.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Elements computed per node before moving on to the next block; the live
+// blocks of a whole expression stay in L1
+#define LAZY_BLOCK 1024
+
+typedef enum { LAZY_INPUT, LAZY_BINARY, LAZY_SCALAR } LazyKind;
+typedef enum { LAZY_ADD, LAZY_SUB, LAZY_MUL, LAZY_DIV } LazyOp;
+
+struct LazyTensor {
+    LazyGraph *graph;
+    LazyKind kind;
+    LazyOp op;
+    const Tensor *tensor; // LAZY_INPUT
+    LazyTensor *a, *b;    // Operands, b only for LAZY_BINARY
+    float scalar;         // LAZY_SCALAR
+    size_t ndim;
+    size_t shape[TENSOR_MAX_DIMS];
+
+    // Evaluation state
+    size_t mark;  // Evaluation that last reached this node
+    size_t index; // Position in the evaluation order
+    size_t slot;  // Scratch block holding the node's values
+};
+
+struct LazyGraph {
+    LazyTensor **nodes; // In creation order, so operands come before their users
+    size_t count;
+    size_t capacity;
+    size_t evaluation;
+};
+
+LazyGraph *lazy_graph_create(void) {
+    LazyGraph *graph = (LazyGraph *)calloc(1, sizeof(LazyGraph));
+    return graph;
+}
+
+void lazy_graph_free(LazyGraph *graph) {
+    if (!graph) {
+        return;
+    }
+    for (size_t i = 0; i < graph->count; i++) {
+        free(graph->nodes[i]);
+    }
+    free(graph->nodes);
+    free(graph);
+}
+
+static LazyTensor *lazy_node(LazyGraph *graph, LazyKind kind, size_t ndim, const size_t shape[]) {
+    if (graph->count == graph->capacity) {
+        size_t capacity = graph->capacity ? graph->capacity * 2 : 16;
+        LazyTensor **nodes = (LazyTensor **)realloc(graph->nodes, capacity * sizeof(LazyTensor *));
+        if (!nodes) {
+            return NULL;
+        }
+        graph->nodes = nodes;
+        graph->capacity = capacity;
+    }
+
+    LazyTensor *node = (LazyTensor *)calloc(1, sizeof(LazyTensor));
+    if (!node) {
+        return NULL;
+    }
+    node->graph = graph;
+    node->kind = kind;
+    node->ndim = ndim;
+    memcpy(node->shape, shape, ndim * sizeof(size_t));
+    graph->nodes[graph->count++] = node;
+    return node;
+}
+
+LazyTensor *lazy_tensor(LazyGraph *graph, const Tensor *t) {
+    if (!graph || !t) {
+        return NULL;
+    }
+    if (t->dtype != TENSOR_F32) {
+        fprintf(stderr, "Error: Lazy expressions need float32 tensors.\n");
+        return NULL;
+    }
+
+    LazyTensor *node = lazy_node(graph, LAZY_INPUT, t->ndim, t->shape);
+    if (node) {
+        node->tensor = t;
+    }
+    return node;
+}
+
+static LazyTensor *lazy_binary(LazyTensor *a, LazyTensor *b, LazyOp op) {
+    if (!a || !b) {
+        return NULL;
+    }
+    if (a->graph != b->graph) {
+        fprintf(stderr, "Error: Lazy tensors belong to different graphs.\n");
+        return NULL;
+    }
+
+    // Same rules as broadcast_shapes, on the recorded shapes
+    size_t ndim = a->ndim > b->ndim ? a->ndim : b->ndim;
+    size_t shape[TENSOR_MAX_DIMS];
+    for (size_t d = 0; d < ndim; d++) {
+        size_t da = d + a->ndim >= ndim ? a->shape[d + a->ndim - ndim] : 1;
+        size_t db = d + b->ndim >= ndim ? b->shape[d + b->ndim - ndim] : 1;
+        if (da != db && da != 1 && db != 1) {
+            fprintf(stderr, "Error: Tensor shapes cannot be broadcast together.\n");
+            return NULL;
+        }
+        shape[d] = da == 1 ? db : da;
+    }
+
+    LazyTensor *node = lazy_node(a->graph, LAZY_BINARY, ndim, shape);
+    if (node) {
+        node->op = op;
+        node->a = a;
+        node->b = b;
+    }
+    return node;
+}
+
+static LazyTensor *lazy_scalar(LazyTensor *a, float scalar, LazyOp op) {
+    if (!a) {
+        return NULL;
+    }
+
+    LazyTensor *node = lazy_node(a->graph, LAZY_SCALAR, a->ndim, a->shape);
+    if (node) {
+        node->op = op;
+        node->a = a;
+        node->scalar = scalar;
+    }
+    return node;
+}
+
+LazyTensor *lazy_add(LazyTensor *a, LazyTensor *b) {
+    return lazy_binary(a, b, LAZY_ADD);
+}
+
+LazyTensor *lazy_subtract(LazyTensor *a, LazyTensor *b) {
+    return lazy_binary(a, b, LAZY_SUB);
+}
+
+LazyTensor *lazy_multiply(LazyTensor *a, LazyTensor *b) {
+    return lazy_binary(a, b, LAZY_MUL);
+}
+
+LazyTensor *lazy_divide(LazyTensor *a, LazyTensor *b) {
+    return lazy_binary(a, b, LAZY_DIV);
+}
+
+LazyTensor *lazy_add_scalar(LazyTensor *a, float scalar) {
+    return lazy_scalar(a, scalar, LAZY_ADD);
+}
+
+LazyTensor *lazy_subtract_scalar(LazyTensor *a, float scalar) {
+    return lazy_scalar(a, scalar, LAZY_SUB);
+}
+
+LazyTensor *lazy_multiply_scalar(LazyTensor *a, float scalar) {
+    return lazy_scalar(a, scalar, LAZY_MUL);
+}
+
+LazyTensor *lazy_divide_scalar(LazyTensor *a, float scalar) {
+    return lazy_scalar(a, scalar, LAZY_DIV);
+}
+
+// Evaluation
+// The nodes reachable from the root are laid out in creation order, which is
+// a topological order. Every node gets a scratch block, and blocks are reused
+// once the last user of a node has run, so a long chain needs only a few.
+typedef struct {
+    LazyTensor **order;
+    size_t n_nodes;
+    const Tensor *inputs[LAZY_MAX_INPUTS];
+    size_t n_inputs;
+    size_t *input_of; // Input number of each LAZY_INPUT node, by index
+    const Dtype **values;
+    Dtype *scratch;
+    const Kernels *kernels;
+} LazyPlan;
+
+static void lazy_plan_free(LazyPlan *plan) {
+    free(plan->order);
+    free(plan->input_of);
+    free(plan->values);
+    free(plan->scratch);
+}
+
+static bool lazy_plan_create(LazyPlan *plan, LazyTensor *root) {
+    LazyGraph *graph = root->graph;
+    size_t mark = ++graph->evaluation;
+
+    memset(plan, 0, sizeof(LazyPlan));
+    plan->kernels = kernels_get();
+
+    // Mark what the root depends on; users come after their operands, so a
+    // single backwards sweep from the root finds all of it
+    root->mark = mark;
+    size_t first = graph->count;
+    for (size_t i = graph->count; i-- > 0;) {
+        LazyTensor *node = graph->nodes[i];
+        if (node->mark != mark) {
+            continue;
+        }
+        first = i;
+        if (node->a) {
+            node->a->mark = mark;
+        }
+        if (node->b) {
+            node->b->mark = mark;
+        }
+    }
+
+    size_t span = graph->count - first;
+    plan->order = (LazyTensor **)malloc(span * sizeof(LazyTensor *));
+    plan->input_of = (size_t *)malloc(span * sizeof(size_t));
+    plan->values = (const Dtype **)malloc(span * sizeof(Dtype *));
+    size_t *last_use = (size_t *)malloc(span * sizeof(size_t));
+    size_t *free_slots = (size_t *)malloc(span * sizeof(size_t));
+    if (!plan->order || !plan->input_of || !plan->values || !last_use || !free_slots) {
+        free(last_use);
+        free(free_slots);
+        lazy_plan_free(plan);
+        return false;
+    }
+
+    for (size_t i = first; i < graph->count; i++) {
+        LazyTensor *node = graph->nodes[i];
+        if (node->mark != mark) {
+            continue;
+        }
+
+        node->index = plan->n_nodes;
+        plan->order[plan->n_nodes] = node;
+        last_use[plan->n_nodes] = node->index;
+        if (node->a) {
+            last_use[node->a->index] = node->index;
+        }
+        if (node->b) {
+            last_use[node->b->index] = node->index;
+        }
+
+        if (node->kind == LAZY_INPUT) {
+            if (plan->n_inputs == LAZY_MAX_INPUTS) {
+                fprintf(stderr, "Error: Expression has more than %d input tensors.\n",
+                        LAZY_MAX_INPUTS);
+                free(last_use);
+                free(free_slots);
+                lazy_plan_free(plan);
+                return false;
+            }
+            plan->input_of[node->index] = plan->n_inputs;
+            plan->inputs[plan->n_inputs++] = node->tensor;
+        }
+        plan->n_nodes++;
+    }
+
+    // Hand out scratch blocks, taking back those of operands whose last user
+    // this node is
+    size_t n_slots = 0, n_free = 0;
+    for (size_t i = 0; i < plan->n_nodes; i++) {
+        LazyTensor *node = plan->order[i];
+        node->slot = n_free > 0 ? free_slots[--n_free] : n_slots++;
+
+        LazyTensor *operands[2] = {node->a, node->b};
+        for (size_t k = 0; k < 2; k++) {
+            LazyTensor *op = operands[k];
+            if (op && last_use[op->index] == i && !(k == 1 && op == node->a)) {
+                free_slots[n_free++] = op->slot;
+            }
+        }
+    }
+    free(last_use);
+    free(free_slots);
+
+    plan->scratch = (Dtype *)aligned_alloc(64, n_slots * LAZY_BLOCK * sizeof(Dtype));
+    if (!plan->scratch) {
+        lazy_plan_free(plan);
+        return false;
+    }
+    return true;
+}
+
+// Compute elements [start, start + len) of the current run for every node.
+// ptrs and strides describe the inputs' runs. When dst is given the root is
+// written there instead of to its scratch block. Returns the root's values.
+static const Dtype *lazy_block(LazyPlan *plan, Dtype *const ptrs[], const size_t strides[],
+                               size_t start, size_t len, Dtype *dst) {
+    const Kernels *k = plan->kernels;
+
+    for (size_t i = 0; i < plan->n_nodes; i++) {
+        LazyTensor *node = plan->order[i];
+        Dtype *out = plan->scratch + node->slot * LAZY_BLOCK;
+        if (dst && i == plan->n_nodes - 1 && node->kind != LAZY_INPUT) {
+            out = dst;
+        }
+
+        if (node->kind == LAZY_INPUT) {
+            size_t input = plan->input_of[i];
+            const Dtype *src = ptrs[input];
+            size_t s = strides[input];
+            if (s == 1) {
+                plan->values[i] = src + start;
+                continue;
+            }
+            for (size_t j = 0; j < len; j++) {
+                out[j] = src[(start + j) * s];
+            }
+        } else if (node->kind == LAZY_BINARY) {
+            const Dtype *a = plan->values[node->a->index];
+            const Dtype *b = plan->values[node->b->index];
+            kernel_binary_fn fns[] = {k->add, k->sub, k->mul, k->div};
+            fns[node->op](len, a, b, out);
+        } else {
+            const Dtype *a = plan->values[node->a->index];
+            kernel_scalar_fn fns[] = {k->add_scalar, k->sub_scalar, k->mul_scalar, k->div_scalar};
+            fns[node->op](len, a, node->scalar, out);
+        }
+        plan->values[i] = out;
+    }
+
+    return plan->values[plan->n_nodes - 1];
+}
+
+// Walk the expression's shape run by run and block by block. With an output
+// tensor the root is stored into it; otherwise the root's blocks are summed.
+static bool lazy_run(LazyTensor *e, Tensor *out, double *sum) {
+    LazyPlan plan;
+    if (!lazy_plan_create(&plan, e)) {
+        return false;
+    }
+
+    const Tensor *operands[ITER_MAX_OPERANDS];
+    size_t first = out ? 1 : 0;
+    operands[0] = out;
+    for (size_t j = 0; j < plan.n_inputs; j++) {
+        operands[first + j] = plan.inputs[j];
+    }
+
+    TensorIter it;
+    iter_init_broadcast(&it, first + plan.n_inputs, operands, e->ndim, e->shape);
+
+    double total = 0;
+    while (iter_next(&it)) {
+        Dtype *const *ptrs = it.ptrs + first;
+        const size_t *strides = it.inner_strides + first;
+
+        for (size_t start = 0; start < it.inner_size; start += LAZY_BLOCK) {
+            size_t len = it.inner_size - start < LAZY_BLOCK ? it.inner_size - start : LAZY_BLOCK;
+
+            if (!out) {
+                const Dtype *values = lazy_block(&plan, ptrs, strides, start, len, NULL);
+                Dtype partial = 0;
+                for (size_t i = 0; i < len; i++) {
+                    partial += values[i];
+                }
+                total += partial;
+                continue;
+            }
+
+            size_t so = it.inner_strides[0];
+            Dtype *dst = it.ptrs[0] + start * so;
+            const Dtype *values = lazy_block(&plan, ptrs, strides, start, len, so == 1 ? dst : NULL);
+            if (values != dst) {
+                for (size_t i = 0; i < len; i++) {
+                    dst[i * so] = values[i];
+                }
+            }
+        }
+    }
+
+    if (sum) {
+        *sum = total;
+    }
+    lazy_plan_free(&plan);
+    return true;
+}
+
+Tensor *lazy_eval_into(Tensor *out, LazyTensor *e) {
+    if (!out || !e) {
+        return NULL;
+    }
+
+    bool ok = out->ndim == e->ndim;
+    for (size_t d = 0; ok && d < e->ndim; d++) {
+        ok = out->shape[d] == e->shape[d];
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Output tensor has the wrong shape.\n");
+        return NULL;
+    }
+    if (out->dtype != TENSOR_F32) {
+        fprintf(stderr, "Error: Lazy expressions need float32 tensors.\n");
+        return NULL;
+    }
+
+    return lazy_run(e, out, NULL) ? out : NULL;
+}
+
+Tensor *lazy_eval(LazyTensor *e) {
+    if (!e) {
+        return NULL;
+    }
+
+    Tensor *out = tensor_create_from_shape(e->ndim, e->shape);
+    if (!lazy_eval_into(out, e)) {
+        tensor_free(out);
+        return NULL;
+    }
+    return out;
+}
+
+Dtype lazy_sum(LazyTensor *e) {
+    double sum;
+    if (!e || !lazy_run(e, NULL, &sum)) {
+        return NAN;
+    }
+    return (Dtype)sum;
+}
+
+Dtype lazy_mean(LazyTensor *e) {
+    if (!e) {
+        return NAN;
+    }
+
+    size_t size = 1;
+    for (size_t d = 0; d < e->ndim; d++) {
+        size *= e->shape[d];
+    }
+    return lazy_sum(e) / size;
+}
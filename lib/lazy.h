@@ -0,0 +1,51 @@
+#ifndef LAZY_H
+#define LAZY_H
+
+#include "tensor.h"
+
+// Lazy Evaluation
+// The lazy_* functions mirror the element-wise and scalar operations of la.h,
+// but only record an expression DAG. Evaluating it runs the whole chain in a
+// single pass: the output is produced in cache-sized blocks, every operation
+// of the chain is applied to a block before the next block is touched, and
+// intermediates never reach memory. A trailing lazy_sum or lazy_mean reduces
+// the blocks directly without writing an output at all.
+//
+//     LazyGraph *g = lazy_graph_create();
+//     LazyTensor *e = lazy_add(lazy_multiply(lazy_tensor(g, a), lazy_tensor(g, b)),
+//                              lazy_multiply_scalar(lazy_tensor(g, c), 2));
+//     Tensor *result = lazy_eval(e);
+//     lazy_graph_free(g);
+//
+// Input tensors are referenced, not copied, and must stay alive until the
+// expression has been evaluated. Shapes broadcast as in la.h. Nodes belong to
+// their graph and are freed with it. An operation on a NULL node (e.g. after
+// a shape error) returns NULL.
+
+typedef struct LazyGraph LazyGraph;
+typedef struct LazyTensor LazyTensor;
+
+// Largest number of distinct input tensors in one evaluated expression
+#define LAZY_MAX_INPUTS 7
+
+LazyGraph *lazy_graph_create(void);
+void lazy_graph_free(LazyGraph *graph);
+
+LazyTensor *lazy_tensor(LazyGraph *graph, const Tensor *t);
+
+LazyTensor *lazy_add(LazyTensor *a, LazyTensor *b);
+LazyTensor *lazy_subtract(LazyTensor *a, LazyTensor *b);
+LazyTensor *lazy_multiply(LazyTensor *a, LazyTensor *b);
+LazyTensor *lazy_divide(LazyTensor *a, LazyTensor *b);
+
+LazyTensor *lazy_add_scalar(LazyTensor *a, float scalar);
+LazyTensor *lazy_subtract_scalar(LazyTensor *a, float scalar);
+LazyTensor *lazy_multiply_scalar(LazyTensor *a, float scalar);
+LazyTensor *lazy_divide_scalar(LazyTensor *a, float scalar);
+
+Tensor *lazy_eval(LazyTensor *e);
+Tensor *lazy_eval_into(Tensor *out, LazyTensor *e);
+Dtype lazy_sum(LazyTensor *e);
+Dtype lazy_mean(LazyTensor *e);
+
+#endif // LAZY_H
@@ -1,4 +1,315 @@
 #include "linear_models.h"
+#include "arena.h"
+#include "gemm.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Streaming normal equations
+// Rows are gathered into blocks of a fixed size and each block's X^T X and
+// X^T y are added to double accumulators. Because a block is always the same
+// rows regardless of how the input was chunked, the sums are computed in the
+// same order and the result does not depend on the chunking.
+
+#define LINEAR_REGRESSION_BLOCK 2048
+
+struct LinearRegression {
+    size_t n_features;
+    size_t n_targets;
+    size_t n_samples;
+    double *xtx; // [n_features, n_features], lower triangle
+    double *xty; // [n_features, n_targets]
+    Dtype *x_block; // Rows of the current, incomplete block
+    Dtype *y_block;
+    size_t buffered;
+    Dtype *product; // One block's product before it is accumulated
+    TensorDtype dtype; // float64 once a float64 chunk has been fitted
+};
+
+LinearRegression *linear_regression_init(size_t n_features, size_t n_targets) {
+    LinearRegression *lr = (LinearRegression *)calloc(1, sizeof(LinearRegression));
+    if (!lr) {
+        return NULL;
+    }
+
+    size_t d = n_features, k = n_targets;
+    lr->n_features = d;
+    lr->n_targets = k;
+    lr->dtype = TENSOR_F32;
+    lr->xtx = (double *)calloc(d * d, sizeof(double));
+    lr->xty = (double *)calloc(d * k, sizeof(double));
+    lr->x_block = (Dtype *)malloc(LINEAR_REGRESSION_BLOCK * d * sizeof(Dtype));
+    lr->y_block = (Dtype *)malloc(LINEAR_REGRESSION_BLOCK * k * sizeof(Dtype));
+    lr->product = (Dtype *)malloc((d > k ? d : k) * d * sizeof(Dtype));
+    if (!lr->xtx || !lr->xty || !lr->x_block || !lr->y_block || !lr->product) {
+        linear_regression_free(lr);
+        return NULL;
+    }
+    return lr;
+}
+
+void linear_regression_free(LinearRegression *lr) {
+    if (!lr) {
+        return;
+    }
+    free(lr->xtx);
+    free(lr->xty);
+    free(lr->x_block);
+    free(lr->y_block);
+    free(lr->product);
+    free(lr);
+}
+
+// Add X^T X and X^T y of m rows, given by their row and column strides
+static void linear_regression_accumulate(LinearRegression *lr, double *xtx, double *xty,
+                                         size_t m, const Dtype *x, size_t rsx, size_t csx,
+                                         const Dtype *y, size_t rsy, size_t csy) {
+    size_t d = lr->n_features, k = lr->n_targets;
+
+    // X^T X is symmetric, only its lower triangle is formed and kept
+    gemm_ssyrk(d, m, 1.0f, x, csx, rsx, 0.0f, lr->product, d, 1);
+    for (size_t i = 0; i < d; i++) {
+        for (size_t j = 0; j <= i; j++) {
+            xtx[i * d + j] += lr->product[i * d + j];
+        }
+    }
+
+    gemm_sgemm(d, k, m, 1.0f, x, csx, rsx, y, rsy, csy, 0.0f, lr->product, k, 1);
+    for (size_t i = 0; i < d * k; i++) {
+        xty[i] += lr->product[i];
+    }
+}
+
+// float64 rows are added to the accumulators one at a time, in double
+static void linear_regression_accumulate_f64(LinearRegression *lr, const Tensor *X,
+                                             const Tensor *y) {
+    size_t d = lr->n_features, k = lr->n_targets;
+    for (size_t r = 0; r < X->shape[0]; r++) {
+        const double *xr = X->data_f64 + r * X->strides[0];
+        const double *yr = y->data_f64 + r * y->strides[0];
+        for (size_t i = 0; i < d; i++) {
+            double xi = xr[i * X->strides[1]];
+            double *xtx = lr->xtx + i * d;
+            for (size_t j = 0; j <= i; j++) {
+                xtx[j] += xi * xr[j * X->strides[1]];
+            }
+            double *xty = lr->xty + i * k;
+            for (size_t c = 0; c < k; c++) {
+                xty[c] += xi * yr[c * y->strides[1]];
+            }
+        }
+    }
+}
+
+// The solvers read float32 data, and the normal equations float64 too
+static bool check_dtype(const Tensor *t, bool f64) {
+    if (t->dtype != TENSOR_F32 && !(f64 && t->dtype == TENSOR_F64)) {
+        fprintf(stderr, "Error: Operation needs float32%s tensors, got %s.\n",
+                f64 ? " or float64" : "", tensor_dtype_name(t->dtype));
+        return false;
+    }
+    return true;
+}
+
+bool linear_regression_partial_fit(LinearRegression *lr, const Tensor *X, const Tensor *y) {
+    if (!check_dtype(X, true) || !check_dtype(y, true)) {
+        return false;
+    }
+    if (X->dtype != y->dtype) {
+        fprintf(stderr, "Error: X and y must have the same dtype, got %s and %s.\n",
+                tensor_dtype_name(X->dtype), tensor_dtype_name(y->dtype));
+        return false;
+    }
+    if (X->ndim != 2 || y->ndim != 2 || X->shape[1] != lr->n_features ||
+        y->shape[1] != lr->n_targets) {
+        fprintf(stderr, "Chunk shapes do not match the model\n");
+        return false;
+    }
+    if (X->shape[0] != y->shape[0]) {
+        fprintf(stderr, "Number of samples in X and Y do not match\n");
+        return false;
+    }
+
+    size_t d = lr->n_features, k = lr->n_targets, rows = X->shape[0];
+    if (X->dtype == TENSOR_F64) {
+        linear_regression_accumulate_f64(lr, X, y);
+        lr->dtype = TENSOR_F64;
+        lr->n_samples += rows;
+        return true;
+    }
+
+    size_t i = 0;
+    while (i < rows) {
+        // Whole blocks are read straight from the chunk
+        if (lr->buffered == 0 && rows - i >= LINEAR_REGRESSION_BLOCK) {
+            linear_regression_accumulate(lr, lr->xtx, lr->xty, LINEAR_REGRESSION_BLOCK,
+                                         X->data + i * X->strides[0], X->strides[0], X->strides[1],
+                                         y->data + i * y->strides[0], y->strides[0], y->strides[1]);
+            i += LINEAR_REGRESSION_BLOCK;
+            continue;
+        }
+
+        size_t m = LINEAR_REGRESSION_BLOCK - lr->buffered;
+        if (m > rows - i) {
+            m = rows - i;
+        }
+        for (size_t r = 0; r < m; r++) {
+            const Dtype *xr = X->data + (i + r) * X->strides[0];
+            const Dtype *yr = y->data + (i + r) * y->strides[0];
+            Dtype *xb = lr->x_block + (lr->buffered + r) * d;
+            Dtype *yb = lr->y_block + (lr->buffered + r) * k;
+            for (size_t j = 0; j < d; j++) {
+                xb[j] = xr[j * X->strides[1]];
+            }
+            for (size_t j = 0; j < k; j++) {
+                yb[j] = yr[j * y->strides[1]];
+            }
+        }
+        lr->buffered += m;
+        i += m;
+
+        if (lr->buffered == LINEAR_REGRESSION_BLOCK) {
+            linear_regression_accumulate(lr, lr->xtx, lr->xty, LINEAR_REGRESSION_BLOCK,
+                                         lr->x_block, d, 1, lr->y_block, k, 1);
+            lr->buffered = 0;
+        }
+    }
+
+    lr->n_samples += rows;
+    return true;
+}
+
+bool linear_regression_partial_fit_sparse(LinearRegression *lr, const SparseTensor *X,
+                                          const Tensor *y) {
+    if (y->ndim != 2 || X->cols != lr->n_features || y->shape[1] != lr->n_targets) {
+        fprintf(stderr, "Chunk shapes do not match the model\n");
+        return false;
+    }
+    if (X->rows != y->shape[0]) {
+        fprintf(stderr, "Number of samples in X and Y do not match\n");
+        return false;
+    }
+    if (!check_dtype(y, false)) {
+        return false;
+    }
+
+    if (!sparse_gram_accumulate(lr->xtx, lr->xty, X, y)) {
+        return false;
+    }
+    lr->n_samples += X->rows;
+    return true;
+}
+
+// Solve a w = b in place for the symmetric positive definite d x d a, of
+// which the lower triangle is read, and the d x k right-hand side b. a is
+// overwritten by its Cholesky factor.
+static bool cholesky_solve_f64(size_t d, size_t k, double *a, double *b) {
+    for (size_t j = 0; j < d; j++) {
+        double *aj = a + j * d;
+        double pivot = aj[j];
+        for (size_t p = 0; p < j; p++) {
+            pivot -= aj[p] * aj[p];
+        }
+        if (!(pivot > 0)) {
+            return false;
+        }
+        aj[j] = sqrt(pivot);
+        for (size_t i = j + 1; i < d; i++) {
+            double *ai = a + i * d;
+            double s = ai[j];
+            for (size_t p = 0; p < j; p++) {
+                s -= ai[p] * aj[p];
+            }
+            ai[j] = s / aj[j];
+        }
+    }
+
+    // L z = b, then L^T w = z
+    for (size_t c = 0; c < k; c++) {
+        for (size_t i = 0; i < d; i++) {
+            double s = b[i * k + c];
+            for (size_t p = 0; p < i; p++) {
+                s -= a[i * d + p] * b[p * k + c];
+            }
+            b[i * k + c] = s / a[i * d + i];
+        }
+        for (size_t i = d; i-- > 0;) {
+            double s = b[i * k + c];
+            for (size_t p = i + 1; p < d; p++) {
+                s -= a[p * d + i] * b[p * k + c];
+            }
+            b[i * k + c] = s / a[i * d + i];
+        }
+    }
+    return true;
+}
+
+Tensor *linear_regression_finalize(LinearRegression *lr) {
+    size_t d = lr->n_features, k = lr->n_targets;
+
+    // The incomplete block is added to copies, so fitting can go on
+    double *xtx = (double *)malloc(d * d * sizeof(double));
+    double *xty = (double *)malloc(d * k * sizeof(double));
+    if (!xtx || !xty) {
+        free(xtx);
+        free(xty);
+        return NULL;
+    }
+    memcpy(xtx, lr->xtx, d * d * sizeof(double));
+    memcpy(xty, lr->xty, d * k * sizeof(double));
+    if (lr->buffered > 0) {
+        linear_regression_accumulate(lr, xtx, xty, lr->buffered, lr->x_block, d, 1,
+                                     lr->y_block, k, 1);
+    }
+
+    // A float64 fit is solved in double and gives float64 weights
+    size_t w_shape[] = {d, k};
+    if (lr->dtype == TENSOR_F64) {
+        Tensor *W = NULL;
+        if (cholesky_solve_f64(d, k, xtx, xty)) {
+            W = tensor_create_typed(TENSOR_F64, 2, w_shape);
+            memcpy(W->data_f64, xty, d * k * sizeof(double));
+        } else {
+            fprintf(stderr, "X^T X is singular\n");
+        }
+        free(xtx);
+        free(xty);
+        return W;
+    }
+
+    // The weights outlive the scratch scope below
+    Tensor *W = tensor_create_from_shape(2, w_shape);
+
+    // Intermediates are allocated from an arena scope and released together
+    arena_push();
+
+    Tensor *XtX = tensor_create(2, d, d);
+    Tensor *XtY = tensor_create_from_shape(2, w_shape);
+    for (size_t i = 0; i < d; i++) {
+        for (size_t j = 0; j <= i; j++) {
+            XtX->data[i * d + j] = XtX->data[j * d + i] = (Dtype)xtx[i * d + j];
+        }
+    }
+    for (size_t i = 0; i < d * k; i++) {
+        XtY->data[i] = (Dtype)xty[i];
+    }
+    // X^T X is symmetric positive definite unless X has dependent columns
+    bool solved = tensor_solve_symmetric_into(W, XtX, XtY) != NULL;
+
+    arena_pop();
+    free(xtx);
+    free(xty);
+
+    if (!solved) {
+        fprintf(stderr, "X^T X is singular\n");
+        tensor_free(W);
+        return NULL;
+    }
+
+    return W;
+}
 
 Tensor *solve_linear_regression(const Tensor *X, const Tensor *y) {
     // Check if X and Y have the same number of samples
@@ -7,18 +318,217 @@ Tensor *solve_linear_regression(const Tensor *X, const Tensor *y) {
         return NULL;
     }
 
-    // Perform linear regression
-    Tensor *Xt = tensor_transpose(X);
-    Tensor *XtX = tensor_matmul(Xt, X);
-    Tensor *XtX_inv = tensor_inverse(XtX);
-    Tensor *XtY = tensor_matmul(Xt, y);
-    Tensor *W = tensor_matmul(XtX_inv, XtY);
+    // The in-memory solve is a stream of one chunk
+    LinearRegression *lr = linear_regression_init(X->shape[1], y->shape[1]);
+    if (!lr) {
+        return NULL;
+    }
+    Tensor *W = linear_regression_partial_fit(lr, X, y) ? linear_regression_finalize(lr) : NULL;
+    linear_regression_free(lr);
+    return W;
+}
+
+Tensor *solve_sparse_linear_regression(const SparseTensor *X, const Tensor *y) {
+    if (y->ndim != 2 || X->rows != y->shape[0]) {
+        fprintf(stderr, "Number of samples in X and Y do not match\n");
+        return NULL;
+    }
+
+    LinearRegression *lr = linear_regression_init(X->cols, y->shape[1]);
+    if (!lr) {
+        return NULL;
+    }
+    Tensor *W = linear_regression_partial_fit_sparse(lr, X, y) ? linear_regression_finalize(lr)
+                                                               : NULL;
+    linear_regression_free(lr);
+    return W;
+}
+
+// Tall-skinny QR
+// The rows of [X | y] are split into one range per worker. Each worker folds
+// its rows into a p x p upper triangular R, a block at a time, with
+// Householder reflections; the R factors are then merged pairwise in a tree.
+// The final R holds R_X in its leading d x d corner and Q^T y to its right.
+
+// Rows per block are chosen so that a block holds about this many floats
+#define TSQR_BLOCK_FLOATS (64 * 1024)
+
+typedef struct {
+    const Tensor *X;
+    const Tensor *y;
+    size_t n, d, p; // p = d + columns of y
+    size_t n_chunks;
+    Dtype *r;    // One p x p R factor per chunk
+    size_t step; // Distance between merged factors during the reduction
+    atomic_bool failed; // A worker could not allocate its scratch
+} TsqrContext;
+
+// Fold the m x p rows of b into the upper triangular p x p matrix r, so that
+// [r; b] = Q [r'; 0]. Row-major throughout; b is destroyed and w is p floats
+// of scratch.
+static void tsqr_fold(size_t p, Dtype *r, size_t m, Dtype *b, Dtype *w) {
+    for (size_t j = 0; j < p; j++) {
+        double norm2 = 0;
+        for (size_t i = 0; i < m; i++) {
+            norm2 += (double)b[i * p + j] * b[i * p + j];
+        }
+        if (norm2 == 0) {
+            continue;
+        }
+
+        // Reflect [r_jj; b_j] onto alpha e_1 with v = [r_jj - alpha; b_j]
+        Dtype *rj = r + j * p;
+        double norm = sqrt(norm2 + (double)rj[j] * rj[j]);
+        Dtype alpha = (Dtype)(rj[j] > 0 ? -norm : norm);
+        Dtype v0 = rj[j] - alpha;
+        Dtype scale = (Dtype)(2.0 / ((double)v0 * v0 + norm2));
+        rj[j] = alpha;
+
+        // w = 2 v^T [r; b] / v^T v over the remaining columns, one pass over
+        // the rows of b to form it and one to apply it
+        for (size_t c = j + 1; c < p; c++) {
+            w[c] = v0 * rj[c];
+        }
+        for (size_t i = 0; i < m; i++) {
+            const Dtype *bi = b + i * p;
+            for (size_t c = j + 1; c < p; c++) {
+                w[c] += bi[j] * bi[c];
+            }
+        }
+        for (size_t c = j + 1; c < p; c++) {
+            w[c] *= scale;
+            rj[c] -= v0 * w[c];
+        }
+        for (size_t i = 0; i < m; i++) {
+            Dtype *bi = b + i * p;
+            for (size_t c = j + 1; c < p; c++) {
+                bi[c] -= bi[j] * w[c];
+            }
+        }
+    }
+}
+
+static void tsqr_chunks(void *arg, size_t begin, size_t end) {
+    TsqrContext *ctx = (TsqrContext *)arg;
+    size_t p = ctx->p, d = ctx->d;
+    size_t block_rows = TSQR_BLOCK_FLOATS / p > 0 ? TSQR_BLOCK_FLOATS / p : 1;
+    Dtype *b = (Dtype *)malloc(block_rows * p * sizeof(Dtype));
+    Dtype *w = (Dtype *)malloc(p * sizeof(Dtype));
+    if (!b || !w) {
+        atomic_store(&ctx->failed, true);
+        free(b);
+        free(w);
+        return;
+    }
+
+    const Tensor *X = ctx->X, *y = ctx->y;
+    for (size_t chunk = begin; chunk < end; chunk++) {
+        Dtype *r = ctx->r + chunk * p * p;
+        memset(r, 0, p * p * sizeof(Dtype));
+
+        size_t lo = chunk * ctx->n / ctx->n_chunks;
+        size_t hi = (chunk + 1) * ctx->n / ctx->n_chunks;
+        for (size_t start = lo; start < hi; start += block_rows) {
+            size_t m = hi - start < block_rows ? hi - start : block_rows;
+            for (size_t i = 0; i < m; i++) {
+                const Dtype *xi = X->data + (start + i) * X->strides[0];
+                const Dtype *yi = y->data + (start + i) * y->strides[0];
+                for (size_t j = 0; j < d; j++) {
+                    b[i * p + j] = xi[j * X->strides[1]];
+                }
+                for (size_t j = d; j < p; j++) {
+                    b[i * p + j] = yi[(j - d) * y->strides[1]];
+                }
+            }
+            tsqr_fold(p, r, m, b, w);
+        }
+    }
+
+    free(b);
+    free(w);
+}
+
+// Fold factor 2k step + step into factor 2k step for every pair k
+static void tsqr_merge(void *arg, size_t begin, size_t end) {
+    TsqrContext *ctx = (TsqrContext *)arg;
+    size_t p = ctx->p;
+    Dtype *w = (Dtype *)malloc(p * sizeof(Dtype));
+    if (!w) {
+        atomic_store(&ctx->failed, true);
+        return;
+    }
+
+    for (size_t k = begin; k < end; k++) {
+        size_t target = 2 * k * ctx->step, source = target + ctx->step;
+        if (source < ctx->n_chunks) {
+            tsqr_fold(p, ctx->r + target * p * p, p, ctx->r + source * p * p, w);
+        }
+    }
+    free(w);
+}
+
+Tensor *solve_linear_regression_tsqr(const Tensor *X, const Tensor *y) {
+    if (!check_dtype(X, false) || !check_dtype(y, false)) {
+        return NULL;
+    }
+    if (X->shape[0] != y->shape[0]) {
+        fprintf(stderr, "Number of samples in X and Y do not match\n");
+        return NULL;
+    }
+
+    size_t n = X->shape[0], d = X->shape[1], k = y->shape[1];
+    size_t p = d + k;
+
+    // One range of at least p rows per worker
+    size_t n_chunks = parallel_num_threads();
+    if (n_chunks > n / p) {
+        n_chunks = n / p > 0 ? n / p : 1;
+    }
+
+    TsqrContext ctx = {.X = X, .y = y, .n = n, .d = d, .p = p, .n_chunks = n_chunks};
+    atomic_init(&ctx.failed, false);
+    ctx.r = (Dtype *)malloc(n_chunks * p * p * sizeof(Dtype));
+    if (!ctx.r) {
+        fprintf(stderr, "Error: Cannot allocate the TSQR factors.\n");
+        return NULL;
+    }
+
+    parallel_for(n_chunks, tsqr_chunks, &ctx);
+    for (ctx.step = 1; ctx.step < n_chunks && !atomic_load(&ctx.failed); ctx.step *= 2) {
+        parallel_for((n_chunks + 2 * ctx.step - 1) / (2 * ctx.step), tsqr_merge, &ctx);
+    }
+    if (atomic_load(&ctx.failed)) {
+        fprintf(stderr, "Error: Cannot allocate the TSQR scratch buffers.\n");
+        free(ctx.r);
+        return NULL;
+    }
 
-    // Clean up
-    tensor_free(Xt);
-    tensor_free(XtX);
-    tensor_free(XtX_inv);
-    tensor_free(XtY);
+    // R_X W = Q^T y by back substitution, refusing a numerically singular R_X
+    const Dtype *r = ctx.r;
+    Dtype max_diag = 0;
+    for (size_t i = 0; i < d; i++) {
+        max_diag = fmaxf(max_diag, fabsf(r[i * p + i]));
+    }
+    for (size_t i = 0; i < d; i++) {
+        if (!(fabsf(r[i * p + i]) > max_diag * 1e-6f)) {
+            fprintf(stderr, "X has linearly dependent columns\n");
+            free(ctx.r);
+            return NULL;
+        }
+    }
+
+    size_t w_shape[] = {d, k};
+    Tensor *W = tensor_create_from_shape(2, w_shape);
+    for (size_t i = d; i-- > 0;) {
+        for (size_t c = 0; c < k; c++) {
+            Dtype s = r[i * p + d + c];
+            for (size_t j = i + 1; j < d; j++) {
+                s -= r[i * p + j] * W->data[j * k + c];
+            }
+            W->data[i * k + c] = s / r[i * p + i];
+        }
+    }
 
+    free(ctx.r);
     return W;
-}
\ No newline at end of file
+}
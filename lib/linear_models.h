@@ -3,7 +3,52 @@
 
 #include "tensor.h"
 #include "la.h"
+#include "sparse.h"
 
+// Least squares W minimizing |X W - y| for X [n, d] and y [n, k].
+// solve_linear_regression solves the normal equations X^T X W = X^T y, which
+// is fast but squares the condition number of X.
+// solve_linear_regression_tsqr factors [X | y] with a tall-skinny QR that
+// runs over row blocks on all cores; it keeps the accuracy of QR and suits
+// n much larger than d.
+// The normal equations take float32 or float64 X and y of the same dtype;
+// float64 data is accumulated and solved in double, for badly conditioned
+// X, and gives float64 weights. TSQR and sparse fits read float32 only.
 Tensor *solve_linear_regression(const Tensor *X, const Tensor *y);
+Tensor *solve_linear_regression_tsqr(const Tensor *X, const Tensor *y);
+
+// Streaming fit
+// Accumulates X^T X and X^T y one chunk of rows at a time, so data that does
+// not fit in memory is fitted in a single sequential pass:
+//
+//     LinearRegression *lr = linear_regression_init(d, k);
+//     while (next_chunk(&X, &y)) {
+//         linear_regression_partial_fit(lr, X, y);
+//     }
+//     Tensor *W = linear_regression_finalize(lr);
+//     linear_regression_free(lr);
+//
+// Memory use depends on d and k only. The result is the same, bit for bit,
+// however the rows are split into chunks, and equals solve_linear_regression
+// on all rows at once. finalize may be called at any point and fitting may
+// continue after it. Once a float64 chunk has been fitted, finalize solves
+// in double and returns float64 weights.
+typedef struct LinearRegression LinearRegression;
+
+LinearRegression *linear_regression_init(size_t n_features, size_t n_targets);
+bool linear_regression_partial_fit(LinearRegression *lr, const Tensor *X, const Tensor *y);
+Tensor *linear_regression_finalize(LinearRegression *lr);
+void linear_regression_free(LinearRegression *lr);
+
+// Sparse X
+// The normal equations of a sparse X [n, d], e.g. one-hot encoded features,
+// built from its nonzeros straight into the double accumulators, in time
+// proportional to the products of nonzeros sharing a row and memory
+// proportional to the nonzeros plus d^2. Sparse chunks may be mixed with
+// dense ones in a streaming fit; the sparse rows give the same bits however
+// they are chunked.
+Tensor *solve_sparse_linear_regression(const SparseTensor *X, const Tensor *y);
+bool linear_regression_partial_fit_sparse(LinearRegression *lr, const SparseTensor *X,
+                                          const Tensor *y);
 
 #endif // LINEAR_MODELS_H
\ No newline at end of file
@@ -0,0 +1,386 @@
+#define _GNU_SOURCE
+#include "parallel.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PARALLEL_MAX_THREADS 256
+// Block results parallel_reduce keeps on the stack
+#define REDUCE_STACK_BLOCKS 64
+
+// What is left of one thread's share of the current job. Owners take from
+// the front, thieves from the back.
+typedef struct {
+    alignas(64) pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+} PoolShare;
+
+// A queued parallel_spawn call
+typedef struct PoolTask {
+    parallel_task_fn fn;
+    void *ctx;
+    struct PoolTask *next;
+} PoolTask;
+
+static struct {
+    pthread_mutex_t lock; // Guards the fields below, not the shares
+    pthread_cond_t wake;  // A job or task was posted, or the pool is stopping
+    pthread_cond_t done;  // The last worker left a job
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    size_t n_workers; // Started threads, the caller of a job not counted
+    bool stop;
+
+    // The current job. Idle workers join it while it is open and has shares
+    // left; the shares of workers busy with tasks are stolen by the others.
+    bool open;
+    parallel_fn fn;
+    void *ctx;
+    size_t grain;
+    size_t n_shares; // The caller being share 0
+    size_t next_share;
+    size_t joined; // Workers still inside the job
+
+    PoolTask *tasks; // Queue of spawned tasks
+    PoolTask *last_task;
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER,
+          .wake = PTHREAD_COND_INITIALIZER,
+          .done = PTHREAD_COND_INITIALIZER};
+
+static PoolShare shares[PARALLEL_MAX_THREADS];
+static bool shares_ready;
+// Held by the thread running a job, which also owns starting and stopping
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_size_t requested_threads;
+static _Thread_local bool in_job;
+static _Thread_local bool is_worker;
+
+size_t parallel_num_threads(void) {
+    size_t requested = atomic_load(&requested_threads);
+    if (requested > 0) {
+        return requested;
+    }
+
+    const char *env = getenv("MLC_NUM_THREADS");
+    long n = env ? strtol(env, NULL, 10) : 0;
+    if (n < 1) {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (n < 1) {
+        return 1;
+    }
+    return n > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS : (size_t)n;
+}
+
+void parallel_set_num_threads(size_t n) {
+    atomic_store(&requested_threads, n > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS : n);
+}
+
+static bool share_take(size_t self, size_t *begin, size_t *end) {
+    PoolShare *s = &shares[self];
+    pthread_mutex_lock(&s->lock);
+    bool found = s->begin < s->end;
+    if (found) {
+        *begin = s->begin;
+        *end = s->end - s->begin > pool.grain ? s->begin + pool.grain : s->end;
+        s->begin = *end;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return found;
+}
+
+// Move the back half of the first non-empty share after self into self's
+// share, or all of it when that is no more than a grain, and take a piece
+static bool share_steal(size_t self, size_t n_shares, size_t *begin, size_t *end) {
+    for (size_t i = 1; i < n_shares; i++) {
+        PoolShare *victim = &shares[(self + i) % n_shares];
+        pthread_mutex_lock(&victim->lock);
+        size_t left = victim->end - victim->begin;
+        size_t stolen_begin = left > pool.grain ? victim->end - left / 2 : victim->begin;
+        size_t stolen_end = victim->end;
+        victim->end = stolen_begin;
+        pthread_mutex_unlock(&victim->lock);
+        if (left == 0) {
+            continue;
+        }
+
+        *begin = stolen_begin;
+        *end = stolen_end - stolen_begin > pool.grain ? stolen_begin + pool.grain : stolen_end;
+        PoolShare *s = &shares[self];
+        pthread_mutex_lock(&s->lock);
+        s->begin = *end;
+        s->end = stolen_end;
+        pthread_mutex_unlock(&s->lock);
+        return true;
+    }
+    return false;
+}
+
+static void pool_run(size_t self, size_t n_shares) {
+    size_t begin, end;
+    in_job = true;
+    while (share_take(self, &begin, &end) || share_steal(self, n_shares, &begin, &end)) {
+        pool.fn(pool.ctx, begin, end);
+    }
+    in_job = false;
+}
+
+static void *pool_worker(void *arg) {
+    (void)arg;
+    is_worker = true;
+
+    pthread_mutex_lock(&pool.lock);
+    while (!pool.stop) {
+        // Jobs first: their caller is waiting
+        if (pool.open && pool.next_share < pool.n_shares) {
+            size_t self = pool.next_share++, n_shares = pool.n_shares;
+            pool.joined++;
+            pthread_mutex_unlock(&pool.lock);
+            pool_run(self, n_shares);
+            pthread_mutex_lock(&pool.lock);
+            if (--pool.joined == 0) {
+                pthread_cond_signal(&pool.done);
+            }
+        } else if (pool.tasks) {
+            PoolTask *task = pool.tasks;
+            pool.tasks = task->next;
+            pthread_mutex_unlock(&pool.lock);
+            task->fn(task->ctx);
+            free(task);
+            pthread_mutex_lock(&pool.lock);
+        } else {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+// Pin a worker to the index-th CPU this process may run on
+static void pool_pin(pthread_t thread, size_t index) {
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+
+    index %= (size_t)CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && index-- == 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            pthread_setaffinity_np(thread, sizeof(one), &one);
+            return;
+        }
+    }
+#else
+    (void)thread;
+    (void)index;
+#endif
+}
+
+// Workers finish the task they are running, queued tasks stay queued
+static void pool_stop(void) {
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = true;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (size_t i = 1; i <= pool.n_workers; i++) {
+        pthread_join(pool.threads[i], NULL);
+    }
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = false;
+    pool.n_workers = 0;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// Run queued tasks on the calling thread, for a pool without workers
+static void pool_drain(void) {
+    pthread_mutex_lock(&pool.lock);
+    while (pool.tasks) {
+        PoolTask *task = pool.tasks;
+        pool.tasks = task->next;
+        pthread_mutex_unlock(&pool.lock);
+        task->fn(task->ctx);
+        free(task);
+        pthread_mutex_lock(&pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// Run with n_threads - 1 workers, restarting the pool when it has another
+// count. A worker cannot restart the pool it runs on, so it keeps the current
+// one. Called with job_lock held, returns the number of workers running.
+static size_t pool_start(size_t n_threads) {
+    if (!shares_ready) {
+        for (size_t i = 0; i < PARALLEL_MAX_THREADS; i++) {
+            pthread_mutex_init(&shares[i].lock, NULL);
+        }
+        shares_ready = true;
+    }
+    if (pool.n_workers == n_threads - 1 || is_worker) {
+        return pool.n_workers;
+    }
+    if (pool.n_workers > 0) {
+        pool_stop();
+    }
+
+    const char *pin = getenv("MLC_PIN_THREADS");
+    for (size_t i = 1; i < n_threads; i++) {
+        if (pthread_create(&pool.threads[i], NULL, pool_worker, NULL) != 0) {
+            break;
+        }
+        if (pin && atoi(pin) > 0) {
+            pool_pin(pool.threads[i], i);
+        }
+        pthread_mutex_lock(&pool.lock);
+        pool.n_workers = i;
+        pthread_mutex_unlock(&pool.lock);
+    }
+    if (pool.n_workers == 0) {
+        pool_drain();
+    }
+    return pool.n_workers;
+}
+
+void parallel_for_grain(size_t n, size_t grain, parallel_fn fn, void *ctx) {
+    if (n == 0) {
+        return;
+    }
+    if (grain == 0) {
+        grain = 1;
+    }
+
+    size_t n_threads = parallel_num_threads();
+    size_t n_pieces = (n - 1) / grain + 1;
+    size_t n_shares = n_threads < n_pieces ? n_threads : n_pieces;
+    if (n_shares <= 1 || in_job || pthread_mutex_trylock(&job_lock) != 0) {
+        fn(ctx, 0, n);
+        return;
+    }
+
+    // A worker that cannot be started leaves its share to the others
+    size_t n_workers = pool_start(n_threads);
+    if (n_shares > n_workers + 1) {
+        n_shares = n_workers + 1;
+    }
+    if (n_shares <= 1) {
+        pthread_mutex_unlock(&job_lock);
+        fn(ctx, 0, n);
+        return;
+    }
+
+    for (size_t i = 0; i < n_shares; i++) {
+        shares[i].begin = i * n / n_shares;
+        shares[i].end = (i + 1) * n / n_shares;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.grain = grain;
+    pool.n_shares = n_shares;
+    pool.next_share = 1;
+    pool.open = true;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    pool_run(0, n_shares);
+
+    // Nothing is left to take; wait for the workers still on their last piece
+    pthread_mutex_lock(&pool.lock);
+    pool.open = false;
+    while (pool.joined > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&job_lock);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+void parallel_spawn(parallel_task_fn fn, void *ctx) {
+    // Start the pool unless a job of another thread holds it, in which case
+    // it is running already
+    if (!in_job && pthread_mutex_trylock(&job_lock) == 0) {
+        pool_start(parallel_num_threads());
+        pthread_mutex_unlock(&job_lock);
+    }
+
+    PoolTask *task = (PoolTask *)malloc(sizeof(PoolTask));
+    if (!task) {
+        fn(ctx);
+        return;
+    }
+    *task = (PoolTask){fn, ctx, NULL};
+
+    // The worker count is read under the same lock as the enqueue, so a pool
+    // stopped in between cannot strand the task
+    pthread_mutex_lock(&pool.lock);
+    if (pool.tasks) {
+        pool.last_task->next = task;
+    } else {
+        pool.tasks = task;
+    }
+    pool.last_task = task;
+    size_t n_workers = pool.n_workers;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    if (n_workers == 0) {
+        pool_drain();
+    }
+}
+
+void parallel_for(size_t n, parallel_fn fn, void *ctx) {
+    parallel_for_grain(n, 1, fn, ctx);
+}
+
+typedef struct {
+    parallel_reduce_fn fn;
+    void *ctx;
+    size_t n;
+    size_t grain;
+    double *partial;
+} ReduceJob;
+
+static void reduce_blocks(void *arg, size_t begin, size_t end) {
+    ReduceJob *job = (ReduceJob *)arg;
+    for (size_t b = begin; b < end; b++) {
+        size_t lo = b * job->grain;
+        size_t hi = job->n - lo > job->grain ? lo + job->grain : job->n;
+        job->partial[b] = job->fn(job->ctx, lo, hi);
+    }
+}
+
+double parallel_reduce(size_t n, size_t grain, parallel_reduce_fn fn, void *ctx) {
+    if (n == 0) {
+        return 0;
+    }
+    if (grain == 0) {
+        grain = 1;
+    }
+
+    size_t n_blocks = (n - 1) / grain + 1;
+    if (n_blocks == 1) {
+        return fn(ctx, 0, n);
+    }
+
+    double stack[REDUCE_STACK_BLOCKS];
+    double *partial = n_blocks <= REDUCE_STACK_BLOCKS ? stack : (double *)malloc(n_blocks * sizeof(double));
+    ReduceJob job = {fn, ctx, n, grain, partial};
+    parallel_for(n_blocks, reduce_blocks, &job);
+
+    double total = 0;
+    for (size_t b = 0; b < n_blocks; b++) {
+        total += partial[b];
+    }
+    if (partial != stack) {
+        free(partial);
+    }
+    return total;
+}
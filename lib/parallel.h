@@ -0,0 +1,48 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+// Shared thread pool
+// Worker threads are started on the first parallel call and then sleep
+// between jobs. A job splits the index range [0, n) into one contiguous share
+// per thread. The calling thread works on the first share and idle workers
+// join to take the others; each takes grain-sized pieces off the front of its
+// own share and, once that is empty, steals the back half of another
+// remaining share. The call returns when every index has been processed. fn
+// must be safe to call concurrently on disjoint ranges, and is called on
+// pieces of any size, so the result must not depend on how the range is
+// split.
+//
+// Ranges of at most grain indices run serially on the calling thread, as does
+// a parallel call made from inside a job or while another thread's job holds
+// the pool.
+typedef void (*parallel_fn)(void *ctx, size_t begin, size_t end);
+typedef double (*parallel_reduce_fn)(void *ctx, size_t begin, size_t end);
+
+// Elements a memory-bound loop should have per piece before splitting pays
+// for waking the pool
+#define PARALLEL_GRAIN 32768
+
+// Each index is a unit of work worth a piece of its own
+void parallel_for(size_t n, parallel_fn fn, void *ctx);
+void parallel_for_grain(size_t n, size_t grain, parallel_fn fn, void *ctx);
+// Sum of fn over the blocks [0, grain), [grain, 2 grain), ... of [0, n),
+// added in block order, so the result does not depend on the thread count
+double parallel_reduce(size_t n, size_t grain, parallel_reduce_fn fn, void *ctx);
+
+// Run fn(ctx) on a pool worker as soon as one is free, without waiting for
+// it. Workers prefer joining jobs to starting tasks. A task may itself run
+// parallel jobs, which then use the workers not busy with other tasks. With
+// a single thread the task runs on the calling thread before returning.
+typedef void (*parallel_task_fn)(void *ctx);
+void parallel_spawn(parallel_task_fn fn, void *ctx);
+
+// The value set by parallel_set_num_threads, else MLC_NUM_THREADS when set,
+// else the number of online processors. Setting 0 goes back to the default.
+// The pool is restarted at the next job when the count changes. With
+// MLC_PIN_THREADS=1 worker i is pinned to the i-th CPU the process may run on.
+size_t parallel_num_threads(void);
+void parallel_set_num_threads(size_t n);
+
+#endif // PARALLEL_H
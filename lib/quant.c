@@ -0,0 +1,252 @@
+#include "quant.h"
+#include "kernels.h"
+#include "la.h"
+#include "parallel.h"
+#include <math.h>
+#include <string.h>
+
+// Longest row the int32 accumulators take: 2^17 products of at most 127^2
+#define QUANT_MAX_COLS (1 << 17)
+
+struct QuantLinear {
+    int8_t *weights; // [k rounded up to 4, ld], row c holds output column c
+    float *scales;   // Dequantization factor of each output
+    float *bias;     // Zeros without a bias
+    size_t d, k, ld;
+};
+
+static size_t quant_ld(size_t cols) {
+    return (cols + QUANT_ALIGN - 1) / QUANT_ALIGN * QUANT_ALIGN;
+}
+
+static int8_t *quant_alloc(size_t rows, size_t ld) {
+    size_t bytes = rows * ld > 0 ? rows * ld : QUANT_ALIGN;
+    return (int8_t *)aligned_alloc(QUANT_ALIGN, bytes);
+}
+
+// Round to nearest even, saturating, NaN to 0
+static inline int8_t quantize(float v) {
+    if (v != v) {
+        return 0;
+    }
+    v = v > 127.0f ? 127.0f : (v < -127.0f ? -127.0f : v);
+    return (int8_t)lrintf(v);
+}
+
+// Dimension dot of t is the length of the dot products it takes part in
+static bool check_matrix(const Tensor *t, size_t dot, const char *name) {
+    if (t->dtype != TENSOR_F32 || t->ndim != 2) {
+        fprintf(stderr, "Error: %s must be a float32 matrix.\n", name);
+        return false;
+    }
+    if (t->shape[dot] > QUANT_MAX_COLS) {
+        fprintf(stderr, "Error: Quantized rows are limited to %d elements.\n", QUANT_MAX_COLS);
+        return false;
+    }
+    return true;
+}
+
+static bool check_vector(const Tensor *t, size_t n, const char *name) {
+    if (t->dtype != TENSOR_F32 || t->ndim != 1 || t->shape[0] != n) {
+        fprintf(stderr, "Error: %s must be a float32 vector of %zu elements.\n", name, n);
+        return false;
+    }
+    return true;
+}
+
+Tensor *quant_column_scales(const Tensor *x) {
+    if (!check_matrix(x, 1, "Quantized data")) {
+        return NULL;
+    }
+
+    // Smallest and largest value of every column in one pass
+    size_t d = x->shape[1];
+    Tensor *lo = tensor_create(1, d), *hi = tensor_create(1, d);
+    Tensor *out[TENSOR_REDUCE_COUNT] = {NULL};
+    out[TENSOR_REDUCE_MIN] = lo;
+    out[TENSOR_REDUCE_MAX] = hi;
+    tensor_reduce_into(out, x, 1, (size_t[]){0});
+
+    Tensor *scales = tensor_create(1, d);
+    for (size_t j = 0; j < d; j++) {
+        float m = fmaxf(-lo->data[j], hi->data[j]) / 127.0f;
+        scales->data[j] = m > 0 ? m : 1.0f;
+    }
+    tensor_free(lo);
+    tensor_free(hi);
+    return scales;
+}
+
+// Rows are quantized in parallel, each into its own padded row
+typedef struct {
+    QuantMatrix *q;
+    const Tensor *x;
+    const float *inverse; // 1 / scale of every column
+} QuantizeJob;
+
+static void quantize_rows(void *arg, size_t begin, size_t end) {
+    const QuantizeJob *job = (const QuantizeJob *)arg;
+    const Tensor *x = job->x;
+    size_t cols = job->q->cols, ld = job->q->ld;
+    size_t rs = x->strides[0], cs = x->strides[1];
+    for (size_t i = begin; i < end; i++) {
+        const float *row = x->data + i * rs;
+        int8_t *q = job->q->data + i * ld;
+        for (size_t j = 0; j < cols; j++) {
+            q[j] = quantize(row[j * cs] * job->inverse[j]);
+        }
+        memset(q + cols, 0, ld - cols);
+    }
+}
+
+QuantMatrix *quant_matrix_create(const Tensor *x, const Tensor *scales) {
+    if (!check_matrix(x, 1, "Quantized data") ||
+        !check_vector(scales, x->shape[1], "Quantization scales")) {
+        return NULL;
+    }
+
+    QuantMatrix *q = (QuantMatrix *)calloc(1, sizeof(QuantMatrix));
+    if (!q) {
+        fprintf(stderr, "Error: Cannot allocate a quantized matrix.\n");
+        return NULL;
+    }
+    q->rows = x->shape[0];
+    q->cols = x->shape[1];
+    q->ld = quant_ld(q->cols);
+    q->data = quant_alloc(q->rows, q->ld);
+    float *inverse = (float *)malloc((q->cols + 1) * sizeof(float));
+    if (!q->data || !inverse) {
+        fprintf(stderr, "Error: Cannot allocate a %zu x %zu quantized matrix.\n", q->rows,
+                q->cols);
+        free(inverse);
+        quant_matrix_free(q);
+        return NULL;
+    }
+
+    for (size_t j = 0; j < q->cols; j++) {
+        inverse[j] = 1.0f / scales->data[j * scales->strides[0]];
+    }
+    QuantizeJob job = {q, x, inverse};
+    parallel_for_grain(q->rows, PARALLEL_GRAIN / q->ld + 1, quantize_rows, &job);
+    free(inverse);
+    return q;
+}
+
+void quant_matrix_free(QuantMatrix *q) {
+    if (q) {
+        free(q->data);
+        free(q);
+    }
+}
+
+QuantLinear *quant_linear_create(const Tensor *w, const Tensor *bias,
+                                 const Tensor *feature_scales) {
+    if (!check_matrix(w, 0, "Weights") ||
+        !check_vector(feature_scales, w->shape[0], "Feature scales") ||
+        (bias && !check_vector(bias, w->shape[1], "Bias"))) {
+        return NULL;
+    }
+
+    size_t d = w->shape[0], k = w->shape[1];
+    size_t k_pad = (k + 3) / 4 * 4;
+    QuantLinear *model = (QuantLinear *)calloc(1, sizeof(QuantLinear));
+    if (!model) {
+        fprintf(stderr, "Error: Cannot allocate a quantized model.\n");
+        return NULL;
+    }
+    model->d = d;
+    model->k = k;
+    model->ld = quant_ld(d);
+    model->weights = quant_alloc(k_pad, model->ld);
+    model->scales = (float *)calloc(k_pad, sizeof(float));
+    model->bias = (float *)calloc(k_pad, sizeof(float));
+    float *folded = (float *)malloc((d + 1) * sizeof(float));
+    if (!model->weights || !model->scales || !model->bias || !folded) {
+        fprintf(stderr, "Error: Cannot allocate a quantized model of %zu x %zu weights.\n", d,
+                k);
+        free(folded);
+        quant_linear_free(model);
+        return NULL;
+    }
+    memset(model->weights, 0, k_pad * model->ld);
+
+    // Column c of W with the feature scales folded in, quantized on its own
+    for (size_t c = 0; c < k; c++) {
+        float m = 0;
+        for (size_t j = 0; j < d; j++) {
+            float fs = feature_scales->data[j * feature_scales->strides[0]];
+            folded[j] = w->data[j * w->strides[0] + c * w->strides[1]] * fs;
+            m = fmaxf(m, fabsf(folded[j]));
+        }
+        float scale = m > 0 ? m / 127.0f : 1.0f;
+        for (size_t j = 0; j < d; j++) {
+            model->weights[c * model->ld + j] = quantize(folded[j] / scale);
+        }
+        model->scales[c] = scale;
+        model->bias[c] = bias ? bias->data[c * bias->strides[0]] : 0.0f;
+    }
+    free(folded);
+    return model;
+}
+
+void quant_linear_free(QuantLinear *model) {
+    if (model) {
+        free(model->weights);
+        free(model->scales);
+        free(model->bias);
+        free(model);
+    }
+}
+
+// Rows of the batch are scored in parallel, four outputs per kernel call
+typedef struct {
+    Tensor *out;
+    const QuantLinear *model;
+    const QuantMatrix *x;
+    kernel_dot4_i8_fn dot4;
+} PredictJob;
+
+static void predict_rows(void *arg, size_t begin, size_t end) {
+    const PredictJob *job = (const PredictJob *)arg;
+    const QuantLinear *model = job->model;
+    size_t ld = model->ld, k = model->k;
+    size_t rs = job->out->strides[0], cs = job->out->strides[1];
+    for (size_t i = begin; i < end; i++) {
+        const int8_t *x = job->x->data + i * ld;
+        float *y = job->out->data + i * rs;
+        for (size_t c = 0; c < k; c += 4) {
+            int32_t acc[4];
+            job->dot4(ld, x, model->weights + c * ld, ld, acc);
+            for (size_t r = 0; r < 4 && c + r < k; r++) {
+                y[(c + r) * cs] = (float)acc[r] * model->scales[c + r] + model->bias[c + r];
+            }
+        }
+    }
+}
+
+Tensor *quant_linear_predict_into(Tensor *out, const QuantLinear *model, const QuantMatrix *x) {
+    if (x->cols != model->d) {
+        fprintf(stderr, "Error: Quantized data has %zu features, the model %zu.\n", x->cols,
+                model->d);
+        return NULL;
+    }
+    if (out->dtype != TENSOR_F32 || out->ndim != 2 || out->shape[0] != x->rows ||
+        out->shape[1] != model->k) {
+        fprintf(stderr, "Error: Output tensor has the wrong shape.\n");
+        return NULL;
+    }
+
+    PredictJob job = {out, model, x, kernels_get()->dot4_i8};
+    size_t work = model->ld * (model->k + 3) / 4 * 4;
+    parallel_for_grain(x->rows, PARALLEL_GRAIN / (work > 0 ? work : 1) + 1, predict_rows, &job);
+    return out;
+}
+
+Tensor *quant_linear_predict(const QuantLinear *model, const QuantMatrix *x) {
+    Tensor *out = tensor_create(2, x->rows, model->k);
+    if (!quant_linear_predict_into(out, model, x)) {
+        tensor_free(out);
+        return NULL;
+    }
+    return out;
+}
@@ -0,0 +1,54 @@
+#ifndef QUANT_H
+#define QUANT_H
+
+#include "tensor.h"
+#include <stdint.h>
+
+// Int8 Quantized Scoring
+// Predictions X_new W + b of a fitted linear model, reading the features as
+// int8 instead of float32, a quarter of the memory traffic:
+//
+//     Tensor *scales = quant_column_scales(X_train);          // Once, [d]
+//     QuantLinear *model = quant_linear_create(W, bias, scales);
+//     QuantMatrix *qx = quant_matrix_create(X_batch, scales); // Per batch
+//     Tensor *y = quant_linear_predict(model, qx);            // [n, k]
+//
+// Quantization is symmetric and per column: x[i, j] is stored as
+// round(x[i, j] / scale[j]), clamped to [-127, 127], where scale[j] is the
+// largest |x[i, j]| of the calibration data over 127. The feature scales are
+// folded into the weights, which are quantized per output column in turn, so
+// each output is one int32 dot product, dequantized by a single multiply
+// fused with the bias add. Rows are dot products of up to 2^17 features.
+
+// Rows of a quantized matrix are zero padded to a multiple of this many
+// elements, so the kernels run without tails
+#define QUANT_ALIGN 64
+
+typedef struct {
+    int8_t *data; // Row-major [rows, ld], 64-byte aligned
+    size_t rows;
+    size_t cols;
+    size_t ld;    // cols rounded up to QUANT_ALIGN
+} QuantMatrix;
+
+typedef struct QuantLinear QuantLinear;
+
+// Per-column scales [d] of a float32 [n, d] matrix, 1 for columns of zeros
+Tensor *quant_column_scales(const Tensor *x);
+
+// Quantize a float32 [n, d] matrix with per-column scales [d]. Values beyond
+// 127 scales saturate, NaNs become 0.
+QuantMatrix *quant_matrix_create(const Tensor *x, const Tensor *scales);
+void quant_matrix_free(QuantMatrix *q);
+
+// Weights w [d, k] and an optional bias [k] (NULL for none) of a model whose
+// features are quantized with feature_scales [d]
+QuantLinear *quant_linear_create(const Tensor *w, const Tensor *bias,
+                                 const Tensor *feature_scales);
+void quant_linear_free(QuantLinear *model);
+
+// out [n, k] = dequantized x W + bias, in float32
+Tensor *quant_linear_predict(const QuantLinear *model, const QuantMatrix *x);
+Tensor *quant_linear_predict_into(Tensor *out, const QuantLinear *model, const QuantMatrix *x);
+
+#endif // QUANT_H
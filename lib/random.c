@@ -0,0 +1,125 @@
+#include "random.h"
+#include "iter.h"
+#include "kernels.h"
+#include "parallel.h"
+
+// Values generated at a time before they are stored in the tensor
+#define RANDOM_STAGE 256
+// Generating a value costs more than copying one, so pieces are smaller
+#define RANDOM_GRAIN (PARALLEL_GRAIN / 8)
+
+typedef enum {
+    RANDOM_UNIFORM,
+    RANDOM_NORMAL,
+} RandomDistribution;
+
+typedef struct {
+    Tensor *t;
+    TensorIter it;
+    uint64_t seed;
+    uint64_t first; // Stream position of the first element
+    RandomDistribution distribution;
+    float a, b; // lo and hi - lo, or mean and std
+    kernel_philox_fn philox;
+    kernel_box_muller_fn box_muller;
+} RandomJob;
+
+Random random_init(uint64_t seed) {
+    return (Random){seed, 0};
+}
+
+// Values at the stream positions [first, first + n), n at most RANDOM_STAGE
+static void random_values(const RandomJob *job, uint64_t first, size_t n, float *out) {
+    uint32_t words[RANDOM_STAGE + 8];
+    size_t skip = first % 4;
+    job->philox((skip + n + 3) / 4, first / 4, job->seed, words);
+
+    if (job->distribution == RANDOM_UNIFORM) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = job->a + job->b * ((float)(words[skip + i] >> 8) * 0x1p-24f);
+        }
+        return;
+    }
+
+    // Box-Muller on the word pairs (0, 1) and (2, 3) of every block: the
+    // even element of a pair takes the cosine side, the odd one the sine
+    float normal[RANDOM_STAGE + 8];
+    size_t pair = skip & ~(size_t)1;
+    job->box_muller((skip + n - pair + 1) / 2, words + pair, normal);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = job->a + job->b * normal[skip - pair + i];
+    }
+}
+
+static void random_range(void *arg, size_t begin, size_t end) {
+    const RandomJob *job = (const RandomJob *)arg;
+    TensorIter it = job->it;
+    iter_restrict(&it, begin, end);
+
+    float stage[RANDOM_STAGE];
+    size_t position = begin;
+    while (iter_next(&it)) {
+        size_t stride = it.inner_strides[0];
+        for (size_t i = 0; i < it.inner_size; i += RANDOM_STAGE) {
+            size_t m = it.inner_size - i < RANDOM_STAGE ? it.inner_size - i : RANDOM_STAGE;
+            random_values(job, job->first + position, m, stage);
+            dtype_convert(m, job->t->dtype, tensor_element(job->t, it.offsets[0] + i * stride),
+                          stride, TENSOR_F32, stage, 1);
+            position += m;
+        }
+    }
+}
+
+static void random_fill(uint64_t seed, uint64_t first, Tensor *t,
+                        RandomDistribution distribution, float a, float b) {
+    RandomJob job = {.t = t, .seed = seed, .first = first, .distribution = distribution,
+                     .a = a, .b = b, .philox = kernels_get()->philox,
+                     .box_muller = kernels_get()->box_muller};
+    iter_init(&job.it, 1, (const Tensor *[]){t});
+    parallel_for_grain(job.it.size, RANDOM_GRAIN, random_range, &job);
+}
+
+void random_uniform_at(uint64_t seed, uint64_t first, Tensor *t, float lo, float hi) {
+    random_fill(seed, first, t, RANDOM_UNIFORM, lo, hi - lo);
+}
+
+void random_normal_at(uint64_t seed, uint64_t first, Tensor *t, float mean, float std) {
+    random_fill(seed, first, t, RANDOM_NORMAL, mean, std);
+}
+
+void random_bits_at(uint64_t seed, uint64_t first, size_t n, uint32_t out[]) {
+    const Kernels *k = kernels_get();
+    size_t i = 0;
+    while (i < n) {
+        uint64_t position = first + i;
+        if (position % 4 == 0 && n - i >= 4) {
+            size_t blocks = (n - i) / 4;
+            k->philox(blocks, position / 4, seed, out + i);
+            i += 4 * blocks;
+        } else {
+            // A block cut by either end goes through a buffer
+            uint32_t block[4];
+            k->philox(1, position / 4, seed, block);
+            for (size_t w = position % 4; w < 4 && i < n; w++) {
+                out[i++] = block[w];
+            }
+        }
+    }
+}
+
+// The stateful versions start at the generator's next block and move past
+// the blocks they use
+void random_uniform(Random *rng, Tensor *t, float lo, float hi) {
+    random_uniform_at(rng->seed, 4 * rng->counter, t, lo, hi);
+    rng->counter += (t->size + 3) / 4;
+}
+
+void random_normal(Random *rng, Tensor *t, float mean, float std) {
+    random_normal_at(rng->seed, 4 * rng->counter, t, mean, std);
+    rng->counter += (t->size + 3) / 4;
+}
+
+void random_bits(Random *rng, size_t n, uint32_t out[]) {
+    random_bits_at(rng->seed, 4 * rng->counter, n, out);
+    rng->counter += (n + 3) / 4;
+}
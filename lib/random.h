@@ -0,0 +1,42 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include "tensor.h"
+#include <stdint.h>
+
+// Counter-based Random Numbers
+// Values come from Philox4x32-10, which turns a 64-bit seed and a block
+// number into four random 32-bit words, with no other state. A generator is
+// a seed and the number of blocks used so far; element i of a fill gets its
+// value from block counter + i / 4, so fills are split across threads
+// freely and give the same tensor for any number of threads or kernel tier:
+//
+//     Random rng = random_init(42);
+//     random_uniform(&rng, x, -1.0f, 1.0f);
+//     random_normal(&rng, noise, 0.0f, 0.1f); // Continues after x
+//
+// Elements are numbered in row-major logical order, so views are filled
+// like contiguous tensors of their shape. Every dtype is filled, through
+// float32 values. Normal values use Box-Muller on pairs of words, so each
+// block gives four.
+typedef struct {
+    uint64_t seed;
+    uint64_t counter; // Blocks of four words used so far
+} Random;
+
+Random random_init(uint64_t seed);
+// Uniform in [lo, hi), with 24 random bits
+void random_uniform(Random *rng, Tensor *t, float lo, float hi);
+void random_normal(Random *rng, Tensor *t, float mean, float std);
+// n raw 32-bit words
+void random_bits(Random *rng, size_t n, uint32_t out[]);
+
+// Without a generator: the values at the stream positions [first, first +
+// size) of a seed, word first % 4 of block first / 4 onwards. A large array
+// is generated in pieces this way, each giving the same values as the whole,
+// e.g. the rows of a dataset chunk by chunk.
+void random_uniform_at(uint64_t seed, uint64_t first, Tensor *t, float lo, float hi);
+void random_normal_at(uint64_t seed, uint64_t first, Tensor *t, float mean, float std);
+void random_bits_at(uint64_t seed, uint64_t first, size_t n, uint32_t out[]);
+
+#endif // RANDOM_H
@@ -0,0 +1,439 @@
+#include "sparse.h"
+#include "parallel.h"
+#include <string.h>
+
+// Rows (CSR) or columns (CSC) the compressed arrays are laid out along
+static size_t sparse_major(const SparseTensor *s) {
+    return s->format == SPARSE_CSR ? s->rows : s->cols;
+}
+
+static size_t sparse_minor(const SparseTensor *s) {
+    return s->format == SPARSE_CSR ? s->cols : s->rows;
+}
+
+// Room for nnz indices and values, keeping the ones already there
+static bool sparse_reserve(SparseTensor *s, size_t nnz) {
+    uint32_t *indices = (uint32_t *)realloc(s->indices, (nnz + 1) * sizeof(uint32_t));
+    if (indices) {
+        s->indices = indices;
+    }
+    Dtype *values = (Dtype *)realloc(s->values, (nnz + 1) * sizeof(Dtype));
+    if (values) {
+        s->values = values;
+    }
+    if (!indices || !values) {
+        fprintf(stderr, "Error: Cannot allocate %zu nonzeros.\n", nnz);
+        return false;
+    }
+    s->nnz = nnz;
+    return true;
+}
+
+SparseTensor *sparse_create(SparseFormat format, size_t rows, size_t cols, size_t nnz) {
+    if (rows > UINT32_MAX || cols > UINT32_MAX) {
+        fprintf(stderr, "Error: Sparse matrices have at most %u rows and columns.\n",
+                UINT32_MAX);
+        return NULL;
+    }
+
+    SparseTensor *s = (SparseTensor *)calloc(1, sizeof(SparseTensor));
+    if (!s) {
+        fprintf(stderr, "Error: Cannot allocate a sparse matrix.\n");
+        return NULL;
+    }
+    s->format = format;
+    s->rows = rows;
+    s->cols = cols;
+    s->indptr = (size_t *)calloc(sparse_major(s) + 1, sizeof(size_t));
+    if (!s->indptr || !sparse_reserve(s, nnz)) {
+        sparse_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void sparse_free(SparseTensor *s) {
+    if (s) {
+        free(s->indptr);
+        free(s->indices);
+        free(s->values);
+        free(s);
+    }
+}
+
+// Dense to sparse in two parallel passes over the lines of the tensor: one
+// counting the nonzeros of each, one storing them once the offsets are known
+typedef struct {
+    SparseTensor *s;
+    const Tensor *t;
+    size_t major_stride;
+    size_t minor_stride;
+} DenseJob;
+
+static void dense_count(void *arg, size_t begin, size_t end) {
+    const DenseJob *job = (const DenseJob *)arg;
+    size_t minor = sparse_minor(job->s);
+    for (size_t i = begin; i < end; i++) {
+        const Dtype *line = job->t->data + i * job->major_stride;
+        size_t count = 0;
+        for (size_t j = 0; j < minor; j++) {
+            count += line[j * job->minor_stride] != 0;
+        }
+        job->s->indptr[i + 1] = count;
+    }
+}
+
+static void dense_store(void *arg, size_t begin, size_t end) {
+    const DenseJob *job = (const DenseJob *)arg;
+    SparseTensor *s = job->s;
+    size_t minor = sparse_minor(s);
+    for (size_t i = begin; i < end; i++) {
+        const Dtype *line = job->t->data + i * job->major_stride;
+        size_t p = s->indptr[i];
+        for (size_t j = 0; j < minor; j++) {
+            Dtype v = line[j * job->minor_stride];
+            if (v != 0) {
+                s->indices[p] = (uint32_t)j;
+                s->values[p++] = v;
+            }
+        }
+    }
+}
+
+SparseTensor *sparse_from_dense(const Tensor *t, SparseFormat format) {
+    if (t->dtype != TENSOR_F32 || t->ndim != 2) {
+        fprintf(stderr, "Error: Sparse matrices are made from float32 matrices.\n");
+        return NULL;
+    }
+
+    SparseTensor *s = sparse_create(format, t->shape[0], t->shape[1], 0);
+    if (!s) {
+        return NULL;
+    }
+
+    bool csr = format == SPARSE_CSR;
+    DenseJob job = {s, t, t->strides[csr ? 0 : 1], t->strides[csr ? 1 : 0]};
+    size_t major = sparse_major(s), grain = PARALLEL_GRAIN / (sparse_minor(s) + 1) + 1;
+    parallel_for_grain(major, grain, dense_count, &job);
+    for (size_t i = 0; i < major; i++) {
+        s->indptr[i + 1] += s->indptr[i];
+    }
+    if (!sparse_reserve(s, s->indptr[major])) {
+        sparse_free(s);
+        return NULL;
+    }
+    parallel_for_grain(major, grain, dense_store, &job);
+    return s;
+}
+
+// The same matrix in the other format, by a counting sort on the minor
+// index. Lines are read in order, so the new lines come out sorted.
+static SparseTensor *sparse_flip(const SparseTensor *s) {
+    SparseFormat format = s->format == SPARSE_CSR ? SPARSE_CSC : SPARSE_CSR;
+    SparseTensor *out = sparse_create(format, s->rows, s->cols, s->nnz);
+    if (!out) {
+        return NULL;
+    }
+
+    size_t major = sparse_major(s), minor = sparse_minor(s);
+    for (size_t p = 0; p < s->nnz; p++) {
+        out->indptr[s->indices[p] + 1]++;
+    }
+    for (size_t j = 0; j < minor; j++) {
+        out->indptr[j + 1] += out->indptr[j];
+    }
+
+    size_t *next = (size_t *)malloc((minor + 1) * sizeof(size_t));
+    if (!next) {
+        fprintf(stderr, "Error: Cannot allocate %zu line offsets.\n", minor + 1);
+        sparse_free(out);
+        return NULL;
+    }
+    memcpy(next, out->indptr, (minor + 1) * sizeof(size_t));
+    for (size_t i = 0; i < major; i++) {
+        for (size_t p = s->indptr[i]; p < s->indptr[i + 1]; p++) {
+            size_t q = next[s->indices[p]]++;
+            out->indices[q] = (uint32_t)i;
+            out->values[q] = s->values[p];
+        }
+    }
+    free(next);
+    return out;
+}
+
+SparseTensor *sparse_convert(const SparseTensor *s, SparseFormat format) {
+    if (format != s->format) {
+        return sparse_flip(s);
+    }
+
+    SparseTensor *out = sparse_create(format, s->rows, s->cols, s->nnz);
+    if (out) {
+        memcpy(out->indptr, s->indptr, (sparse_major(s) + 1) * sizeof(size_t));
+        memcpy(out->indices, s->indices, s->nnz * sizeof(uint32_t));
+        memcpy(out->values, s->values, s->nnz * sizeof(Dtype));
+    }
+    return out;
+}
+
+SparseTensor *sparse_from_triplets(SparseFormat format, size_t rows, size_t cols, size_t nnz,
+                                   const size_t row[], const size_t col[], const Dtype values[]) {
+    for (size_t p = 0; p < nnz; p++) {
+        if (row[p] >= rows || col[p] >= cols) {
+            fprintf(stderr, "Error: Entry (%zu, %zu) is outside a %zu x %zu matrix.\n", row[p],
+                    col[p], rows, cols);
+            return NULL;
+        }
+    }
+
+    // Bucketed by the minor index of the requested format first, so flipping
+    // sorts every line of the result
+    SparseFormat other = format == SPARSE_CSR ? SPARSE_CSC : SPARSE_CSR;
+    SparseTensor *tmp = sparse_create(other, rows, cols, nnz);
+    if (!tmp) {
+        return NULL;
+    }
+    const size_t *major_index = format == SPARSE_CSR ? col : row;
+    const size_t *minor_index = format == SPARSE_CSR ? row : col;
+    size_t lines = sparse_major(tmp);
+    for (size_t p = 0; p < nnz; p++) {
+        tmp->indptr[major_index[p] + 1]++;
+    }
+    for (size_t i = 0; i < lines; i++) {
+        tmp->indptr[i + 1] += tmp->indptr[i];
+    }
+    size_t *next = (size_t *)malloc((lines + 1) * sizeof(size_t));
+    if (!next) {
+        fprintf(stderr, "Error: Cannot allocate %zu line offsets.\n", lines + 1);
+        sparse_free(tmp);
+        return NULL;
+    }
+    memcpy(next, tmp->indptr, (lines + 1) * sizeof(size_t));
+    for (size_t p = 0; p < nnz; p++) {
+        size_t q = next[major_index[p]]++;
+        tmp->indices[q] = (uint32_t)minor_index[p];
+        tmp->values[q] = values[p];
+    }
+    free(next);
+
+    SparseTensor *s = sparse_flip(tmp);
+    sparse_free(tmp);
+    if (!s) {
+        return NULL;
+    }
+
+    // Duplicates are now next to each other
+    size_t w = 0, begin = 0;
+    for (size_t i = 0; i < sparse_major(s); i++) {
+        size_t end = s->indptr[i + 1], line = w;
+        for (size_t p = begin; p < end; p++) {
+            if (w > line && s->indices[w - 1] == s->indices[p]) {
+                s->values[w - 1] += s->values[p];
+            } else {
+                s->indices[w] = s->indices[p];
+                s->values[w++] = s->values[p];
+            }
+        }
+        begin = end;
+        s->indptr[i + 1] = w;
+    }
+    sparse_reserve(s, w);
+    return s;
+}
+
+Tensor *sparse_to_dense(const SparseTensor *s) {
+    Tensor *t = tensor_create(2, s->rows, s->cols);
+    tensor_fill(t, 0);
+    size_t major_stride = t->strides[s->format == SPARSE_CSR ? 0 : 1];
+    size_t minor_stride = t->strides[s->format == SPARSE_CSR ? 1 : 0];
+    for (size_t i = 0; i < sparse_major(s); i++) {
+        for (size_t p = s->indptr[i]; p < s->indptr[i + 1]; p++) {
+            t->data[i * major_stride + s->indices[p] * minor_stride] = s->values[p];
+        }
+    }
+    return t;
+}
+
+// Sparse Times Dense
+// Row i of the output is the sum of the rows of b selected by the nonzeros
+// of row i of a, scaled by them, accumulated in a contiguous row
+
+typedef struct {
+    Tensor *out;
+    const SparseTensor *a; // CSR
+    const Tensor *b;
+    size_t n;              // Columns of b and of the output, 1 for a vector
+    size_t rsb, csb;
+    size_t rso, cso;
+} SpmmJob;
+
+static void spmm_rows(void *arg, size_t begin, size_t end) {
+    const SpmmJob *job = (const SpmmJob *)arg;
+    const SparseTensor *a = job->a;
+    size_t n = job->n, csb = job->csb;
+    Dtype *acc = job->cso == 1 ? NULL : (Dtype *)malloc(n * sizeof(Dtype));
+
+    for (size_t i = begin; i < end; i++) {
+        Dtype *o = job->out->data + i * job->rso;
+        Dtype *row = acc ? acc : o;
+        memset(row, 0, n * sizeof(Dtype));
+        for (size_t p = a->indptr[i]; p < a->indptr[i + 1]; p++) {
+            const Dtype *bj = job->b->data + a->indices[p] * job->rsb;
+            Dtype v = a->values[p];
+            if (csb == 1) {
+                for (size_t c = 0; c < n; c++) {
+                    row[c] += v * bj[c];
+                }
+            } else {
+                for (size_t c = 0; c < n; c++) {
+                    row[c] += v * bj[c * csb];
+                }
+            }
+        }
+        if (acc) {
+            for (size_t c = 0; c < n; c++) {
+                o[c * job->cso] = acc[c];
+            }
+        }
+    }
+    free(acc);
+}
+
+static bool spmm_check(const SparseTensor *a, const Tensor *b) {
+    if (b->dtype != TENSOR_F32 || (b->ndim != 1 && b->ndim != 2)) {
+        fprintf(stderr, "Error: Sparse matrices multiply float32 vectors or matrices.\n");
+        return false;
+    }
+    if (b->shape[0] != a->cols) {
+        fprintf(stderr, "Error: Incompatible shapes for matrix multiplication.\n");
+        return false;
+    }
+    return true;
+}
+
+Tensor *sparse_matmul_into(Tensor *out, const SparseTensor *a, const Tensor *b) {
+    if (!spmm_check(a, b)) {
+        return NULL;
+    }
+    size_t n = b->ndim == 2 ? b->shape[1] : 1;
+    if (out->dtype != TENSOR_F32 || out->ndim != b->ndim || out->shape[0] != a->rows ||
+        (b->ndim == 2 && out->shape[1] != n)) {
+        fprintf(stderr, "Error: Output tensor has the wrong shape.\n");
+        return NULL;
+    }
+    if (out->storage == b->storage) {
+        fprintf(stderr, "Error: Output of matrix multiplication must not alias an input.\n");
+        return NULL;
+    }
+
+    const SparseTensor *csr = a->format == SPARSE_CSR ? a : sparse_flip(a);
+    if (!csr) {
+        return NULL;
+    }
+    SpmmJob job = {out, csr, b, n, b->strides[0], b->ndim == 2 ? b->strides[1] : 1,
+                   out->strides[0], out->ndim == 2 ? out->strides[1] : 1};
+    size_t work = (csr->nnz / (csr->rows + 1) + 1) * n;
+    parallel_for_grain(csr->rows, PARALLEL_GRAIN / work + 1, spmm_rows, &job);
+    if (csr != a) {
+        sparse_free((SparseTensor *)csr);
+    }
+    return out;
+}
+
+Tensor *sparse_matmul(const SparseTensor *a, const Tensor *b) {
+    if (!spmm_check(a, b)) {
+        return NULL;
+    }
+    size_t shape[] = {a->rows, b->ndim == 2 ? b->shape[1] : 1};
+    Tensor *out = tensor_create_from_shape(b->ndim, shape);
+    if (!sparse_matmul_into(out, a, b)) {
+        tensor_free(out);
+        return NULL;
+    }
+    return out;
+}
+
+// Sparse Gram Matrix
+// Row a of X^T X is the sum, over the rows r of X with a nonzero in column
+// a, of x[r, a] times row r of X: the column comes from the CSC form, the
+// rows from the CSR form. Only columns up to a are kept, which the sorted
+// rows make a prefix. Output rows are independent, so they are computed in
+// parallel, and each entry is a sum over r in increasing order.
+
+typedef struct {
+    const SparseTensor *csr;
+    const SparseTensor *csc;
+    const Tensor *y;
+    double *xtx;
+    double *xty;
+} GramJob;
+
+static void gram_rows(void *arg, size_t begin, size_t end) {
+    const GramJob *job = (const GramJob *)arg;
+    const SparseTensor *csr = job->csr, *csc = job->csc;
+    size_t d = csc->cols, k = job->y ? job->y->shape[1] : 0;
+    size_t rsy = job->y ? job->y->strides[0] : 0, csy = job->y ? job->y->strides[1] : 0;
+
+    for (size_t a = begin; a < end; a++) {
+        double *g = job->xtx + a * d;
+        for (size_t p = csc->indptr[a]; p < csc->indptr[a + 1]; p++) {
+            size_t r = csc->indices[p];
+            double v = csc->values[p];
+            for (size_t q = csr->indptr[r]; q < csr->indptr[r + 1] && csr->indices[q] <= a; q++) {
+                g[csr->indices[q]] += v * csr->values[q];
+            }
+            if (job->xty) {
+                const Dtype *yr = job->y->data + r * rsy;
+                double *t = job->xty + a * k;
+                for (size_t c = 0; c < k; c++) {
+                    t[c] += v * yr[c * csy];
+                }
+            }
+        }
+    }
+}
+
+bool sparse_gram_accumulate(double *xtx, double *xty, const SparseTensor *x, const Tensor *y) {
+    if (!y) {
+        xty = NULL;
+    }
+    if (xty && (y->dtype != TENSOR_F32 || y->ndim != 2 || y->shape[0] != x->rows)) {
+        fprintf(stderr, "Error: Targets must be a float32 matrix with a row per sample.\n");
+        return false;
+    }
+
+    SparseTensor *flipped = sparse_flip(x);
+    if (!flipped) {
+        return false;
+    }
+    bool csr = x->format == SPARSE_CSR;
+    GramJob job = {csr ? x : flipped, csr ? flipped : x, xty ? y : NULL, xtx, xty};
+
+    // Products per output row, on average
+    size_t d = x->cols, n = x->rows;
+    size_t work = (x->nnz / (d + 1) + 1) * (x->nnz / (n + 1) / 2 + 1 + (xty ? y->shape[1] : 0));
+    parallel_for_grain(d, PARALLEL_GRAIN / work + 1, gram_rows, &job);
+    sparse_free(flipped);
+    return true;
+}
+
+Tensor *sparse_gram(const SparseTensor *x) {
+    size_t d = x->cols;
+    double *xtx = (double *)calloc(d * d + 1, sizeof(double));
+    if (!xtx) {
+        fprintf(stderr, "Error: Cannot allocate a %zu x %zu Gram matrix.\n", d, d);
+        return NULL;
+    }
+    if (!sparse_gram_accumulate(xtx, NULL, x, NULL)) {
+        free(xtx);
+        return NULL;
+    }
+
+    Tensor *g = tensor_create(2, d, d);
+    for (size_t i = 0; i < d; i++) {
+        for (size_t j = 0; j <= i; j++) {
+            g->data[i * d + j] = g->data[j * d + i] = (Dtype)xtx[i * d + j];
+        }
+    }
+    free(xtx);
+    return g;
+}
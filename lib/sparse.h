@@ -0,0 +1,69 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "tensor.h"
+#include <stdint.h>
+
+// Sparse Matrices
+// Compressed float32 matrices that store only their nonzeros. CSR keeps the
+// nonzeros row after row, CSC column after column:
+//
+//     row i of a CSR matrix is values[indptr[i] .. indptr[i + 1]] at the
+//     columns indices[indptr[i] .. indptr[i + 1]], in increasing order
+//
+// and likewise for the columns of a CSC matrix, with row indices. Either
+// format goes into every operation; the one that walks the matrix in the
+// order an operation needs is converted internally when it is missing.
+//
+//     SparseTensor *X = sparse_from_dense(dense, SPARSE_CSR);
+//     Tensor *y = sparse_matmul(X, w);     // [n, k] or [n] for a vector w
+//     Tensor *g = sparse_gram(X);          // X^T X, dense [d, d]
+//
+// Rows and columns are limited to 2^32 - 1 each, the number of nonzeros is
+// not.
+
+typedef enum {
+    SPARSE_CSR,
+    SPARSE_CSC,
+} SparseFormat;
+
+typedef struct {
+    SparseFormat format;
+    size_t rows;
+    size_t cols;
+    size_t nnz;
+    size_t *indptr;    // [rows + 1] for CSR, [cols + 1] for CSC
+    uint32_t *indices; // [nnz], column of each value for CSR, row for CSC
+    Dtype *values;     // [nnz]
+} SparseTensor;
+
+// Room for nnz values with every row (CSR) or column (CSC) empty, to be
+// filled in by the caller
+SparseTensor *sparse_create(SparseFormat format, size_t rows, size_t cols, size_t nnz);
+// The nonzeros of a float32 [rows, cols] tensor
+SparseTensor *sparse_from_dense(const Tensor *t, SparseFormat format);
+// Values at (row[i], col[i]) in any order; duplicates are added up
+SparseTensor *sparse_from_triplets(SparseFormat format, size_t rows, size_t cols, size_t nnz,
+                                   const size_t row[], const size_t col[], const Dtype values[]);
+// The same matrix in the given format
+SparseTensor *sparse_convert(const SparseTensor *s, SparseFormat format);
+Tensor *sparse_to_dense(const SparseTensor *s);
+void sparse_free(SparseTensor *s);
+
+// Sparse times dense: a [m, k] by b [k, n] into [m, n], or by a vector b [k]
+// into [m]. Rows of the output are computed in parallel, each touching only
+// the rows of b its nonzeros select.
+Tensor *sparse_matmul(const SparseTensor *a, const Tensor *b);
+Tensor *sparse_matmul_into(Tensor *out, const SparseTensor *a, const Tensor *b);
+
+// Gram matrix X^T X [d, d] of a sparse [n, d] matrix, summed in double. Rows
+// of the result are computed in parallel, with work proportional to the
+// products of nonzeros sharing a row of X.
+Tensor *sparse_gram(const SparseTensor *x);
+// Adds the lower triangle of X^T X to the row-major double [d, d] matrix xtx
+// and, unless y or xty is NULL, X^T y to the row-major double [d, k] matrix xty,
+// for a float32 y [n, k]. Each entry is summed over the rows of X in order,
+// so accumulating the rows in chunks gives the same bits as all at once.
+bool sparse_gram_accumulate(double *xtx, double *xty, const SparseTensor *x, const Tensor *y);
+
+#endif // SPARSE_H
@@ -0,0 +1,311 @@
+#include "stream.h"
+#include "parallel.h"
+#include <pthread.h>
+
+// Most operations handed to the pool per scan of the queue
+#define STREAM_MAX_READY 64
+
+typedef enum {
+    STREAM_QUEUED,
+    STREAM_RUNNING,
+    STREAM_DONE,
+} StreamState;
+
+// Bytes spanned by a tensor, from its first to its last element
+typedef struct {
+    const char *begin;
+    const char *end;
+    bool write;
+} StreamRegion;
+
+struct StreamEvent {
+    Stream *stream;
+    stream_fn fn;
+    void *ctx;
+    bool owns_ctx;
+    size_t n_regions;
+    StreamRegion *regions;
+    size_t n_deps;
+    StreamEvent **deps;
+    StreamState state; // Guarded by the stream lock
+    bool ok;
+    StreamEvent *next; // Enqueued after this one
+};
+
+struct Stream {
+    pthread_mutex_t lock;
+    pthread_cond_t work; // An operation was enqueued or the stream is stopping
+    pthread_cond_t done; // Operations finished
+    pthread_t dispatcher;
+    StreamEvent *head; // Everything enqueued since the last sync, in order
+    StreamEvent *tail;
+    StreamEvent *queued; // The first one not started yet
+    size_t unfinished;
+    bool failed; // Since the last sync
+    bool stop;
+};
+
+static StreamRegion stream_region(const Tensor *t, bool write) {
+    size_t last = 0;
+    for (size_t d = 0; d < t->ndim; d++) {
+        last += (t->shape[d] - 1) * t->strides[d];
+    }
+    const char *begin = (const char *)t->data;
+    return (StreamRegion){begin, t->size == 0 ? begin : begin + (last + 1) * tensor_dtype_size(t->dtype), write};
+}
+
+// Whether b must wait for a
+static bool stream_conflict(const StreamEvent *a, const StreamEvent *b) {
+    for (size_t i = 0; i < a->n_regions; i++) {
+        for (size_t j = 0; j < b->n_regions; j++) {
+            const StreamRegion *x = &a->regions[i], *y = &b->regions[j];
+            if ((x->write || y->write) && x->begin < y->end && y->begin < x->end) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void stream_finish(Stream *s, StreamEvent *e) {
+    e->state = STREAM_DONE;
+    s->unfinished--;
+    s->failed = s->failed || !e->ok;
+    if (e->owns_ctx) {
+        free(e->ctx);
+        e->ctx = NULL;
+    }
+}
+
+// A pool task running one operation
+static void stream_run(void *arg) {
+    StreamEvent *e = (StreamEvent *)arg;
+    bool ok = e->fn(e->ctx);
+
+    Stream *s = e->stream;
+    pthread_mutex_lock(&s->lock);
+    e->ok = ok;
+    stream_finish(s, e);
+    pthread_cond_signal(&s->work);
+    pthread_cond_broadcast(&s->done);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Hands every operation whose dependencies are done to the pool, as soon as
+// they are
+static void *stream_dispatch(void *arg) {
+    Stream *s = (Stream *)arg;
+    StreamEvent *ready[STREAM_MAX_READY];
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        // Operations depending on a failed one fail without running, which
+        // may make more operations ready, hence the rescan
+        size_t n = 0;
+        bool skipped = false;
+        for (StreamEvent *e = s->queued; e && n < STREAM_MAX_READY; e = e->next) {
+            if (e->state != STREAM_QUEUED) {
+                continue;
+            }
+            bool done = true, deps_ok = true;
+            for (size_t i = 0; i < e->n_deps; i++) {
+                done = done && e->deps[i]->state == STREAM_DONE;
+                deps_ok = deps_ok && e->deps[i]->ok;
+            }
+            if (done && !deps_ok) {
+                e->ok = false;
+                stream_finish(s, e);
+                skipped = true;
+            } else if (done) {
+                e->state = STREAM_RUNNING;
+                ready[n++] = e;
+            }
+        }
+        // Nothing before the first queued operation needs scanning again
+        while (s->queued && s->queued->state != STREAM_QUEUED) {
+            s->queued = s->queued->next;
+        }
+
+        if (n > 0) {
+            pthread_mutex_unlock(&s->lock);
+            for (size_t i = 0; i < n; i++) {
+                parallel_spawn(stream_run, ready[i]);
+            }
+            pthread_mutex_lock(&s->lock);
+        } else if (skipped) {
+            pthread_cond_broadcast(&s->done);
+        } else if (s->stop) {
+            break;
+        } else {
+            pthread_cond_wait(&s->work, &s->lock);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+Stream *stream_create(void) {
+    Stream *s = (Stream *)calloc(1, sizeof(Stream));
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->work, NULL);
+    pthread_cond_init(&s->done, NULL);
+    if (pthread_create(&s->dispatcher, NULL, stream_dispatch, s) != 0) {
+        fprintf(stderr, "Error: Cannot start the stream thread.\n");
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->work);
+        pthread_cond_destroy(&s->done);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void stream_free(Stream *s) {
+    stream_sync(s);
+    pthread_mutex_lock(&s->lock);
+    s->stop = true;
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->lock);
+
+    pthread_join(s->dispatcher, NULL);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->work);
+    pthread_cond_destroy(&s->done);
+    free(s);
+}
+
+static StreamEvent *stream_enqueue(Stream *s, stream_fn fn, void *ctx, bool owns_ctx,
+                                   size_t n_inputs, const Tensor *const inputs[],
+                                   size_t n_outputs, Tensor *const outputs[]) {
+    StreamEvent *e = (StreamEvent *)calloc(1, sizeof(StreamEvent));
+    e->stream = s;
+    e->fn = fn;
+    e->ctx = ctx;
+    e->owns_ctx = owns_ctx;
+    e->regions = (StreamRegion *)malloc((n_inputs + n_outputs + 1) * sizeof(StreamRegion));
+    for (size_t i = 0; i < n_inputs; i++) {
+        e->regions[e->n_regions++] = stream_region(inputs[i], false);
+    }
+    for (size_t i = 0; i < n_outputs; i++) {
+        e->regions[e->n_regions++] = stream_region(outputs[i], true);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    // Finished operations only matter when they failed
+    size_t capacity = 0;
+    for (StreamEvent *p = s->head; p; p = p->next) {
+        if ((p->state != STREAM_DONE || !p->ok) && stream_conflict(p, e)) {
+            if (e->n_deps == capacity) {
+                capacity = capacity ? 2 * capacity : 4;
+                e->deps = (StreamEvent **)realloc(e->deps, capacity * sizeof(StreamEvent *));
+            }
+            e->deps[e->n_deps++] = p;
+        }
+    }
+
+    if (s->tail) {
+        s->tail->next = e;
+    } else {
+        s->head = e;
+    }
+    s->tail = e;
+    if (!s->queued) {
+        s->queued = e;
+    }
+    s->unfinished++;
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->lock);
+    return e;
+}
+
+StreamEvent *stream_submit(Stream *s, stream_fn fn, void *ctx, size_t n_inputs,
+                           const Tensor *const inputs[], size_t n_outputs,
+                           Tensor *const outputs[]) {
+    return stream_enqueue(s, fn, ctx, false, n_inputs, inputs, n_outputs, outputs);
+}
+
+// One of the la.h style calls, with its arguments
+typedef struct {
+    Tensor *(*binary)(Tensor *, const Tensor *, const Tensor *);
+    Tensor *(*unary)(Tensor *, const Tensor *);
+    Tensor *(*scalar_op)(Tensor *, const Tensor *, float);
+    Tensor *out;
+    const Tensor *a;
+    const Tensor *b;
+    float scalar;
+} StreamCall;
+
+static bool stream_call(void *ctx) {
+    const StreamCall *c = (const StreamCall *)ctx;
+    if (c->binary) {
+        return c->binary(c->out, c->a, c->b) != NULL;
+    }
+    if (c->unary) {
+        return c->unary(c->out, c->a) != NULL;
+    }
+    return c->scalar_op(c->out, c->a, c->scalar) != NULL;
+}
+
+static StreamEvent *stream_enqueue_call(Stream *s, StreamCall call) {
+    StreamCall *c = (StreamCall *)malloc(sizeof(StreamCall));
+    *c = call;
+    const Tensor *inputs[] = {call.a, call.b};
+    return stream_enqueue(s, stream_call, c, true, call.b ? 2 : 1, inputs, 1, &c->out);
+}
+
+StreamEvent *stream_binary(Stream *s, Tensor *(*op)(Tensor *, const Tensor *, const Tensor *),
+                           Tensor *out, const Tensor *a, const Tensor *b) {
+    return stream_enqueue_call(s, (StreamCall){.binary = op, .out = out, .a = a, .b = b});
+}
+
+StreamEvent *stream_unary(Stream *s, Tensor *(*op)(Tensor *, const Tensor *), Tensor *out,
+                          const Tensor *a) {
+    return stream_enqueue_call(s, (StreamCall){.unary = op, .out = out, .a = a});
+}
+
+StreamEvent *stream_scalar(Stream *s, Tensor *(*op)(Tensor *, const Tensor *, float),
+                           Tensor *out, const Tensor *a, float scalar) {
+    return stream_enqueue_call(s, (StreamCall){.scalar_op = op, .out = out, .a = a,
+                                               .scalar = scalar});
+}
+
+bool stream_event_wait(StreamEvent *e) {
+    Stream *s = e->stream;
+    pthread_mutex_lock(&s->lock);
+    while (e->state != STREAM_DONE) {
+        pthread_cond_wait(&s->done, &s->lock);
+    }
+    bool ok = e->ok;
+    pthread_mutex_unlock(&s->lock);
+    return ok;
+}
+
+bool stream_event_done(const StreamEvent *e) {
+    Stream *s = e->stream;
+    pthread_mutex_lock(&s->lock);
+    bool done = e->state == STREAM_DONE;
+    pthread_mutex_unlock(&s->lock);
+    return done;
+}
+
+bool stream_sync(Stream *s) {
+    pthread_mutex_lock(&s->lock);
+    while (s->unfinished > 0) {
+        pthread_cond_wait(&s->done, &s->lock);
+    }
+    bool ok = !s->failed;
+    s->failed = false;
+
+    StreamEvent *e = s->head;
+    s->head = s->tail = s->queued = NULL;
+    pthread_mutex_unlock(&s->lock);
+
+    while (e) {
+        StreamEvent *next = e->next;
+        free(e->regions);
+        free(e->deps);
+        free(e);
+        e = next;
+    }
+    return ok;
+}
@@ -0,0 +1,65 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "tensor.h"
+
+// Asynchronous Execution
+// Operations enqueued on a stream return at once and run in the background.
+// An operation waits for every earlier operation of its stream whose tensors
+// overlap its own in memory, where at least one of the two writes them: it
+// reads what was written before it and does not overwrite what is still to
+// be read. Operations with nothing in common run concurrently on the thread
+// pool of parallel.h.
+//
+//     Stream *s = stream_create();
+//     StreamEvent *fit = stream_binary(s, tensor_matmul_into, w, x, y);
+//     stream_unary(s, tensor_copy_into, scaled, features); // Overlaps fit
+//     stream_scalar(s, tensor_multiply_scalar_into, w, w, 2); // After fit
+//     stream_event_wait(fit);
+//     stream_sync(s);
+//     stream_free(s);
+//
+// Tensors are referenced, not copied, and must stay alive until the
+// operations using them are done; the output tensors already have their
+// final shape. Whatever ran before a synchronization point (stream_event_wait
+// or stream_sync) is visible to the caller after it.
+//
+// An operation is handed to the pool as a task (parallel_spawn) as soon as
+// its dependencies are done. Its own parallel loops use whichever workers are
+// not busy with other operations, so a lone operation gets the whole pool.
+
+typedef struct Stream Stream;
+typedef struct StreamEvent StreamEvent;
+
+// An operation on its own context, false when it failed. Operations that
+// depend on a failed one are not run and fail too.
+typedef bool (*stream_fn)(void *ctx);
+
+Stream *stream_create(void);
+// Waits for the stream to finish
+void stream_free(Stream *stream);
+
+// Run fn(ctx) once the earlier operations touching inputs or outputs are
+// done. ctx stays owned by the caller.
+StreamEvent *stream_submit(Stream *stream, stream_fn fn, void *ctx, size_t n_inputs,
+                           const Tensor *const inputs[], size_t n_outputs,
+                           Tensor *const outputs[]);
+
+// The _into operations of la.h and tensor.h, e.g.
+// stream_binary(s, tensor_add_into, out, a, b)
+StreamEvent *stream_binary(Stream *stream,
+                           Tensor *(*op)(Tensor *, const Tensor *, const Tensor *),
+                           Tensor *out, const Tensor *a, const Tensor *b);
+StreamEvent *stream_unary(Stream *stream, Tensor *(*op)(Tensor *, const Tensor *),
+                          Tensor *out, const Tensor *a);
+StreamEvent *stream_scalar(Stream *stream, Tensor *(*op)(Tensor *, const Tensor *, float),
+                           Tensor *out, const Tensor *a, float scalar);
+
+// Events are owned by their stream and valid until the next stream_sync
+bool stream_event_wait(StreamEvent *event); // false when the operation failed
+bool stream_event_done(const StreamEvent *event);
+// Wait for everything enqueued so far, false when anything failed since the
+// last sync
+bool stream_sync(Stream *stream);
+
+#endif // STREAM_H
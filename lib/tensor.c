@@ -1,203 +1,588 @@
 #include "tensor.h"
+#include "arena.h"
+#include "iter.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "random.h"
 #include "utils.h"
 #include <math.h>
+#include <stdalign.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// The storage header and the data share one block, data is 64-byte aligned
+#define STORAGE_HEADER_SIZE ((sizeof(TensorStorage) + 63) / 64 * 64)
+// Smallest sides of a copy that goes through the transpose kernel
+#define TRANSPOSE_MIN 16
+// Side of the tiles swapped by tensor_transpose_inplace
+#define TRANSPOSE_TILE 32
+
+// Take the storage from the current arena scope if one is open, from the
+// size-class pool otherwise
+static TensorStorage *storage_create(size_t data_bytes) {
+    size_t bytes = STORAGE_HEADER_SIZE + data_bytes;
+    TensorStorage *storage = (TensorStorage *)arena_alloc(bytes, 64);
+    if (storage) {
+        storage->kind = TENSOR_STORAGE_ARENA;
+    } else {
+        storage = (TensorStorage *)pool_alloc(bytes);
+        storage->kind = TENSOR_STORAGE_HEAP;
+    }
+
+    storage->data = (Dtype *)((unsigned char *)storage + STORAGE_HEADER_SIZE);
+    storage->capacity = bytes;
+    storage->mapping = NULL;
+    atomic_init(&storage->refcount, 1);
+    return storage;
+}
+
+static void storage_release(TensorStorage *storage) {
+    if (atomic_fetch_sub(&storage->refcount, 1) != 1) {
+        return;
+    }
+
+    if (storage->kind == TENSOR_STORAGE_HEAP) {
+        pool_free(storage, storage->capacity);
+    } else if (storage->kind == TENSOR_STORAGE_MMAP) {
+        munmap(storage->mapping, storage->capacity);
+        free(storage);
+    }
+}
+
+// An arena header holding heap or mapped storage drops its reference when
+// its scope is popped, unless tensor_free has dropped it already
+static void arena_header_release(void *arg) {
+    Tensor *t = (Tensor *)arg;
+    if (t->storage) {
+        storage_release(t->storage);
+        t->storage = NULL;
+    }
+}
+
+static void header_hold(Tensor *t) {
+    if (t->in_arena && t->storage->kind != TENSOR_STORAGE_ARENA) {
+        arena_defer(arena_header_release, t);
+    }
+}
+
+// Allocate a tensor header for a shape, with row-major strides and no data.
+// The shape and strides arrays live in the same block as the header.
+static Tensor *tensor_header_create(size_t ndim, const size_t shape[]) {
+    if (ndim > TENSOR_MAX_DIMS) {
+        fprintf(stderr, "Error: Tensors can have at most %d dimensions.\n",
+                TENSOR_MAX_DIMS);
+        return NULL;
+    }
+
+    size_t bytes = sizeof(Tensor) + 2 * ndim * sizeof(size_t);
+    Tensor *t = (Tensor *)arena_alloc(bytes, alignof(Tensor));
+    if (t) {
+        t->in_arena = true;
+    } else {
+        t = (Tensor *)malloc(bytes);
+        t->in_arena = false;
+    }
+
+    t->ndim = ndim;
+    t->shape = (size_t *)(t + 1);
+    t->strides = t->shape + ndim;
+    t->size = 1;
+    for (size_t i = 0; i < ndim; i++) {
+        t->shape[i] = shape[i];
+        t->size *= shape[i];
+    }
+
+    size_t stride = 1;
+    for (size_t i = ndim; i-- > 0;) {
+        t->strides[i] = stride;
+        stride *= shape[i];
+    }
+
+    t->offset = 0;
+    t->storage = NULL;
+    t->data = NULL;
+    t->dtype = TENSOR_F32;
+    return t;
+}
+
+// Create a view sharing the storage of t. NULL strides mean row-major.
+static Tensor *tensor_view(const Tensor *t, size_t ndim, const size_t shape[],
+                           const size_t strides[], size_t offset) {
+    Tensor *view = tensor_header_create(ndim, shape);
+    if (!view) {
+        return NULL;
+    }
+
+    if (strides) {
+        for (size_t i = 0; i < ndim; i++) {
+            view->strides[i] = strides[i];
+        }
+    }
+
+    atomic_fetch_add(&t->storage->refcount, 1);
+    view->storage = t->storage;
+    view->offset = offset;
+    view->dtype = t->dtype;
+    view->data = (Dtype *)((unsigned char *)t->storage->data + offset * tensor_dtype_size(t->dtype));
+    header_hold(view);
+    return view;
+}
+
+size_t tensor_dtype_size(TensorDtype dtype) {
+    static const size_t sizes[TENSOR_DTYPE_COUNT] = {4, 8, 2, 2};
+    return sizes[dtype];
+}
+
+const char *tensor_dtype_name(TensorDtype dtype) {
+    static const char *const names[TENSOR_DTYPE_COUNT] = {"float32", "float64", "float16",
+                                                          "bfloat16"};
+    return names[dtype];
+}
+
+// Element at an offset from the first one, in double, which holds every dtype
+static double element_value(const Tensor *t, size_t pos) {
+    double value;
+    dtype_convert(1, TENSOR_F64, &value, 1, t->dtype, tensor_element(t, pos), 1);
+    return value;
+}
 
 // Function to create a tensor with arbitrary shape
 Tensor *tensor_create(size_t ndim, ...) {
-    Tensor *t = (Tensor *)malloc(sizeof(Tensor));
-    t->ndim = ndim;
-    t->shape = (size_t *)malloc(ndim * sizeof(size_t));
+    size_t shape[TENSOR_MAX_DIMS];
+    if (ndim > TENSOR_MAX_DIMS) {
+        fprintf(stderr, "Error: Tensors can have at most %d dimensions.\n",
+                TENSOR_MAX_DIMS);
+        return NULL;
+    }
 
     va_list args;
     va_start(args, ndim);
-    t->size = 1;
     for (size_t i = 0; i < ndim; i++) {
-        t->shape[i] = va_arg(args, size_t);
-        t->size *= t->shape[i];
+        shape[i] = va_arg(args, size_t);
     }
     va_end(args);
 
-    t->data = (Dtype *)malloc(t->size * sizeof(Dtype));
-    return t;
+    return tensor_create_from_shape(ndim, shape);
 }
 
 // Create a tensor from shape
 Tensor *tensor_create_from_shape(size_t ndim, size_t shape[]) {
-    Tensor *t = (Tensor *)malloc(sizeof(Tensor));
-    t->ndim = ndim;
-    t->shape = (size_t *)malloc(ndim * sizeof(size_t));
-    t->size = 1;
+    return tensor_create_typed(TENSOR_F32, ndim, shape);
+}
+
+Tensor *tensor_create_typed(TensorDtype dtype, size_t ndim, const size_t shape[]) {
+    Tensor *t = tensor_header_create(ndim, shape);
+    if (!t) {
+        return NULL;
+    }
+
+    t->dtype = dtype;
+    t->storage = storage_create(t->size * tensor_dtype_size(dtype));
+    t->data = t->storage->data;
+    return t;
+}
 
-    for (size_t i = 0; i < (t->ndim); i++) {
-        t->shape[i] = *(shape + i);
-        t->size *= *(shape + i);
+Tensor *tensor_from_storage(TensorStorage *storage, TensorDtype dtype, size_t ndim,
+                            const size_t shape[]) {
+    Tensor *t = tensor_header_create(ndim, shape);
+    if (!t) {
+        return NULL;
     }
 
-    t->data = (Dtype *)malloc(t->size * sizeof(Dtype));
+    t->dtype = dtype;
+    t->storage = storage;
+    t->data = storage->data;
+    header_hold(t);
     return t;
 }
 
-// Copy a tensor
+// The batch of transposes is split over the thread pool by bands of rows,
+// counted across the whole batch
+typedef struct {
+    TensorIter outer; // Over the matrices of the batch
+    const Kernels *kernels;
+    size_t rows, cols, lds, ldd;
+} TransposeJob;
+
+static void transpose_range(void *arg, size_t begin, size_t end) {
+    const TransposeJob *job = (const TransposeJob *)arg;
+    size_t o = begin / job->rows;
+    TensorIter outer = job->outer;
+    iter_restrict(&outer, o, (end - 1) / job->rows + 1);
+    while (iter_next(&outer)) {
+        for (size_t i = 0; i < outer.inner_size; i++, o++) {
+            size_t r0 = begin > o * job->rows ? begin - o * job->rows : 0;
+            size_t r1 = end < (o + 1) * job->rows ? end - o * job->rows : job->rows;
+            job->kernels->transpose(r1 - r0, job->cols,
+                                    outer.ptrs[1] + i * outer.inner_strides[1] + r0 * job->lds,
+                                    job->lds, outer.ptrs[0] + i * outer.inner_strides[0] + r0,
+                                    job->ldd);
+        }
+    }
+}
+
+// A copy whose operands are laid out along different dimensions, such as
+// materializing a transposed or permuted view, element by element reads or
+// writes one element per cache line. When one operand is contiguous along the
+// run and the other along an outer dimension p, the copy is a batch of 2-D
+// transposes over (p, run) instead, done by the blocked transpose kernel.
+// it is a freshly initialized iterator over {out, t}.
+static bool copy_transposed(const TensorIter *it) {
+    size_t q = it->ndim;
+    if (q == 0) {
+        return false;
+    }
+
+    // The operand that is strided along the run
+    size_t k;
+    if (it->strides[0][q] == 1 && it->strides[1][q] != 1) {
+        k = 1;
+    } else if (it->strides[1][q] == 1 && it->strides[0][q] != 1) {
+        k = 0;
+    } else {
+        return false;
+    }
+
+    size_t p = q;
+    for (size_t d = 0; d < q; d++) {
+        if (it->strides[k][d] == 1) {
+            p = d;
+        }
+    }
+    if (p == q || it->shape[p] < TRANSPOSE_MIN || it->shape[q] < TRANSPOSE_MIN) {
+        return false;
+    }
+
+    // The kernel transposes a rows x cols matrix of src into dst, with rows
+    // along the dimension where src is strided
+    const size_t *ds = it->strides[0], *ss = it->strides[1];
+    size_t rows = k == 1 ? it->shape[q] : it->shape[p];
+    size_t cols = k == 1 ? it->shape[p] : it->shape[q];
+    size_t lds = k == 1 ? ss[q] : ss[p];
+    size_t ldd = k == 1 ? ds[p] : ds[q];
+
+    // The remaining dimensions are walked by an iterator of their own
+    size_t shape[TENSOR_MAX_DIMS], out_strides[TENSOR_MAX_DIMS], in_strides[TENSOR_MAX_DIMS];
+    size_t nd = 0;
+    for (size_t d = 0; d < q; d++) {
+        if (d != p) {
+            shape[nd] = it->shape[d];
+            out_strides[nd] = ds[d];
+            in_strides[nd] = ss[d];
+            nd++;
+        }
+    }
+
+    TransposeJob job = {.kernels = kernels_get(), .rows = rows, .cols = cols, .lds = lds, .ldd = ldd};
+    iter_init_strided(&job.outer, 2, it->base, nd, shape,
+                      (const size_t *const[]){out_strides, in_strides});
+    size_t grain = PARALLEL_GRAIN / cols > TRANSPOSE_TILE ? PARALLEL_GRAIN / cols : TRANSPOSE_TILE;
+    parallel_for_grain(job.outer.size * rows, grain, transpose_range, &job);
+    return true;
+}
+
+// Copies and fills are split over the thread pool by element ranges of an
+// iterator over {out, in} or {t}
+typedef struct {
+    TensorIter it;
+    Tensor *out;
+    const Tensor *in;
+} CopyJob;
+
+static void copy_range(void *arg, size_t begin, size_t end) {
+    const CopyJob *job = (const CopyJob *)arg;
+    TensorIter it = job->it;
+    iter_restrict(&it, begin, end);
+    while (iter_next(&it)) {
+        dtype_convert(it.inner_size, job->out->dtype, tensor_element(job->out, it.offsets[0]),
+                      it.inner_strides[0], job->in->dtype, tensor_element(job->in, it.offsets[1]),
+                      it.inner_strides[1]);
+    }
+}
+
+// The value is converted to the dtype of t once, up front
+typedef struct {
+    TensorIter it;
+    const Tensor *t;
+    union {
+        float f32;
+        double f64;
+        uint16_t half;
+    } value;
+} FillJob;
+
+#define FILL_RUN(type, data, value)                                              \
+    for (size_t i = 0; i < it.inner_size; i++) {                                 \
+        ((type *)data)[i * it.inner_strides[0]] = value;                         \
+    }
+
+static void fill_range(void *arg, size_t begin, size_t end) {
+    const FillJob *job = (const FillJob *)arg;
+    TensorIter it = job->it;
+    iter_restrict(&it, begin, end);
+    while (iter_next(&it)) {
+        void *data = tensor_element(job->t, it.offsets[0]);
+        switch (job->t->dtype) {
+        case TENSOR_F32:
+            FILL_RUN(float, data, job->value.f32)
+            break;
+        case TENSOR_F64:
+            FILL_RUN(double, data, job->value.f64)
+            break;
+        default:
+            FILL_RUN(uint16_t, data, job->value.half)
+            break;
+        }
+    }
+}
+
+// Copy the elements of t into out, which must have the same shape
+Tensor *tensor_copy_into(Tensor *out, const Tensor *t) {
+    bool same_shape = out->ndim == t->ndim;
+    for (size_t i = 0; same_shape && i < t->ndim; i++) {
+        same_shape = out->shape[i] == t->shape[i];
+    }
+    if (!same_shape) {
+        fprintf(stderr, "Error: Output tensor has the wrong shape.\n");
+        return NULL;
+    }
+
+    CopyJob job = {.out = out, .in = t};
+    iter_init(&job.it, 2, (const Tensor *[]){out, t});
+    bool transposed = out->dtype == TENSOR_F32 && t->dtype == TENSOR_F32 && copy_transposed(&job.it);
+    if (!transposed) {
+        parallel_for_grain(job.it.size, PARALLEL_GRAIN, copy_range, &job);
+    }
+    return out;
+}
+
+// Copy a tensor into new contiguous storage
 Tensor *tensor_copy(const Tensor *t) {
-    Tensor *copy = (Tensor *)malloc(sizeof(Tensor));
-    copy->ndim = t->ndim;
-    copy->shape = (size_t *)malloc(t->ndim * sizeof(size_t));
-    copy->size = t->size;
+    return tensor_astype(t, t->dtype);
+}
 
-    for (size_t i = 0; i < t->ndim; i++) {
-	copy->shape[i] = t->shape[i];
+Tensor *tensor_astype(const Tensor *t, TensorDtype dtype) {
+    Tensor *copy = tensor_create_typed(dtype, t->ndim, t->shape);
+    return tensor_copy_into(copy, t);
+}
+
+// Check if a tensor is laid out in row-major order without gaps
+bool tensor_is_contiguous(const Tensor *t) {
+    size_t stride = 1;
+    for (size_t i = t->ndim; i-- > 0;) {
+        // The stride of a dimension of size 1 is never used
+        if (t->shape[i] != 1 && t->strides[i] != stride) {
+            return false;
+        }
+        stride *= t->shape[i];
     }
+    return true;
+}
 
-    copy->data = (Dtype *)malloc(t->size * sizeof(Dtype));
-    for (size_t i = 0; i < t->size; i++) {
-        copy->data[i] = t->data[i];
+// Contiguous version of a tensor: a view when the data already is, a copy
+// otherwise. Either way the result must be freed.
+Tensor *tensor_contiguous(const Tensor *t) {
+    if (tensor_is_contiguous(t)) {
+        return tensor_view(t, t->ndim, t->shape, NULL, t->offset);
     }
+    return tensor_copy(t);
+}
 
-    return copy;
+// Set every element of a tensor to value
+void tensor_fill(Tensor *t, Dtype value) {
+    FillJob job = {.t = t};
+    dtype_convert(1, t->dtype, &job.value, 1, TENSOR_F32, &value, 1);
+    iter_init(&job.it, 1, (const Tensor *[]){t});
+    parallel_for_grain(job.it.size, PARALLEL_GRAIN, fill_range, &job);
 }
 
-// Populate a tensor with data from an array
+// Populate a tensor with data from an array, in row-major order
 void tensor_populate_array(Tensor *t, Dtype array[]) {
-    for (size_t i = 0; i < t->size; i++) {
-        t->data[i] = array[i];
+    TensorIter it;
+    iter_init(&it, 1, (const Tensor *[]){t});
+    while (iter_next(&it)) {
+        dtype_convert(it.inner_size, t->dtype, tensor_element(t, it.offsets[0]), it.inner_strides[0],
+                      TENSOR_F32, array, 1);
+        array += it.inner_size;
     }
 }
 
-// Reshape a tensor
+// Reshape a tensor, as a view when its data is contiguous
 Tensor *tensor_reshape(const Tensor *t, size_t ndim, size_t shape[]) {
-    Tensor *reshaped = tensor_copy(t);
     size_t new_size = 1;
     for (size_t i = 0; i < ndim; i++) {
         new_size *= shape[i];
     }
 
-    if (new_size != reshaped->size) {
+    if (new_size != t->size) {
         fprintf(stderr,
                 "Error: New shape must have the same number of elements.\n");
-
-        tensor_free(reshaped);
         return NULL;
     }
 
-    reshaped->ndim = ndim;
-    free(reshaped->shape);
-    reshaped->shape = (size_t *)malloc(ndim * sizeof(size_t));
-    for (size_t i = 0; i < ndim; i++) {
-        reshaped->shape[i] = shape[i];
+    if (tensor_is_contiguous(t)) {
+        return tensor_view(t, ndim, shape, NULL, t->offset);
     }
 
+    // Strided data has to be laid out in row-major order first
+    Tensor *copy = tensor_copy(t);
+    Tensor *reshaped = tensor_view(copy, ndim, shape, NULL, 0);
+    tensor_free(copy);
     return reshaped;
 }
 
-// Transpose a tensor
+// Reorder the dimensions of a tensor: dimension i of the view is dimension
+// axes[i] of t
+Tensor *tensor_permute(const Tensor *t, const size_t axes[]) {
+    size_t shape[TENSOR_MAX_DIMS], strides[TENSOR_MAX_DIMS];
+    bool seen[TENSOR_MAX_DIMS] = {false};
+
+    for (size_t i = 0; i < t->ndim; i++) {
+        if (axes[i] >= t->ndim || seen[axes[i]]) {
+            fprintf(stderr, "Error: Axes must be a permutation of the "
+                            "tensor dimensions.\n");
+            return NULL;
+        }
+        seen[axes[i]] = true;
+        shape[i] = t->shape[axes[i]];
+        strides[i] = t->strides[axes[i]];
+    }
+
+    return tensor_view(t, t->ndim, shape, strides, t->offset);
+}
+
+// Transpose a tensor by reversing the order of its dimensions
 Tensor *tensor_transpose(const Tensor *tensor) {
     if (!tensor || tensor->ndim < 2) {
         return NULL; // Handle invalid input
     }
 
-    // Create new dimensions array with reversed order
-    size_t *new_dims = (size_t *)malloc(tensor->ndim * sizeof(size_t));
-    if (!new_dims)
-        return NULL;
-
-    // Reverse the dimensions
+    size_t axes[TENSOR_MAX_DIMS];
     for (size_t i = 0; i < tensor->ndim; i++) {
-        new_dims[i] = tensor->shape[tensor->ndim - 1 - i];
+        axes[i] = tensor->ndim - 1 - i;
     }
 
-    // Create new tensor with transposed dimensions
-    Tensor *transposed = tensor_create_from_shape(tensor->ndim, new_dims);
-    free(new_dims); // Clean up temporary array
-
-    if (!transposed)
-        return NULL;
-
-    // Calculate strides for both tensors
-    size_t *original_strides = (size_t *)malloc(tensor->ndim * sizeof(size_t));
-    size_t *new_strides = (size_t *)malloc(tensor->ndim * sizeof(size_t));
+    return tensor_permute(tensor, axes);
+}
 
-    if (!original_strides || !new_strides) {
-        free(original_strides);
-        free(new_strides);
-        tensor_free(transposed);
-        return NULL;
+// Tile rows of an in-place transpose: tile row i swaps its tiles right of
+// the diagonal with tile column i, so tile rows are independent
+typedef struct {
+    Dtype *data;
+    size_t n, ld;
+    const Kernels *kernels;
+} TransposeInplaceJob;
+
+static void transpose_inplace_range(void *arg, size_t begin, size_t end) {
+    const TransposeInplaceJob *job = (const TransposeInplaceJob *)arg;
+    size_t n = job->n, ld = job->ld;
+    Dtype upper[TRANSPOSE_TILE * TRANSPOSE_TILE], lower[TRANSPOSE_TILE * TRANSPOSE_TILE];
+    for (size_t i0 = begin * TRANSPOSE_TILE; i0 < end * TRANSPOSE_TILE; i0 += TRANSPOSE_TILE) {
+        size_t bi = n - i0 < TRANSPOSE_TILE ? n - i0 : TRANSPOSE_TILE;
+        for (size_t j0 = i0; j0 < n; j0 += TRANSPOSE_TILE) {
+            size_t bj = n - j0 < TRANSPOSE_TILE ? n - j0 : TRANSPOSE_TILE;
+            Dtype *a = job->data + i0 * ld + j0; // bi x bj
+            Dtype *b = job->data + j0 * ld + i0; // bj x bi
+
+            job->kernels->transpose(bi, bj, a, ld, upper, TRANSPOSE_TILE);
+            if (j0 != i0) {
+                job->kernels->transpose(bj, bi, b, ld, lower, TRANSPOSE_TILE);
+                for (size_t r = 0; r < bi; r++) {
+                    memcpy(a + r * ld, lower + r * TRANSPOSE_TILE, bj * sizeof(Dtype));
+                }
+            }
+            for (size_t r = 0; r < bj; r++) {
+                memcpy(b + r * ld, upper + r * TRANSPOSE_TILE, bi * sizeof(Dtype));
+            }
+        }
     }
+}
 
-    // Calculate strides for original tensor
-    original_strides[tensor->ndim - 1] = 1;
-    for (int i = tensor->ndim - 2; i >= 0; i--) {
-        original_strides[i] = original_strides[i + 1] * tensor->shape[i + 1];
+// Transpose a square matrix in its own storage. Pairs of tiles mirrored
+// across the diagonal are transposed into buffers and written back swapped.
+Tensor *tensor_transpose_inplace(Tensor *t) {
+    if (t->ndim != 2 || t->shape[0] != t->shape[1]) {
+        fprintf(stderr, "Error: In-place transpose needs a square matrix.\n");
+        return NULL;
     }
-
-    // Calculate strides for transposed tensor
-    new_strides[tensor->ndim - 1] = 1;
-    for (int i = tensor->ndim - 2; i >= 0; i--) {
-        new_strides[i] = new_strides[i + 1] * transposed->shape[i + 1];
+    if (t->dtype != TENSOR_F32) {
+        fprintf(stderr, "Error: In-place transpose needs a float32 tensor.\n");
+        return NULL;
     }
 
-    // Iterate through all elements using a counter
-    size_t total_elements = tensor->size;
-    for (size_t count = 0; count < total_elements; count++) {
-        // Convert linear index to multi-dimensional indices for original tensor
-        size_t remaining = count;
-        size_t *indices = (size_t *)malloc(tensor->ndim * sizeof(size_t));
+    // Element (i, j) and element (j, i) trade places, which is the same set of
+    // swaps for a matrix and for a transposed view of it. A 2-D tensor always
+    // has a unit stride along one dimension unless it has a single element.
+    size_t n = t->shape[0];
+    size_t ld = t->strides[0] == 1 ? t->strides[1] : t->strides[0];
+    TransposeInplaceJob job = {t->data, n, ld, kernels_get()};
+    size_t tiles = (n + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE;
+    size_t grain = PARALLEL_GRAIN / (n * TRANSPOSE_TILE) + 1;
+    parallel_for_grain(tiles, grain, transpose_inplace_range, &job);
+    return t;
+}
 
-        if (!indices) {
-            free(original_strides);
-            free(new_strides);
-            tensor_free(transposed);
-            return NULL;
-        }
+// View of the indices [start, stop) of one dimension, e.g. a batch of rows
+Tensor *tensor_slice(const Tensor *t, size_t axis, size_t start, size_t stop) {
+    if (axis >= t->ndim || start > stop || stop > t->shape[axis]) {
+        fprintf(stderr, "Error: Slice out of bounds.\n");
+        return NULL;
+    }
 
-        for (size_t i = 0; i < tensor->ndim; i++) {
-            indices[i] = remaining / original_strides[i];
-            remaining %= original_strides[i];
-        }
+    size_t shape[TENSOR_MAX_DIMS];
+    for (size_t i = 0; i < t->ndim; i++) {
+        shape[i] = t->shape[i];
+    }
+    shape[axis] = stop - start;
 
-        // Calculate transposed position
-        size_t transposed_pos = 0;
-        for (size_t i = 0; i < tensor->ndim; i++) {
-            // Use reversed indices for transposition
-            transposed_pos += indices[tensor->ndim - 1 - i] * new_strides[i];
-        }
+    return tensor_view(t, t->ndim, shape, t->strides,
+                       t->offset + start * t->strides[axis]);
+}
 
-        // Copy the data to its transposed position
-        transposed->data[transposed_pos] = tensor->data[count];
-        free(indices);
+// Element at a multi-dimensional index
+Dtype tensor_get(const Tensor *t, const size_t idx[]) {
+    size_t pos = 0;
+    for (size_t i = 0; i < t->ndim; i++) {
+        pos += idx[i] * t->strides[i];
     }
-
-    free(original_strides);
-    free(new_strides);
-    return transposed;
+    return t->dtype == TENSOR_F32 ? t->data[pos] : (Dtype)element_value(t, pos);
 }
 
 // Copy data from array to tensor
 void copy_data(Dtype array[], Tensor *t) {
-    for (size_t i = 0; i < t->size; i++) {
-        t->data[i] = *(array + i);
-    }
+    tensor_populate_array(t, array);
 }
 
-// Function to free the tensor
+// Function to free the tensor. Arena memory is only reclaimed by arena_pop.
 void tensor_free(Tensor *t) {
-    free(t->data);
-    free(t->shape);
-    free(t);
+    if (!t->storage) {
+        return; // An arena header freed before
+    }
+    storage_release(t->storage);
+    if (t->in_arena) {
+        t->storage = NULL;
+    } else {
+        free(t);
+    }
 }
 
 // Function to print the tensor (for debugging purposes)
 void tensor_print(const Tensor *t) {
-    printf("===\nTensor with %zu dimensions:\n", t->ndim);
+    printf("===\nTensor with %zu dimensions (%s):\n", t->ndim, tensor_dtype_name(t->dtype));
     for (size_t i = 0; i < t->ndim; i++) {
         printf("Dimension %zu: %zu\n", i, t->shape[i]);
     }
     printf("Data:\n");
-    for (size_t i = 0; i < (t->size); i++) {
-        printf("%f ", t->data[i]);
+    TensorIter it;
+    iter_init(&it, 1, (const Tensor *[]){t});
+    while (iter_next(&it)) {
+        for (size_t i = 0; i < it.inner_size; i++) {
+            printf("%f ", element_value(t, it.offsets[0] + i * it.inner_strides[0]));
+        }
     }
     printf("\n===\n");
 }
@@ -215,92 +600,52 @@ Tensor *tensor_concatenate(const Tensor *t1, const Tensor *t2, size_t axis) {
         }
     }
 
-    // Create new shape array
-    size_t *new_shape = malloc(t1->ndim * sizeof(size_t));
-    if (!new_shape)
-        return NULL;
-
     // Calculate new shape
+    size_t new_shape[TENSOR_MAX_DIMS];
     for (size_t i = 0; i < t1->ndim; i++) {
         new_shape[i] = (i == axis) ? t1->shape[i] + t2->shape[i] : t1->shape[i];
     }
 
     // Create new tensor
-    Tensor *result = tensor_create_from_shape(t1->ndim, new_shape);
-    free(new_shape);
+    Tensor *result = tensor_create_typed(t1->dtype, t1->ndim, new_shape);
     if (!result)
         return NULL;
 
-    // Calculate strides for copying
-    size_t *strides = malloc(t1->ndim * sizeof(size_t));
-    if (!strides) {
-        tensor_free(result);
-        return NULL;
-    }
-
-    // Calculate strides (number of elements to jump for each dimension)
-    strides[t1->ndim - 1] = 1;
-    for (int i = t1->ndim - 2; i >= 0; i--) {
-        strides[i] = strides[i + 1] * result->shape[i + 1];
-    }
+    // Copy each input into its slice of the result. The iterator merges the
+    // dimensions after the axis, so each copy moves whole blocks at a time.
+    Tensor *part1 = tensor_slice(result, axis, 0, t1->shape[axis]);
+    Tensor *part2 = tensor_slice(result, axis, t1->shape[axis], new_shape[axis]);
+    tensor_copy_into(part1, t1);
+    tensor_copy_into(part2, t2);
 
-    // Copy data from t1 and t2 to result
-    size_t *indices = calloc(t1->ndim, sizeof(size_t));
-    if (!indices) {
-        free(strides);
-        tensor_free(result);
-        return NULL;
-    }
-
-    // Copy data from first tensor
-    for (size_t i = 0; i < t1->size; i++) {
-        // Calculate current indices
-        size_t temp = i;
-        for (int j = t1->ndim - 1; j >= 0; j--) {
-            indices[j] = temp % t1->shape[j];
-            temp /= t1->shape[j];
-        }
-
-        // Calculate destination index in result
-        size_t dest_idx = tensor_get_linear_index(result->shape, indices, t1->ndim);
-        result->data[dest_idx] = t1->data[i];
-    }
-
-    // Copy data from second tensor
-    for (size_t i = 0; i < t2->size; i++) {
-        // Calculate current indices
-        size_t temp = i;
-        for (int j = t2->ndim - 1; j >= 0; j--) {
-            indices[j] = temp % t2->shape[j];
-            temp /= t2->shape[j];
-        }
-
-        // Adjust index for concatenation axis
-        indices[axis] += t1->shape[axis];
+    tensor_free(part1);
+    tensor_free(part2);
+    return result;
+}
 
-        // Calculate destination index in result
-        size_t dest_idx = tensor_get_linear_index(result->shape, indices, t2->ndim);
-        result->data[dest_idx] = t2->data[i];
-    }
+// Generator of tensor_rand and tensor_randn. Each call claims its blocks
+// with one atomic add, so concurrent calls draw different values.
+static _Atomic uint64_t rand_seed, rand_counter;
 
-    free(indices);
-    free(strides);
-    return result;
+void tensor_seed(uint64_t seed) {
+    atomic_store(&rand_seed, seed);
+    atomic_store(&rand_counter, 0);
 }
 
-float rand_float() {
-    return (float)rand() / (float)RAND_MAX;
+static Tensor *rand_fill(Tensor *t, bool normal) {
+    Random rng = {atomic_load(&rand_seed), atomic_fetch_add(&rand_counter, (t->size + 3) / 4)};
+    if (normal) {
+        random_normal(&rng, t, 0.0f, 1.0f);
+    } else {
+        random_uniform(&rng, t, 0.0f, 1.0f);
+    }
+    return t;
 }
 
 // Function to create a tensor with random values from a given shape
 Tensor *tensor_rand_from_shape(size_t ndim, size_t shape[]) {
     Tensor *t = tensor_create_from_shape(ndim, shape);
-
-    for (size_t i = 0; i < t->size; i++) {
-        t->data[i] = (Dtype)rand_float();
-    }
-
-    return t;
+    return t ? rand_fill(t, false) : NULL;
 }
 
 // Function to create a tensor with random values from a given shape
@@ -318,8 +663,31 @@ Tensor *tensor_rand(size_t ndim, ...) {
     return t;
 }
 
+Tensor *tensor_randn_from_shape(size_t ndim, size_t shape[]) {
+    Tensor *t = tensor_create_from_shape(ndim, shape);
+    return t ? rand_fill(t, true) : NULL;
+}
+
+Tensor *tensor_randn(size_t ndim, ...) {
+    size_t shape[TENSOR_MAX_DIMS];
+    if (ndim > TENSOR_MAX_DIMS) {
+        fprintf(stderr, "Error: Tensors can have at most %d dimensions.\n",
+                TENSOR_MAX_DIMS);
+        return NULL;
+    }
+
+    va_list args;
+    va_start(args, ndim);
+    for (size_t i = 0; i < ndim; i++) {
+        shape[i] = va_arg(args, size_t);
+    }
+    va_end(args);
+
+    return tensor_randn_from_shape(ndim, shape);
+}
+
 bool tensor_equal(const Tensor *t1, const Tensor *t2) {
-    if (t1->ndim != t2->ndim) {
+    if (t1->ndim != t2->ndim || t1->dtype != t2->dtype) {
         return false;
     }
 
@@ -329,9 +697,17 @@ bool tensor_equal(const Tensor *t1, const Tensor *t2) {
         }
     }
 
-    for (size_t i = 0; i < t1->size; i++) {
-        if (t1->data[i] != t2->data[i]) {
-            return false;
+    TensorIter it;
+    iter_init(&it, 2, (const Tensor *[]){t1, t2});
+    while (iter_next(&it)) {
+        for (size_t i = 0; i < it.inner_size; i++) {
+            size_t p0 = it.offsets[0] + i * it.inner_strides[0];
+            size_t p1 = it.offsets[1] + i * it.inner_strides[1];
+            bool equal = t1->dtype == TENSOR_F32 ? t1->data[p0] == t2->data[p1]
+                                                 : element_value(t1, p0) == element_value(t2, p1);
+            if (!equal) {
+                return false;
+            }
         }
     }
 
@@ -6,29 +6,103 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Largest number of dimensions a tensor may have
+#define TENSOR_MAX_DIMS 32
 
 // General Tensor structure
 typedef float Dtype;
 
+// Element types. Most operations work on float32 tensors. Element-wise
+// operations, sums, means, copies and views work on every type: float64 with
+// kernels of its own, float16 and bfloat16 as storage formats that are
+// converted to float32 for the arithmetic and rounded back.
+typedef enum {
+    TENSOR_F32,
+    TENSOR_F64,
+    TENSOR_F16,
+    TENSOR_BF16,
+    TENSOR_DTYPE_COUNT
+} TensorDtype;
+
+typedef enum {
+    TENSOR_STORAGE_HEAP,  // Pooled heap block, freed with the last reference
+    TENSOR_STORAGE_ARENA, // Released when its arena scope is popped
+    TENSOR_STORAGE_MMAP,  // File mapping, unmapped with the last reference
+} TensorStorageKind;
+
+// Buffer shared by a tensor and all views of it
 typedef struct {
-    Dtype *data;  // Pointer to flattened data
-    size_t *shape; // Array storing dimensions
-    size_t ndim;   // Number of dimensions
-    size_t size;   // Total number of elements (product of shape)
+    Dtype *data;
+    atomic_size_t refcount;
+    size_t capacity; // Bytes of the block holding this header and the data,
+                     // or of the mapping
+    TensorStorageKind kind;
+    void *mapping;   // Start of the mapping for TENSOR_STORAGE_MMAP
+} TensorStorage;
+
+typedef struct {
+    union {
+        Dtype *data;    // Pointer to the first element (storage data + offset)
+        double *data_f64;
+        uint16_t *data_half; // Bit patterns of float16 and bfloat16 elements
+    };
+    TensorDtype dtype;
+    size_t *shape;  // Array storing dimensions
+    size_t ndim;    // Number of dimensions
+    size_t size;    // Total number of elements (product of shape)
+    size_t *strides; // Elements to skip to advance one index in each dimension
+    size_t offset;  // Position of the first element in the storage
+    TensorStorage *storage;
+    bool in_arena;  // Header allocated from an arena scope
 } Tensor;
 
 // Function prototypes
 Tensor *tensor_create(size_t ndim, ...);
 Tensor *tensor_create_from_shape(size_t ndim, size_t shape[]);
+Tensor *tensor_create_typed(TensorDtype dtype, size_t ndim, const size_t shape[]);
 Tensor *tensor_copy(const Tensor *t);
+// Copies between dtypes convert, rounding to nearest even
+Tensor *tensor_copy_into(Tensor *out, const Tensor *t);
+// Contiguous copy of t converted to dtype
+Tensor *tensor_astype(const Tensor *t, TensorDtype dtype);
+size_t tensor_dtype_size(TensorDtype dtype); // Bytes per element
+const char *tensor_dtype_name(TensorDtype dtype);
 void tensor_populate_array(Tensor *t, Dtype array[]);
+void tensor_fill(Tensor *t, Dtype value);
 Tensor *tensor_reshape(const Tensor *t, size_t ndim, size_t shape[]);
 Tensor *tensor_transpose(const Tensor *tensor);
+// Transpose a square matrix by moving its elements, returns t
+Tensor *tensor_transpose_inplace(Tensor *t);
 Tensor *tensor_concatenate(const Tensor *t1, const Tensor *t2, size_t axis);
+// Uniform values in [0, 1) and standard normal values from the counter-based
+// generator of random.h, seeded by tensor_seed (0 until it is called). The
+// values do not depend on the number of threads.
 Tensor *tensor_rand(size_t ndim, ...);
 Tensor *tensor_rand_from_shape(size_t ndim, size_t shape[]);
+Tensor *tensor_randn(size_t ndim, ...);
+Tensor *tensor_randn_from_shape(size_t ndim, size_t shape[]);
+void tensor_seed(uint64_t seed);
 bool tensor_equal(const Tensor *t1, const Tensor *t2);
 
+// Views
+// These share the data of the source tensor instead of copying it, as do
+// tensor_transpose and tensor_reshape of contiguous data. A view stays valid
+// after the source is freed, and writes through a view are visible in every
+// tensor sharing its storage.
+Tensor *tensor_permute(const Tensor *t, const size_t axes[]);
+Tensor *tensor_slice(const Tensor *t, size_t axis, size_t start, size_t stop);
+bool tensor_is_contiguous(const Tensor *t);
+Tensor *tensor_contiguous(const Tensor *t);
+Dtype tensor_get(const Tensor *t, const size_t idx[]);
+
+// Row-major tensor of dtype over existing storage, e.g. a file mapping,
+// starting at storage->data. The tensor takes over the caller's reference.
+Tensor *tensor_from_storage(TensorStorage *storage, TensorDtype dtype, size_t ndim,
+                            const size_t shape[]);
+
 void tensor_free(Tensor *t);
 void tensor_print(const Tensor *t);
 
@@ -1,7 +1,74 @@
+#include "datasets.h"
 #include "la.h"
+#include "linear_models.h"
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
 
-int main() {
-    
+// Ordinary least squares on a synthetic problem, streamed in chunks so that
+// the rows never exist all at once:
+//
+//     ord_lin_reg [samples] [features] [chunk rows]
 
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    size_t d = argc > 2 ? strtoull(argv[2], NULL, 10) : 100;
+    size_t chunk = argc > 3 ? strtoull(argv[3], NULL, 10) : 65536;
+    if (n == 0 || d == 0 || chunk == 0) {
+        fprintf(stderr, "Usage: %s [samples] [features] [chunk rows]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    RegressionOptions options = {.n_samples = n, .n_features = d, .n_informative = d / 2 + 1,
+                                 .bias = 0.0f, .noise = 1.0f, .seed = 42};
+    LinearRegression *lr = linear_regression_init(d, 1);
+    Tensor *X = tensor_create(2, chunk, d);
+    Tensor *y = tensor_create(2, chunk, (size_t)1);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    double generating = 0;
+    for (size_t begin = 0; begin < n; begin += chunk) {
+        size_t rows = n - begin < chunk ? n - begin : chunk;
+        Tensor *Xc = tensor_slice(X, 0, 0, rows);
+        Tensor *yc = tensor_slice(y, 0, 0, rows);
+
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        make_regression_rows(&options, begin, Xc, yc);
+        generating += seconds_since(&t);
+        linear_regression_partial_fit(lr, Xc, yc);
+
+        tensor_free(Xc);
+        tensor_free(yc);
+    }
+    Tensor *W = linear_regression_finalize(lr);
+    double total = seconds_since(&start);
+    if (!W) {
+        return EXIT_FAILURE;
+    }
+
+    // The fit recovers the generating weights up to the noise
+    Tensor *coef = make_regression_coef(&options);
+    double err = 0;
+    for (size_t j = 0; j < d; j++) {
+        double e = W->data[j] - coef->data[j];
+        err = e * e > err ? e * e : err;
+    }
+    printf("%zu samples x %zu features: generated in %.2f s, fitted in %.2f s\n", n, d,
+           generating, total - generating);
+    printf("Largest weight error: %.3g\n", sqrt(err));
+
+    tensor_free(X);
+    tensor_free(y);
+    tensor_free(W);
+    tensor_free(coef);
+    linear_regression_free(lr);
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,300 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "datasets.h"
+#include "linear_models.h"
+#include "parallel.h"
+#include "utils.h"
+
+static void write_file(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    fputs(text, f);
+    fclose(f);
+}
+
+void test_load_csv() {
+    printf("\nTesting dataset_load_csv...\n");
+    const char *path = "test_datasets.csv";
+
+    // Test 1: Header, delimiter and the last column as y are guessed
+    write_file(path, "a,b,target\n1,2.5,3\n-4e2,0.125,6\r\n\n7,\"8\",1e-3\n");
+    Dataset *d = dataset_load_csv(path, NULL);
+    assert(d->X->shape[0] == 3 && d->X->shape[1] == 2);
+    assert(d->y->shape[0] == 3 && d->y->shape[1] == 1);
+    assert(float_equal(d->X->data[1], 2.5));
+    assert(float_equal(d->X->data[2], -400));
+    assert(float_equal(d->X->data[5], 8));
+    assert(float_equal(d->y->data[2], 0.001));
+    dataset_free(d);
+    printf("Defaults passed\n");
+
+    // Test 2: TSV with column selection, an empty field and no header
+    write_file(path, "1\t2\t3\t4\n5\t\t7\t8\n");
+    CsvOptions options = {'\t', 0, (size_t[]){3, 1}, 2, (size_t[]){0, 2}, 2};
+    d = dataset_load_csv(path, &options);
+    assert(d->X->shape[1] == 2 && d->y->shape[1] == 2);
+    assert(float_equal(d->X->data[0], 4) && float_equal(d->X->data[1], 2));
+    assert(isnan(d->X->data[3]));
+    assert(float_equal(d->y->data[2], 5) && float_equal(d->y->data[3], 7));
+    dataset_free(d);
+    printf("Column selection passed\n");
+
+    // Test 3: Many rows split over several workers. Short decimals take the
+    // fast path, which must round exactly like strtod.
+    size_t n = 20000;
+    Dtype *expected = malloc(2 * n * sizeof(Dtype));
+    FILE *f = fopen(path, "w");
+    fprintf(f, "x,y\n");
+    for (size_t i = 0; i < n; i++) {
+        char x[32], y[32];
+        snprintf(x, sizeof(x), "%.6f", i * 0.001 - 3);
+        snprintf(y, sizeof(y), "%.9g", 1.0 / (i + 1));
+        expected[2 * i] = (Dtype)strtod(x, NULL);
+        expected[2 * i + 1] = (Dtype)strtod(y, NULL);
+        fprintf(f, "%s,%s\n", x, y);
+    }
+    fclose(f);
+    setenv("MLC_NUM_THREADS", "4", 1);
+    d = dataset_load_csv(path, NULL);
+    unsetenv("MLC_NUM_THREADS");
+    assert(d->X->shape[0] == n);
+    for (size_t i = 0; i < n; i++) {
+        assert(d->X->data[i] == expected[2 * i]);
+        assert(d->y->data[i] == expected[2 * i + 1]);
+    }
+    dataset_free(d);
+    free(expected);
+    printf("Parallel parsing passed\n");
+
+    // Test 4: Malformed input
+    write_file(path, "1,2,3\n4,5\n");
+    assert(dataset_load_csv(path, NULL) == NULL);
+    write_file(path, "1,2,3\n4,x,6\n");
+    assert(dataset_load_csv(path, NULL) == NULL);
+    CsvOptions bad_columns = {0, -1, NULL, 0, (size_t[]){5}, 1};
+    assert(dataset_load_csv(path, &bad_columns) == NULL);
+    remove(path);
+    assert(dataset_load_csv(path, NULL) == NULL);
+    printf("Error handling passed\n");
+}
+
+void test_make_regression() {
+    printf("\nTesting make_regression...\n");
+
+    // Without noise y is exactly X W + bias, with W zero past the
+    // informative features
+    RegressionOptions options = {.n_samples = 5000, .n_features = 30, .n_informative = 10,
+                                 .n_targets = 2, .bias = 3.0f, .seed = 11};
+    Dataset *d = make_regression(&options);
+    Tensor *W = make_regression_coef(&options);
+    assert(d->X->shape[0] == 5000 && d->X->shape[1] == 30 && d->y->shape[1] == 2);
+    for (size_t j = 0; j < 30; j++) {
+        for (size_t c = 0; c < 2; c++) {
+            Dtype w = W->data[j * 2 + c];
+            assert(j < 10 ? w >= 0 && w < 100 && w != 0 : w == 0);
+        }
+    }
+    for (size_t i = 0; i < 5000; i += 7) {
+        double expected = 3.0;
+        for (size_t j = 0; j < 30; j++) {
+            expected += (double)d->X->data[i * 30 + j] * W->data[j * 2 + 1];
+        }
+        assert(fabs(d->y->data[i * 2 + 1] - expected) < 1e-3 * (1 + fabs(expected)));
+    }
+    double m1 = 0, m2 = 0;
+    for (size_t i = 0; i < d->X->size; i++) {
+        m1 += d->X->data[i];
+        m2 += (double)d->X->data[i] * d->X->data[i];
+    }
+    assert(fabs(m1 / d->X->size) < 0.02 && fabs(m2 / d->X->size - 1) < 0.03);
+
+    // Chunks of any size, on any number of threads, give the same rows, and
+    // the noisy problem is still solved (the fit has no intercept)
+    options.noise = 0.5f;
+    options.bias = 0.0f;
+    Dataset *noisy = make_regression(&options);
+    Tensor *Xc = tensor_create(2, 1300, 30);
+    Tensor *yc = tensor_create(2, 1300, 2);
+    LinearRegression *lr = linear_regression_init(30, 2);
+    parallel_set_num_threads(1);
+    for (size_t begin = 0; begin < 5000; begin += 1300) {
+        size_t rows = 5000 - begin < 1300 ? 5000 - begin : 1300;
+        Tensor *xs = tensor_slice(Xc, 0, 0, rows), *ys = tensor_slice(yc, 0, 0, rows);
+        assert(make_regression_rows(&options, begin, xs, ys));
+        assert(memcmp(xs->data, noisy->X->data + begin * 30, rows * 30 * sizeof(Dtype)) == 0);
+        assert(memcmp(ys->data, noisy->y->data + begin * 2, rows * 2 * sizeof(Dtype)) == 0);
+        assert(linear_regression_partial_fit(lr, xs, ys));
+        tensor_free(xs);
+        tensor_free(ys);
+    }
+    parallel_set_num_threads(0);
+    Tensor *fit = linear_regression_finalize(lr);
+    for (size_t i = 0; i < 60; i++) {
+        assert(fabsf(fit->data[i] - W->data[i]) < 0.05f);
+    }
+    assert(memcmp(d->X->data, noisy->X->data, d->X->size * sizeof(Dtype)) == 0);
+
+    // Another seed, other data; rows past the end and bad shapes fail
+    options.seed = 12;
+    Dataset *other = make_regression(&options);
+    assert(memcmp(other->X->data, d->X->data, 100 * sizeof(Dtype)) != 0);
+    assert(!make_regression_rows(&options, 4000, Xc, yc));
+    assert(!make_regression_rows(&options, 0, yc, yc));
+    options.n_informative = 31;
+    assert(make_regression(&options) == NULL);
+
+    dataset_free(d);
+    dataset_free(noisy);
+    dataset_free(other);
+    linear_regression_free(lr);
+    Tensor *tensors[] = {W, Xc, yc, fit};
+    for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+        tensor_free(tensors[i]);
+    }
+    printf("Synthetic regression passed\n");
+}
+
+void test_make_sparse_regression() {
+    printf("\nTesting make_sparse_regression...\n");
+
+    // One percent of 2000 features per row, in distinct sorted columns
+    RegressionOptions options = {.n_samples = 3000, .n_features = 2000, .n_informative = 500,
+                                 .density = 0.01f, .noise = 0.0f, .seed = 5};
+    SparseDataset *d = make_sparse_regression(&options);
+    SparseTensor *X = d->X;
+    assert(X->format == SPARSE_CSR && X->rows == 3000 && X->cols == 2000);
+    assert(X->nnz == 3000 * 20);
+    size_t *hits = calloc(2000, sizeof(size_t));
+    for (size_t i = 0; i < 3000; i++) {
+        assert(X->indptr[i + 1] - X->indptr[i] == 20);
+        for (size_t p = X->indptr[i]; p < X->indptr[i + 1]; p++) {
+            assert(X->indices[p] < 2000);
+            assert(p == X->indptr[i] || X->indices[p] > X->indices[p - 1]);
+            hits[X->indices[p]]++;
+        }
+    }
+    // Every column is used about 30 times
+    for (size_t j = 0; j < 2000; j++) {
+        assert(hits[j] < 80);
+    }
+    free(hits);
+
+    // The targets are X W, and chunks match the whole
+    Tensor *W = make_regression_coef(&options);
+    Tensor *expected = sparse_matmul(X, W);
+    for (size_t i = 0; i < 3000; i++) {
+        assert(fabsf(d->y->data[i] - expected->data[i]) < 1e-3f * (1 + fabsf(expected->data[i])));
+    }
+    SparseDataset *chunk = make_sparse_regression_rows(&options, 1234, 700);
+    assert(memcmp(chunk->X->indices, X->indices + 1234 * 20, 700 * 20 * sizeof(uint32_t)) == 0);
+    assert(memcmp(chunk->X->values, X->values + 1234 * 20, 700 * 20 * sizeof(Dtype)) == 0);
+    assert(memcmp(chunk->y->data, d->y->data + 1234, 700 * sizeof(Dtype)) == 0);
+
+    options.density = 0;
+    assert(make_sparse_regression(&options) == NULL);
+
+    sparse_dataset_free(d);
+    sparse_dataset_free(chunk);
+    tensor_free(W);
+    tensor_free(expected);
+    printf("Synthetic sparse regression passed\n");
+}
+
+void test_make_classification() {
+    printf("\nTesting make_classification...\n");
+
+    // Four classes on distinct corners of the square of the first two
+    // features, the others noise
+    ClassificationOptions options = {.n_samples = 8000, .n_features = 6, .n_informative = 2,
+                                     .n_classes = 4, .class_sep = 3.0f, .seed = 9};
+    Dataset *d = make_classification(&options);
+    assert(d->y->shape[0] == 8000 && d->y->shape[1] == 1);
+    size_t counts[4] = {0};
+    double mean[4][6] = {{0}};
+    for (size_t i = 0; i < 8000; i++) {
+        Dtype label = d->y->data[i];
+        assert(label == floorf(label) && label >= 0 && label < 4);
+        size_t c = (size_t)label;
+        counts[c]++;
+        for (size_t j = 0; j < 6; j++) {
+            mean[c][j] += d->X->data[i * 6 + j];
+        }
+    }
+    int corners = 0;
+    for (size_t c = 0; c < 4; c++) {
+        assert(counts[c] > 1800 && counts[c] < 2200);
+        for (size_t j = 0; j < 6; j++) {
+            mean[c][j] /= counts[c];
+            double centre = j >= 2 ? 0 : mean[c][j] > 0 ? 3 : -3;
+            assert(fabs(mean[c][j] - centre) < 0.1);
+        }
+        corners |= 1 << ((mean[c][0] > 0) + 2 * (mean[c][1] > 0));
+    }
+    assert(corners == 15);
+
+    // The class is the quadrant, mostly
+    size_t agree = 0;
+    for (size_t i = 0; i < 8000; i++) {
+        const Dtype *x = d->X->data + i * 6;
+        size_t c = (size_t)d->y->data[i];
+        agree += (x[0] > 0) == (mean[c][0] > 0) && (x[1] > 0) == (mean[c][1] > 0);
+    }
+    assert(agree > 7700);
+
+    // Flipped labels no longer follow the quadrant
+    options.flip_y = 0.5f;
+    Dataset *flipped = make_classification(&options);
+    assert(memcmp(flipped->X->data, d->X->data, d->X->size * sizeof(Dtype)) == 0);
+    size_t changed = 0;
+    for (size_t i = 0; i < 8000; i++) {
+        changed += flipped->y->data[i] != d->y->data[i];
+    }
+    assert(changed > 8000 * 0.5 * 0.75 * 0.9 && changed < 8000 * 0.5 * 0.75 * 1.1);
+
+    options.n_classes = 5;
+    assert(make_classification(&options) == NULL);
+
+    // Every informative feature separates the classes, for any seed and
+    // however few classes there are
+    for (uint64_t seed = 0; seed < 8; seed++) {
+        for (size_t n_classes = 2; n_classes <= 5; n_classes++) {
+            ClassificationOptions few = {.n_samples = 2000, .n_features = 8,
+                                         .n_informative = 6, .n_classes = n_classes,
+                                         .class_sep = 2.0f, .seed = seed};
+            Dataset *c = make_classification(&few);
+            double sums[5][6] = {{0}};
+            size_t sizes[5] = {0};
+            for (size_t i = 0; i < 2000; i++) {
+                size_t label = (size_t)c->y->data[i];
+                sizes[label]++;
+                for (size_t j = 0; j < 6; j++) {
+                    sums[label][j] += c->X->data[i * 8 + j];
+                }
+            }
+            for (size_t j = 0; j < 6; j++) {
+                double lo = INFINITY, hi = -INFINITY;
+                for (size_t k = 0; k < n_classes; k++) {
+                    double m = sums[k][j] / sizes[k];
+                    lo = m < lo ? m : lo;
+                    hi = m > hi ? m : hi;
+                }
+                assert(hi - lo > 3);
+            }
+            dataset_free(c);
+        }
+    }
+
+    dataset_free(d);
+    dataset_free(flipped);
+    printf("Synthetic classification passed\n");
+}
+
+int main() {
+    test_load_csv();
+    test_make_regression();
+    test_make_sparse_regression();
+    test_make_classification();
+    printf("\nAll tests passed successfully!\n");
+    return 0;
+}
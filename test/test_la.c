@@ -1,7 +1,17 @@
+#include "kernels.h"
 #include "la.h"
+#include "lazy.h"
+#include "parallel.h"
+#include "sparse.h"
+#include "stream.h"
 #include "tensor.h"
 #include "utils.h"
 #include <assert.h>
+#include <math.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
 
 void test_element_wise_operations() {
     // Create two 2x2 tensors
@@ -90,6 +100,310 @@ void test_scalar_operations() {
     tensor_free(div);
 }
 
+void test_into_operations() {
+    Tensor *a = tensor_create(2, 2, 2);
+    Tensor *b = tensor_create(2, 2, 2);
+    Tensor *out = tensor_create(2, 2, 2);
+    tensor_populate_array(a, (float[]){1.0, 2.0, 3.0, 4.0});
+    tensor_populate_array(b, (float[]){2.0, 3.0, 4.0, 5.0});
+
+    // Write into a caller-provided tensor
+    assert(tensor_multiply_into(out, a, b) == out);
+    assert(float_equal(out->data[3], 20.0)); // 4 * 5
+
+    // In place: a += b, then a *= 0.5
+    assert(tensor_add_into(a, a, b) == a);
+    assert(tensor_multiply_scalar_into(a, a, 0.5) == a);
+    assert(float_equal(a->data[0], 1.5)); // (1 + 2) / 2
+    assert(float_equal(a->data[3], 4.5)); // (4 + 5) / 2
+
+    // Matrix multiplication into an existing output
+    Tensor *m = tensor_create(2, 2, 3);
+    tensor_populate_array(m, (float[]){1.0, 0.0, 2.0, 0.0, 1.0, 3.0});
+    Tensor *mm = tensor_create(2, 2, 3);
+    assert(tensor_matmul_into(mm, b, m) == mm);
+    assert(float_equal(mm->data[2], 13.0)); // 2*2 + 3*3
+    assert(tensor_matmul_into(b, b, b) == NULL); // aliasing is rejected
+
+    // Reductions along an axis into an existing output
+    Tensor *col = tensor_create(1, 3);
+    assert(tensor_mean_axis_into(col, m, 0) == col);
+    assert(float_equal(col->data[2], 2.5)); // (2 + 3) / 2
+
+    // Wrong output shapes are rejected
+    assert(tensor_add_into(col, a, b) == NULL);
+    assert(tensor_sum_axis_into(col, m, 1) == NULL);
+
+    tensor_free(a);
+    tensor_free(b);
+    tensor_free(out);
+    tensor_free(m);
+    tensor_free(mm);
+    tensor_free(col);
+}
+
+void test_strided_operations() {
+    Tensor *a = tensor_create(2, 3, 2);
+    tensor_populate_array(a, (float[]){1.0, 2.0, 3.0, 4.0, 5.0, 6.0});
+    Tensor *at = tensor_transpose(a); // [[1, 3, 5], [2, 4, 6]]
+
+    // Element-wise ops on a transposed view
+    Tensor *b = tensor_create(2, 2, 3);
+    tensor_populate_array(b, (float[]){1.0, 1.0, 1.0, 2.0, 2.0, 2.0});
+    Tensor *sum = tensor_add(at, b);
+    assert(float_equal(sum->data[1], 4.0)); // 3 + 1
+    assert(float_equal(sum->data[3], 4.0)); // 2 + 2
+
+    // Writing into a column slice through the view
+    Tensor *col = tensor_slice(a, 1, 1, 2);
+    assert(tensor_multiply_scalar_into(col, col, 10.0) == col);
+    assert(float_equal(a->data[1], 20.0));
+    assert(float_equal(a->data[5], 60.0));
+
+    // Matrix multiplication reads transposed operands in place
+    Tensor *ata = tensor_matmul(at, a); // A^T A with A = [[1, 20], [3, 40], [5, 60]]
+    assert(float_equal(ata->data[0], 35.0));   // 1 + 9 + 25
+    assert(float_equal(ata->data[1], 440.0));  // 20 + 120 + 300
+    assert(float_equal(ata->data[2], 440.0));
+
+    // Reductions follow the logical order of the view
+    assert(float_equal(tensor_sum(at), 129.0));
+    assert(tensor_argmax(at) == 5); // 60 is last in [[1, 3, 5], [20, 40, 60]]
+    Tensor *rows = tensor_sum_axis(at, 1);
+    assert(float_equal(rows->data[1], 120.0));
+
+    tensor_free(a);
+    tensor_free(at);
+    tensor_free(b);
+    tensor_free(sum);
+    tensor_free(col);
+    tensor_free(ata);
+    tensor_free(rows);
+}
+
+void test_broadcasting() {
+    Tensor *x = tensor_create(2, 2, 3);
+    tensor_populate_array(x, (float[]){1.0, 2.0, 3.0, 4.0, 5.0, 6.0});
+
+    // A [3] bias row is added to every row
+    Tensor *bias = tensor_create(1, 3);
+    tensor_populate_array(bias, (float[]){10.0, 20.0, 30.0});
+    Tensor *shifted = tensor_add(x, bias);
+    assert(shifted->shape[0] == 2 && shifted->shape[1] == 3);
+    assert(float_equal(shifted->data[0], 11.0));
+    assert(float_equal(shifted->data[5], 36.0));
+
+    // Centering columns with a [1, 3] mean and scaling rows with a [2, 1] column
+    Tensor *mean = tensor_create(2, 1, 3);
+    tensor_populate_array(mean, (float[]){2.5, 3.5, 4.5});
+    Tensor *centered = tensor_subtract(x, mean);
+    assert(float_equal(centered->data[0], -1.5));
+    assert(float_equal(centered->data[4], 1.5));
+
+    Tensor *rows = tensor_create(2, 2, 1);
+    tensor_populate_array(rows, (float[]){1.0, 2.0});
+    Tensor *scaled = tensor_divide(x, rows);
+    assert(float_equal(scaled->data[2], 3.0)); // 3 / 1
+    assert(float_equal(scaled->data[5], 3.0)); // 6 / 2
+
+    // Both operands broadcast: [2, 1] * [3] gives [2, 3]
+    Tensor *outer = tensor_multiply(rows, bias);
+    assert(outer->shape[0] == 2 && outer->shape[1] == 3);
+    assert(float_equal(outer->data[4], 40.0)); // 2 * 20
+
+    // In place with a broadcast operand
+    assert(tensor_subtract_into(x, x, mean) == x);
+    assert(float_equal(tensor_sum(x), 0.0));
+
+    // Incompatible shapes
+    Tensor *bad = tensor_create(1, 2);
+    assert(tensor_add(x, bad) == NULL);
+
+    tensor_free(x);
+    tensor_free(bias);
+    tensor_free(shifted);
+    tensor_free(mean);
+    tensor_free(centered);
+    tensor_free(rows);
+    tensor_free(scaled);
+    tensor_free(outer);
+    tensor_free(bad);
+}
+
+void test_lazy_evaluation() {
+    // Longer than one evaluation block, with a broadcast row and a strided input
+    Tensor *a = tensor_create(2, 3, 1500);
+    Tensor *b = tensor_create(2, 3, 1500);
+    Tensor *bias = tensor_create(1, 1500);
+    Tensor *ct = tensor_create(2, 1500, 3);
+    for (size_t i = 0; i < a->size; i++) {
+        a->data[i] = (float)(i % 13) * 0.5f - 3.0f;
+        b->data[i] = (float)(i % 7) + 1.0f;
+        ct->data[i] = (float)(i % 5) * 0.25f;
+    }
+    for (size_t i = 0; i < bias->size; i++) {
+        bias->data[i] = (float)(i % 3);
+    }
+    Tensor *c = tensor_transpose(ct);
+
+    // (a * b + 2c - bias) / b against the eager operations
+    Tensor *ab = tensor_multiply(a, b);
+    Tensor *c2 = tensor_multiply_scalar(c, 2);
+    Tensor *sum = tensor_add(ab, c2);
+    Tensor *shifted = tensor_subtract(sum, bias);
+    Tensor *expected = tensor_divide(shifted, b);
+
+    LazyGraph *g = lazy_graph_create();
+    LazyTensor *la = lazy_tensor(g, a), *lb = lazy_tensor(g, b);
+    LazyTensor *e = lazy_add(lazy_multiply(la, lb), lazy_multiply_scalar(lazy_tensor(g, c), 2));
+    e = lazy_divide(lazy_subtract(e, lazy_tensor(g, bias)), lb);
+    Tensor *result = lazy_eval(e);
+    assert(tensor_equal(result, expected));
+
+    // Fused reductions, with a node used twice
+    LazyTensor *r = lazy_subtract(la, lb);
+    LazyTensor *sq = lazy_multiply(r, r);
+    Tensor *diff = tensor_subtract(a, b);
+    Tensor *diff2 = tensor_multiply(diff, diff);
+    assert(fabsf(lazy_sum(sq) - tensor_sum(diff2)) <= 1e-4f * fabsf(tensor_sum(diff2)));
+    assert(fabsf(lazy_mean(sq) - tensor_mean(diff2)) <= 1e-4f * fabsf(tensor_mean(diff2)));
+
+    // Into a strided output, and in place into an input
+    Tensor *out_t = tensor_create(2, 1500, 3);
+    Tensor *out = tensor_transpose(out_t);
+    assert(lazy_eval_into(out, e) == out);
+    assert(float_equal(tensor_get(out, (size_t[]){2, 999}), tensor_get(expected, (size_t[]){2, 999})));
+    assert(lazy_eval_into(a, lazy_add_scalar(la, 1)) == a);
+    assert(float_equal(a->data[1], -1.5));
+
+    // Errors propagate as NULL
+    Tensor *bad = tensor_create(1, 2);
+    assert(lazy_add(la, lazy_tensor(g, bad)) == NULL);
+    assert(lazy_eval(lazy_multiply_scalar(NULL, 2)) == NULL);
+    assert(lazy_eval_into(bad, e) == NULL);
+    lazy_graph_free(g);
+
+    Tensor *tensors[] = {a, b, bias, ct, c, ab, c2, sum, shifted, expected,
+                         result, diff, diff2, out_t, out, bad};
+    for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+        tensor_free(tensors[i]);
+    }
+    printf("Lazy evaluation passed\n");
+}
+
+void test_kernel_variants() {
+    // Every SIMD variant must match the scalar loops exactly, including tails
+    // and unaligned starts
+    const Kernels *ref = kernels_for_isa(KERNEL_ISA_SCALAR);
+    float a[80], b[80], expected[80], out[80];
+    for (size_t i = 0; i < 80; i++) {
+        a[i] = (float)i * 0.37f - 11.0f;
+        b[i] = (float)i * 0.11f + 1.0f;
+    }
+
+    for (int isa = 0; isa < KERNEL_ISA_COUNT; isa++) {
+        const Kernels *k = kernels_for_isa((KernelIsa)isa);
+        if (!k) {
+            continue;
+        }
+        kernel_binary_fn binary[][2] = {{k->add, ref->add}, {k->sub, ref->sub},
+                                        {k->mul, ref->mul}, {k->div, ref->div}};
+        kernel_scalar_fn scalar[][2] = {{k->add_scalar, ref->add_scalar},
+                                        {k->sub_scalar, ref->sub_scalar},
+                                        {k->mul_scalar, ref->mul_scalar},
+                                        {k->div_scalar, ref->div_scalar}};
+
+        for (size_t n = 0; n < 70; n++) {
+            for (size_t op = 0; op < 4; op++) {
+                binary[op][1](n, a + 1, b + 3, expected);
+                binary[op][0](n, a + 1, b + 3, out);
+                assert(memcmp(expected, out, n * sizeof(float)) == 0);
+
+                scalar[op][1](n, a + 2, 1.7f, expected);
+                scalar[op][0](n, a + 2, 1.7f, out);
+                assert(memcmp(expected, out, n * sizeof(float)) == 0);
+            }
+        }
+
+        // The double versions of the same templates
+        double ad[80], bd[80], expected_d[80], out_d[80];
+        for (size_t i = 0; i < 80; i++) {
+            ad[i] = a[i] + 1e-9 * (double)i;
+            bd[i] = b[i];
+        }
+        kernel_binary_f64_fn binary_f64[][2] = {{k->add_f64, ref->add_f64}, {k->sub_f64, ref->sub_f64},
+                                                {k->mul_f64, ref->mul_f64}, {k->div_f64, ref->div_f64}};
+        kernel_scalar_f64_fn scalar_f64[][2] = {{k->add_scalar_f64, ref->add_scalar_f64},
+                                                {k->sub_scalar_f64, ref->sub_scalar_f64},
+                                                {k->mul_scalar_f64, ref->mul_scalar_f64},
+                                                {k->div_scalar_f64, ref->div_scalar_f64}};
+        for (size_t n = 0; n < 70; n++) {
+            for (size_t op = 0; op < 4; op++) {
+                binary_f64[op][1](n, ad + 1, bd + 3, expected_d);
+                binary_f64[op][0](n, ad + 1, bd + 3, out_d);
+                assert(memcmp(expected_d, out_d, n * sizeof(double)) == 0);
+
+                scalar_f64[op][1](n, ad + 2, 1.7, expected_d);
+                scalar_f64[op][0](n, ad + 2, 1.7, out_d);
+                assert(memcmp(expected_d, out_d, n * sizeof(double)) == 0);
+            }
+            assert(fabs(k->sum_f64(n, ad + 1) - ref->sum_f64(n, ad + 1)) < 1e-9);
+        }
+
+        // int8 dot products at every length around the vector widths, with
+        // the extremes of the range
+        int8_t xi[200], wi[4 * 211];
+        for (size_t i = 0; i < 4 * 211; i++) {
+            wi[i] = (int8_t)((int)((i * 37) % 255) - 127);
+            if (i < 200) {
+                xi[i] = (int8_t)((int)((i * 91) % 255) - 127);
+            }
+        }
+        const Kernels *dots[] = {k, kernels_get()};
+        for (size_t v = 0; v < 2; v++) {
+            for (size_t n = 0; n < 200; n += n < 70 ? 1 : 13) {
+                int32_t expected_i[4], out_i[4];
+                ref->dot4_i8(n, xi, wi + 3, 211, expected_i);
+                dots[v]->dot4_i8(n, xi, wi + 3, 211, out_i);
+                assert(memcmp(expected_i, out_i, sizeof(out_i)) == 0);
+            }
+        }
+
+        // Transposes of every shape up to 9 x 8 out of a source with row
+        // pitch 8, into a destination with row pitch 10
+        for (size_t rows = 0; rows <= 9; rows++) {
+            for (size_t cols = 0; cols <= 8; cols++) {
+                memset(out, 0, sizeof(out));
+                k->transpose(rows, cols, a + 1, 8, out, 10);
+                for (size_t i = 0; i < rows; i++) {
+                    for (size_t j = 0; j < cols; j++) {
+                        assert(out[j * 10 + i] == a[1 + i * 8 + j]);
+                    }
+                }
+            }
+        }
+
+        // Reductions over every length, with repeated extremes and NaNs
+        float c[80];
+        for (size_t i = 0; i < 80; i++) {
+            c[i] = (float)((i * 37) % 23) - 11.0f;
+        }
+        c[5] = NAN;
+        c[40] = NAN;
+        for (size_t n = 0; n < 70; n++) {
+            assert(fabs(k->sum(n, a + 1) - ref->sum(n, a + 1)) < 1e-9);
+
+            float min, max, ref_min, ref_max;
+            size_t argmin, argmax, ref_argmin, ref_argmax;
+            ref->min_max(n, c + 3, &ref_min, &ref_argmin, &ref_max, &ref_argmax);
+            k->min_max(n, c + 3, &min, &argmin, &max, &argmax);
+            assert(argmin == ref_argmin && argmax == ref_argmax);
+            assert(n == 0 || (min == ref_min && max == ref_max));
+        }
+        printf("%s kernels passed\n", k->name);
+    }
+}
+
 void test_linear_algebra_operations() {
     // Test matrix multiplication
     Tensor *a = tensor_create(2, 2, 3); // 2x3 matrix
@@ -133,6 +447,263 @@ void test_linear_algebra_operations() {
     tensor_free(cross);
 }
 
+void test_matmul_blocked() {
+    // Shapes that exercise the packed path, edge tiles and several k blocks
+    size_t shapes[][3] = {{37, 300, 53}, {129, 517, 7}, {5, 1000, 131}, {64, 64, 64}};
+
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        size_t m = shapes[s][0], k = shapes[s][1], n = shapes[s][2];
+        Tensor *a = tensor_rand(2, m, k);
+        Tensor *b = tensor_rand(2, k, n);
+
+        Tensor *c = tensor_matmul(a, b);
+        assert(c->shape[0] == m && c->shape[1] == n);
+
+        for (size_t i = 0; i < m; i++) {
+            for (size_t j = 0; j < n; j++) {
+                double expected = 0;
+                for (size_t p = 0; p < k; p++) {
+                    expected += (double)a->data[i * k + p] * b->data[p * n + j];
+                }
+                assert(fabs(c->data[i * n + j] - expected) < 1e-4 * k);
+            }
+        }
+
+        tensor_free(a);
+        tensor_free(b);
+        tensor_free(c);
+    }
+}
+
+void test_gemm_flags() {
+    // Every combination of transposes against tensor_matmul on explicit
+    // transposed copies, accumulated into an existing output
+    Tensor *a = tensor_rand(2, 70, 40);  // op(a) is 70 x 40 or, transposed, 40 x 70
+    Tensor *b = tensor_rand(2, 40, 90);
+    Tensor *a_t = tensor_transpose(a);
+    Tensor *b_t = tensor_transpose(b);
+    Tensor *ac = tensor_contiguous(a_t); // 40 x 70
+    Tensor *bc = tensor_contiguous(b_t); // 90 x 40
+    Tensor *expected = tensor_matmul(a, b);
+
+    const Tensor *lhs[] = {a, ac}, *rhs[] = {b, bc};
+    for (int ta = 0; ta < 2; ta++) {
+        for (int tb = 0; tb < 2; tb++) {
+            Tensor *out = tensor_create(2, 70, 90);
+            tensor_fill(out, 1.0f);
+            assert(tensor_gemm(out, lhs[ta], rhs[tb], ta, tb, 2.0f, 0.5f) == out);
+            for (size_t i = 0; i < out->size; i++) {
+                assert(fabsf(out->data[i] - (2 * expected->data[i] + 0.5f)) < 1e-3f);
+            }
+            tensor_free(out);
+        }
+    }
+
+    // A^T A with beta 0 ignores whatever out held
+    Tensor *out = tensor_create(2, 40, 40);
+    tensor_fill(out, NAN);
+    Tensor *gram = tensor_gram(a);
+    tensor_gemm(out, a, a, true, false, 1.0f, 0.0f);
+    for (size_t i = 0; i < out->size; i++) {
+        assert(fabsf(out->data[i] - gram->data[i]) < 1e-3f);
+    }
+
+    // Shape and aliasing errors
+    Tensor *wrong = tensor_create(2, 70, 70);
+    assert(tensor_gemm(wrong, a, b, true, false, 1.0f, 0.0f) == NULL);
+    assert(tensor_gemm(wrong, a, a, false, true, 1.0f, 0.0f) == wrong);
+    assert(tensor_gemm(a_t, a, wrong, true, false, 1.0f, 0.0f) == NULL);
+
+    Tensor *tensors[] = {a, b, a_t, b_t, ac, bc, expected, out, gram, wrong};
+    for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+        tensor_free(tensors[i]);
+    }
+    printf("GEMM transpose flags passed\n");
+}
+
+static bool same_bits(const Tensor *a, const Tensor *b) {
+    return tensor_equal(a, b) && memcmp(a->data, b->data, a->size * sizeof(Dtype)) == 0;
+}
+
+// Reference product of matrix ia of a [.., m, k] and matrix ib of b [.., k, n],
+// both contiguous, against matrix io of out
+static void check_batch_product(const Tensor *out, size_t io, const Tensor *a, size_t ia,
+                                const Tensor *b, size_t ib, bool trans_b, float tol) {
+    size_t m = a->shape[a->ndim - 2], k = a->shape[a->ndim - 1];
+    size_t n = out->shape[out->ndim - 1];
+    const Dtype *am = a->data + ia * m * k, *bm = b->data + ib * k * n;
+    const Dtype *om = out->data + io * m * n;
+    for (size_t i = 0; i < m; i++) {
+        for (size_t j = 0; j < n; j++) {
+            double sum = 0;
+            for (size_t p = 0; p < k; p++) {
+                sum += (double)am[i * k + p] * bm[trans_b ? j * k + p : p * n + j];
+            }
+            assert(fabs(om[i * n + j] - sum) < tol);
+        }
+    }
+}
+
+void test_batched_matmul() {
+    // Small products spread over the batch: [6, 5] batches of [8, 7] matrices
+    // times [5] of [7, 9], broadcast along the first batch dimension
+    Tensor *a = tensor_rand(4, 6, 5, 8, 7);
+    Tensor *b = tensor_rand(3, 5, 7, 9);
+    Tensor *c = tensor_matmul(a, b);
+    assert(c->ndim == 4 && c->shape[0] == 6 && c->shape[1] == 5 && c->shape[2] == 8 &&
+           c->shape[3] == 9);
+    for (size_t i = 0; i < 30; i++) {
+        check_batch_product(c, i, a, i, b, i % 5, false, 1e-5f);
+    }
+
+    // Size 1 batch dimensions broadcast against each other: [3, 1] by [4]
+    Tensor *a1 = tensor_rand(4, 3, 1, 8, 7);
+    Tensor *b1 = tensor_rand(3, 4, 7, 9);
+    Tensor *c1 = tensor_matmul(a1, b1);
+    assert(c1->ndim == 4 && c1->shape[0] == 3 && c1->shape[1] == 4);
+    for (size_t i = 0; i < 12; i++) {
+        check_batch_product(c1, i, a1, i / 4, b1, i % 4, false, 1e-5f);
+    }
+
+    // A batch against one matrix, with B transposed, and the same bits on
+    // one thread as on all of them
+    Tensor *bt = tensor_rand(2, 9, 7);
+    Tensor *ct = tensor_create(4, 6, 5, 8, 9);
+    assert(tensor_gemm(ct, a, bt, false, true, 1.0f, 0.0f) == ct);
+    for (size_t i = 0; i < 30; i++) {
+        check_batch_product(ct, i, a, i, bt, 0, true, 1e-5f);
+    }
+    parallel_set_num_threads(1);
+    Tensor *serial = tensor_matmul(a, b);
+    parallel_set_num_threads(0);
+    assert(same_bits(serial, c));
+
+    // Products large enough to split across threads on their own, into a
+    // strided output
+    Tensor *la = tensor_rand(3, 2, 200, 150);
+    Tensor *lb = tensor_rand(3, 2, 150, 170);
+    Tensor *lc = tensor_matmul(la, lb);
+    for (size_t i = 0; i < 2; i++) {
+        check_batch_product(lc, i, la, i, lb, i, false, 1e-3f);
+    }
+    Tensor *lo = tensor_create(3, 170, 200, 2);
+    Tensor *lo_t = tensor_transpose(lo); // [2, 200, 170]
+    assert(tensor_matmul_into(lo_t, la, lb) == lo_t);
+    assert(tensor_equal(lo_t, lc));
+
+    // Batch dimensions that do not broadcast, and vectors
+    Tensor *v = tensor_rand(1, 7);
+    assert(tensor_matmul(a, b1) == NULL);
+    assert(tensor_matmul(v, b) == NULL);
+    assert(tensor_matmul_into(c1, a, b) == NULL);
+
+    Tensor *tensors[] = {a, b, c, a1, b1, c1, bt, ct, serial, la, lb, lc, lo, lo_t, v};
+    for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+        tensor_free(tensors[i]);
+    }
+    printf("Batched matmul passed\n");
+}
+
+void test_gram() {
+    // Shapes below the small-product cutoff, spanning several diagonal
+    // blocks, and a strided view
+    size_t shapes[][2] = {{5, 3}, {300, 70}, {1000, 130}};
+    for (size_t s = 0; s < 3; s++) {
+        Tensor *x = tensor_rand(2, shapes[s][0], shapes[s][1]);
+        Tensor *xt = tensor_transpose(x);
+        Tensor *expected = tensor_matmul(xt, x);
+        Tensor *g = tensor_gram(x);
+        Tensor *gd = tensor_gram_double(x);
+        for (size_t i = 0; i < expected->size; i++) {
+            Dtype tol = 1e-5f * shapes[s][0];
+            assert(fabsf(g->data[i] - expected->data[i]) < tol);
+            assert(fabsf(gd->data[i] - expected->data[i]) < tol);
+        }
+        size_t d = shapes[s][1];
+        assert(g->data[1 * d + 2] == g->data[2 * d + 1]);
+
+        // The Gram matrix of X^T is X X^T
+        Tensor *outer = tensor_matmul(x, xt);
+        Tensor *gt = tensor_gram(xt);
+        for (size_t i = 0; i < outer->size; i++) {
+            assert(fabsf(gt->data[i] - outer->data[i]) < 1e-5f * shapes[s][1]);
+        }
+
+        Tensor *tensors[] = {x, xt, expected, g, gd, outer, gt};
+        for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+            tensor_free(tensors[i]);
+        }
+    }
+
+    Tensor *v = tensor_create(1, 4);
+    assert(tensor_gram(v) == NULL);
+    tensor_free(v);
+    printf("Gram matrix passed\n");
+}
+
+void test_linear_solvers() {
+    // Symmetric positive definite, larger than one Cholesky block: A = M M^T + n I
+    size_t n = 150, r = 3;
+    Tensor *m = tensor_create(2, n, n);
+    for (size_t i = 0; i < m->size; i++) {
+        m->data[i] = (float)((i * 7) % 11) / 11.0f - 0.5f;
+    }
+    Tensor *mt = tensor_transpose(m);
+    Tensor *a = tensor_matmul(m, mt);
+    for (size_t i = 0; i < n; i++) {
+        a->data[i * n + i] += (float)n;
+    }
+    Tensor *x_true = tensor_create(2, n, r);
+    for (size_t i = 0; i < x_true->size; i++) {
+        x_true->data[i] = (float)(i % 5) - 2.0f;
+    }
+    Tensor *b = tensor_matmul(a, x_true);
+
+    Tensor *l = tensor_cholesky(a);
+    assert(l && float_equal(l->data[1], 0.0));
+    Tensor *lt = tensor_transpose(l);
+    Tensor *llt = tensor_matmul(l, lt);
+    for (size_t i = 0; i < a->size; i++) {
+        assert(fabsf(llt->data[i] - a->data[i]) < 1e-3f);
+    }
+
+    Tensor *x = tensor_solve_symmetric(a, b);
+    Tensor *y = tensor_solve(a, b);
+    for (size_t i = 0; i < x_true->size; i++) {
+        assert(fabsf(x->data[i] - x_true->data[i]) < 1e-3f);
+        assert(fabsf(y->data[i] - x_true->data[i]) < 1e-3f);
+    }
+
+    // Only the lower triangle is read: garbage above the diagonal is ignored
+    a->data[1] = 1e6f;
+    assert(tensor_solve_symmetric_into(b, a, b) == b);
+    for (size_t i = 0; i < x_true->size; i++) {
+        assert(fabsf(b->data[i] - x_true->data[i]) < 1e-3f);
+    }
+
+    // Symmetric but indefinite falls back to pivoting, which also handles a
+    // zero leading entry
+    Tensor *ind = tensor_create(2, 2, 2);
+    tensor_populate_array(ind, (float[]){0.0, 1.0, 1.0, 0.0});
+    Tensor *rhs = tensor_create(1, 2);
+    tensor_populate_array(rhs, (float[]){2.0, 3.0});
+    assert(tensor_cholesky(ind) == NULL);
+    Tensor *sol = tensor_solve_symmetric(ind, rhs);
+    assert(float_equal(sol->data[0], 3.0) && float_equal(sol->data[1], 2.0));
+
+    // Singular
+    Tensor *sing = tensor_create(2, 2, 2);
+    tensor_populate_array(sing, (float[]){1.0, 2.0, 2.0, 4.0});
+    assert(tensor_solve_symmetric(sing, rhs) == NULL);
+    assert(tensor_solve(sing, rhs) == NULL);
+
+    Tensor *tensors[] = {m, mt, a, x_true, b, l, lt, llt, x, y, ind, rhs, sol, sing};
+    for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+        tensor_free(tensors[i]);
+    }
+    printf("Linear solvers passed\n");
+}
+
 void test_reduction_operations() {
     // Create a 2x3 tensor
     Tensor *t = tensor_create(2, 2, 3);
@@ -173,6 +744,58 @@ void test_reduction_operations() {
     assert(float_equal(mean_axis1->data[0], 2.0)); // (1+2+3)/3
     assert(float_equal(mean_axis1->data[1], 5.0)); // (4+5+6)/3
 
+    // Sum along the middle axis of a 3-D tensor
+    Tensor *cube = tensor_create(3, 2, 3, 2);
+    tensor_populate_array(cube, (float[]){1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12});
+    Tensor *sum_mid = tensor_sum_axis(cube, 1);
+    assert(sum_mid->shape[0] == 2 && sum_mid->shape[1] == 2);
+    assert(float_equal(sum_mid->data[0], 9.0));  // 1+3+5
+    assert(float_equal(sum_mid->data[3], 30.0)); // 8+10+12
+    tensor_free(cube);
+    tensor_free(sum_mid);
+
+    // Sums of many elements keep their precision: a float accumulator would
+    // stop growing long before 2^24 + 2^22 ones
+    size_t big = (1 << 24) + (1 << 22);
+    Tensor *ones = tensor_create(1, big);
+    tensor_fill(ones, 1);
+    assert(tensor_sum(ones) == (Dtype)big);
+    assert(tensor_mean(ones) == 1);
+    tensor_free(ones);
+
+    // Results do not depend on the number of threads, and a strided view
+    // reduces exactly like its contiguous copy
+    Tensor *r = tensor_rand(2, 1500, 1000);
+    r->data[777777] = 2;
+    r->data[999999] = 2;
+    r->data[12345] = -1;
+    setenv("MLC_NUM_THREADS", "1", 1);
+    Dtype sum1 = tensor_sum(r);
+    TensorExtrema e1 = tensor_extrema(r);
+    setenv("MLC_NUM_THREADS", "3", 1);
+    Dtype sum3 = tensor_sum(r);
+    TensorExtrema e3 = tensor_extrema(r);
+    unsetenv("MLC_NUM_THREADS");
+    assert(memcmp(&sum1, &sum3, sizeof(Dtype)) == 0);
+    assert(memcmp(&e1, &e3, sizeof(e1)) == 0);
+    assert(e1.argmax == 777777 && e1.max == 2 && e1.argmin == 12345 && e1.min == -1);
+    assert(tensor_argmax(r) == 777777 && tensor_min(r) == -1);
+
+    Tensor *rt = tensor_transpose(r);
+    Tensor *rc = tensor_contiguous(rt);
+    Dtype sum_t = tensor_sum(rt), sum_c = tensor_sum(rc);
+    assert(memcmp(&sum_t, &sum_c, sizeof(Dtype)) == 0);
+    assert(tensor_argmin(rt) == tensor_argmin(rc) && tensor_argmin(rc) == 345 * 1500 + 12);
+    tensor_free(r);
+    tensor_free(rt);
+    tensor_free(rc);
+
+    // NaNs are skipped by the extrema
+    Tensor *nan = tensor_create(1, 4);
+    tensor_populate_array(nan, (float[]){NAN, 3, NAN, -2});
+    assert(tensor_argmax(nan) == 1 && tensor_argmin(nan) == 3);
+    tensor_free(nan);
+
     tensor_free(t);
     tensor_free(sum_axis0);
     tensor_free(sum_axis1);
@@ -180,11 +803,631 @@ void test_reduction_operations() {
     tensor_free(mean_axis1);
 }
 
+// Reference statistics of the elements t[a][b][c] over a and c, for one b
+static void axis_stats_reference(const Tensor *t, size_t b, double *mean, double *var,
+                                 Dtype *min, size_t *argmax) {
+    size_t n = t->shape[0] * t->shape[2];
+    double sum = 0, sq = 0;
+    Dtype max = -INFINITY;
+    *min = INFINITY;
+    for (size_t a = 0; a < t->shape[0]; a++) {
+        for (size_t c = 0; c < t->shape[2]; c++) {
+            Dtype v = tensor_get(t, (size_t[]){a, b, c});
+            sum += v;
+            *min = v < *min ? v : *min;
+            if (v > max) {
+                max = v;
+                *argmax = a * t->shape[2] + c;
+            }
+        }
+    }
+    *mean = sum / n;
+    for (size_t a = 0; a < t->shape[0]; a++) {
+        for (size_t c = 0; c < t->shape[2]; c++) {
+            double d = tensor_get(t, (size_t[]){a, b, c}) - *mean;
+            sq += d * d;
+        }
+    }
+    *var = sq / n;
+}
+
+// Statistics of row b of a contiguous matrix, in double
+static void row_stats_reference(const Tensor *t, size_t b, double *mean, double *var, Dtype *min,
+                                size_t *argmax) {
+    size_t n = t->shape[1];
+    const Dtype *x = t->data + b * n;
+    double sum = 0, sq = 0;
+    *min = x[0];
+    *argmax = 0;
+    for (size_t c = 0; c < n; c++) {
+        sum += x[c];
+        *min = x[c] < *min ? x[c] : *min;
+        *argmax = x[c] > x[*argmax] ? c : *argmax;
+    }
+    *mean = sum / n;
+    for (size_t c = 0; c < n; c++) {
+        double d = x[c] - *mean;
+        sq += d * d;
+    }
+    *var = sq / n;
+}
+
+void test_axis_reductions() {
+    // Over the outer and inner axis of a 3-D tensor, laid out so that the
+    // fastest dimension is reduced (segments of one output) and kept (rows
+    // of neighbouring outputs)
+    Tensor *t = tensor_rand(3, 7, 5, 9);
+    Tensor *base1 = tensor_create(3, 9, 5, 7);
+    Tensor *view1 = tensor_permute(base1, (size_t[]){2, 1, 0});
+    tensor_copy_into(view1, t);
+    Tensor *base2 = tensor_create(3, 7, 9, 5);
+    Tensor *view2 = tensor_permute(base2, (size_t[]){0, 2, 1});
+    tensor_copy_into(view2, t);
+
+    const Tensor *inputs[] = {t, view1, view2};
+    for (size_t i = 0; i < 3; i++) {
+        size_t axes[] = {2, 0};
+        Tensor *mean = tensor_reduce(inputs[i], TENSOR_REDUCE_MEAN, 2, axes, true);
+        assert(mean->ndim == 3 && mean->shape[0] == 1 && mean->shape[1] == 5 && mean->shape[2] == 1);
+
+        // The fused call fills several results of the dropped shape at once
+        Tensor *out[TENSOR_REDUCE_COUNT] = {NULL};
+        out[TENSOR_REDUCE_VAR] = tensor_create(1, 5);
+        out[TENSOR_REDUCE_STD] = tensor_create(1, 5);
+        out[TENSOR_REDUCE_MIN] = tensor_create(1, 5);
+        out[TENSOR_REDUCE_ARGMAX] = tensor_create(1, 5);
+        assert(tensor_reduce_into(out, inputs[i], 2, axes));
+
+        for (size_t b = 0; b < 5; b++) {
+            double ref_mean = 0, ref_var = 0;
+            Dtype ref_min = 0;
+            size_t ref_argmax = 0;
+            axis_stats_reference(inputs[i], b, &ref_mean, &ref_var, &ref_min, &ref_argmax);
+            assert(fabs(mean->data[b] - ref_mean) < 1e-6);
+            assert(fabs(out[TENSOR_REDUCE_VAR]->data[b] - ref_var) < 1e-6);
+            assert(fabs(out[TENSOR_REDUCE_STD]->data[b] - sqrt(ref_var)) < 1e-6);
+            assert(out[TENSOR_REDUCE_MIN]->data[b] == ref_min);
+            assert(out[TENSOR_REDUCE_ARGMAX]->data[b] == ref_argmax);
+        }
+
+        tensor_free(mean);
+        tensor_free(out[TENSOR_REDUCE_VAR]);
+        tensor_free(out[TENSOR_REDUCE_STD]);
+        tensor_free(out[TENSOR_REDUCE_MIN]);
+        tensor_free(out[TENSOR_REDUCE_ARGMAX]);
+    }
+
+    // Rows long enough for the kernels: more of them than REDUCE_SLOTS, and
+    // fewer that span several REDUCE_BLOCK pieces merged into one output
+    Tensor *wide[] = {tensor_rand(2, 6000, 70), tensor_rand(2, 3, 150000)};
+    for (size_t i = 0; i < 2; i++) {
+        size_t rows = wide[i]->shape[0];
+        Tensor *out[TENSOR_REDUCE_COUNT] = {NULL};
+        out[TENSOR_REDUCE_MEAN] = tensor_create(1, rows);
+        out[TENSOR_REDUCE_VAR] = tensor_create(1, rows);
+        out[TENSOR_REDUCE_MIN] = tensor_create(1, rows);
+        out[TENSOR_REDUCE_ARGMAX] = tensor_create(1, rows);
+        assert(tensor_reduce_into(out, wide[i], 1, (size_t[]){1}));
+
+        for (size_t b = 0; b < rows; b++) {
+            double ref_mean = 0, ref_var = 0;
+            Dtype ref_min = 0;
+            size_t ref_argmax = 0;
+            row_stats_reference(wide[i], b, &ref_mean, &ref_var, &ref_min, &ref_argmax);
+            assert(fabs(out[TENSOR_REDUCE_MEAN]->data[b] - ref_mean) < 1e-6);
+            assert(fabs(out[TENSOR_REDUCE_VAR]->data[b] - ref_var) < 1e-6);
+            assert(out[TENSOR_REDUCE_MIN]->data[b] == ref_min);
+            assert(out[TENSOR_REDUCE_ARGMAX]->data[b] == ref_argmax);
+        }
+
+        tensor_free(out[TENSOR_REDUCE_MEAN]);
+        tensor_free(out[TENSOR_REDUCE_VAR]);
+        tensor_free(out[TENSOR_REDUCE_MIN]);
+        tensor_free(out[TENSOR_REDUCE_ARGMAX]);
+        tensor_free(wide[i]);
+    }
+
+    // A single axis gives the index along it, the first one on ties
+    Tensor *m = tensor_create(2, 2, 3);
+    tensor_populate_array(m, (float[]){1, 7, 7, 7, 2, 7});
+    Tensor *argmax = tensor_reduce(m, TENSOR_REDUCE_ARGMAX, 1, (size_t[]){1}, false);
+    assert(argmax->data[0] == 1 && argmax->data[1] == 0);
+    Tensor *argmin = tensor_reduce(m, TENSOR_REDUCE_ARGMIN, 1, (size_t[]){0}, false);
+    assert(argmin->data[0] == 0 && argmin->data[1] == 1 && argmin->data[2] == 0);
+
+    // Variance of data far from zero, where the textbook E[x^2] - E[x]^2
+    // formula cancels to noise in float
+    Tensor *shifted = tensor_create(2, 4096, 2);
+    for (size_t r = 0; r < 4096; r++) {
+        shifted->data[2 * r] = 10000.0f + (r % 2 ? 1.0f : -1.0f);
+        shifted->data[2 * r + 1] = (float)(r % 4);
+    }
+    Tensor *var = tensor_reduce(shifted, TENSOR_REDUCE_VAR, 1, (size_t[]){0}, false);
+    assert(fabs(var->data[0] - 1.0) < 1e-6);
+    assert(fabs(var->data[1] - 1.25) < 1e-6);
+    Tensor *mean = tensor_reduce(shifted, TENSOR_REDUCE_MEAN, 1, (size_t[]){0}, false);
+    assert(mean->data[0] == 10000 && mean->data[1] == 1.5);
+
+    // Invalid axes
+    assert(tensor_reduce(m, TENSOR_REDUCE_SUM, 2, (size_t[]){1, 1}, false) == NULL);
+    assert(tensor_reduce(m, TENSOR_REDUCE_SUM, 1, (size_t[]){2}, false) == NULL);
+
+    tensor_free(t);
+    tensor_free(base1);
+    tensor_free(view1);
+    tensor_free(base2);
+    tensor_free(view2);
+    tensor_free(m);
+    tensor_free(argmax);
+    tensor_free(argmin);
+    tensor_free(shifted);
+    tensor_free(var);
+    tensor_free(mean);
+}
+
+static void count_indices(void *ctx, size_t begin, size_t end) {
+    atomic_int *counts = (atomic_int *)ctx;
+    for (size_t i = begin; i < end; i++) {
+        atomic_fetch_add(&counts[i], 1);
+    }
+}
+
+static double sum_indices(void *ctx, size_t begin, size_t end) {
+    (void)ctx;
+    double sum = 0;
+    for (size_t i = begin; i < end; i++) {
+        sum += 1.0 / (i + 1);
+    }
+    return sum;
+}
+
+// Heavy ops on the thread pool give the same bits for any thread count
+void test_parallel_runtime() {
+    // Every index is visited exactly once, whatever the grain and threads
+    size_t n = 100003;
+    atomic_int *counts = (atomic_int *)malloc(n * sizeof(atomic_int));
+    for (size_t threads = 1; threads <= 5; threads += 2) {
+        parallel_set_num_threads(threads);
+        assert(parallel_num_threads() == threads);
+        for (size_t grain = 1; grain <= 4096; grain *= 64) {
+            for (size_t i = 0; i < n; i++) {
+                atomic_init(&counts[i], 0);
+            }
+            parallel_for_grain(n, grain, count_indices, counts);
+            for (size_t i = 0; i < n; i++) {
+                assert(atomic_load(&counts[i]) == 1);
+            }
+        }
+    }
+    free(counts);
+
+    parallel_set_num_threads(1);
+    double serial = parallel_reduce(n, 1000, sum_indices, NULL);
+    parallel_set_num_threads(4);
+    double threaded = parallel_reduce(n, 1000, sum_indices, NULL);
+    assert(memcmp(&serial, &threaded, sizeof(double)) == 0);
+    assert(fabs(serial - 12.09) < 0.01); // Harmonic number H_n
+
+    Tensor *a = tensor_rand(2, 700, 613);
+    Tensor *b = tensor_rand(2, 613, 300);
+    Tensor *bias = tensor_rand(1, 613);
+    Tensor *at = tensor_transpose(a);
+    Tensor *tall = tensor_rand(2, 90000, 61);
+    Tensor *results[2][8];
+    for (int run = 0; run < 2; run++) {
+        parallel_set_num_threads(run == 0 ? 1 : 4);
+        results[run][0] = tensor_matmul(a, b);
+        results[run][1] = tensor_gram(a);
+        results[run][2] = tensor_add(a, bias);
+        results[run][3] = tensor_multiply_scalar(at, 3);
+        results[run][4] = tensor_contiguous(at);
+        results[run][5] = tensor_concatenate(a, a, 1);
+        // Six rows chunks merged for tall, over two waves with 4 threads,
+        // segments for at
+        results[run][6] = tensor_reduce(tall, TENSOR_REDUCE_STD, 1, (size_t[]){0}, false);
+        results[run][7] = tensor_reduce(at, TENSOR_REDUCE_ARGMAX, 1, (size_t[]){0}, false);
+    }
+    parallel_set_num_threads(0);
+    for (int i = 0; i < 8; i++) {
+        assert(same_bits(results[0][i], results[1][i]));
+        tensor_free(results[0][i]);
+    }
+
+    // The threaded results are right too
+    for (size_t i = 0; i < 700; i += 77) {
+        for (size_t j = 0; j < 613; j += 61) {
+            Dtype x = a->data[i * 613 + j];
+            assert(results[1][2]->data[i * 613 + j] == x + bias->data[j]);
+            assert(results[1][4]->data[j * 700 + i] == x);
+            assert(results[1][5]->data[i * 1226 + 613 + j] == x);
+        }
+    }
+    double sum = 0, sq = 0;
+    for (size_t i = 0; i < 90000; i++) {
+        sum += tall->data[i * 61 + 5];
+    }
+    for (size_t i = 0; i < 90000; i++) {
+        double d = tall->data[i * 61 + 5] - sum / 90000;
+        sq += d * d;
+    }
+    assert(fabs(results[1][6]->data[5] - sqrt(sq / 90000)) < 1e-5);
+    size_t best = 0;
+    for (size_t i = 1; i < 613; i++) {
+        best = a->data[9 * 613 + i] > a->data[9 * 613 + best] ? i : best;
+    }
+    assert(results[1][7]->data[9] == (Dtype)best);
+
+    Tensor *square = tensor_rand(2, 300, 300);
+    Tensor *copy = tensor_copy(square);
+    tensor_transpose_inplace(square);
+    for (size_t i = 0; i < 300; i++) {
+        assert(square->data[i * 300 + 299 - i] == copy->data[(299 - i) * 300 + i]);
+    }
+    for (int i = 0; i < 8; i++) {
+        tensor_free(results[1][i]);
+    }
+    tensor_free(a);
+    tensor_free(b);
+    tensor_free(bias);
+    tensor_free(at);
+    tensor_free(tall);
+    tensor_free(square);
+    tensor_free(copy);
+}
+
+// Two operations that each wait until the other has started, which only
+// returns true when they run at the same time
+typedef struct {
+    atomic_int *started;
+    int self;
+    Tensor *out;
+} Rendezvous;
+
+static bool rendezvous(void *ctx) {
+    Rendezvous *r = (Rendezvous *)ctx;
+    atomic_fetch_add(&r->started[r->self], 1);
+    for (long spins = 0; atomic_load(&r->started[1 - r->self]) == 0; spins++) {
+        if (spins > 10000000) {
+            return false;
+        }
+        sched_yield();
+    }
+    tensor_fill(r->out, (Dtype)r->self + 1);
+    return true;
+}
+
+static bool slow_fill(void *ctx) {
+    for (int i = 0; i < 20; i++) {
+        sched_yield();
+    }
+    tensor_fill((Tensor *)ctx, 7);
+    return true;
+}
+
+void test_streams() {
+    parallel_set_num_threads(3);
+    Tensor *a = tensor_rand(2, 150, 90);
+    Tensor *b = tensor_rand(2, 90, 120);
+    Tensor *x = tensor_rand(2, 150, 120);
+    Tensor *ab = tensor_create(2, 150, 120);
+    Tensor *sum = tensor_create(2, 150, 120);
+    Tensor *expected = tensor_matmul(a, b);
+    tensor_multiply_scalar_into(expected, expected, 2);
+    tensor_add_into(expected, expected, x);
+
+    // ab = 2 a b + x waits for the matmul, the copy of x does not
+    Stream *s = stream_create();
+    StreamEvent *mm = stream_binary(s, tensor_matmul_into, ab, a, b);
+    StreamEvent *copy = stream_unary(s, tensor_copy_into, sum, x);
+    stream_scalar(s, tensor_multiply_scalar_into, ab, ab, 2);
+    StreamEvent *last = stream_binary(s, tensor_add_into, ab, ab, x);
+    assert(stream_event_wait(copy) && tensor_equal(sum, x));
+    assert(stream_event_wait(last) && stream_event_done(mm));
+    assert(same_bits(ab, expected));
+
+    // A write waits for earlier reads of the same memory, and later reads wait
+    // for it
+    Tensor *before = tensor_create(2, 150, 120);
+    Tensor *after = tensor_create(2, 150, 120);
+    stream_unary(s, tensor_copy_into, before, x);
+    stream_submit(s, slow_fill, x, 0, NULL, 1, (Tensor *[]){x});
+    stream_unary(s, tensor_copy_into, after, x);
+    assert(stream_sync(s));
+    assert(tensor_equal(before, sum) && tensor_max(after) == 7 && tensor_min(after) == 7);
+
+    // Disjoint slices of one tensor are independent: the two operations
+    // can only finish by running concurrently
+    atomic_int started[2] = {0, 0};
+    Tensor *top = tensor_slice(x, 0, 0, 75), *bottom = tensor_slice(x, 0, 75, 150);
+    Rendezvous r0 = {started, 0, top}, r1 = {started, 1, bottom};
+    StreamEvent *e0 = stream_submit(s, rendezvous, &r0, 0, NULL, 1, (Tensor *[]){top});
+    StreamEvent *e1 = stream_submit(s, rendezvous, &r1, 0, NULL, 1, (Tensor *[]){bottom});
+    assert(stream_event_wait(e0) && stream_event_wait(e1));
+    assert(x->data[0] == 1 && x->data[150 * 120 - 1] == 2);
+
+    // A failed operation fails the ones depending on it, until the next sync
+    Tensor *wrong = tensor_create(2, 3, 3);
+    StreamEvent *bad = stream_binary(s, tensor_matmul_into, wrong, a, b);
+    StreamEvent *dependent = stream_unary(s, tensor_copy_into, wrong, wrong);
+    StreamEvent *unrelated = stream_unary(s, tensor_copy_into, before, sum);
+    assert(!stream_event_wait(bad) && !stream_event_wait(dependent));
+    assert(stream_event_wait(unrelated));
+    assert(!stream_sync(s));
+    stream_scalar(s, tensor_add_scalar_into, wrong, wrong, 1);
+    assert(stream_sync(s));
+    stream_free(s);
+    parallel_set_num_threads(0);
+
+    tensor_free(a);
+    tensor_free(b);
+    tensor_free(x);
+    tensor_free(ab);
+    tensor_free(sum);
+    tensor_free(expected);
+    tensor_free(before);
+    tensor_free(after);
+    tensor_free(top);
+    tensor_free(bottom);
+    tensor_free(wrong);
+}
+
+void test_dtype_operations() {
+    // float64 element-wise ops with broadcasting and a strided view, against
+    // double arithmetic
+    Tensor *x = tensor_create_typed(TENSOR_F64, 2, (size_t[]){37, 45});
+    Tensor *row = tensor_create_typed(TENSOR_F64, 1, (size_t[]){37});
+    for (size_t i = 0; i < x->size; i++) {
+        x->data_f64[i] = 1.0 + (double)i * 1e-10;
+    }
+    for (size_t i = 0; i < row->size; i++) {
+        row->data_f64[i] = (double)i / 3.0;
+    }
+    Tensor *xt = tensor_transpose(x); // [45, 37]
+    Tensor *sum = tensor_add(xt, row);
+    Tensor *scaled = tensor_multiply_scalar(sum, 3.0f);
+    assert(sum->dtype == TENSOR_F64 && scaled->dtype == TENSOR_F64);
+    for (size_t i = 0; i < 45; i++) {
+        for (size_t j = 0; j < 37; j++) {
+            double expected = x->data_f64[j * 45 + i] + row->data_f64[j];
+            assert(sum->data_f64[i * 37 + j] == expected);
+            assert(scaled->data_f64[i * 37 + j] == expected * 3.0);
+        }
+    }
+
+    // Whole-tensor sums in double see the 1e-10 steps float32 would lose
+    double expected = 0;
+    for (size_t i = 0; i < x->size; i++) {
+        expected += x->data_f64[i];
+    }
+    assert(fabs((double)tensor_sum(xt) - expected) < 1e-3);
+    assert(tensor_mean(x) == (float)(expected / (double)x->size));
+    TensorExtrema e = tensor_extrema(xt);
+    assert(e.argmin == 0 && e.argmax == xt->size - 1);
+
+    // bfloat16 and float16 compute in float32 and round once per result
+    Tensor *a = tensor_rand(2, (size_t)300, (size_t)129);
+    Tensor *b = tensor_rand(1, (size_t)129);
+    Tensor *ref = tensor_divide(a, b);
+    TensorDtype halves[] = {TENSOR_BF16, TENSOR_F16};
+    for (size_t h = 0; h < 2; h++) {
+        Tensor *ah = tensor_astype(a, halves[h]), *bh = tensor_astype(b, halves[h]);
+        Tensor *a32 = tensor_astype(ah, TENSOR_F32), *b32 = tensor_astype(bh, TENSOR_F32);
+        Tensor *q32 = tensor_divide(a32, b32);
+        Tensor *expected_h = tensor_astype(q32, halves[h]);
+        Tensor *quotient = tensor_divide(ah, bh);
+        assert(quotient->dtype == halves[h]);
+        assert(tensor_equal(quotient, expected_h));
+
+        // In place, on a strided view
+        Tensor *view = tensor_slice(ah, 1, 7, 100);
+        Tensor *view32 = tensor_slice(a32, 1, 7, 100);
+        tensor_subtract_scalar_into(view, view, 0.25f);
+        tensor_subtract_scalar_into(view32, view32, 0.25f);
+        Tensor *rounded = tensor_astype(view32, halves[h]);
+        assert(tensor_equal(view, rounded));
+
+        // Sums of the exact float32 values of the elements
+        Tensor *widened = tensor_astype(ah, TENSOR_F32);
+        assert(tensor_sum(ah) == tensor_sum(widened));
+        tensor_free(widened);
+        TensorExtrema eh = tensor_extrema(view), e32 = tensor_extrema(rounded);
+        assert(eh.argmin == e32.argmin && eh.max == e32.max);
+
+        // Mixed dtypes and float32-only operations are refused
+        assert(tensor_add(ah, a) == NULL);
+        assert(tensor_add_into(a, a, ah) == NULL);
+        assert(tensor_matmul(ah, ah) == NULL);
+        assert(tensor_reduce(ah, TENSOR_REDUCE_SUM, 1, (size_t[]){0}, false) == NULL);
+
+        tensor_free(rounded);
+        tensor_free(view32);
+        tensor_free(view);
+        tensor_free(quotient);
+        tensor_free(expected_h);
+        tensor_free(q32);
+        tensor_free(a32);
+        tensor_free(b32);
+        tensor_free(ah);
+        tensor_free(bh);
+    }
+    assert(tensor_gram(x) == NULL);
+    assert(tensor_solve(x, row) == NULL);
+
+    tensor_free(ref);
+    tensor_free(a);
+    tensor_free(b);
+    tensor_free(scaled);
+    tensor_free(sum);
+    tensor_free(xt);
+    tensor_free(row);
+    tensor_free(x);
+    printf("Dtype operations passed\n");
+}
+
+void test_sparse() {
+    // A mostly zero matrix with some empty rows and columns
+    size_t n = 700, d = 90;
+    Tensor *x = tensor_rand(2, n, d);
+    for (size_t i = 0; i < n * d; i++) {
+        if (x->data[i] < 0.95f || i % d == 7 || i / d == 3) {
+            x->data[i] = 0;
+        }
+    }
+
+    // CSC of X holds the same arrays as CSR of X^T
+    SparseTensor *csr = sparse_from_dense(x, SPARSE_CSR);
+    Tensor *xt = tensor_transpose(x);
+    SparseTensor *csr_t = sparse_from_dense(xt, SPARSE_CSR);
+    SparseTensor *flipped = sparse_convert(csr, SPARSE_CSC);
+    assert(csr->nnz > 0 && csr->nnz < n * d / 10 && csr_t->nnz == csr->nnz);
+    assert(csr->indptr[4] == csr->indptr[3]);
+    assert(memcmp(csr_t->indptr, flipped->indptr, (d + 1) * sizeof(size_t)) == 0);
+    assert(memcmp(csr_t->indices, flipped->indices, csr->nnz * sizeof(uint32_t)) == 0);
+    assert(memcmp(csr_t->values, flipped->values, csr->nnz * sizeof(Dtype)) == 0);
+    Tensor *back = sparse_to_dense(csr);
+    Tensor *back_t = sparse_to_dense(csr_t);
+    Tensor *back_csc = sparse_to_dense(flipped);
+    assert(tensor_equal(back, x) && tensor_equal(back_csc, x));
+    assert(tensor_equal(back_t, xt));
+
+    // Triplets in reverse order, each split in two, build the same matrix
+    size_t m = 2 * csr->nnz;
+    size_t *rows = (size_t *)malloc(m * sizeof(size_t));
+    size_t *cols = (size_t *)malloc(m * sizeof(size_t));
+    Dtype *values = (Dtype *)malloc(m * sizeof(Dtype));
+    size_t t = 0;
+    for (size_t i = n; i-- > 0;) {
+        for (size_t p = csr->indptr[i + 1]; p-- > csr->indptr[i];) {
+            for (size_t half = 0; half < 2; half++, t++) {
+                rows[t] = i;
+                cols[t] = csr->indices[p];
+                values[t] = half ? csr->values[p] - 0.5f : 0.5f;
+            }
+        }
+    }
+    SparseFormat formats[] = {SPARSE_CSR, SPARSE_CSC};
+    for (size_t f = 0; f < 2; f++) {
+        SparseTensor *s = sparse_from_triplets(formats[f], n, d, m, rows, cols, values);
+        assert(s->nnz == csr->nnz);
+        Tensor *dense = sparse_to_dense(s);
+        for (size_t i = 0; i < n * d; i++) {
+            assert(fabsf(dense->data[i] - x->data[i]) < 1e-6f);
+        }
+        sparse_free(s);
+        tensor_free(dense);
+    }
+    rows[0] = n;
+    assert(sparse_from_triplets(SPARSE_CSR, n, d, m, rows, cols, values) == NULL);
+    free(rows);
+    free(cols);
+    free(values);
+
+    // Sparse times dense equals the dense product, for a matrix, a strided
+    // matrix into a strided output and a vector, in either format
+    Tensor *b = tensor_rand(2, d, (size_t)33);
+    Tensor *expected = tensor_matmul(x, b);
+    Tensor *bt = tensor_create(2, (size_t)33, d);
+    Tensor *btt = tensor_transpose(bt);
+    tensor_copy_into(btt, b);
+    assert(btt->strides[1] == d);
+    Tensor *v = tensor_rand(1, d);
+    Tensor *v2 = tensor_reshape(v, 2, (size_t[]){d, 1});
+    Tensor *expected_v = tensor_matmul(x, v2);
+    const SparseTensor *inputs[] = {csr, flipped};
+    for (size_t f = 0; f < 2; f++) {
+        Tensor *y = sparse_matmul(inputs[f], b);
+        Tensor *out = tensor_create(2, (size_t)33, n);
+        Tensor *out_t = tensor_transpose(out);
+        assert(sparse_matmul_into(out_t, inputs[f], btt) == out_t);
+        Tensor *yv = sparse_matmul(inputs[f], v);
+        assert(yv->ndim == 1 && yv->shape[0] == n);
+        for (size_t i = 0; i < expected->size; i++) {
+            assert(fabsf(y->data[i] - expected->data[i]) < 1e-5f);
+            assert(out_t->data[(i % 33) * n + i / 33] == y->data[i]);
+        }
+        for (size_t i = 0; i < n; i++) {
+            assert(fabsf(yv->data[i] - expected_v->data[i]) < 1e-5f);
+        }
+        Tensor *tensors[] = {y, out, out_t, yv};
+        for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+            tensor_free(tensors[i]);
+        }
+    }
+    assert(sparse_matmul(csr, expected) == NULL);
+
+    // The Gram matrix matches the dense one, and accumulating the rows in
+    // chunks gives the same bits as all at once
+    Tensor *g = sparse_gram(flipped);
+    Tensor *g_dense = tensor_gram_double(x);
+    for (size_t i = 0; i < d * d; i++) {
+        assert(fabsf(g->data[i] - g_dense->data[i]) < 1e-4f);
+    }
+    Tensor *y = tensor_rand(2, n, (size_t)2);
+    double *xtx = (double *)calloc(2 * d * d, sizeof(double));
+    double *xty = (double *)calloc(4 * d, sizeof(double));
+    assert(sparse_gram_accumulate(xtx, xty, csr, y));
+    for (size_t lo = 0; lo < n; lo += 250) {
+        size_t hi = lo + 250 < n ? lo + 250 : n;
+        Tensor *xc = tensor_create(2, hi - lo, d);
+        Tensor *yc = tensor_create(2, hi - lo, (size_t)2);
+        memcpy(xc->data, x->data + lo * d, (hi - lo) * d * sizeof(Dtype));
+        memcpy(yc->data, y->data + lo * 2, (hi - lo) * 2 * sizeof(Dtype));
+        SparseTensor *chunk = sparse_from_dense(xc, SPARSE_CSC);
+        assert(sparse_gram_accumulate(xtx + d * d, xty + 2 * d, chunk, yc));
+        sparse_free(chunk);
+        tensor_free(xc);
+        tensor_free(yc);
+    }
+    assert(memcmp(xtx, xtx + d * d, d * d * sizeof(double)) == 0);
+    assert(memcmp(xty, xty + 2 * d, 2 * d * sizeof(double)) == 0);
+    for (size_t i = 0; i < d; i++) {
+        for (size_t j = 0; j < d; j++) {
+            assert(j > i || (Dtype)xtx[i * d + j] == g->data[i * d + j]);
+        }
+    }
+    assert(!sparse_gram_accumulate(xtx, xty, csr, b));
+
+    // Without y only X^T X is accumulated
+    memset(xty, 0, 2 * d * sizeof(double));
+    assert(sparse_gram_accumulate(xtx + d * d, xty, csr, NULL));
+    assert(fabs(xtx[d * d] - 2 * xtx[0]) < 1e-9 * xtx[0]);
+    for (size_t i = 0; i < 2 * d; i++) {
+        assert(xty[i] == 0);
+    }
+    free(xtx);
+    free(xty);
+
+    sparse_free(csr);
+    sparse_free(csr_t);
+    sparse_free(flipped);
+    Tensor *tensors[] = {x, xt, back, back_t, back_csc, b, expected, bt, btt, v, v2, expected_v, g,
+                         g_dense, y};
+    for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+        tensor_free(tensors[i]);
+    }
+    printf("Sparse matrices passed\n");
+}
+
 int main() {
     test_element_wise_operations();
     test_scalar_operations();
+    test_into_operations();
+    test_strided_operations();
+    test_broadcasting();
+    test_lazy_evaluation();
+    test_kernel_variants();
     test_linear_algebra_operations();
+    test_matmul_blocked();
+    test_gemm_flags();
+    test_batched_matmul();
+    test_gram();
+    test_linear_solvers();
     test_reduction_operations();
+    test_axis_reductions();
+    test_parallel_runtime();
+    test_streams();
+    test_dtype_operations();
+    test_sparse();
     printf("All tests passed!\n");
     return 0;
 }
@@ -1,7 +1,11 @@
 #include <tensor.h>
 #include <linear_models.h>
+#include <quant.h>
 #include <utils.h>
 #include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 void test_solve_linear_regression() {
     // Create input tensor X (4 samples, 2 features)
@@ -26,7 +30,333 @@ void test_solve_linear_regression() {
     printf("Linear regression test passed\n");
 }
 
+void test_solve_linear_regression_tsqr() {
+    // Same exact fit as above
+    Tensor *X = tensor_create(2, 4, 2);
+    copy_data((Dtype[]){1, 1, 2, 1, 3, 1, 4, 1}, X);
+    Tensor *Y = tensor_create(2, 4, 1);
+    copy_data((Dtype[]){2, 3, 4, 5}, Y);
+    Tensor *W = solve_linear_regression_tsqr(X, Y);
+    assert(float_equal(W->data[0], 1.0));
+    assert(float_equal(W->data[1], 1.0));
+
+    // Cubic features of t in [0, 1] are badly conditioned, two targets, and
+    // enough rows to be split over several workers and merged in a tree
+    size_t n = 5000;
+    Tensor *P = tensor_create(2, n, 4);
+    Tensor *T = tensor_create(2, n, 2);
+    for (size_t i = 0; i < n; i++) {
+        Dtype t = (Dtype)i / n;
+        Dtype row[] = {1, t, t * t, t * t * t};
+        for (size_t j = 0; j < 4; j++) {
+            P->data[i * 4 + j] = row[j];
+        }
+        T->data[i * 2] = 1 - 2 * t + 3 * t * t - 4 * t * t * t;
+        T->data[i * 2 + 1] = 0.5f + t;
+    }
+    Dtype expected[] = {1, 0.5, -2, 1, 3, 0, -4, 0};
+
+    setenv("MLC_NUM_THREADS", "3", 1);
+    Tensor *Wp = solve_linear_regression_tsqr(P, T);
+    unsetenv("MLC_NUM_THREADS");
+    for (size_t i = 0; i < 8; i++) {
+        assert(fabsf(Wp->data[i] - expected[i]) < 1e-2f);
+    }
+
+    // Strided inputs give the same answer: P stored column by column
+    Tensor *Pt = tensor_create(2, (size_t)4, n);
+    Tensor *Ptt = tensor_transpose(Pt);
+    tensor_copy_into(Ptt, P);
+    assert(Ptt->strides[0] == 1 && Ptt->strides[1] == n);
+    Tensor *Ws = solve_linear_regression_tsqr(Ptt, T);
+    for (size_t i = 0; i < 8; i++) {
+        assert(fabsf(Ws->data[i] - expected[i]) < 1e-2f);
+    }
+
+    // A repeated column
+    Tensor *D = tensor_create(2, 4, 2);
+    copy_data((Dtype[]){1, 1, 2, 2, 3, 3, 4, 4}, D);
+    assert(solve_linear_regression_tsqr(D, Y) == NULL);
+
+    Tensor *tensors[] = {X, Y, W, P, T, Wp, Pt, Ptt, Ws, D};
+    for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+        tensor_free(tensors[i]);
+    }
+
+    printf("TSQR linear regression test passed\n");
+}
+
+void test_streaming_linear_regression() {
+    // Noisy targets so that the fit is not exact, more rows than one block
+    size_t n = 5000, d = 5, k = 2;
+    Tensor *X = tensor_rand(2, n, d);
+    Tensor *Y = tensor_rand(2, n, k);
+    for (size_t i = 0; i < n; i++) {
+        Y->data[i * k] += 3 * X->data[i * d] - X->data[i * d + 4];
+    }
+    Tensor *W = solve_linear_regression(X, Y);
+
+    // Uneven chunks, some smaller and some larger than a block, give the
+    // in-memory result bit for bit
+    size_t bounds[] = {0, 1, 700, 3100, 3101, n};
+    LinearRegression *lr = linear_regression_init(d, k);
+    Tensor *partial = NULL;
+    for (size_t c = 0; c + 1 < sizeof(bounds) / sizeof(bounds[0]); c++) {
+        Tensor *Xc = tensor_slice(X, 0, bounds[c], bounds[c + 1]);
+        Tensor *Yc = tensor_slice(Y, 0, bounds[c], bounds[c + 1]);
+        assert(linear_regression_partial_fit(lr, Xc, Yc));
+        tensor_free(Xc);
+        tensor_free(Yc);
+
+        // Finalizing midway does not disturb the rest of the fit
+        if (c == 2) {
+            partial = linear_regression_finalize(lr);
+            assert(partial != NULL);
+        }
+    }
+    Tensor *Ws = linear_regression_finalize(lr);
+    assert(memcmp(W->data, Ws->data, d * k * sizeof(Dtype)) == 0);
+    assert(float_equal(Ws->data[0], W->data[0]));
+
+    // Chunks of the wrong width are rejected
+    Tensor *bad = tensor_create(2, 3, d + 1);
+    Tensor *bad_y = tensor_create(2, 3, k);
+    assert(!linear_regression_partial_fit(lr, bad, bad_y));
+    linear_regression_free(lr);
+
+    Tensor *tensors[] = {X, Y, W, partial, Ws, bad, bad_y};
+    for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+        tensor_free(tensors[i]);
+    }
+
+    printf("Streaming linear regression test passed\n");
+}
+
+void test_quantized_prediction() {
+    // Integer data whose columns reach 127 quantizes exactly, so the int8
+    // path must reproduce the integer products bit for bit; 150 features
+    // and 6 outputs leave tails on both
+    size_t n = 300, d = 150, k = 6;
+    Tensor *X = tensor_create(2, n, d);
+    Tensor *W = tensor_create(2, d, k);
+    Tensor *b = tensor_create(1, k);
+    for (size_t i = 0; i < n * d; i++) {
+        X->data[i] = (Dtype)((int)((i * 7919) % 255) - 127);
+    }
+    for (size_t j = 0; j < d; j++) {
+        X->data[j] = (j % 2) ? 127 : -127;
+    }
+    for (size_t i = 0; i < d * k; i++) {
+        W->data[i] = (Dtype)((int)((i * 104729) % 255) - 127);
+    }
+    for (size_t c = 0; c < k; c++) {
+        W->data[c] = 127;
+        b->data[c] = 0.5f * (Dtype)c;
+    }
+
+    Tensor *scales = quant_column_scales(X);
+    for (size_t j = 0; j < d; j++) {
+        assert(scales->data[j] == 1.0f);
+    }
+    QuantMatrix *qx = quant_matrix_create(X, scales);
+    QuantLinear *model = quant_linear_create(W, b, scales);
+    Tensor *Y = quant_linear_predict(model, qx);
+    assert(Y->shape[0] == n && Y->shape[1] == k);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t c = 0; c < k; c++) {
+            long exact = 0;
+            for (size_t j = 0; j < d; j++) {
+                exact += (long)X->data[i * d + j] * (long)W->data[j * k + c];
+            }
+            assert(Y->data[i * k + c] == (float)exact + b->data[c]);
+        }
+    }
+
+    // A fitted model on real-valued features stays within a percent of the
+    // float predictions, through a strided output and feature matrix
+    size_t m = 2000, f = 40;
+    Tensor *A = tensor_rand(2, m, f);
+    for (size_t i = 0; i < m * f; i++) {
+        A->data[i] = (A->data[i] - 0.5f) * (Dtype)(1 + i % f);
+    }
+    Tensor *T = tensor_rand(2, m, (size_t)3);
+    Tensor *Wf = solve_linear_regression(A, T);
+    Tensor *At = tensor_create(2, f, m);
+    Tensor *Att = tensor_transpose(At);
+    tensor_copy_into(Att, A);
+    assert(Att->strides[1] == m);
+    Tensor *fscales = quant_column_scales(A);
+    QuantMatrix *qa = quant_matrix_create(Att, fscales);
+    QuantLinear *fitted = quant_linear_create(Wf, NULL, fscales);
+    Tensor *out = tensor_create(2, (size_t)3, m);
+    Tensor *outt = tensor_transpose(out);
+    assert(quant_linear_predict_into(outt, fitted, qa) == outt);
+    Tensor *ref = tensor_matmul(A, Wf);
+    double err = 0, norm = 0;
+    for (size_t i = 0; i < m; i++) {
+        for (size_t c = 0; c < 3; c++) {
+            double e = outt->data[c * m + i] - ref->data[i * 3 + c];
+            err += e * e;
+            norm += (double)ref->data[i * 3 + c] * ref->data[i * 3 + c];
+        }
+    }
+    assert(sqrt(err / norm) < 1e-2);
+
+    // Mismatched shapes
+    assert(quant_linear_predict(model, qa) == NULL);
+    assert(quant_matrix_create(X, fscales) == NULL);
+    assert(quant_linear_create(W, fscales, scales) == NULL);
+
+    // The limit is on the length of the dot products, not on the outputs
+    Tensor *tall = tensor_create(2, (size_t)(1 << 17) + 1, (size_t)1);
+    Tensor *tall_scales = tensor_create(1, (size_t)(1 << 17) + 1);
+    Tensor *wide = tensor_create(2, (size_t)1, (size_t)(1 << 17) + 1);
+    Tensor *wide_scales = tensor_create(1, (size_t)1);
+    tensor_fill(tall, 0.5f);
+    tensor_fill(tall_scales, 1.0f);
+    tensor_fill(wide, 0.5f);
+    tensor_fill(wide_scales, 1.0f);
+    assert(quant_linear_create(tall, NULL, tall_scales) == NULL);
+    QuantLinear *many = quant_linear_create(wide, NULL, wide_scales);
+    assert(many != NULL);
+    quant_linear_free(many);
+    Tensor *limits[] = {tall, tall_scales, wide, wide_scales};
+    for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+        tensor_free(limits[i]);
+    }
+
+    quant_matrix_free(qx);
+    quant_matrix_free(qa);
+    quant_linear_free(model);
+    quant_linear_free(fitted);
+    Tensor *tensors[] = {X, W, b, scales, Y, A, T, Wf, At, Att, fscales, out, outt, ref};
+    for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+        tensor_free(tensors[i]);
+    }
+
+    printf("Quantized prediction test passed\n");
+}
+
+void test_sparse_linear_regression() {
+    // One-hot encoded categories plus a dense column, fitted from the
+    // sparse form and from the dense one
+    size_t n = 3000, categories = 60, d = categories + 1;
+    Tensor *X = tensor_create(2, n, d);
+    Tensor *W_true = tensor_rand(2, d, (size_t)2);
+    tensor_fill(X, 0);
+    for (size_t i = 0; i < n; i++) {
+        X->data[i * d + (i * 7) % categories] = 1;
+        X->data[i * d + categories] = (Dtype)(i % 13) / 13;
+    }
+    Tensor *y = tensor_matmul(X, W_true);
+    SparseTensor *Xs = sparse_from_dense(X, SPARSE_CSR);
+    assert(Xs->nnz <= 2 * n);
+
+    Tensor *W = solve_sparse_linear_regression(Xs, y);
+    Tensor *W_dense = solve_linear_regression(X, y);
+    for (size_t i = 0; i < d * 2; i++) {
+        assert(fabsf(W->data[i] - W_true->data[i]) < 1e-3f);
+        assert(fabsf(W->data[i] - W_dense->data[i]) < 1e-3f);
+    }
+
+    // Streaming sparse chunks gives the same bits as one solve
+    LinearRegression *lr = linear_regression_init(d, 2);
+    for (size_t lo = 0; lo < n; lo += 700) {
+        size_t hi = lo + 700 < n ? lo + 700 : n;
+        Tensor *Xc = tensor_create(2, hi - lo, d);
+        Tensor *yc = tensor_create(2, hi - lo, (size_t)2);
+        memcpy(Xc->data, X->data + lo * d, (hi - lo) * d * sizeof(Dtype));
+        memcpy(yc->data, y->data + lo * 2, (hi - lo) * 2 * sizeof(Dtype));
+        SparseTensor *chunk = sparse_from_dense(Xc, SPARSE_CSC);
+        assert(linear_regression_partial_fit_sparse(lr, chunk, yc));
+        sparse_free(chunk);
+        tensor_free(Xc);
+        tensor_free(yc);
+    }
+    Tensor *W_stream = linear_regression_finalize(lr);
+    assert(memcmp(W_stream->data, W->data, d * 2 * sizeof(Dtype)) == 0);
+
+    // Mismatched shapes
+    assert(!linear_regression_partial_fit_sparse(lr, Xs, W_true));
+    assert(solve_sparse_linear_regression(Xs, W_true) == NULL);
+    linear_regression_free(lr);
+
+    sparse_free(Xs);
+    Tensor *tensors[] = {X, W_true, y, W, W_dense, W_stream};
+    for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+        tensor_free(tensors[i]);
+    }
+
+    printf("Sparse linear regression test passed\n");
+}
+
+void test_linear_regression_dtypes() {
+    // Quintic features of t in [0, 1]: X^T X is too badly conditioned for
+    // float32, float64 recovers the coefficients
+    size_t n = 2000, d = 6;
+    size_t x_shape[] = {n, d}, y_shape[] = {n, 1};
+    Tensor *X = tensor_create_typed(TENSOR_F64, 2, x_shape);
+    Tensor *y = tensor_create_typed(TENSOR_F64, 2, y_shape);
+    double coef[] = {1, -2, 3, -4, 5, -6};
+    for (size_t i = 0; i < n; i++) {
+        double t = (double)i / n, power = 1, sum = 0;
+        for (size_t j = 0; j < d; j++) {
+            X->data_f64[i * d + j] = power;
+            sum += coef[j] * power;
+            power *= t;
+        }
+        y->data_f64[i] = sum;
+    }
+    Tensor *W = solve_linear_regression(X, y);
+    assert(W->dtype == TENSOR_F64);
+    for (size_t j = 0; j < d; j++) {
+        assert(fabs(W->data_f64[j] - coef[j]) < 1e-6);
+    }
+
+    // Streamed in chunks, the same bits
+    LinearRegression *lr = linear_regression_init(d, 1);
+    for (size_t lo = 0; lo < n; lo += 300) {
+        size_t hi = lo + 300 < n ? lo + 300 : n;
+        Tensor *Xc = tensor_slice(X, 0, lo, hi);
+        Tensor *yc = tensor_slice(y, 0, lo, hi);
+        assert(linear_regression_partial_fit(lr, Xc, yc));
+        tensor_free(Xc);
+        tensor_free(yc);
+    }
+    Tensor *Ws = linear_regression_finalize(lr);
+    assert(memcmp(W->data_f64, Ws->data_f64, d * sizeof(double)) == 0);
+
+    // float16 everywhere, float64 in the float32-only solvers and mixed
+    // dtypes are rejected
+    Tensor *X16 = tensor_astype(X, TENSOR_F16);
+    Tensor *y16 = tensor_astype(y, TENSOR_F16);
+    Tensor *y32 = tensor_astype(y, TENSOR_F32);
+    assert(solve_linear_regression(X16, y16) == NULL);
+    assert(solve_linear_regression_tsqr(X16, y16) == NULL);
+    assert(solve_linear_regression_tsqr(X, y) == NULL);
+    assert(solve_linear_regression(X, y32) == NULL);
+    assert(!linear_regression_partial_fit(lr, X16, y16));
+    Tensor *X32 = tensor_astype(X, TENSOR_F32);
+    SparseTensor *Xs = sparse_from_dense(X32, SPARSE_CSR);
+    assert(solve_sparse_linear_regression(Xs, y) == NULL);
+    assert(solve_sparse_linear_regression(Xs, y16) == NULL);
+    linear_regression_free(lr);
+
+    sparse_free(Xs);
+    Tensor *tensors[] = {X, y, W, Ws, X16, y16, y32, X32};
+    for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+        tensor_free(tensors[i]);
+    }
+
+    printf("Linear regression dtype test passed\n");
+}
+
 int main() {
     test_solve_linear_regression();
+    test_solve_linear_regression_tsqr();
+    test_streaming_linear_regression();
+    test_quantized_prediction();
+    test_sparse_linear_regression();
+    test_linear_regression_dtypes();
     return 0;
 }
\ No newline at end of file
@@ -1,6 +1,12 @@
 #include <assert.h>
 #include <math.h>
+#include <stdint.h>
 #include <string.h>
+#include "arena.h"
+#include "io.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "random.h"
 #include "tensor.h"
 #include "utils.h"
 
@@ -102,12 +108,304 @@ void test_tensor_transpose() {
     assert(t2 != NULL);
     assert(t2->shape[0] == t1->shape[1]);
     assert(t2->shape[1] == t1->shape[0]);
-    assert(float_equal(t2->data[0], 1));
-    assert(float_equal(t2->data[1], 4));
+    assert(float_equal(tensor_get(t2, (size_t[]){0, 0}), 1));
+    assert(float_equal(tensor_get(t2, (size_t[]){0, 1}), 4));
     
     tensor_free(t1);
     tensor_free(t2);
     printf("2D tensor transpose passed\n");
+
+    // Test 2: Materializing transposes and permutations with sizes that are
+    // not multiples of the kernel tiles
+    Tensor *m = tensor_rand(2, 37, 53);
+    Tensor *mt = tensor_transpose(m);
+    Tensor *mc = tensor_contiguous(mt);
+    assert(tensor_is_contiguous(mc) && tensor_equal(mc, mt));
+    assert(mc->data[1] == m->data[53] && mc->data[52 * 37 + 36] == m->data[36 * 53 + 52]);
+
+    Tensor *c = tensor_rand(3, 17, 5, 19);
+    size_t perms[][3] = {{2, 1, 0}, {2, 0, 1}, {1, 2, 0}, {0, 2, 1}};
+    for (size_t i = 0; i < 4; i++) {
+        Tensor *view = tensor_permute(c, perms[i]);
+        Tensor *copy = tensor_copy(view);
+        assert(tensor_equal(copy, view));
+        size_t idx[3] = {3, 4, 16}, src_idx[3];
+        for (size_t d = 0; d < 3; d++) {
+            src_idx[perms[i][d]] = idx[d] % c->shape[perms[i][d]];
+        }
+        for (size_t d = 0; d < 3; d++) {
+            idx[d] = src_idx[perms[i][d]];
+        }
+        assert(tensor_get(copy, idx) == tensor_get(c, src_idx));
+        tensor_free(view);
+        tensor_free(copy);
+    }
+    printf("Permuted copies passed\n");
+
+    // Test 3: Copying contiguous data into a transposed view
+    Tensor *back = tensor_create(2, 53, 37);
+    Tensor *back_t = tensor_transpose(back);
+    tensor_copy_into(back_t, m);
+    assert(tensor_equal(back, mc));
+    printf("Copy into transposed view passed\n");
+
+    // Test 4: In-place transpose of a square matrix and of a transposed view
+    Tensor *sq = tensor_rand(2, 45, 45);
+    Tensor *sq_t = tensor_transpose(sq);
+    Tensor *expected = tensor_copy(sq_t);
+    assert(tensor_transpose_inplace(sq) == sq);
+    assert(tensor_equal(sq, expected));
+    // The view now shows the original matrix, in place it becomes the
+    // transpose again while sq goes back to the original data
+    tensor_transpose_inplace(sq_t);
+    assert(tensor_equal(sq_t, expected) && !tensor_equal(sq, expected));
+    assert(tensor_transpose_inplace(m) == NULL);
+    printf("In-place transpose passed\n");
+
+    tensor_free(m);
+    tensor_free(mt);
+    tensor_free(mc);
+    tensor_free(c);
+    tensor_free(back);
+    tensor_free(back_t);
+    tensor_free(sq);
+    tensor_free(sq_t);
+    tensor_free(expected);
+}
+
+// Test zero-copy views
+void test_tensor_views() {
+    printf("\nTesting tensor views...\n");
+
+    size_t shape[] = {3, 4};
+    Tensor *t = tensor_create_from_shape(2, shape);
+    float data[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    tensor_populate_array(t, data);
+
+    // Test 1: Transpose shares the data and swaps strides
+    Tensor *tt = tensor_transpose(t);
+    assert(tt->data == t->data);
+    assert(!tensor_is_contiguous(tt));
+    assert(float_equal(tensor_get(tt, (size_t[]){3, 1}), 7));
+    printf("Transpose view passed\n");
+
+    // Test 2: Materializing a transposed view
+    Tensor *tc = tensor_contiguous(tt);
+    assert(tensor_is_contiguous(tc));
+    assert(tensor_equal(tc, tt));
+    assert(float_equal(tc->data[1], 4));
+    printf("Contiguous materialization passed\n");
+
+    // Test 3: Row and column slices
+    Tensor *rows = tensor_slice(t, 0, 1, 3);
+    assert(rows->shape[0] == 2 && tensor_is_contiguous(rows));
+    assert(float_equal(rows->data[0], 4));
+    Tensor *col = tensor_slice(t, 1, 2, 3);
+    assert(col->shape[0] == 3 && col->shape[1] == 1);
+    assert(float_equal(tensor_get(col, (size_t[]){2, 0}), 10));
+    printf("Slicing passed\n");
+
+    // Test 4: Reshape of contiguous data is a view, of strided data a copy
+    size_t flat[] = {12};
+    Tensor *r1 = tensor_reshape(rows, 1, flat);
+    assert(r1 == NULL); // 8 elements, not 12
+    size_t flat8[] = {8};
+    r1 = tensor_reshape(rows, 1, flat8);
+    assert(r1->data == rows->data);
+    Tensor *r2 = tensor_reshape(tt, 1, flat);
+    assert(r2->data != t->data);
+    assert(float_equal(r2->data[1], 4));
+    printf("Reshape views passed\n");
+
+    // Test 5: Views keep the data alive and see writes
+    tensor_free(t);
+    col->data[0] = 42;
+    assert(float_equal(tensor_get(tt, (size_t[]){2, 0}), 42));
+
+    // Test 6: Permute validates its axes
+    assert(tensor_permute(tt, (size_t[]){0, 0}) == NULL);
+
+    tensor_free(tt);
+    tensor_free(tc);
+    tensor_free(rows);
+    tensor_free(col);
+    tensor_free(r1);
+    tensor_free(r2);
+    printf("View lifetime passed\n");
+}
+
+// Test arena scopes and buffer pooling
+void test_tensor_arena() {
+    printf("\nTesting arena allocation...\n");
+
+    // Test 1: Tensors created inside a scope come from the arena
+    arena_push();
+    Tensor *outer = tensor_create(2, 3, 5);
+    assert(outer->in_arena);
+    assert(outer->storage->kind == TENSOR_STORAGE_ARENA);
+    assert((uintptr_t)outer->data % 64 == 0);
+    outer->data[14] = 7;
+
+    // Test 2: An inner scope releases only its own tensors
+    arena_push();
+    Tensor *inner = tensor_create(1, 100);
+    Dtype *inner_data = inner->data;
+    tensor_free(inner);
+    arena_pop();
+    arena_push();
+    inner = tensor_create(1, 100);
+    assert(inner->data == inner_data); // Same memory handed out again
+    arena_pop();
+    assert(float_equal(outer->data[14], 7));
+    arena_pop();
+    printf("Arena scopes passed\n");
+
+    // Test 3: Views of heap tensors made in a scope let go of the storage
+    // when it is popped, freed or not
+    Tensor *big = tensor_create(2, 64, 64);
+    arena_push();
+    Tensor *view = tensor_transpose(big);
+    assert(view->in_arena && atomic_load(&big->storage->refcount) == 2);
+    Tensor *freed = tensor_slice(big, 0, 0, 8);
+    tensor_free(freed);
+    assert(atomic_load(&big->storage->refcount) == 2);
+    arena_push();
+    Tensor *nested = tensor_slice(view, 1, 0, 8);
+    assert(atomic_load(&big->storage->refcount) == 3);
+    arena_pop();
+    assert(atomic_load(&big->storage->refcount) == 2);
+    (void)nested;
+    arena_pop();
+    assert(atomic_load(&big->storage->refcount) == 1);
+    tensor_free(big);
+    printf("Arena views passed\n");
+
+    // Test 4: Outside a scope, freed buffers are recycled by size class
+    Tensor *t = tensor_create(2, 10, 10);
+    assert(!t->in_arena && t->storage->kind == TENSOR_STORAGE_HEAP);
+    assert((uintptr_t)t->data % 64 == 0);
+    TensorStorage *storage = t->storage;
+    tensor_free(t);
+    t = tensor_create(2, 11, 9);
+    assert(t->storage == storage);
+    tensor_free(t);
+    pool_trim();
+    printf("Pool reuse passed\n");
+}
+
+// Write a version 1.0 .npy file with the given header dict and raw data,
+// which starts at a multiple of align bytes
+static void write_npy(const char *path, const char *dict, const void *data, size_t bytes,
+                      size_t align) {
+    char header[256];
+    size_t len = strlen(dict);
+    size_t header_len = (10 + len + 1 + align - 1) / align * align - 10;
+    memcpy(header, dict, len);
+    memset(header + len, ' ', header_len - len - 1);
+    header[header_len - 1] = '\n';
+
+    FILE *f = fopen(path, "wb");
+    fwrite("\x93NUMPY\x01\x00", 1, 8, f);
+    unsigned char size[2] = {(unsigned char)header_len, (unsigned char)(header_len >> 8)};
+    fwrite(size, 1, 2, f);
+    fwrite(header, 1, header_len, f);
+    fwrite(data, 1, bytes, f);
+    fclose(f);
+}
+
+void test_tensor_npy() {
+    printf("\nTesting .npy save and load...\n");
+    const char *path = "test_tensor.npy";
+
+    // Test 1: Round trip of a transposed view, loaded without copying
+    Tensor *t = tensor_create(2, 3, 4);
+    for (size_t i = 0; i < t->size; i++) {
+        t->data[i] = (Dtype)i * 0.5f;
+    }
+    Tensor *tt = tensor_transpose(t);
+    assert(tensor_save(tt, path));
+    Tensor *loaded = tensor_load(path);
+    assert(loaded->ndim == 2 && loaded->shape[0] == 4 && loaded->shape[1] == 3);
+    assert(loaded->storage->kind == TENSOR_STORAGE_MMAP);
+    assert((uintptr_t)loaded->data % 64 == 0);
+    assert(tensor_is_contiguous(loaded));
+    assert(tensor_equal(loaded, tt));
+
+    // Test 2: Writes stay private to the process
+    loaded->data[0] = 100;
+    Tensor *again = tensor_load(path);
+    assert(float_equal(again->data[0], 0));
+    tensor_free(again);
+    printf("Round trip passed\n");
+
+    // Test 3: A view keeps the mapping alive
+    Tensor *row = tensor_slice(loaded, 0, 1, 2);
+    tensor_free(loaded);
+    assert(float_equal(tensor_get(row, (size_t[]){0, 2}), 4.5));
+    tensor_free(row);
+
+    // Test 4: Fortran order, float64, 1-D and 0-D files
+    float col_major[] = {1, 4, 2, 5, 3, 6};
+    write_npy(path, "{'descr': '<f4', 'fortran_order': True, 'shape': (2, 3), }",
+              col_major, sizeof(col_major), 16);
+    Tensor *f = tensor_load(path);
+    assert(f->shape[0] == 2 && f->shape[1] == 3);
+    assert(float_equal(tensor_get(f, (size_t[]){1, 0}), 4));
+    assert(float_equal(tensor_get(f, (size_t[]){0, 2}), 3));
+    tensor_free(f);
+
+    double doubles[] = {1.5, -2.25, 3};
+    write_npy(path, "{'descr': '<f8', 'fortran_order': False, 'shape': (3,), }",
+              doubles, sizeof(doubles), 16);
+    Tensor *d = tensor_load(path);
+    assert(d->dtype == TENSOR_F64 && d->storage->kind == TENSOR_STORAGE_MMAP);
+    assert(d->ndim == 1 && d->shape[0] == 3 && d->data_f64[1] == -2.25);
+    tensor_free(d);
+
+    // Data not aligned to the element size is read rather than mapped
+    write_npy(path, "{'descr': '<f8', 'fortran_order': False, 'shape': (3,), }",
+              doubles, sizeof(doubles), 4);
+    d = tensor_load(path);
+    assert(d->dtype == TENSOR_F64 && d->storage->kind == TENSOR_STORAGE_HEAP);
+    assert(d->data_f64[0] == 1.5 && d->data_f64[1] == -2.25 && d->data_f64[2] == 3);
+    tensor_free(d);
+    uint16_t halves[] = {0x3c00, 0xc000}; // 1, -2
+    write_npy(path, "{'descr': '<f2', 'fortran_order': False, 'shape': (2,),  }",
+              halves, sizeof(halves), 1);
+    Tensor *h = tensor_load(path);
+    assert(h->dtype == TENSOR_F16 && memcmp(h->data_half, halves, sizeof(halves)) == 0);
+    tensor_free(h);
+
+    Tensor *scalar = tensor_create(0);
+    scalar->data[0] = 7;
+    assert(tensor_save(scalar, path));
+    Tensor *s = tensor_load(path);
+    assert(s->ndim == 0 && s->size == 1 && float_equal(s->data[0], 7));
+    tensor_free(s);
+    tensor_free(scalar);
+    printf("Fortran order and dtypes passed\n");
+
+    // Test 5: Unsupported, truncated and missing files
+    int ints[] = {1, 2};
+    write_npy(path, "{'descr': '<i4', 'fortran_order': False, 'shape': (2,), }", ints,
+              sizeof(ints), 16);
+    assert(tensor_load(path) == NULL);
+    write_npy(path, "{'descr': '<f4', 'fortran_order': False, 'shape': (3,), }", ints,
+              sizeof(ints), 16);
+    assert(tensor_load(path) == NULL);
+    // Shapes whose byte count wraps around
+    write_npy(path, "{'descr': '<f4', 'fortran_order': False, 'shape': (4611686018427387905,), }",
+              ints, sizeof(ints), 16);
+    assert(tensor_load(path) == NULL);
+    write_npy(path, "{'descr': '<f4', 'fortran_order': False, 'shape': (4294967296, 4294967296), }",
+              ints, sizeof(ints), 16);
+    assert(tensor_load(path) == NULL);
+    remove(path);
+    assert(tensor_load(path) == NULL);
+
+    tensor_free(t);
+    tensor_free(tt);
+    printf("Error handling passed\n");
 }
 
 // Test concatenation
@@ -129,10 +427,26 @@ void test_tensor_concatenate() {
     assert(t3->shape[0] == t1->shape[0] + t2->shape[0]);
     assert(t3->shape[1] == t1->shape[1]);
     
+    assert(float_equal(t3->data[6], 7));
+    tensor_free(t3);
+    printf("Concatenation along axis 0 passed\n");
+
+    // Test 2: Concatenate along axis 1, with a transposed view as input
+    Tensor *t2t = tensor_transpose(t2); // 3x2
+    Tensor *t1t = tensor_transpose(t1);
+    t3 = tensor_concatenate(t1t, t2t, 1);
+    assert(t3->shape[0] == 3 && t3->shape[1] == 4);
+    float expected[] = {1, 4, 7, 10, 2, 5, 8, 11, 3, 6, 9, 12};
+    for (size_t i = 0; i < t3->size; i++) {
+        assert(float_equal(t3->data[i], expected[i]));
+    }
+
     tensor_free(t1);
     tensor_free(t2);
+    tensor_free(t1t);
+    tensor_free(t2t);
     tensor_free(t3);
-    printf("Concatenation along axis 0 passed\n");
+    printf("Concatenation along axis 1 passed\n");
 }
 
 // Test random tensor creation
@@ -155,6 +469,258 @@ void test_tensor_rand() {
     printf("Random tensor creation passed\n");
 }
 
+static float bits_to_float(uint32_t bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+void test_tensor_dtypes() {
+    // float16: exact values, rounding to nearest even, overflow, subnormals
+    float f16_in[] = {1.0f, -2.5f, 65504.0f, 65519.0f, 65520.0f, 0x1p-24f, 0x1p-25f, 0x3p-25f,
+                      1.0f + 0x1p-11f, 1.0f + 0x3p-11f, 0.1f, INFINITY};
+    uint16_t f16_out[] = {0x3c00, 0xc100, 0x7bff, 0x7bff, 0x7c00, 0x0001, 0x0000, 0x0002,
+                          0x3c00, 0x3c02, 0x2e66, 0x7c00};
+    // bfloat16: the upper half of a float32, rounded to nearest even
+    float bf16_in[] = {1.0f, bits_to_float(0x3f808000), bits_to_float(0x3f818000),
+                       bits_to_float(0x3f808001), -0.0f, bits_to_float(0x7f7fffff)};
+    uint16_t bf16_out[] = {0x3f80, 0x3f80, 0x3f82, 0x3f81, 0x8000, 0x7f80};
+    size_t n16 = sizeof(f16_in) / sizeof(f16_in[0]), nb = sizeof(bf16_in) / sizeof(bf16_in[0]);
+
+    for (int isa = 0; isa < KERNEL_ISA_COUNT; isa++) {
+        const Kernels *ki = kernels_for_isa((KernelIsa)isa);
+        if (!ki) {
+            continue;
+        }
+        uint16_t h[16];
+        float back[16];
+        ki->f32_to_f16(n16, f16_in, h);
+        assert(memcmp(h, f16_out, sizeof(f16_out)) == 0);
+        ki->f16_to_f32(n16, h, back);
+        assert(back[0] == 1.0f && back[1] == -2.5f && back[5] == 0x1p-24f && back[11] == INFINITY);
+        ki->f32_to_bf16(nb, bf16_in, h);
+        assert(memcmp(h, bf16_out, sizeof(bf16_out)) == 0);
+
+        // NaNs stay NaNs, and quiet
+        float nan_in[1] = {bits_to_float(0x7f800001)};
+        ki->f32_to_f16(1, nan_in, h);
+        ki->f32_to_bf16(1, nan_in, h + 1);
+        assert((h[0] & 0x7e00) == 0x7e00 && (h[1] & 0x7fc0) == 0x7fc0);
+
+        // Every float16 survives the round trip through float32, vector
+        // lengths included
+        uint16_t all[4096], again[4096];
+        float wide[4096];
+        for (uint32_t start = 0; start < 65536; start += 4096) {
+            for (uint32_t i = 0; i < 4096; i++) {
+                all[i] = (uint16_t)(start + i);
+            }
+            ki->f16_to_f32(4096, all, wide);
+            ki->f32_to_f16(4096, wide, again);
+            for (uint32_t i = 0; i < 4096; i++) {
+                bool nan = (all[i] & 0x7c00) == 0x7c00 && (all[i] & 0x3ff);
+                assert(nan ? isnan(wide[i]) : again[i] == all[i]);
+            }
+        }
+    }
+
+    // Typed tensors, views and conversions
+    Tensor *a = tensor_create(2, (size_t)3, (size_t)4);
+    for (size_t i = 0; i < a->size; i++) {
+        a->data[i] = (float)i * 0.5f - 2.0f;
+    }
+    for (int dtype = 0; dtype < TENSOR_DTYPE_COUNT; dtype++) {
+        Tensor *t = tensor_astype(a, (TensorDtype)dtype);
+        assert(t->dtype == (TensorDtype)dtype);
+        assert(t->storage->capacity >= t->size * tensor_dtype_size(t->dtype));
+        // Multiples of 0.5 this small are exact in every dtype
+        assert(tensor_get(t, (size_t[]){2, 3}) == a->data[11]);
+
+        Tensor *tt = tensor_transpose(t);
+        Tensor *col = tensor_slice(tt, 0, 1, 3);
+        assert(col->dtype == t->dtype);
+        assert(tensor_get(col, (size_t[]){1, 2}) == a->data[2 * 4 + 2]);
+        Tensor *back = tensor_astype(col, TENSOR_F32);
+        Tensor *at = tensor_transpose(a);
+        Tensor *ref = tensor_slice(at, 0, 1, 3);
+        assert(tensor_equal(back, ref));
+        assert(!tensor_equal(back, col) || dtype == TENSOR_F32);
+
+        tensor_fill(col, 1.25f);
+        assert(tensor_get(t, (size_t[]){0, 1}) == 1.25f && tensor_get(t, (size_t[]){0, 0}) == -2.0f);
+        Tensor *copy = tensor_copy(t);
+        assert(tensor_equal(copy, t));
+        if (dtype != TENSOR_F32) {
+            Tensor *square = tensor_slice(t, 1, 0, 3);
+            assert(tensor_transpose_inplace(square) == NULL);
+            tensor_free(square);
+        }
+
+        tensor_free(copy);
+        tensor_free(back);
+        tensor_free(at);
+        tensor_free(ref);
+        tensor_free(col);
+        tensor_free(tt);
+        tensor_free(t);
+    }
+
+    // float64 keeps what float32 cannot
+    Tensor *d = tensor_create_typed(TENSOR_F64, 1, (size_t[]){2});
+    d->data_f64[0] = 1.0 + 0x1p-40;
+    d->data_f64[1] = 16777217.0;
+    Tensor *f = tensor_astype(d, TENSOR_F32);
+    assert(f->data[0] == 1.0f && f->data[1] == 16777216.0f);
+    assert(tensor_save(d, "/tmp/test_dtype.npy"));
+    FILE *file = fopen("/tmp/test_dtype.npy", "rb");
+    char header[128];
+    assert(fread(header, 1, sizeof(header), file) == sizeof(header));
+    fseek(file, 0, SEEK_END);
+    assert(ftell(file) % 64 == 2 * 8);
+    fclose(file);
+    assert(strstr(header + 10, "'<f8'") != NULL);
+
+    // Every dtype survives a round trip through a file, bfloat16 as float32
+    for (int dt = 0; dt < TENSOR_DTYPE_COUNT; dt++) {
+        Tensor *src = tensor_astype(a, (TensorDtype)dt);
+        assert(tensor_save(src, "/tmp/test_dtype.npy"));
+        Tensor *back = tensor_load("/tmp/test_dtype.npy");
+        TensorDtype expected = dt == TENSOR_BF16 ? TENSOR_F32 : dt;
+        assert(back && back->dtype == expected && back->storage->kind == TENSOR_STORAGE_MMAP);
+        assert(back->ndim == src->ndim && back->size == src->size);
+        Tensor *same = tensor_astype(src, expected);
+        assert(memcmp(back->data, same->data, same->size * tensor_dtype_size(expected)) == 0);
+        tensor_free(same);
+        tensor_free(back);
+        tensor_free(src);
+    }
+    remove("/tmp/test_dtype.npy");
+
+    tensor_free(f);
+    tensor_free(d);
+    tensor_free(a);
+    printf("Tensor dtypes passed\n");
+}
+
+void test_tensor_random() {
+    printf("\nTesting counter-based random numbers...\n");
+
+    // Known answer of Philox4x32-10 for a zero counter and key, from every
+    // kernel tier, across the point where the high counter word changes
+    Random rng = random_init(0);
+    uint32_t words[6];
+    random_bits(&rng, 6, words);
+    assert(words[0] == 0x6627e8d5 && words[1] == 0xe169c58d && words[2] == 0xbc57ac4c &&
+           words[3] == 0x9b00dbd8);
+    assert(rng.counter == 2);
+    uint32_t expected[4 * 20], out[4 * 20];
+    kernels_for_isa(KERNEL_ISA_SCALAR)->philox(20, 0xfffffff7, 99, expected);
+    for (int isa = 0; isa < KERNEL_ISA_COUNT; isa++) {
+        const Kernels *k = kernels_for_isa((KernelIsa)isa);
+        if (k) {
+            for (size_t n = 0; n <= 20; n++) {
+                memset(out, 0, sizeof(out));
+                k->philox(n, 0xfffffff7, 99, out);
+                assert(memcmp(out, expected, 4 * n * sizeof(uint32_t)) == 0);
+            }
+        }
+    }
+
+    // Box-Muller: the same bits from every tier and for every length, within
+    // a few float ulps of the libm formula, extreme words included
+    uint32_t bm_words[2 * 1000];
+    float bm_expected[2 * 1000], bm_out[2 * 1000];
+    random_bits_at(11, 0, 2 * 1000, bm_words);
+    bm_words[0] = 0xffffffff;
+    bm_words[1] = 0;
+    bm_words[2] = 0;
+    bm_words[3] = 0xffffff00;
+    kernels_for_isa(KERNEL_ISA_SCALAR)->box_muller(1000, bm_words, bm_expected);
+    for (size_t i = 0; i < 1000; i++) {
+        double u = ((bm_words[2 * i] >> 8) + 1) * 0x1p-24;
+        double theta = 2 * M_PI * (bm_words[2 * i + 1] >> 8) * 0x1p-24;
+        double r = sqrt(-2 * log(u));
+        assert(fabs(bm_expected[2 * i] - r * cos(theta)) < 2e-6);
+        assert(fabs(bm_expected[2 * i + 1] - r * sin(theta)) < 2e-6);
+    }
+    assert(bm_expected[0] == 0 && bm_expected[1] == 0);
+    for (int isa = 0; isa < KERNEL_ISA_COUNT; isa++) {
+        const Kernels *k = kernels_for_isa((KernelIsa)isa);
+        for (size_t n = 1; k && n <= 1000; n += n < 40 ? 1 : 97) {
+            k->box_muller(n, bm_words + 2 * (1000 - n), bm_out);
+            assert(memcmp(bm_out, bm_expected + 2 * (1000 - n), 2 * n * sizeof(float)) == 0);
+        }
+    }
+
+    // The same seed gives the same tensor whatever the number of threads,
+    // and consecutive fills continue the stream
+    size_t n = 100003;
+    Tensor *u = tensor_create(1, n);
+    Tensor *u1 = tensor_create(1, n);
+    Tensor *halves = tensor_create(1, n);
+    rng = random_init(7);
+    random_uniform(&rng, u, -2.0f, 3.0f);
+    parallel_set_num_threads(1);
+    rng = random_init(7);
+    random_uniform(&rng, u1, -2.0f, 3.0f);
+    parallel_set_num_threads(0);
+    assert(memcmp(u->data, u1->data, n * sizeof(Dtype)) == 0);
+    rng = random_init(7);
+    Tensor *front = tensor_slice(halves, 0, 0, 40000);
+    Tensor *back = tensor_slice(halves, 0, 40000, n);
+    random_uniform(&rng, front, -2.0f, 3.0f);
+    random_uniform(&rng, back, -2.0f, 3.0f);
+    assert(memcmp(u->data, halves->data, n * sizeof(Dtype)) == 0);
+
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        assert(u->data[i] >= -2.0f && u->data[i] < 3.0f);
+        sum += u->data[i];
+    }
+    assert(fabs(sum / n - 0.5) < 0.02);
+    rng = random_init(8);
+    random_uniform(&rng, u1, -2.0f, 3.0f);
+    assert(memcmp(u->data, u1->data, n * sizeof(Dtype)) != 0);
+
+    // Standard normal moments, and a transposed view filled in its logical
+    // order like a contiguous tensor
+    tensor_seed(3);
+    Tensor *z = tensor_randn(2, (size_t)300, (size_t)400);
+    double m1 = 0, m2 = 0;
+    for (size_t i = 0; i < z->size; i++) {
+        assert(isfinite(z->data[i]));
+        m1 += z->data[i];
+        m2 += (double)z->data[i] * z->data[i];
+    }
+    m1 /= z->size;
+    m2 = m2 / z->size - m1 * m1;
+    assert(fabs(m1) < 0.01 && fabs(m2 - 1) < 0.02);
+
+    Tensor *zt_storage = tensor_create(2, (size_t)400, (size_t)300);
+    Tensor *zt = tensor_transpose(zt_storage);
+    rng = random_init(3);
+    random_normal(&rng, zt, 0.0f, 1.0f);
+    for (size_t i = 0; i < 300; i++) {
+        for (size_t j = 0; j < 400; j++) {
+            assert(zt_storage->data[j * 300 + i] == z->data[i * 400 + j]);
+        }
+    }
+
+    // float64 tensors get the float32 values
+    Tensor *zd = tensor_create_typed(TENSOR_F64, 2, (size_t[]){300, 400});
+    rng = random_init(3);
+    random_normal(&rng, zd, 0.0f, 1.0f);
+    for (size_t i = 0; i < z->size; i++) {
+        assert(zd->data_f64[i] == (double)z->data[i]);
+    }
+
+    Tensor *tensors[] = {u, u1, halves, front, back, z, zt_storage, zt, zd};
+    for (size_t i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++) {
+        tensor_free(tensors[i]);
+    }
+    printf("Counter-based random numbers passed\n");
+}
+
 int main() {
     printf("Running tensor operations tests...\n");
     
@@ -162,8 +728,13 @@ int main() {
     test_tensor_data_operations();
     test_tensor_reshape();
     test_tensor_transpose();
+    test_tensor_views();
+    test_tensor_arena();
+    test_tensor_npy();
     test_tensor_concatenate();
     test_tensor_rand();
+    test_tensor_random();
+    test_tensor_dtypes();
     
     printf("\nAll tests passed successfully!\n");
     return 0;